@@ -0,0 +1,144 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "AudioBatcher.h"
+
+#include <string.h>
+#include <algorithm>
+
+AudioBatcher::AudioBatcher()
+  : mSampleRate(0),
+    mFrameSize(0),
+    mBatchSamples(0),
+    mNumPending(0),
+    mStartTime(0),
+    mNumInput(0),
+    mNumOutput(0),
+    mStarted(false)
+{
+}
+
+bool
+AudioBatcher::Init(const AudioFormat& aFormat, uint32_t aFramesPerBatch)
+{
+  if (aFormat.compressed || !aFormat.sampleRate || !aFormat.numChannels ||
+      (aFormat.bitsPerSample & 7) || !aFramesPerBatch) {
+    return false;
+  }
+  mSampleRate = aFormat.sampleRate;
+  mFrameSize = aFormat.numChannels * aFormat.bitsPerSample / 8;
+  mBatchSamples = aFramesPerBatch * AacFrameSamples;
+  mPending.reset();
+  mNumPending = 0;
+  mStarted = false;
+  return true;
+}
+
+int64_t
+AudioBatcher::GetTimestamp(uint64_t aSample) const
+{
+  return mStartTime + int64_t(aSample * TimeUnitsPerSecond / mSampleRate);
+}
+
+void
+AudioBatcher::Output(uint8_t* aData,
+                     uint32_t aNumSamples,
+                     const std::shared_ptr<void>& aStorage,
+                     std::vector<MediaFrame>* aOutBatches)
+{
+  MediaFrame batch;
+  batch.stream = Stream_Audio;
+  batch.timestamp = GetTimestamp(mNumOutput);
+  mNumOutput += aNumSamples;
+  batch.duration = GetTimestamp(mNumOutput) - batch.timestamp;
+  batch.data = aData;
+  batch.length = aNumSamples * mFrameSize;
+  batch.storage = aStorage;
+  aOutBatches->push_back(batch);
+}
+
+bool
+AudioBatcher::Process(const MediaFrame& aInput, std::vector<MediaFrame>* aOutBatches)
+{
+  const uint32_t numSamples = uint32_t(aInput.length / mFrameSize);
+  if (!aInput.data || !numSamples) {
+    return true;
+  }
+  if (mStarted) {
+    const int64_t error = aInput.timestamp - GetTimestamp(mNumInput);
+    if (error > MaxTimestampError || error < -MaxTimestampError) {
+      Flush(aOutBatches);
+      mStarted = false;
+    }
+  }
+  if (!mStarted) {
+    mStartTime = aInput.timestamp;
+    mNumInput = 0;
+    mNumOutput = 0;
+    mStarted = true;
+  }
+  mNumInput += numSamples;
+
+  uint8_t* data = aInput.data;
+  uint32_t remaining = numSamples;
+  if (mNumPending) {
+    // Top up the batch being collected.
+    const uint32_t count = std::min(remaining, mBatchSamples - mNumPending);
+    memcpy(mPending.get() + mNumPending * mFrameSize, data, count * mFrameSize);
+    mNumPending += count;
+    data += count * mFrameSize;
+    remaining -= count;
+    if (mNumPending < mBatchSamples) {
+      return true;
+    }
+    Output(mPending.get(), mNumPending, mPending, aOutBatches);
+    mPending.reset();
+    mNumPending = 0;
+  }
+  // Whole batches can go straight out, if the input's buffer is kept alive
+  // by its storage, rather than only for the duration of this call.
+  while (aInput.storage && remaining >= mBatchSamples) {
+    Output(data, mBatchSamples, aInput.storage, aOutBatches);
+    data += mBatchSamples * mFrameSize;
+    remaining -= mBatchSamples;
+  }
+  while (remaining) {
+    mPending = mBuffers.Acquire(mBatchSamples * mFrameSize);
+    if (!mPending) {
+      return false;
+    }
+    const uint32_t count = std::min(remaining, mBatchSamples);
+    memcpy(mPending.get(), data, count * mFrameSize);
+    data += count * mFrameSize;
+    remaining -= count;
+    mNumPending = count;
+    if (mNumPending == mBatchSamples) {
+      Output(mPending.get(), mNumPending, mPending, aOutBatches);
+      mPending.reset();
+      mNumPending = 0;
+    }
+  }
+  return true;
+}
+
+void
+AudioBatcher::Flush(std::vector<MediaFrame>* aOutBatches)
+{
+  if (mNumPending) {
+    Output(mPending.get(), mNumPending, mPending, aOutBatches);
+  }
+  mPending.reset();
+  mNumPending = 0;
+}
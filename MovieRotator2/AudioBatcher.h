@@ -0,0 +1,91 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Regroups PCM audio, which arrives in whatever sizes the decoder and the
+// filter made it, into batches of whole AAC frames for the encoder.
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "FrameBufferPool.h"
+#include "FrameSource.h"
+
+// Collects audio into frames of a whole number of AAC frames of samples.
+// The encoder takes whole AAC frames; writing it several at once saves a
+// call per decoded frame, and saves it buffering the remainders itself.
+// The batches' timestamps count on from the first sample's by the samples
+// output, so they join up exactly. If the input's timestamps jump, what's
+// collected is output as a short batch, and the count restarts at the
+// jump, so that gaps in the input are kept.
+class AudioBatcher {
+public:
+  // The number of samples per channel in an AAC frame.
+  static const uint32_t AacFrameSamples = 1024;
+
+  // How far an input frame's timestamp may be from where the previous one
+  // ended, in 100ns units, before it's taken as a jump.
+  static const int64_t MaxTimestampError = TimeUnitsPerSecond / 1000;
+
+  AudioBatcher();
+
+  // Configures the batcher for PCM in aFormat, to be output aFramesPerBatch
+  // AAC frames at a time, and resets it. Returns false if the format is
+  // compressed, or aFramesPerBatch is 0.
+  bool Init(const AudioFormat& aFormat, uint32_t aFramesPerBatch);
+
+  // Adds aInput, and appends the batches it completes to *aOutBatches.
+  // Whole batches of aInput are output without being copied, sharing its
+  // storage. Returns false if we're out of memory.
+  bool Process(const MediaFrame& aInput, std::vector<MediaFrame>* aOutBatches);
+
+  // Appends what's been collected, if anything, as a short batch to
+  // *aOutBatches, at the end of the stream.
+  void Flush(std::vector<MediaFrame>* aOutBatches);
+
+  // The number of samples per channel in a batch.
+  uint32_t GetBatchSamples() const { return mBatchSamples; }
+
+private:
+  AudioBatcher(const AudioBatcher&);
+  AudioBatcher& operator=(const AudioBatcher&);
+
+  // Returns the timestamp of the aSample'th sample since the timeline
+  // started.
+  int64_t GetTimestamp(uint64_t aSample) const;
+
+  // Appends aNumSamples samples at aData, kept alive by aStorage, to
+  // *aOutBatches, as the next batch.
+  void Output(uint8_t* aData,
+              uint32_t aNumSamples,
+              const std::shared_ptr<void>& aStorage,
+              std::vector<MediaFrame>* aOutBatches);
+
+  uint32_t mSampleRate;
+  size_t mFrameSize;
+  uint32_t mBatchSamples;
+
+  // The batch being collected, and how many samples it has.
+  RecyclingBufferPool mBuffers;
+  std::shared_ptr<uint8_t> mPending;
+  uint32_t mNumPending;
+
+  // The timestamp of the first sample since the timeline started, and the
+  // numbers of samples input and output since.
+  int64_t mStartTime;
+  uint64_t mNumInput;
+  uint64_t mNumOutput;
+  bool mStarted;
+};
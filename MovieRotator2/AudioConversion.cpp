@@ -0,0 +1,623 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "AudioConversion.h"
+#include "CpuFeatures.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(HAVE_X86_SIMD)
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+// Scales the dither generators' 24 bit outputs to [0, 1) LSB.
+static const float DitherScale = 1.0f / 16777216;
+
+AudioKernel
+GetBestAudioKernel()
+{
+  if (HasCpuFeature(CPU_FEATURE_AVX2)) {
+    return AudioKernel_AVX2;
+  }
+  if (HasCpuFeature(CPU_FEATURE_SSE2)) {
+    return AudioKernel_SSE2;
+  }
+  return AudioKernel_Scalar;
+}
+
+bool
+IsAudioKernelSupported(AudioKernel aKernel)
+{
+  switch (aKernel) {
+    case AudioKernel_Auto:
+    case AudioKernel_Scalar:
+      return true;
+    case AudioKernel_SSE2:
+      return HasCpuFeature(CPU_FEATURE_SSE2);
+    case AudioKernel_AVX2:
+      return HasCpuFeature(CPU_FEATURE_AVX2);
+  }
+  return false;
+}
+
+const char*
+GetAudioKernelName(AudioKernel aKernel)
+{
+  switch (aKernel) {
+    case AudioKernel_Auto: return "auto";
+    case AudioKernel_Scalar: return "scalar";
+    case AudioKernel_SSE2: return "SSE2";
+    case AudioKernel_AVX2: return "AVX2";
+  }
+  return "?";
+}
+
+// Returns the kernel to run aKernel as, or AudioKernel_Auto if it's not
+// supported by this CPU.
+static AudioKernel
+ResolveKernel(AudioKernel aKernel)
+{
+  if (!IsAudioKernelSupported(aKernel)) {
+    return AudioKernel_Auto;
+  }
+  return (aKernel == AudioKernel_Auto) ? GetBestAudioKernel() : aKernel;
+}
+
+static void
+U8ToFloat_Scalar(const uint8_t* aInput, size_t aNumSamples, float* aOutput)
+{
+  for (size_t i = 0; i < aNumSamples; i++) {
+    aOutput[i] = (int32_t(aInput[i]) - 128) * (1.0f / 128);
+  }
+}
+
+static void
+S16ToFloat_Scalar(const uint8_t* aInput, size_t aNumSamples, float* aOutput)
+{
+  for (size_t i = 0; i < aNumSamples; i++) {
+    const uint8_t* sample = aInput + i * 2;
+    aOutput[i] = int16_t(sample[0] | (sample[1] << 8)) * (1.0f / 32768);
+  }
+}
+
+static void
+S24ToFloat_Scalar(const uint8_t* aInput, size_t aNumSamples, float* aOutput)
+{
+  for (size_t i = 0; i < aNumSamples; i++) {
+    const uint8_t* sample = aInput + i * 3;
+    const uint32_t bits = (uint32_t(sample[0]) << 8) | (uint32_t(sample[1]) << 16) |
+                          (uint32_t(sample[2]) << 24);
+    aOutput[i] = (int32_t(bits) >> 8) * (1.0f / 8388608);
+  }
+}
+
+static void
+S32ToFloat_Scalar(const uint8_t* aInput, size_t aNumSamples, float* aOutput)
+{
+  for (size_t i = 0; i < aNumSamples; i++) {
+    const uint8_t* sample = aInput + i * 4;
+    const uint32_t bits = uint32_t(sample[0]) | (uint32_t(sample[1]) << 8) |
+                          (uint32_t(sample[2]) << 16) | (uint32_t(sample[3]) << 24);
+    aOutput[i] = int32_t(bits) * (1.0f / 2147483648.0f);
+  }
+}
+
+static void
+MixChannels_Scalar(const float* aInput,
+                   uint32_t aInputChannels,
+                   uint32_t aNumFrames,
+                   const float* aMatrix,
+                   uint32_t aOutputChannels,
+                   float* aOutput)
+{
+  for (uint32_t f = 0; f < aNumFrames; f++) {
+    const float* frame = aInput + size_t(f) * aInputChannels;
+    for (uint32_t o = 0; o < aOutputChannels; o++) {
+      const float* weights = aMatrix + o * aInputChannels;
+      float sum = 0.0f;
+      for (uint32_t i = 0; i < aInputChannels; i++) {
+        sum += weights[i] * frame[i];
+      }
+      aOutput[size_t(f) * aOutputChannels + o] = sum;
+    }
+  }
+}
+
+static inline uint32_t
+XorShift(uint32_t aState)
+{
+  aState ^= aState << 13;
+  aState ^= aState >> 17;
+  aState ^= aState << 5;
+  return aState;
+}
+
+// Returns the next dither value from aLane's generator; the difference of
+// two uniform values, which is triangular over (-1, 1) LSB.
+static inline float
+NextDither(uint32_t* aLane)
+{
+  *aLane = XorShift(*aLane);
+  const float a = float(*aLane >> 8) * DitherScale;
+  *aLane = XorShift(*aLane);
+  const float b = float(*aLane >> 8) * DitherScale;
+  return a - b;
+}
+
+static void
+ToS16_Scalar(const float* aInput, size_t aNumSamples, int16_t* aOutput, TpdfDither* aDither)
+{
+  for (size_t i = 0; i < aNumSamples; i++) {
+    float sample = aInput[i] * 32768.0f + 0.5f;
+    if (aDither) {
+      sample += NextDither(&aDither->lanes[i % TpdfDither::NumLanes]);
+    }
+    sample = std::min(32767.0f, std::max(-32768.0f, sample));
+    aOutput[i] = int16_t(floorf(sample));
+  }
+}
+
+#if defined(HAVE_X86_SIMD)
+
+static TARGET_SSE2 void
+S16ToFloat_SSE2(const uint8_t* aInput, size_t aNumSamples, float* aOutput)
+{
+  const __m128 scale = _mm_set1_ps(1.0f / 32768);
+  size_t i = 0;
+  for (; i + 8 <= aNumSamples; i += 8) {
+    const __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(aInput + i * 2));
+    // Each sample paired with itself, shifted down, is sign extended.
+    const __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16);
+    const __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16);
+    _mm_storeu_ps(aOutput + i, _mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+    _mm_storeu_ps(aOutput + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+  }
+  S16ToFloat_Scalar(aInput + i * 2, aNumSamples - i, aOutput + i);
+}
+
+static TARGET_SSE2 void
+S32ToFloat_SSE2(const uint8_t* aInput, size_t aNumSamples, float* aOutput)
+{
+  const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+  size_t i = 0;
+  for (; i + 4 <= aNumSamples; i += 4) {
+    const __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(aInput + i * 4));
+    _mm_storeu_ps(aOutput + i, _mm_mul_ps(_mm_cvtepi32_ps(samples), scale));
+  }
+  S32ToFloat_Scalar(aInput + i * 4, aNumSamples - i, aOutput + i);
+}
+
+// Mixes one 5.1 or 7.1 frame, whose first four channels are aFront and the
+// rest aBack, to stereo, and stores it at aOutput.
+static TARGET_SSE2 inline void
+MixFrameToStereo_SSE2(__m128 aFront,
+                      __m128 aBack,
+                      const __m128* aWeights,
+                      float* aOutput)
+{
+  const __m128 left = _mm_add_ps(_mm_mul_ps(aFront, aWeights[0]), _mm_mul_ps(aBack, aWeights[1]));
+  const __m128 right = _mm_add_ps(_mm_mul_ps(aFront, aWeights[2]), _mm_mul_ps(aBack, aWeights[3]));
+  // Sum both across at once; [l0 + l2, r0 + r2, l1 + l3, r1 + r3], then
+  // the two halves of that.
+  const __m128 pairs = _mm_add_ps(_mm_unpacklo_ps(left, right), _mm_unpackhi_ps(left, right));
+  const __m128 sums = _mm_add_ps(pairs, _mm_movehl_ps(pairs, pairs));
+  _mm_store_sd(reinterpret_cast<double*>(aOutput), _mm_castps_pd(sums));
+}
+
+// Loads aMatrix, a stereo mix of aInputChannels channels, as the left and
+// right weights for channels 0-3 and 4-7, with zeros past the last channel.
+static TARGET_SSE2 void
+LoadStereoWeights_SSE2(const float* aMatrix, uint32_t aInputChannels, __m128* aOutWeights)
+{
+  float weights[2][8];
+  memset(weights, 0, sizeof(weights));
+  for (uint32_t o = 0; o < 2; o++) {
+    memcpy(weights[o], aMatrix + o * aInputChannels, aInputChannels * sizeof(float));
+  }
+  aOutWeights[0] = _mm_loadu_ps(weights[0]);
+  aOutWeights[1] = _mm_loadu_ps(weights[0] + 4);
+  aOutWeights[2] = _mm_loadu_ps(weights[1]);
+  aOutWeights[3] = _mm_loadu_ps(weights[1] + 4);
+}
+
+// aInputChannels must be 6 or 8.
+static TARGET_SSE2 void
+MixToStereo_SSE2(const float* aInput,
+                 uint32_t aInputChannels,
+                 uint32_t aNumFrames,
+                 const float* aMatrix,
+                 float* aOutput)
+{
+  __m128 weights[4];
+  LoadStereoWeights_SSE2(aMatrix, aInputChannels, weights);
+  if (aInputChannels == 8) {
+    for (uint32_t f = 0; f < aNumFrames; f++) {
+      const float* frame = aInput + size_t(f) * 8;
+      MixFrameToStereo_SSE2(_mm_loadu_ps(frame), _mm_loadu_ps(frame + 4),
+                            weights, aOutput + size_t(f) * 2);
+    }
+  } else {
+    for (uint32_t f = 0; f < aNumFrames; f++) {
+      const float* frame = aInput + size_t(f) * 6;
+      // Load the last two channels without reading past the frame.
+      const __m128 back = _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(frame + 4)));
+      MixFrameToStereo_SSE2(_mm_loadu_ps(frame), back, weights, aOutput + size_t(f) * 2);
+    }
+  }
+}
+
+static TARGET_SSE2 inline __m128i
+XorShift_SSE2(__m128i aState)
+{
+  aState = _mm_xor_si128(aState, _mm_slli_epi32(aState, 13));
+  aState = _mm_xor_si128(aState, _mm_srli_epi32(aState, 17));
+  return _mm_xor_si128(aState, _mm_slli_epi32(aState, 5));
+}
+
+// NextDither() for four lanes at once.
+static TARGET_SSE2 inline __m128
+NextDither_SSE2(__m128i* aLanes)
+{
+  const __m128 scale = _mm_set1_ps(DitherScale);
+  *aLanes = XorShift_SSE2(*aLanes);
+  const __m128 a = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(*aLanes, 8)), scale);
+  *aLanes = XorShift_SSE2(*aLanes);
+  const __m128 b = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(*aLanes, 8)), scale);
+  return _mm_sub_ps(a, b);
+}
+
+// Rounds aValue, which must be within the int32 range, down.
+static TARGET_SSE2 inline __m128i
+FloorToInt_SSE2(__m128 aValue)
+{
+  // Truncating rounds negative values up; take one off those which had a
+  // fraction.
+  const __m128i truncated = _mm_cvttps_epi32(aValue);
+  const __m128 roundedUp = _mm_cmpgt_ps(_mm_cvtepi32_ps(truncated), aValue);
+  return _mm_add_epi32(truncated, _mm_castps_si128(roundedUp));
+}
+
+static TARGET_SSE2 void
+ToS16_SSE2(const float* aInput, size_t aNumSamples, int16_t* aOutput, TpdfDither* aDither)
+{
+  const __m128 scale = _mm_set1_ps(32768.0f);
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 low = _mm_set1_ps(-32768.0f);
+  const __m128 high = _mm_set1_ps(32767.0f);
+  __m128i lanes0 = _mm_setzero_si128();
+  __m128i lanes1 = _mm_setzero_si128();
+  if (aDither) {
+    lanes0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(aDither->lanes));
+    lanes1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(aDither->lanes + 4));
+  }
+  size_t i = 0;
+  for (; i + 8 <= aNumSamples; i += 8) {
+    __m128 samples0 = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(aInput + i), scale), half);
+    __m128 samples1 = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(aInput + i + 4), scale), half);
+    if (aDither) {
+      samples0 = _mm_add_ps(samples0, NextDither_SSE2(&lanes0));
+      samples1 = _mm_add_ps(samples1, NextDither_SSE2(&lanes1));
+    }
+    samples0 = _mm_min_ps(high, _mm_max_ps(low, samples0));
+    samples1 = _mm_min_ps(high, _mm_max_ps(low, samples1));
+    const __m128i output = _mm_packs_epi32(FloorToInt_SSE2(samples0), FloorToInt_SSE2(samples1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(aOutput + i), output);
+  }
+  if (aDither) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(aDither->lanes), lanes0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(aDither->lanes + 4), lanes1);
+  }
+  // i is a multiple of the number of lanes, so the rest start at lane 0.
+  ToS16_Scalar(aInput + i, aNumSamples - i, aOutput + i, aDither);
+}
+
+static TARGET_AVX2 void
+S16ToFloat_AVX2(const uint8_t* aInput, size_t aNumSamples, float* aOutput)
+{
+  const __m256 scale = _mm256_set1_ps(1.0f / 32768);
+  size_t i = 0;
+  for (; i + 16 <= aNumSamples; i += 16) {
+    const __m128i* input = reinterpret_cast<const __m128i*>(aInput + i * 2);
+    const __m256i low = _mm256_cvtepi16_epi32(_mm_loadu_si128(input));
+    const __m256i high = _mm256_cvtepi16_epi32(_mm_loadu_si128(input + 1));
+    _mm256_storeu_ps(aOutput + i, _mm256_mul_ps(_mm256_cvtepi32_ps(low), scale));
+    _mm256_storeu_ps(aOutput + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(high), scale));
+  }
+  S16ToFloat_Scalar(aInput + i * 2, aNumSamples - i, aOutput + i);
+}
+
+static TARGET_AVX2 void
+S24ToFloat_AVX2(const uint8_t* aInput, size_t aNumSamples, float* aOutput)
+{
+  // Moves each half's four 3 byte samples into the top of a 32 bit lane.
+  const __m256i spread = _mm256_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+                                          -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+  const __m256 scale = _mm256_set1_ps(1.0f / 8388608);
+  size_t i = 0;
+  // The loads read 16 bytes from the start of samples 0 and 4, which is 4
+  // bytes past the end of sample 7, so leave two samples to spare.
+  for (; i + 10 <= aNumSamples; i += 8) {
+    const uint8_t* input = aInput + i * 3;
+    const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+    const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 12));
+    const __m256i bytes = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+    const __m256i samples = _mm256_srai_epi32(_mm256_shuffle_epi8(bytes, spread), 8);
+    _mm256_storeu_ps(aOutput + i, _mm256_mul_ps(_mm256_cvtepi32_ps(samples), scale));
+  }
+  S24ToFloat_Scalar(aInput + i * 3, aNumSamples - i, aOutput + i);
+}
+
+static TARGET_AVX2 void
+S32ToFloat_AVX2(const uint8_t* aInput, size_t aNumSamples, float* aOutput)
+{
+  const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+  size_t i = 0;
+  for (; i + 8 <= aNumSamples; i += 8) {
+    const __m256i samples = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(aInput + i * 4));
+    _mm256_storeu_ps(aOutput + i, _mm256_mul_ps(_mm256_cvtepi32_ps(samples), scale));
+  }
+  S32ToFloat_Scalar(aInput + i * 4, aNumSamples - i, aOutput + i);
+}
+
+// aInputChannels must be 6 or 8.
+static TARGET_AVX2 void
+MixToStereo_AVX2(const float* aInput,
+                 uint32_t aInputChannels,
+                 uint32_t aNumFrames,
+                 const float* aMatrix,
+                 float* aOutput)
+{
+  __m128 weights[4];
+  LoadStereoWeights_SSE2(aMatrix, aInputChannels, weights);
+  const __m256 left = _mm256_insertf128_ps(_mm256_castps128_ps256(weights[0]), weights[1], 1);
+  const __m256 right = _mm256_insertf128_ps(_mm256_castps128_ps256(weights[2]), weights[3], 1);
+  // 5.1 frames are loaded masked, so as not to read past the last one.
+  const __m256i mask = _mm256_setr_epi32(-1, -1, -1, -1, -1, -1,
+                                         aInputChannels == 8 ? -1 : 0,
+                                         aInputChannels == 8 ? -1 : 0);
+  uint32_t f = 0;
+  for (; f + 2 <= aNumFrames; f += 2) {
+    const float* frame = aInput + size_t(f) * aInputChannels;
+    const __m256 a = _mm256_maskload_ps(frame, mask);
+    const __m256 b = _mm256_maskload_ps(frame + aInputChannels, mask);
+    // Pairwise adds leave each half holding [La, Ra, Lb, Rb] summed over
+    // its four channels.
+    const __m256 sums = _mm256_hadd_ps(
+      _mm256_hadd_ps(_mm256_mul_ps(a, left), _mm256_mul_ps(a, right)),
+      _mm256_hadd_ps(_mm256_mul_ps(b, left), _mm256_mul_ps(b, right)));
+    _mm_storeu_ps(aOutput + size_t(f) * 2,
+                  _mm_add_ps(_mm256_castps256_ps128(sums), _mm256_extractf128_ps(sums, 1)));
+  }
+  if (f < aNumFrames) {
+    MixToStereo_SSE2(aInput + size_t(f) * aInputChannels, aInputChannels,
+                     aNumFrames - f, aMatrix, aOutput + size_t(f) * 2);
+  }
+}
+
+static TARGET_AVX2 inline __m256i
+XorShift_AVX2(__m256i aState)
+{
+  aState = _mm256_xor_si256(aState, _mm256_slli_epi32(aState, 13));
+  aState = _mm256_xor_si256(aState, _mm256_srli_epi32(aState, 17));
+  return _mm256_xor_si256(aState, _mm256_slli_epi32(aState, 5));
+}
+
+static TARGET_AVX2 void
+ToS16_AVX2(const float* aInput, size_t aNumSamples, int16_t* aOutput, TpdfDither* aDither)
+{
+  const __m256 scale = _mm256_set1_ps(32768.0f);
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256 low = _mm256_set1_ps(-32768.0f);
+  const __m256 high = _mm256_set1_ps(32767.0f);
+  const __m256 ditherScale = _mm256_set1_ps(DitherScale);
+  __m256i lanes = _mm256_setzero_si256();
+  if (aDither) {
+    lanes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(aDither->lanes));
+  }
+  size_t i = 0;
+  for (; i + 8 <= aNumSamples; i += 8) {
+    __m256 samples = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(aInput + i), scale), half);
+    if (aDither) {
+      lanes = XorShift_AVX2(lanes);
+      const __m256 a = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(lanes, 8)), ditherScale);
+      lanes = XorShift_AVX2(lanes);
+      const __m256 b = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(lanes, 8)), ditherScale);
+      samples = _mm256_add_ps(samples, _mm256_sub_ps(a, b));
+    }
+    samples = _mm256_min_ps(high, _mm256_max_ps(low, samples));
+    // Round down, as FloorToInt_SSE2() does.
+    const __m256i truncated = _mm256_cvttps_epi32(samples);
+    const __m256 roundedUp = _mm256_cmp_ps(_mm256_cvtepi32_ps(truncated), samples, _CMP_GT_OQ);
+    const __m256i rounded = _mm256_add_epi32(truncated, _mm256_castps_si256(roundedUp));
+    const __m128i output = _mm_packs_epi32(_mm256_castsi256_si128(rounded),
+                                           _mm256_extracti128_si256(rounded, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(aOutput + i), output);
+  }
+  if (aDither) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(aDither->lanes), lanes);
+  }
+  // i is a multiple of the number of lanes, so the rest start at lane 0.
+  ToS16_Scalar(aInput + i, aNumSamples - i, aOutput + i, aDither);
+}
+
+#endif // HAVE_X86_SIMD
+
+bool
+IsSampleFormatSupported(const AudioFormat& aFormat)
+{
+  if (aFormat.compressed) {
+    return false;
+  }
+  if (aFormat.floatingPoint) {
+    return aFormat.bitsPerSample == 32;
+  }
+  const uint32_t bits = aFormat.bitsPerSample;
+  return bits == 8 || bits == 16 || bits == 24 || bits == 32;
+}
+
+bool
+ConvertToFloat(const uint8_t* aInput,
+               const AudioFormat& aFormat,
+               size_t aNumSamples,
+               float* aOutput,
+               AudioKernel aKernel)
+{
+  const AudioKernel kernel = ResolveKernel(aKernel);
+  if (kernel == AudioKernel_Auto || !IsSampleFormatSupported(aFormat)) {
+    return false;
+  }
+  if (aFormat.floatingPoint) {
+    memcpy(aOutput, aInput, aNumSamples * sizeof(float));
+    return true;
+  }
+  typedef void (*ConvertFn)(const uint8_t*, size_t, float*);
+  ConvertFn convert = nullptr;
+  switch (aFormat.bitsPerSample) {
+    case 8: convert = U8ToFloat_Scalar; break;
+    case 16: convert = S16ToFloat_Scalar; break;
+    case 24: convert = S24ToFloat_Scalar; break;
+    default: convert = S32ToFloat_Scalar; break;
+  }
+#if defined(HAVE_X86_SIMD)
+  // SSE2 has no byte shuffle to unpack 24 bit samples with, so they're
+  // left to the scalar kernel.
+  if (kernel == AudioKernel_SSE2) {
+    switch (aFormat.bitsPerSample) {
+      case 16: convert = S16ToFloat_SSE2; break;
+      case 32: convert = S32ToFloat_SSE2; break;
+    }
+  } else if (kernel == AudioKernel_AVX2) {
+    switch (aFormat.bitsPerSample) {
+      case 16: convert = S16ToFloat_AVX2; break;
+      case 24: convert = S24ToFloat_AVX2; break;
+      case 32: convert = S32ToFloat_AVX2; break;
+    }
+  }
+#endif
+  convert(aInput, aNumSamples, aOutput);
+  return true;
+}
+
+std::vector<float>
+GetDownmixMatrix(uint32_t aInputChannels, uint32_t aOutputChannels)
+{
+  std::vector<float> stereo(2 * aInputChannels, 0.0f);
+  float* left = &stereo[0];
+  float* right = &stereo[aInputChannels];
+  if (aInputChannels == 1) {
+    left[0] = right[0] = 1.0f;
+  } else {
+    left[0] = right[1] = 1.0f;
+    const float Minus3dB = 0.70710678f;
+    if (aInputChannels == 3 || aInputChannels == 5 || aInputChannels >= 6) {
+      left[2] = right[2] = Minus3dB;
+    }
+    if (aInputChannels == 4) {
+      left[2] = right[3] = Minus3dB;
+    } else if (aInputChannels == 5) {
+      left[3] = right[4] = Minus3dB;
+    } else if (aInputChannels >= 6) {
+      left[4] = right[5] = Minus3dB;
+      if (aInputChannels >= 8) {
+        left[6] = right[7] = Minus3dB;
+      }
+    }
+  }
+  for (uint32_t o = 0; o < 2; o++) {
+    float sum = 0.0f;
+    for (uint32_t i = 0; i < aInputChannels; i++) {
+      sum += stereo[o * aInputChannels + i];
+    }
+    for (uint32_t i = 0; i < aInputChannels; i++) {
+      stereo[o * aInputChannels + i] /= sum;
+    }
+  }
+  if (aOutputChannels == 2) {
+    return stereo;
+  }
+  std::vector<float> mono(aInputChannels);
+  for (uint32_t i = 0; i < aInputChannels; i++) {
+    mono[i] = (left[i] + right[i]) / 2;
+  }
+  return mono;
+}
+
+bool
+MixChannels(const float* aInput,
+            uint32_t aInputChannels,
+            uint32_t aNumFrames,
+            const float* aMatrix,
+            uint32_t aOutputChannels,
+            float* aOutput,
+            AudioKernel aKernel)
+{
+  const AudioKernel kernel = ResolveKernel(aKernel);
+  if (kernel == AudioKernel_Auto) {
+    return false;
+  }
+#if defined(HAVE_X86_SIMD)
+  if (aOutputChannels == 2 && (aInputChannels == 6 || aInputChannels == 8)) {
+    if (kernel == AudioKernel_AVX2) {
+      MixToStereo_AVX2(aInput, aInputChannels, aNumFrames, aMatrix, aOutput);
+      return true;
+    }
+    if (kernel == AudioKernel_SSE2) {
+      MixToStereo_SSE2(aInput, aInputChannels, aNumFrames, aMatrix, aOutput);
+      return true;
+    }
+  }
+#endif
+  MixChannels_Scalar(aInput, aInputChannels, aNumFrames, aMatrix, aOutputChannels, aOutput);
+  return true;
+}
+
+TpdfDither::TpdfDither(uint32_t aSeed)
+{
+  // Spread the seed over the lanes with an LCG. Xorshift's state must
+  // never be 0.
+  uint32_t state = aSeed;
+  for (uint32_t i = 0; i < NumLanes; i++) {
+    state = state * 1664525 + 1013904223;
+    lanes[i] = state ? state : 1;
+  }
+}
+
+bool
+ConvertToS16(const float* aInput,
+             size_t aNumSamples,
+             int16_t* aOutput,
+             TpdfDither* aDither,
+             AudioKernel aKernel)
+{
+  const AudioKernel kernel = ResolveKernel(aKernel);
+  switch (kernel) {
+#if defined(HAVE_X86_SIMD)
+    case AudioKernel_AVX2:
+      ToS16_AVX2(aInput, aNumSamples, aOutput, aDither);
+      return true;
+    case AudioKernel_SSE2:
+      ToS16_SSE2(aInput, aNumSamples, aOutput, aDither);
+      return true;
+#endif
+    case AudioKernel_Scalar:
+      ToS16_Scalar(aInput, aNumSamples, aOutput, aDither);
+      return true;
+    default:
+      return false;
+  }
+}
@@ -0,0 +1,101 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Kernels which convert PCM between sample formats, and mix it down to
+// fewer channels, for the audio path in front of the AAC encoder, which
+// only takes 16 bit mono or stereo. Audio is converted to float, mixed,
+// resampled if need be, and converted back.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "FrameSource.h"
+
+// The implementations of the kernels. AudioKernel_Auto picks the fastest
+// one supported by the CPU we're running on.
+enum AudioKernel {
+  AudioKernel_Auto,
+  AudioKernel_Scalar,
+  AudioKernel_SSE2,
+  AudioKernel_AVX2
+};
+
+// Returns the kernel which AudioKernel_Auto resolves to on this CPU.
+AudioKernel GetBestAudioKernel();
+
+// Returns true if aKernel can run on this CPU.
+bool IsAudioKernelSupported(AudioKernel aKernel);
+
+// Returns a human readable name for aKernel, for logging.
+const char* GetAudioKernelName(AudioKernel aKernel);
+
+// Returns true if we can convert samples in aFormat; 8 bit unsigned, 16,
+// 24 or 32 bit signed integer, or 32 bit float PCM.
+bool IsSampleFormatSupported(const AudioFormat& aFormat);
+
+// Converts aNumSamples samples of aInput, in aFormat's sample format, to
+// floats, scaled so that integer full scale is [-1, 1). Float input is
+// copied as it is. Returns false if the format isn't supported, or aKernel
+// isn't supported by this CPU.
+bool ConvertToFloat(const uint8_t* aInput,
+                    const AudioFormat& aFormat,
+                    size_t aNumSamples,
+                    float* aOutput,
+                    AudioKernel aKernel = AudioKernel_Auto);
+
+// Returns the weights which mix aInputChannels channels, in the usual WAVE
+// order (front left, front right, center, LFE, back left, back right, side
+// left, side right), down to aOutputChannels, which is 1 or 2; a row of
+// aInputChannels weights per output channel. Stereo gets the ITU-R BS.775
+// matrix; the center goes to both fronts at -3dB, the surrounds go to their
+// side at -3dB, and the LFE is dropped. Each row is scaled to sum to 1, so
+// the mix can't clip.
+std::vector<float> GetDownmixMatrix(uint32_t aInputChannels, uint32_t aOutputChannels);
+
+// Mixes aNumFrames frames of aInputChannels interleaved channels down to
+// aOutputChannels channels with aMatrix, which has a row of aInputChannels
+// weights for each output channel. The SIMD kernels handle 5.1 and 7.1 to
+// stereo; other layouts are mixed by the scalar kernel.
+// Returns false if aKernel isn't supported by this CPU.
+bool MixChannels(const float* aInput,
+                 uint32_t aInputChannels,
+                 uint32_t aNumFrames,
+                 const float* aMatrix,
+                 uint32_t aOutputChannels,
+                 float* aOutput,
+                 AudioKernel aKernel = AudioKernel_Auto);
+
+// The state of the random number generators which TPDF dither is made
+// from. There's one xorshift generator per SIMD lane, and the i'th sample
+// passed to ConvertToS16() is dithered with lane i % NumLanes, so that
+// every kernel dithers a stream identically, however it's chunked.
+struct TpdfDither {
+  static const uint32_t NumLanes = 8;
+  explicit TpdfDither(uint32_t aSeed = 1);
+  uint32_t lanes[NumLanes];
+};
+
+// Converts aNumSamples floats to 16 bit, rounding to the nearest integer
+// and clamping to the 16 bit range. If aDither is non-null, triangular
+// dither of up to 1 LSB either way is added first, which turns the
+// rounding error, which is correlated with the signal, into a constant
+// noise floor. Returns false if aKernel isn't supported by this CPU.
+bool ConvertToS16(const float* aInput,
+                  size_t aNumSamples,
+                  int16_t* aOutput,
+                  TpdfDither* aDither,
+                  AudioKernel aKernel = AudioKernel_Auto);
@@ -15,20 +15,13 @@
 #include "stdafx.h"
 #include "AudioProcessor.h"
 
-HRESULT
-AudioProcessor::SetInputType(IMFMediaType* aInputType)
+AudioProcessor::AudioProcessor()
+  : mResampling(false)
 {
-  ENSURE_TRUE(aInputType, E_POINTER);
-
-  HRESULT hr = ConfigureOutputTypeForInput(aInputType);
-  ENSURE_SUCCESS(hr, hr);
-
-  mInputType = aInputType;
-  return S_OK;
 }
 
 HRESULT
-AudioProcessor::ConfigureOutputTypeForInput(IMFMediaType* aInputType)
+AudioProcessor::SetInputType(IMFMediaType* aInputType, ResampleQuality aQuality)
 {
   ENSURE_TRUE(aInputType, E_POINTER);
 
@@ -38,41 +31,67 @@ AudioProcessor::ConfigureOutputTypeForInput(IMFMediaType* aInputType)
   hr = aInputType->GetGUID(MF_MT_SUBTYPE, &subtype);
   ENSURE_SUCCESS(hr, hr);
 
-  ENSURE_TRUE(subtype == MFAudioFormat_PCM, E_FAIL);
+  ENSURE_TRUE(subtype == MFAudioFormat_PCM || subtype == MFAudioFormat_Float, E_FAIL);
 
   // Otherwise we need to encode. Check to see if we need to resample.
-  UINT32 samplesPerSecond;
-  hr = aInputType->GetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, &samplesPerSecond);
+  AudioFormat inputFormat;
+  inputFormat.floatingPoint = (subtype == MFAudioFormat_Float);
+  hr = aInputType->GetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, &inputFormat.sampleRate);
   ENSURE_SUCCESS(hr, hr);
-
-  UINT32 channels;
-  hr = aInputType->GetUINT32(MF_MT_AUDIO_NUM_CHANNELS, &channels);
+  hr = aInputType->GetUINT32(MF_MT_AUDIO_NUM_CHANNELS, &inputFormat.numChannels);
+  ENSURE_SUCCESS(hr, hr);
+  hr = aInputType->GetUINT32(MF_MT_AUDIO_BITS_PER_SAMPLE, &inputFormat.bitsPerSample);
   ENSURE_SUCCESS(hr, hr);
 
-  if ((samplesPerSecond == 44100 || samplesPerSecond == 48000) &&
-      channels == 2) {
+  const bool encoderRate = (inputFormat.sampleRate == 44100 || inputFormat.sampleRate == 48000);
+  if (encoderRate &&
+      inputFormat.numChannels == 2 &&
+      inputFormat.bitsPerSample == 16 &&
+      !inputFormat.floatingPoint) {
     // The samples are of the rates supported by the AAC encoder,
     // as is the channel count, no need to resample, so pass through,
     // don't resample.
     mOutputType = aInputType;
+    mOutputFormat = inputFormat;
+    mResampling = false;
     return S_OK;
   }
 
-  // Otherwise, we need to resample!
-  hr = ConfigureResampler(aInputType);
+  // Otherwise, we need to convert, and maybe resample! Rates the encoder
+  // takes are kept, so that the resampler only runs when it has to. Other
+  // rates which are multiples of 11025Hz go to 44.1KHz, which they're a
+  // simple ratio of, and the rest to 48KHz. Dither when we're cutting the
+  // bits per sample.
+  const UINT32 outputRate = encoderRate ? inputFormat.sampleRate
+                          : (inputFormat.sampleRate % 11025 == 0) ? 44100 : 48000;
+  const bool dither = inputFormat.floatingPoint || inputFormat.bitsPerSample > 16;
+  ENSURE_TRUE(mResampler.Init(inputFormat, outputRate, 2, aQuality, dither), MF_E_INVALIDMEDIATYPE);
+  if (mResampler.IsResampling()) {
+    DBGMSG(L"Resampling audio from %u Hz, %u channels to %u Hz stereo, %S quality, %u taps, %S kernel\n",
+           inputFormat.sampleRate, inputFormat.numChannels, outputRate,
+           GetResampleQualityName(aQuality),
+           mResampler.GetResampler().GetNumTaps(),
+           GetResampleKernelName(mResampler.GetResampler().GetKernel()));
+  } else {
+    DBGMSG(L"Converting audio from %u bit %u channels to 16 bit stereo at %u Hz, %S kernel\n",
+           inputFormat.bitsPerSample, inputFormat.numChannels, outputRate,
+           GetAudioKernelName(GetBestAudioKernel()));
+  }
+
+  hr = CreateResamplerOutputType(outputRate);
   ENSURE_SUCCESS(hr, hr);
+  mOutputFormat = mResampler.GetOutputFormat();
+  mResampling = true;
 
   return S_OK;
 }
 
 static const UINT32 OutputNumChannels = 2;
 static const UINT32 OutputBitsPerSample = 16;
-static const UINT32 OutputSamplesPerSec = 48000;
 static const UINT32 OutputBlockAlign = 4; // NumChannels * bytesPerSample
-static const UINT32 OutputBytePerSec = 192000; // BlockAlign*SamplesPerSec
 
 HRESULT
-AudioProcessor::CreateResamplerOutputType()
+AudioProcessor::CreateResamplerOutputType(UINT32 aSampleRate)
 {
   HRESULT hr;
 
@@ -92,10 +111,10 @@ AudioProcessor::CreateResamplerOutputType()
   hr = outputType->SetUINT32(MF_MT_AUDIO_NUM_CHANNELS, OutputNumChannels);
   ENSURE_SUCCESS(hr, hr);
 
-  hr = outputType->SetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, OutputSamplesPerSec);
+  hr = outputType->SetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, aSampleRate);
   ENSURE_SUCCESS(hr, hr);
 
-  hr = outputType->SetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND, OutputBytePerSec);
+  hr = outputType->SetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND, OutputBlockAlign * aSampleRate);
   ENSURE_SUCCESS(hr, hr);
 
   hr = outputType->SetUINT32(MF_MT_AUDIO_BLOCK_ALIGNMENT, OutputBlockAlign);
@@ -112,53 +131,6 @@ AudioProcessor::CreateResamplerOutputType()
 
   return S_OK;
 }
-HRESULT
-AudioProcessor::ConfigureResampler(IMFMediaType* aInputType)
-{
-  HRESULT hr;
-
-  hr = aInputType->GetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND, &mInputAvgBytesPerSec);
-  ENSURE_SUCCESS(hr, hr);
-
-  // Create the resampler MFT
-  IUnknownPtr unknown;
-  hr = CoCreateInstance(CLSID_CResamplerMediaObject,
-                        NULL,
-                        CLSCTX_INPROC_SERVER,
-                        IID_IUnknown,
-                        (void**)&unknown);
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = unknown->QueryInterface(IID_PPV_ARGS(&mResampler));
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = mResampler->QueryInterface(IID_PPV_ARGS(&mResampleProps));
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = mResampleProps->SetHalfFilterLength(60); //< best conversion quality
-  ENSURE_SUCCESS(hr, hr);
-
-  // Set input type.
-  hr = mResampler->SetInputType(0, aInputType, 0);
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = CreateResamplerOutputType();
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = mResampler->SetOutputType(0, mOutputType, 0);
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = mResampler->ProcessMessage(MFT_MESSAGE_COMMAND_FLUSH, NULL);
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = mResampler->ProcessMessage(MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, NULL);
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = mResampler->ProcessMessage(MFT_MESSAGE_NOTIFY_START_OF_STREAM, NULL);
-  ENSURE_SUCCESS(hr, hr);
-
-  return S_OK;
-}
 
 HRESULT
 AudioProcessor::GetOutputType(IMFMediaType** aOutType)
@@ -169,93 +141,23 @@ AudioProcessor::GetOutputType(IMFMediaType** aOutType)
   return S_OK;
 }
 
-HRESULT
-AudioProcessor::Process(IMFSample* aInput, IMFSample** aOutput, bool aEOS)
+bool
+AudioProcessor::Process(const MediaFrame& aInput,
+                        bool aLast,
+                        MediaFrame* aOutput)
 {
-  ENSURE_TRUE(aInput, E_POINTER);
-  ENSURE_TRUE(aOutput, E_POINTER);
-  HRESULT hr;
-
-  if (!mResampler) {
-    // Pass through mode, just addref the sample and put it in aOutput.
+  if (!mResampling) {
     *aOutput = aInput;
-    (*aOutput)->AddRef();
-    return S_OK;
+    return true;
   }
-
-  // Otherwise, we need to resample!
-
-  // Calculate how many bytes we'll get out.
-  DWORD numInputBytes = 0;
-  hr = aInput->GetTotalLength(&numInputBytes);
-  ENSURE_SUCCESS(hr, hr);
-  int64_t numOutputBytes64 = numInputBytes * OutputBytePerSec / mInputAvgBytesPerSec;
-  ENSURE_TRUE(numOutputBytes64 < INT32_MAX, E_FAIL);
-  DWORD numOutputBytes = (DWORD)(numOutputBytes64);
-
-  // Send the input to resampler.
-  hr = mResampler->ProcessInput(0, aInput, 0);
-  ENSURE_SUCCESS(hr, hr);
-
-  // Clone the input sample. This is important, so that we copy timestamps, etc.
-  IMFSamplePtr outSample;
-  hr = CloneSample(aInput, &outSample);
-  ENSURE_SUCCESS(hr, hr);
-
-  if (aEOS) {
-    hr = mResampler->ProcessMessage(MFT_MESSAGE_NOTIFY_END_OF_STREAM, NULL);
-    ENSURE_SUCCESS(hr, hr);
-
-    mResampler->ProcessMessage(MFT_MESSAGE_COMMAND_DRAIN, NULL);
-    ENSURE_SUCCESS(hr, hr);
-  }
-
-  while (1) {
-
-    MFT_OUTPUT_DATA_BUFFER outputDataBuffer = {0};
-    IMFSamplePtr sample;
-    hr = MFCreateSample(&sample);
-    ENSURE_SUCCESS(hr, hr);
-
-    IMFMediaBufferPtr buffer;
-    hr = MFCreateMemoryBuffer(numOutputBytes, &buffer);
-    ENSURE_SUCCESS(hr, hr);
-
-    hr = sample->AddBuffer(buffer);
-    ENSURE_SUCCESS(hr, hr);
-
-    outputDataBuffer.pSample = sample;
-
-    DWORD dwStatus;
-    hr = mResampler->ProcessOutput(0, 1, &outputDataBuffer, &dwStatus);
-    if (hr == MF_E_TRANSFORM_NEED_MORE_INPUT) {
-      // conversion end
-      // Shouldn't happen!
-      break;
-    }
-    ENSURE_SUCCESS(hr, hr);
-
-    DWORD totalLength = 0;
-    hr = sample->GetTotalLength(&totalLength);
-    ENSURE_SUCCESS(hr, hr);
-
-    IMFMediaBufferPtr outBuffer;
-    hr = MFCreateMemoryBuffer(totalLength, &outBuffer);
-    ENSURE_SUCCESS(hr, hr);
-
-    hr = sample->CopyToBuffer(outBuffer);
-    ENSURE_SUCCESS(hr, hr);
-
-    hr = outSample->AddBuffer(outBuffer);
-    ENSURE_SUCCESS(hr, hr);
+  if (!mResampler.Process(aInput, aLast, aOutput)) {
+    DBGMSG(L"Failed to resample audio\n");
+    return false;
   }
-
-  if (aEOS) {
-    hr = mResampler->ProcessMessage(MFT_MESSAGE_NOTIFY_END_STREAMING, NULL);
-    ENSURE_SUCCESS(hr, hr);
+  if (aLast) {
+    const AudioFilterAllocationStats stats = mResampler.GetAllocationStats();
+    DBGMSG(L"Resampled %llu audio frames with %llu allocations, the last in frame %llu\n",
+           stats.numFrames, stats.numAllocations, stats.lastAllocationFrame);
   }
-
-  *aOutput = outSample.Detach();
-
-  return S_OK;
+  return true;
 }
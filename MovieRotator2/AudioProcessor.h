@@ -12,31 +12,41 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+
 #pragma once
 
+#include "AudioResampler.h"
+#include "FrameSource.h"
+
 // Resamples audio if neccessary, so that it's in an appropriate format for
 // the AAC encoder MFT, which only accepts PCM audio as 16 bits per sample,
-// 1 or 2 channels, and 44100 and 48000 Hz.
-class AudioProcessor {
+// 1 or 2 channels, and 44100 and 48000 Hz. The conversion is done by a
+// ResamplingAudioFilter, which only resamples audio at other rates.
+class AudioProcessor : public IAudioFilter {
 public:
+  AudioProcessor();
 
-  HRESULT SetInputType(IMFMediaType* aType);
+  // Configures us for PCM input of aType. Audio which needs resampling is
+  // resampled with aQuality.
+  HRESULT SetInputType(IMFMediaType* aType, ResampleQuality aQuality);
 
   HRESULT GetOutputType(IMFMediaType** aOutType);
 
-  HRESULT Process(IMFSample* aInput, IMFSample** aOutput, bool aEOS);
+  // IAudioFilter methods, so that the transcode pipeline can run audio
+  // through us.
+  const AudioFormat& GetOutputFormat() const override { return mOutputFormat; }
+  bool Process(const MediaFrame& aInput,
+               bool aLast,
+               MediaFrame* aOutput) override;
 
 private:
 
-  HRESULT ConfigureOutputTypeForInput(IMFMediaType* aInputType);
-  HRESULT ConfigureResampler(IMFMediaType* aInputType);
-  HRESULT CreateResamplerOutputType();
+  HRESULT CreateResamplerOutputType(UINT32 aSampleRate);
 
-  IMFMediaTypePtr mInputType;
   IMFMediaTypePtr mOutputType;
+  AudioFormat mOutputFormat;
 
-  IMFTransformPtr mResampler;
-  IWMResamplerPropsPtr mResampleProps;
-
-  UINT32 mInputAvgBytesPerSec;
+  ResamplingAudioFilter mResampler;
+  // False if the input is passed through as it is.
+  bool mResampling;
 };
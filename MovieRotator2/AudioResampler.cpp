@@ -0,0 +1,535 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+#include "AudioResampler.h"
+#include "AudioConversion.h"
+#include "CpuFeatures.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+
+#if defined(HAVE_X86_SIMD)
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+static const double Pi = 3.14159265358979323846;
+
+// The number of taps, before widening for downsampling, and the stopband
+// attenuation in dB, of each quality. The numbers of taps are multiples of
+// 8, so the SIMD kernels have no remainders to handle.
+static const struct {
+  uint32_t numTaps;
+  double attenuationDb;
+} QualityParams[NumResampleQualities] = {
+  { 16, 60.0 },
+  { 48, 90.0 },
+  { 128, 120.0 }
+};
+
+static const char* const QualityNames[NumResampleQualities] = {
+  "fast",
+  "balanced",
+  "best"
+};
+
+const char*
+GetResampleQualityName(ResampleQuality aQuality)
+{
+  return (aQuality >= 0 && aQuality < NumResampleQualities) ? QualityNames[aQuality] : "unknown";
+}
+
+static float
+DotProduct_Scalar(const float* aCoeffs, const float* aSamples, uint32_t aLength)
+{
+  float sum = 0.0f;
+  for (uint32_t i = 0; i < aLength; i++) {
+    sum += aCoeffs[i] * aSamples[i];
+  }
+  return sum;
+}
+
+#if defined(HAVE_X86_SIMD)
+
+// aLength must be a multiple of 8.
+static TARGET_SSE2 float
+DotProduct_SSE2(const float* aCoeffs, const float* aSamples, uint32_t aLength)
+{
+  __m128 sum0 = _mm_setzero_ps();
+  __m128 sum1 = _mm_setzero_ps();
+  for (uint32_t i = 0; i < aLength; i += 8) {
+    sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(aCoeffs + i),
+                                       _mm_loadu_ps(aSamples + i)));
+    sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(aCoeffs + i + 4),
+                                       _mm_loadu_ps(aSamples + i + 4)));
+  }
+  __m128 sum = _mm_add_ps(sum0, sum1);
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+  return _mm_cvtss_f32(sum);
+}
+
+// aLength must be a multiple of 8.
+static TARGET_AVX2 float
+DotProduct_AVX2(const float* aCoeffs, const float* aSamples, uint32_t aLength)
+{
+  __m256 sum0 = _mm256_setzero_ps();
+  __m256 sum1 = _mm256_setzero_ps();
+  uint32_t i = 0;
+  for (; i + 16 <= aLength; i += 16) {
+    sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(aCoeffs + i),
+                                             _mm256_loadu_ps(aSamples + i)));
+    sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_loadu_ps(aCoeffs + i + 8),
+                                             _mm256_loadu_ps(aSamples + i + 8)));
+  }
+  if (i < aLength) {
+    sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(aCoeffs + i),
+                                             _mm256_loadu_ps(aSamples + i)));
+  }
+  const __m256 sum8 = _mm256_add_ps(sum0, sum1);
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum8), _mm256_extractf128_ps(sum8, 1));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+  return _mm_cvtss_f32(sum);
+}
+
+#endif // HAVE_X86_SIMD
+
+ResampleKernel
+GetBestResampleKernel()
+{
+  if (HasCpuFeature(CPU_FEATURE_AVX2)) {
+    return ResampleKernel_AVX2;
+  }
+  if (HasCpuFeature(CPU_FEATURE_SSE2)) {
+    return ResampleKernel_SSE2;
+  }
+  return ResampleKernel_Scalar;
+}
+
+bool
+IsResampleKernelSupported(ResampleKernel aKernel)
+{
+  switch (aKernel) {
+    case ResampleKernel_Auto:
+    case ResampleKernel_Scalar:
+      return true;
+    case ResampleKernel_SSE2:
+      return HasCpuFeature(CPU_FEATURE_SSE2);
+    case ResampleKernel_AVX2:
+      return HasCpuFeature(CPU_FEATURE_AVX2);
+  }
+  return false;
+}
+
+const char*
+GetResampleKernelName(ResampleKernel aKernel)
+{
+  switch (aKernel) {
+    case ResampleKernel_Auto: return "auto";
+    case ResampleKernel_Scalar: return "scalar";
+    case ResampleKernel_SSE2: return "SSE2";
+    case ResampleKernel_AVX2: return "AVX2";
+  }
+  return "?";
+}
+
+static uint32_t
+Gcd(uint32_t aA, uint32_t aB)
+{
+  while (aB) {
+    const uint32_t r = aA % aB;
+    aA = aB;
+    aB = r;
+  }
+  return aA;
+}
+
+// The zeroth order modified Bessel function of the first kind, which the
+// Kaiser window is made of.
+static double
+BesselI0(double aX)
+{
+  double sum = 1.0;
+  double term = 1.0;
+  const double halfX = aX / 2;
+  for (int k = 1; k < 64; k++) {
+    term *= (halfX / k) * (halfX / k);
+    sum += term;
+    if (term < sum * 1e-17) {
+      break;
+    }
+  }
+  return sum;
+}
+
+static double
+Sinc(double aX)
+{
+  return (fabs(aX) < 1e-12) ? 1.0 : sin(Pi * aX) / (Pi * aX);
+}
+
+AudioResampler::AudioResampler()
+  : mInputRate(0),
+    mOutputRate(0),
+    mNumChannels(0),
+    mStepNumer(1),
+    mStepDenom(1),
+    mNumTaps(0),
+    mNumPhases(0),
+    mPassbandEdgeHz(0.0),
+    mKernel(ResampleKernel_Scalar),
+    mDotProduct(DotProduct_Scalar),
+    mHistoryStart(0),
+    mNumInput(0),
+    mNumOutput(0),
+    mInputIndex(0),
+    mPhase(0),
+    mNumAllocations(0)
+{
+}
+
+bool
+AudioResampler::Init(uint32_t aInputRate,
+                     uint32_t aOutputRate,
+                     uint32_t aNumChannels,
+                     ResampleQuality aQuality,
+                     ResampleKernel aKernel)
+{
+  if (!aInputRate || !aOutputRate || !aNumChannels ||
+      aQuality < 0 || aQuality >= NumResampleQualities ||
+      !IsResampleKernelSupported(aKernel)) {
+    return false;
+  }
+  mInputRate = aInputRate;
+  mOutputRate = aOutputRate;
+  mNumChannels = aNumChannels;
+  const uint32_t divisor = Gcd(aInputRate, aOutputRate);
+  mStepNumer = aInputRate / divisor;
+  mStepDenom = aOutputRate / divisor;
+
+  mKernel = (aKernel == ResampleKernel_Auto) ? GetBestResampleKernel() : aKernel;
+  mDotProduct = DotProduct_Scalar;
+#if defined(HAVE_X86_SIMD)
+  if (mKernel == ResampleKernel_SSE2) {
+    mDotProduct = DotProduct_SSE2;
+  } else if (mKernel == ResampleKernel_AVX2) {
+    mDotProduct = DotProduct_AVX2;
+  }
+#endif
+
+  // When downsampling, the cutoff has to come down to the output's Nyquist
+  // frequency, and the filter gets proportionally longer to keep the
+  // transition band as narrow, relative to the output rate.
+  const double scale = std::min(1.0, double(aOutputRate) / aInputRate);
+  const uint32_t baseTaps = QualityParams[aQuality].numTaps;
+  const double attenuation = QualityParams[aQuality].attenuationDb;
+  mNumTaps = (uint32_t(ceil(baseTaps / scale)) + 7) & ~7u;
+
+  // Kaiser's formulas for the window's shape, and for the width of the
+  // transition band, as a fraction of the lower rate, a filter of this
+  // length and attenuation has. The transition is centered on the cutoff,
+  // so put the cutoff half a transition below the Nyquist frequency, so
+  // that the stopband starts there.
+  const double beta = 0.1102 * (attenuation - 8.7);
+  const double transition = (attenuation - 7.95) / (14.36 * baseTaps);
+  // In cycles per input sample.
+  const double cutoff = scale * (0.5 - transition / 2);
+  mPassbandEdgeHz = scale * (0.5 - transition) * aInputRate;
+
+  mNumPhases = std::min(mStepDenom, uint32_t(MaxPhases));
+  mCoeffs.resize(size_t(mNumPhases) * mNumTaps);
+  const int32_t halfTaps = int32_t(mNumTaps / 2);
+  const double windowScale = 1.0 / BesselI0(beta);
+  for (uint32_t phase = 0; phase < mNumPhases; phase++) {
+    // Tap k is applied to the input sample (k - (halfTaps - 1) - offset)
+    // samples from the output sample, which is offset samples after the
+    // input sample it falls after.
+    const double offset = double(phase) / mNumPhases;
+    float* row = &mCoeffs[size_t(phase) * mNumTaps];
+    double sum = 0.0;
+    for (uint32_t k = 0; k < mNumTaps; k++) {
+      const double distance = double(int32_t(k) - (halfTaps - 1)) - offset;
+      const double x = distance / halfTaps;
+      const double window = (fabs(x) < 1.0) ? BesselI0(beta * sqrt(1.0 - x * x)) * windowScale : 0.0;
+      const double coeff = 2 * cutoff * Sinc(2 * cutoff * distance) * window;
+      row[k] = float(coeff);
+      sum += coeff;
+    }
+    // Give each phase unity gain at DC, so that the phases don't modulate
+    // the signal's level.
+    for (uint32_t k = 0; k < mNumTaps; k++) {
+      row[k] = float(row[k] / sum);
+    }
+  }
+
+  Reset();
+  return true;
+}
+
+void
+AudioResampler::Reset()
+{
+  // The first output sample falls on the first input sample, and needs
+  // the filter's first half of input before it, which is silence.
+  const uint32_t lead = mNumTaps ? mNumTaps / 2 - 1 : 0;
+  mHistory.resize(mNumChannels);
+  for (uint32_t c = 0; c < mNumChannels; c++) {
+    mHistory[c].assign(lead, 0.0f);
+  }
+  mHistoryStart = -int64_t(lead);
+  mNumInput = 0;
+  mNumOutput = 0;
+  mInputIndex = 0;
+  mPhase = 0;
+}
+
+void
+AudioResampler::Process(const float* aInput, uint32_t aNumFrames, std::vector<float>* aOutput)
+{
+  for (uint32_t c = 0; c < mNumChannels; c++) {
+    std::vector<float>& history = mHistory[c];
+    const size_t start = history.size();
+    // Leave room for the silence Drain() pads the history with, and for
+    // chunks a bit bigger than this one, so that it doesn't grow again.
+    const size_t needed = start + aNumFrames + mNumTaps / 2;
+    if (history.capacity() < needed) {
+      history.reserve(needed + needed / 4);
+      mNumAllocations++;
+    }
+    history.resize(start + aNumFrames);
+    const float* input = aInput + c;
+    for (uint32_t i = 0; i < aNumFrames; i++) {
+      history[start + i] = input[size_t(i) * mNumChannels];
+    }
+  }
+  mNumInput += aNumFrames;
+  Resample(mNumInput, UINT64_MAX, aOutput);
+}
+
+void
+AudioResampler::Drain(std::vector<float>* aOutput)
+{
+  // The output is as long as the input, rounded up to a whole sample.
+  const uint64_t end = (mNumInput * mStepDenom + mStepNumer - 1) / mStepNumer;
+  const uint32_t trail = mNumTaps / 2;
+  for (uint32_t c = 0; c < mNumChannels; c++) {
+    std::vector<float>& history = mHistory[c];
+    if (history.capacity() < history.size() + trail) {
+      mNumAllocations++;
+    }
+    history.resize(history.size() + trail, 0.0f);
+  }
+  Resample(mNumInput + trail, end, aOutput);
+  Reset();
+}
+
+void
+AudioResampler::Resample(uint64_t aNumAvailable, uint64_t aEnd, std::vector<float>* aOutput)
+{
+  const int64_t halfTaps = mNumTaps / 2;
+  while (mNumOutput < aEnd && mInputIndex + halfTaps < int64_t(aNumAvailable)) {
+    const uint32_t row = (mNumPhases == mStepDenom)
+                       ? mPhase
+                       : uint32_t(uint64_t(mPhase) * mNumPhases / mStepDenom);
+    const float* coeffs = &mCoeffs[size_t(row) * mNumTaps];
+    const size_t first = size_t(mInputIndex - (halfTaps - 1) - mHistoryStart);
+    for (uint32_t c = 0; c < mNumChannels; c++) {
+      aOutput->push_back(mDotProduct(coeffs, &mHistory[c][first], mNumTaps));
+    }
+    mNumOutput++;
+    mPhase += mStepNumer;
+    mInputIndex += mPhase / mStepDenom;
+    mPhase %= mStepDenom;
+  }
+
+  // Drop the input before the next output sample's filter.
+  const int64_t needed = mInputIndex - (halfTaps - 1);
+  if (needed <= mHistoryStart || mHistory.empty()) {
+    return;
+  }
+  const size_t drop = size_t(std::min<int64_t>(needed - mHistoryStart,
+                                               int64_t(mHistory[0].size())));
+  for (uint32_t c = 0; c < mNumChannels; c++) {
+    mHistory[c].erase(mHistory[c].begin(), mHistory[c].begin() + drop);
+  }
+  mHistoryStart += drop;
+}
+
+ResamplingAudioFilter::ResamplingAudioFilter()
+  : mMixing(false),
+    mResampling(false),
+    mDithering(false),
+    mNumScratchAllocations(0),
+    mStartTime(0),
+    mNumOutput(0),
+    mStarted(false)
+{
+  memset(&mAllocationStats, 0, sizeof(mAllocationStats));
+}
+
+bool
+ResamplingAudioFilter::Init(const AudioFormat& aInputFormat,
+                            uint32_t aOutputRate,
+                            uint32_t aOutputChannels,
+                            ResampleQuality aQuality,
+                            bool aDither,
+                            ResampleKernel aKernel)
+{
+  if (!IsSampleFormatSupported(aInputFormat) ||
+      !aInputFormat.numChannels ||
+      !aInputFormat.sampleRate ||
+      (aOutputChannels != 1 && aOutputChannels != 2)) {
+    return false;
+  }
+  mResampling = (aInputFormat.sampleRate != aOutputRate);
+  if (mResampling &&
+      !mResampler.Init(aInputFormat.sampleRate, aOutputRate, aOutputChannels, aQuality, aKernel)) {
+    return false;
+  }
+  mInputFormat = aInputFormat;
+  mOutputFormat = AudioFormat();
+  mOutputFormat.sampleRate = aOutputRate;
+  mOutputFormat.numChannels = aOutputChannels;
+  mOutputFormat.bitsPerSample = 16;
+  mMixing = (aInputFormat.numChannels != aOutputChannels);
+  if (mMixing) {
+    mMixMatrix = GetDownmixMatrix(aInputFormat.numChannels, aOutputChannels);
+  }
+  mDithering = aDither;
+  mDither = TpdfDither();
+  mStarted = false;
+  mNumOutput = 0;
+  return true;
+}
+
+uint64_t
+ResamplingAudioFilter::CountAllocations() const
+{
+  return mNumScratchAllocations + mResampler.GetNumAllocations() +
+         mOutputBuffers.GetNumAllocations();
+}
+
+AudioFilterAllocationStats
+ResamplingAudioFilter::GetAllocationStats() const
+{
+  AudioFilterAllocationStats stats = mAllocationStats;
+  stats.numAllocations = CountAllocations();
+  return stats;
+}
+
+void
+ResamplingAudioFilter::Reserve(std::vector<float>* aBuffer, size_t aSize)
+{
+  if (aBuffer->capacity() < aSize) {
+    // Leave room for chunks a bit bigger than this one.
+    aBuffer->reserve(aSize + aSize / 4);
+    mNumScratchAllocations++;
+  }
+}
+
+bool
+ResamplingAudioFilter::Process(const MediaFrame& aInput,
+                               bool aLast,
+                               MediaFrame* aOutput)
+{
+  if (!mStarted) {
+    mStartTime = aInput.timestamp;
+    mNumOutput = 0;
+    mStarted = true;
+  }
+  const uint32_t inputChannels = mInputFormat.numChannels;
+  const uint32_t outputChannels = mOutputFormat.numChannels;
+  const size_t inputFrameSize = inputChannels * mInputFormat.bitsPerSample / 8;
+  const uint32_t numFrames = aInput.data ? uint32_t(aInput.length / inputFrameSize) : 0;
+
+  const uint64_t numAllocations = CountAllocations();
+  mAllocationStats.numFrames++;
+
+  const size_t numInputSamples = size_t(numFrames) * inputChannels;
+  Reserve(&mConverted, numInputSamples);
+  mConverted.resize(numInputSamples);
+  if (numFrames) {
+    ConvertToFloat(aInput.data, mInputFormat, numInputSamples, &mConverted[0]);
+  }
+  const std::vector<float>* samples = &mConverted;
+
+  if (mMixing) {
+    const size_t numMixedSamples = size_t(numFrames) * outputChannels;
+    Reserve(&mMixed, numMixedSamples);
+    mMixed.resize(numMixedSamples);
+    if (numFrames) {
+      MixChannels(&mConverted[0], inputChannels, numFrames, &mMixMatrix[0],
+                  outputChannels, &mMixed[0]);
+    }
+    samples = &mMixed;
+  }
+
+  if (mResampling) {
+    // Make room for the most output this input, and what's left of the
+    // stream if it's the last, could make, so that the resampler's appends
+    // don't reallocate.
+    const uint64_t maxOutput = (uint64_t(numFrames) + mResampler.GetNumTaps()) *
+                               mOutputFormat.sampleRate / mInputFormat.sampleRate + 2;
+    mResampled.clear();
+    Reserve(&mResampled, size_t(maxOutput * outputChannels));
+    mResampler.Process(samples->empty() ? nullptr : &(*samples)[0], numFrames, &mResampled);
+    if (aLast) {
+      mResampler.Drain(&mResampled);
+    }
+    samples = &mResampled;
+  }
+  if (aLast) {
+    mStarted = false;
+  }
+
+  *aOutput = MediaFrame();
+  aOutput->stream = Stream_Audio;
+  const size_t numSamples = samples->size();
+  const uint64_t numOutput = numSamples / outputChannels;
+  if (!numOutput) {
+    // The resampler holds back the start of the stream while it fills its
+    // filter.
+    if (CountAllocations() != numAllocations) {
+      mAllocationStats.lastAllocationFrame = mAllocationStats.numFrames;
+    }
+    return true;
+  }
+
+  const size_t length = numSamples * sizeof(int16_t);
+  std::shared_ptr<uint8_t> buffer = mOutputBuffers.Acquire(length);
+  if (!buffer) {
+    return false;
+  }
+  if (CountAllocations() != numAllocations) {
+    mAllocationStats.lastAllocationFrame = mAllocationStats.numFrames;
+  }
+  ConvertToS16(&(*samples)[0], numSamples, reinterpret_cast<int16_t*>(buffer.get()),
+               mDithering ? &mDither : nullptr);
+
+  const uint32_t rate = mOutputFormat.sampleRate;
+  const int64_t start = mStartTime + int64_t(mNumOutput * TimeUnitsPerSecond / rate);
+  mNumOutput += numOutput;
+  const int64_t end = mStartTime + int64_t(mNumOutput * TimeUnitsPerSecond / rate);
+  aOutput->timestamp = start;
+  aOutput->duration = end - start;
+  aOutput->data = buffer.get();
+  aOutput->length = length;
+  aOutput->storage = buffer;
+  return true;
+}
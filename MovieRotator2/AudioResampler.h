@@ -0,0 +1,230 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+
+// A polyphase windowed-sinc resampler, and an IAudioFilter which uses it to
+// convert PCM to the rates and channel counts the AAC encoder takes. This
+// replaces the Windows resampler DMO, so that the audio path runs, and can
+// be tuned and measured, anywhere.
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "AudioConversion.h"
+#include "FrameBufferPool.h"
+#include "FrameSource.h"
+
+// How hard the resampler works. Higher qualities have longer filters, with
+// a flatter passband, a sharper cutoff and more stopband attenuation.
+enum ResampleQuality {
+  // 16 taps, 60dB of attenuation. For bulk jobs.
+  ResampleQuality_Fast,
+  // 48 taps, 90dB of attenuation. Transparent for almost anything.
+  ResampleQuality_Balanced,
+  // 128 taps, 120dB of attenuation; better than 16 bit output can show.
+  ResampleQuality_Best,
+  NumResampleQualities
+};
+
+// Returns the name of aQuality; "fast", "balanced" or "best".
+const char* GetResampleQualityName(ResampleQuality aQuality);
+
+// The implementations of the filter's inner loop. ResampleKernel_Auto
+// picks the fastest one supported by the CPU we're running on.
+enum ResampleKernel {
+  ResampleKernel_Auto,
+  ResampleKernel_Scalar,
+  ResampleKernel_SSE2,
+  ResampleKernel_AVX2
+};
+
+// Returns the kernel which ResampleKernel_Auto resolves to on this CPU.
+ResampleKernel GetBestResampleKernel();
+
+// Returns true if aKernel can run on this CPU.
+bool IsResampleKernelSupported(ResampleKernel aKernel);
+
+// Returns a human readable name for aKernel, for logging.
+const char* GetResampleKernelName(ResampleKernel aKernel);
+
+// Resamples interleaved float audio by a rational ratio. The input rate
+// over the output rate is reduced to M/L, and each output sample is the
+// dot product of the input around it with one of L phases of a Kaiser
+// windowed sinc, so no time is lost to rounding however long the stream.
+// The resampler streams; input can be passed in chunks of any size, and
+// the output is the same as if it had been passed in one go.
+class AudioResampler {
+public:
+  // Ratios with more phases than this share phases, rounding each output
+  // sample's position down to a multiple of 1/MaxPhases of an input sample.
+  // The rates media is recorded at never need that many.
+  static const uint32_t MaxPhases = 4096;
+
+  AudioResampler();
+
+  // Configures the resampler to convert aNumChannels channels from
+  // aInputRate to aOutputRate, and resets it. Returns false if a rate or
+  // the channel count is 0, or aKernel isn't supported by this CPU.
+  bool Init(uint32_t aInputRate,
+            uint32_t aOutputRate,
+            uint32_t aNumChannels,
+            ResampleQuality aQuality,
+            ResampleKernel aKernel = ResampleKernel_Auto);
+
+  // Resamples aNumFrames frames of aInput, appending as many frames of
+  // output as they complete to *aOutput.
+  void Process(const float* aInput, uint32_t aNumFrames, std::vector<float>* aOutput);
+
+  // Appends the output which is still waiting on input after the end of the
+  // stream, treating that input as silence, to *aOutput, so that the output
+  // is as long as the input. Then resets, ready for another stream.
+  void Drain(std::vector<float>* aOutput);
+
+  // Forgets the stream, as if we'd just been initialized.
+  void Reset();
+
+  // The highest frequency the filter passes unattenuated, in Hz.
+  double GetPassbandEdgeHz() const { return mPassbandEdgeHz; }
+
+  uint32_t GetNumTaps() const { return mNumTaps; }
+  uint32_t GetNumPhases() const { return mNumPhases; }
+  ResampleKernel GetKernel() const { return mKernel; }
+
+  // The number of times the input history has had to grow. It stops
+  // growing once it's seen the largest chunk of input.
+  uint64_t GetNumAllocations() const { return mNumAllocations; }
+
+private:
+  // Appends the output frames, up to output frame aEnd, which the first
+  // aNumAvailable input frames are enough for, and drops the input which
+  // no more output needs.
+  void Resample(uint64_t aNumAvailable, uint64_t aEnd, std::vector<float>* aOutput);
+
+  typedef float (*DotProductFn)(const float* aCoeffs, const float* aSamples, uint32_t aLength);
+
+  uint32_t mInputRate;
+  uint32_t mOutputRate;
+  uint32_t mNumChannels;
+  // The ratio of the rates, as the output step, M input samples per L
+  // output samples, in lowest terms.
+  uint32_t mStepNumer;
+  uint32_t mStepDenom;
+  uint32_t mNumTaps;
+  uint32_t mNumPhases;
+  double mPassbandEdgeHz;
+  // mNumPhases rows of mNumTaps coefficients.
+  std::vector<float> mCoeffs;
+  ResampleKernel mKernel;
+  DotProductFn mDotProduct;
+
+  // Each channel's input, from mHistoryStart on, so the filter runs over
+  // contiguous samples. Starts with the filter's worth of silence before
+  // the stream, so the first output sample lines up with the first input.
+  std::vector<std::vector<float> > mHistory;
+  int64_t mHistoryStart;
+  // The input frames passed in, and the output frames produced.
+  uint64_t mNumInput;
+  uint64_t mNumOutput;
+  // The input frame the next output frame falls on or after, and how far
+  // after it it is, in L'ths of an input frame.
+  int64_t mInputIndex;
+  uint32_t mPhase;
+  uint64_t mNumAllocations;
+};
+
+// How many heap allocations a ResamplingAudioFilter has made. Its buffers
+// are kept and reused, so it only allocates while it's warming up, or when
+// the input comes in bigger chunks than it has seen before.
+struct AudioFilterAllocationStats {
+  // The number of frames of input processed.
+  uint64_t numFrames;
+  uint64_t numAllocations;
+  // The frame, counting from 1, whose processing last allocated, or 0 if
+  // none has.
+  uint64_t lastAllocationFrame;
+};
+
+// Converts integer or float PCM to 16 bit PCM at a given rate with 1 or 2
+// channels, for the AAC encoder. The input is converted to float, more
+// channels are mixed down, and if the rate differs it's changed with an
+// AudioResampler, all with the AudioConversion kernels. The output's
+// timestamps count on from the first input frame's by the number of
+// samples output, so they don't drift, whatever the input's timestamps are
+// rounded to.
+class ResamplingAudioFilter : public IAudioFilter {
+public:
+  ResamplingAudioFilter();
+
+  // Configures the filter for input in aInputFormat, which must be 8, 16,
+  // 24 or 32 bit integer, or float, PCM, to be output at aOutputRate with
+  // aOutputChannels channels. The output is TPDF dithered if aDither is
+  // set. Returns false if the format isn't supported.
+  bool Init(const AudioFormat& aInputFormat,
+            uint32_t aOutputRate,
+            uint32_t aOutputChannels,
+            ResampleQuality aQuality,
+            bool aDither,
+            ResampleKernel aKernel = ResampleKernel_Auto);
+
+  // False if the input's already at the output rate, so the resampler
+  // isn't used.
+  bool IsResampling() const { return mResampling; }
+  const AudioResampler& GetResampler() const { return mResampler; }
+
+  AudioFilterAllocationStats GetAllocationStats() const;
+
+  // IAudioFilter methods.
+  const AudioFormat& GetOutputFormat() const override { return mOutputFormat; }
+  bool Process(const MediaFrame& aInput,
+               bool aLast,
+               MediaFrame* aOutput) override;
+
+private:
+  // Makes room for aSize samples in *aBuffer, counting the allocation if
+  // that takes one.
+  void Reserve(std::vector<float>* aBuffer, size_t aSize);
+
+  // Returns the allocations made by us, the resampler and the output pool.
+  uint64_t CountAllocations() const;
+
+  AudioFormat mInputFormat;
+  AudioFormat mOutputFormat;
+  // Each output channel is the sum of the input channels weighted by the
+  // row of this matrix for it; aOutputChannels rows of one weight per
+  // input channel.
+  std::vector<float> mMixMatrix;
+  AudioResampler mResampler;
+  bool mMixing;
+  bool mResampling;
+  bool mDithering;
+  TpdfDither mDither;
+
+  // The input converted to float, then mixed, then resampled.
+  std::vector<float> mConverted;
+  std::vector<float> mMixed;
+  std::vector<float> mResampled;
+  // The output frames' samples are converted straight into these, and the
+  // frames share them with the sink, so each sample is only copied once.
+  RecyclingBufferPool mOutputBuffers;
+  uint64_t mNumScratchAllocations;
+  AudioFilterAllocationStats mAllocationStats;
+
+  // The timestamp of the first input frame, and the number of frames
+  // output since.
+  int64_t mStartTime;
+  uint64_t mNumOutput;
+  bool mStarted;
+};
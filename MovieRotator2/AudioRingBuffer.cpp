@@ -0,0 +1,132 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "AudioRingBuffer.h"
+
+#include <string.h>
+#include <algorithm>
+
+AudioRingBuffer::AudioRingBuffer()
+  : mFrameSize(0),
+    mCapacityFrames(0),
+    mReadPosition(0),
+    mWritePosition(0),
+    mEnded(false),
+    mNumCallbacks(0),
+    mNumUnderruns(0),
+    mNumSilentFrames(0)
+{
+}
+
+bool
+AudioRingBuffer::Init(uint32_t aFrameSize, uint32_t aCapacityFrames)
+{
+  if (!aFrameSize || !aCapacityFrames || aCapacityFrames > (1u << 30)) {
+    return false;
+  }
+  uint32_t capacity = 1;
+  while (capacity < aCapacityFrames) {
+    capacity <<= 1;
+  }
+  mData.assign(size_t(capacity) * aFrameSize, 0);
+  mFrameSize = aFrameSize;
+  mCapacityFrames = capacity;
+  mReadPosition = 0;
+  mWritePosition = 0;
+  mEnded = false;
+  mNumCallbacks = 0;
+  mNumUnderruns = 0;
+  mNumSilentFrames = 0;
+  return true;
+}
+
+uint32_t
+AudioRingBuffer::Write(const uint8_t* aData, uint32_t aNumFrames)
+{
+  const uint32_t write = mWritePosition.load(std::memory_order_relaxed);
+  const uint32_t read = mReadPosition.load(std::memory_order_acquire);
+  const uint32_t numFrames = std::min(aNumFrames, mCapacityFrames - (write - read));
+  const uint32_t offset = write & (mCapacityFrames - 1);
+  const uint32_t first = std::min(numFrames, mCapacityFrames - offset);
+  memcpy(&mData[size_t(offset) * mFrameSize], aData, size_t(first) * mFrameSize);
+  memcpy(&mData[0], aData + size_t(first) * mFrameSize,
+         size_t(numFrames - first) * mFrameSize);
+  mWritePosition.store(write + numFrames, std::memory_order_release);
+  return numFrames;
+}
+
+void
+AudioRingBuffer::MarkEnded()
+{
+  mEnded.store(true, std::memory_order_release);
+}
+
+uint32_t
+AudioRingBuffer::Render(uint8_t* aOut, uint32_t aNumFrames)
+{
+  // Read whether we've ended before what's been written, as the writer
+  // marks the end after writing the last frames. If we've ended, what's
+  // been written is all there is.
+  const bool ended = mEnded.load(std::memory_order_acquire);
+  const uint32_t read = mReadPosition.load(std::memory_order_relaxed);
+  const uint32_t write = mWritePosition.load(std::memory_order_acquire);
+  const uint32_t numFrames = std::min(aNumFrames, write - read);
+  const uint32_t offset = read & (mCapacityFrames - 1);
+  const uint32_t first = std::min(numFrames, mCapacityFrames - offset);
+  memcpy(aOut, &mData[size_t(offset) * mFrameSize], size_t(first) * mFrameSize);
+  memcpy(aOut + size_t(first) * mFrameSize, &mData[0],
+         size_t(numFrames - first) * mFrameSize);
+  mReadPosition.store(read + numFrames, std::memory_order_release);
+
+  // The counters only have one writer, so they don't need an atomic
+  // increment; they're atomic so that GetStats() can read them.
+  mNumCallbacks.store(mNumCallbacks.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+  const uint32_t missing = aNumFrames - numFrames;
+  memset(aOut + size_t(numFrames) * mFrameSize, 0, size_t(missing) * mFrameSize);
+  if (!missing || ended) {
+    return numFrames;
+  }
+  mNumUnderruns.store(mNumUnderruns.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+  mNumSilentFrames.store(mNumSilentFrames.load(std::memory_order_relaxed) + missing,
+                         std::memory_order_relaxed);
+  return aNumFrames;
+}
+
+uint32_t
+AudioRingBuffer::GetAvailableFrames() const
+{
+  // The read position is loaded first, so that the count can't be negative.
+  const uint32_t read = mReadPosition.load(std::memory_order_acquire);
+  const uint32_t write = mWritePosition.load(std::memory_order_acquire);
+  return std::min(write - read, mCapacityFrames);
+}
+
+uint32_t
+AudioRingBuffer::GetFreeFrames() const
+{
+  return mCapacityFrames - GetAvailableFrames();
+}
+
+AudioRingStats
+AudioRingBuffer::GetStats() const
+{
+  AudioRingStats stats;
+  stats.numCallbacks = mNumCallbacks.load(std::memory_order_relaxed);
+  stats.numUnderruns = mNumUnderruns.load(std::memory_order_relaxed);
+  stats.numSilentFrames = mNumSilentFrames.load(std::memory_order_relaxed);
+  return stats;
+}
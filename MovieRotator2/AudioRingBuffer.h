@@ -0,0 +1,96 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// A ring of interleaved PCM frames, for handing audio from a thread which
+// decodes it to an audio device's callback. Writing and rendering are
+// wait-free and copy with memcpy, so the callback never waits on the
+// decoder; if the decoder falls behind, the callback plays silence, and
+// counts the underrun.
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+struct AudioRingStats {
+  AudioRingStats()
+    : numCallbacks(0),
+      numUnderruns(0),
+      numSilentFrames(0)
+  {
+  }
+  // The number of times Render() has been called.
+  uint64_t numCallbacks;
+  // The number of those which ran out of audio before its end, and so
+  // played silence.
+  uint64_t numUnderruns;
+  // The frames of silence which those played.
+  uint64_t numSilentFrames;
+};
+
+// Has one writer thread, which writes the audio and marks its end, and one
+// reader thread, the device's callback, which renders it.
+class AudioRingBuffer {
+public:
+  AudioRingBuffer();
+
+  // Allocates room for at least aCapacityFrames frames of aFrameSize bytes,
+  // and empties the ring. Not threadsafe. Returns false if either is 0.
+  bool Init(uint32_t aFrameSize, uint32_t aCapacityFrames);
+
+  // Writer only. Copies as many of the aNumFrames frames at aData as there's
+  // room for into the ring, and returns how many that was.
+  uint32_t Write(const uint8_t* aData, uint32_t aNumFrames);
+
+  // Writer only. Marks the end of the audio; once what's in the ring has
+  // been rendered, Render() returns short instead of playing silence.
+  void MarkEnded();
+
+  // Reader only. Fills aOut with the next aNumFrames frames, padding it with
+  // silence if the ring runs out. Returns the number of frames filled,
+  // which is aNumFrames unless the end of the audio has been reached.
+  uint32_t Render(uint8_t* aOut, uint32_t aNumFrames);
+
+  // The number of frames written but not yet rendered. Threadsafe, but only
+  // a snapshot if the other side is running.
+  uint32_t GetAvailableFrames() const;
+
+  // The number of frames there's room to write. Same caveat.
+  uint32_t GetFreeFrames() const;
+
+  uint32_t GetCapacityFrames() const { return mCapacityFrames; }
+
+  // Threadsafe.
+  AudioRingStats GetStats() const;
+
+private:
+  AudioRingBuffer(const AudioRingBuffer&);
+  AudioRingBuffer& operator=(const AudioRingBuffer&);
+
+  std::vector<uint8_t> mData;
+  uint32_t mFrameSize;
+  // A power of two, so that the positions can wrap around.
+  uint32_t mCapacityFrames;
+  // The positions count frames up forever, and are masked to find where
+  // they are in mData.
+  std::atomic<uint32_t> mReadPosition;
+  std::atomic<uint32_t> mWritePosition;
+  std::atomic<bool> mEnded;
+  // Only written by the reader.
+  std::atomic<uint64_t> mNumCallbacks;
+  std::atomic<uint64_t> mNumUnderruns;
+  std::atomic<uint64_t> mNumSilentFrames;
+};
@@ -0,0 +1,455 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// The SelfTest tool's checks and benchmarks of the audio conversion,
+// resampling and batching.
+
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "AudioBatcher.h"
+#include "AudioConversion.h"
+#include "AudioResampler.h"
+#include "FrameSource.h"
+#include "SelfTest.h"
+
+// Returns the amplitude of the aFrequency Hz sine wave which best fits
+// channel 0 of aOutput, which has aNumChannels channels at aRate, ignoring
+// aSkip frames at each end, where the filter ran over the silence either
+// side of the input. If aOutResidual is non-null, sets it to the ratio of
+// the power of what's left over to the sine's, in dB; the THD+N.
+static double
+FitSine(const std::vector<float>& aOutput,
+        uint32_t aNumChannels,
+        uint32_t aRate,
+        double aFrequency,
+        size_t aSkip,
+        double* aOutResidual)
+{
+  const size_t numFrames = aOutput.size() / aNumChannels;
+  const double step = 2 * 3.14159265358979323846 * aFrequency / aRate;
+  // Least squares fit of a cos + b sin.
+  double cc = 0, ss = 0, cs = 0, yc = 0, ys = 0;
+  for (size_t n = aSkip; n + aSkip < numFrames; n++) {
+    const double c = cos(step * n);
+    const double s = sin(step * n);
+    const double y = aOutput[n * aNumChannels];
+    cc += c * c;
+    ss += s * s;
+    cs += c * s;
+    yc += y * c;
+    ys += y * s;
+  }
+  const double det = cc * ss - cs * cs;
+  const double a = (yc * ss - ys * cs) / det;
+  const double b = (ys * cc - yc * cs) / det;
+  if (aOutResidual) {
+    double signal = 0, residual = 0;
+    for (size_t n = aSkip; n + aSkip < numFrames; n++) {
+      const double fit = a * cos(step * n) + b * sin(step * n);
+      const double error = aOutput[n * aNumChannels] - fit;
+      signal += fit * fit;
+      residual += error * error;
+    }
+    *aOutResidual = 10 * log10(std::max(residual, 1e-30) / signal);
+  }
+  return sqrt(a * a + b * b);
+}
+
+// Returns aNumFrames frames of an aFrequency Hz sine wave at aRate, of
+// amplitude aAmplitude, in aNumChannels channels.
+static std::vector<float>
+MakeSine(uint32_t aNumFrames, uint32_t aNumChannels, uint32_t aRate,
+         double aFrequency, double aAmplitude)
+{
+  std::vector<float> sine(size_t(aNumFrames) * aNumChannels);
+  const double step = 2 * 3.14159265358979323846 * aFrequency / aRate;
+  for (uint32_t n = 0; n < aNumFrames; n++) {
+    for (uint32_t c = 0; c < aNumChannels; c++) {
+      sine[size_t(n) * aNumChannels + c] = float(aAmplitude * sin(step * n));
+    }
+  }
+  return sine;
+}
+
+// Resamples aInput with aResampler, in chunks the size the pipeline's
+// audio frames typically are, and returns the output.
+static std::vector<float>
+Resample(AudioResampler& aResampler, const std::vector<float>& aInput, uint32_t aNumChannels)
+{
+  static const uint32_t ChunkFrames = 1024;
+  std::vector<float> output;
+  output.reserve(aInput.size() * 2);
+  const uint32_t numFrames = uint32_t(aInput.size() / aNumChannels);
+  for (uint32_t f = 0; f < numFrames; f += ChunkFrames) {
+    aResampler.Process(&aInput[size_t(f) * aNumChannels],
+                       std::min(ChunkFrames, numFrames - f), &output);
+  }
+  aResampler.Drain(&output);
+  return output;
+}
+
+bool
+BenchmarkResampler()
+{
+  static const uint32_t NumChannels = 2;
+  static const struct {
+    uint32_t input;
+    uint32_t output;
+  } Rates[] = {
+    { 44100, 48000 },
+    { 22050, 48000 },
+    { 96000, 48000 }
+  };
+  static const ResampleKernel Kernels[] = {
+    ResampleKernel_Scalar,
+    ResampleKernel_SSE2,
+    ResampleKernel_AVX2
+  };
+
+  for (size_t r = 0; r < sizeof(Rates) / sizeof(Rates[0]); r++) {
+    const uint32_t inputRate = Rates[r].input;
+    const uint32_t outputRate = Rates[r].output;
+    printf("%u Hz -> %u Hz, %u channels:\n", inputRate, outputRate, NumChannels);
+
+    // Ten seconds of white noise, for the speed; the contents don't matter.
+    std::vector<float> noise(size_t(inputRate) * 10 * NumChannels);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < noise.size(); i++) {
+      seed = seed * 1664525 + 1013904223;
+      noise[i] = float(int32_t(seed) / 2147483648.0 * 0.5);
+    }
+
+    for (int q = 0; q < NumResampleQualities; q++) {
+      const ResampleQuality quality = ResampleQuality(q);
+      AudioResampler resampler;
+      if (!resampler.Init(inputRate, outputRate, NumChannels, quality)) {
+        return false;
+      }
+      printf("  %s: %u taps, %u phases, passband to %.0lf Hz\n",
+             GetResampleQualityName(quality), resampler.GetNumTaps(),
+             resampler.GetNumPhases(), resampler.GetPassbandEdgeHz());
+
+      for (size_t k = 0; k < sizeof(Kernels) / sizeof(Kernels[0]); k++) {
+        if (!IsResampleKernelSupported(Kernels[k]) ||
+            !resampler.Init(inputRate, outputRate, NumChannels, quality, Kernels[k])) {
+          continue;
+        }
+        const uint64_t start = GetHighResTimeUs();
+        const std::vector<float> output = Resample(resampler, noise, NumChannels);
+        const double seconds = std::max<uint64_t>(GetHighResTimeUs() - start, 1) / 1e6;
+        printf("    %-6s %.1lf M samples/s output, %.0lfx real time\n",
+               GetResampleKernelName(Kernels[k]),
+               output.size() / seconds / 1e6,
+               double(output.size()) / NumChannels / outputRate / seconds);
+      }
+
+      // Measure against ideal sine waves, one second long, so that even the
+      // lowest frequencies have whole cycles to fit to. The fit ignores the
+      // filter's length at each end.
+      resampler.Init(inputRate, outputRate, NumChannels, quality);
+      const size_t skip = resampler.GetNumTaps() * outputRate / inputRate + 1;
+      double thdn = 0;
+      const std::vector<float> tone = MakeSine(inputRate, NumChannels, inputRate, 1000, 0.9);
+      FitSine(Resample(resampler, tone, NumChannels), NumChannels, outputRate, 1000, skip, &thdn);
+
+      double minGain = 1e9, maxGain = -1e9;
+      const double edge = resampler.GetPassbandEdgeHz();
+      for (double frequency = 20; frequency <= edge; frequency *= 1.1) {
+        const std::vector<float> sine = MakeSine(inputRate, NumChannels, inputRate, frequency, 0.5);
+        const double amplitude = FitSine(Resample(resampler, sine, NumChannels),
+                                         NumChannels, outputRate, frequency, skip, nullptr);
+        const double gain = 20 * log10(amplitude / 0.5);
+        minGain = std::min(minGain, gain);
+        maxGain = std::max(maxGain, gain);
+      }
+      printf("    1KHz THD+N %.1lf dB, passband ripple %.4lf dB\n", thdn, maxGain - minGain);
+    }
+  }
+  return true;
+}
+
+
+// Returns the largest difference between aA and aB.
+static float
+MaxDifference(const std::vector<float>& aA, const std::vector<float>& aB)
+{
+  float difference = 0.0f;
+  for (size_t i = 0; i < aA.size(); i++) {
+    difference = std::max(difference, fabsf(aA[i] - aB[i]));
+  }
+  return difference;
+}
+
+
+// Converts all of aInput, in aFormat, with aFilter, in chunks the size the
+// pipeline's audio frames typically are. Returns the number of frames
+// output, or 0 on error.
+static uint64_t
+FilterAudio(IAudioFilter& aFilter, const AudioFormat& aFormat, std::vector<uint8_t>& aInput)
+{
+  static const uint32_t ChunkFrames = 1024;
+  const size_t frameSize = aFormat.numChannels * aFormat.bitsPerSample / 8;
+  const size_t numFrames = aInput.size() / frameSize;
+  uint64_t numOutput = 0;
+  for (size_t f = 0; f < numFrames; f += ChunkFrames) {
+    MediaFrame input;
+    input.stream = Stream_Audio;
+    input.timestamp = int64_t(f * TimeUnitsPerSecond / aFormat.sampleRate);
+    input.data = &aInput[f * frameSize];
+    input.length = std::min<size_t>(ChunkFrames, numFrames - f) * frameSize;
+    MediaFrame output;
+    if (!aFilter.Process(input, f + ChunkFrames >= numFrames, &output)) {
+      return 0;
+    }
+    numOutput += output.length / (aFilter.GetOutputFormat().numChannels * sizeof(int16_t));
+  }
+  return numOutput;
+}
+
+bool
+BenchmarkAudio()
+{
+  static const AudioKernel Kernels[] = {
+    AudioKernel_Scalar,
+    AudioKernel_SSE2,
+    AudioKernel_AVX2
+  };
+  static const size_t NumKernels = sizeof(Kernels) / sizeof(Kernels[0]);
+  // Ten seconds of 48KHz stereo.
+  static const uint32_t Rate = 48000;
+  static const size_t NumSamples = size_t(Rate) * 10 * 2;
+  const std::vector<float> noise = MakeNoise(NumSamples * 4);
+  std::vector<float> output(NumSamples * 4);
+  std::vector<float> expected;
+
+  printf("Conversion to float:\n");
+  static const uint32_t Bits[] = { 16, 24, 32, 0 };
+  for (size_t b = 0; b < sizeof(Bits) / sizeof(Bits[0]); b++) {
+    AudioFormat format;
+    format.bitsPerSample = Bits[b] ? Bits[b] : 32;
+    format.floatingPoint = !Bits[b];
+    const std::vector<float> samples(noise.begin(), noise.begin() + NumSamples);
+    const std::vector<uint8_t> input = EncodeSamples(samples, Bits[b]);
+    printf("  %s:\n", Bits[b] == 16 ? "s16" : Bits[b] == 24 ? "s24" : Bits[b] == 32 ? "s32" : "f32");
+    for (size_t k = 0; k < NumKernels; k++) {
+      if (!IsAudioKernelSupported(Kernels[k])) {
+        continue;
+      }
+      const double seconds = TimeFastest([&]() {
+        ConvertToFloat(&input[0], format, NumSamples, &output[0], Kernels[k]);
+      });
+      std::vector<float> converted(output.begin(), output.begin() + NumSamples);
+      if (k == 0) {
+        expected = converted;
+      }
+      printf("    %-6s %.0lf M samples/s, max difference from scalar %g\n",
+             GetAudioKernelName(Kernels[k]), NumSamples / seconds / 1e6,
+             MaxDifference(converted, expected));
+    }
+  }
+
+  printf("Downmix to stereo:\n");
+  static const uint32_t Layouts[] = { 6, 8 };
+  for (size_t l = 0; l < sizeof(Layouts) / sizeof(Layouts[0]); l++) {
+    const uint32_t numChannels = Layouts[l];
+    const uint32_t numFrames = uint32_t(NumSamples / 2);
+    const std::vector<float> matrix = GetDownmixMatrix(numChannels, 2);
+    printf("  %s:\n", numChannels == 6 ? "5.1" : "7.1");
+    for (size_t k = 0; k < NumKernels; k++) {
+      if (!IsAudioKernelSupported(Kernels[k])) {
+        continue;
+      }
+      const double seconds = TimeFastest([&]() {
+        MixChannels(&noise[0], numChannels, numFrames, &matrix[0], 2, &output[0], Kernels[k]);
+      });
+      std::vector<float> mixed(output.begin(), output.begin() + size_t(numFrames) * 2);
+      if (k == 0) {
+        expected = mixed;
+      }
+      printf("    %-6s %.0lf M frames/s, max difference from scalar %g\n",
+             GetAudioKernelName(Kernels[k]), numFrames / seconds / 1e6,
+             MaxDifference(mixed, expected));
+    }
+  }
+
+  printf("Conversion to 16 bit:\n");
+  std::vector<int16_t> s16(NumSamples);
+  for (int dither = 0; dither < 2; dither++) {
+    printf("  %s:\n", dither ? "TPDF dither" : "no dither");
+    std::vector<float> expectedS16;
+    for (size_t k = 0; k < NumKernels; k++) {
+      if (!IsAudioKernelSupported(Kernels[k])) {
+        continue;
+      }
+      TpdfDither state;
+      const double seconds = TimeFastest([&]() {
+        ConvertToS16(&noise[0], NumSamples, &s16[0], dither ? &state : nullptr, Kernels[k]);
+      });
+      // Convert once more from the start of the dither's sequence, to
+      // compare with the other kernels.
+      state = TpdfDither();
+      ConvertToS16(&noise[0], NumSamples, &s16[0], dither ? &state : nullptr, Kernels[k]);
+      std::vector<float> converted(s16.begin(), s16.end());
+      if (k == 0) {
+        expectedS16 = converted;
+      }
+      // The error, in LSBs, of rounding, and dithering; TPDF dither adds
+      // noise of 1/6 LSB squared to rounding's 1/12, 0.5 LSB RMS in all.
+      double sum = 0, sumSquares = 0;
+      for (size_t i = 0; i < NumSamples; i++) {
+        const double error = s16[i] - noise[i] * 32768.0;
+        sum += error;
+        sumSquares += error * error;
+      }
+      printf("    %-6s %.0lf M samples/s, max difference from scalar %g LSB, "
+             "error mean %.4lf RMS %.4lf LSB\n",
+             GetAudioKernelName(Kernels[k]), NumSamples / seconds / 1e6,
+             MaxDifference(converted, expectedS16),
+             sum / NumSamples, sqrt(sumSquares / NumSamples));
+    }
+  }
+
+  // Everything the filter does for the encoder, for 5.1 24 bit audio which
+  // is already at an encoder rate, and which isn't.
+  AudioFormat format;
+  format.sampleRate = Rate;
+  format.numChannels = 6;
+  format.bitsPerSample = 24;
+  std::vector<uint8_t> input = EncodeSamples(std::vector<float>(noise.begin(),
+                                                                noise.begin() + NumSamples * 3),
+                                             24);
+  static const uint32_t OutputRates[] = { 48000, 44100 };
+  printf("ResamplingAudioFilter, 48KHz 5.1 s24 to 16 bit stereo, dithered:\n");
+  for (size_t r = 0; r < sizeof(OutputRates) / sizeof(OutputRates[0]); r++) {
+    ResamplingAudioFilter filter;
+    if (!filter.Init(format, OutputRates[r], 2, ResampleQuality_Best, true)) {
+      return false;
+    }
+    uint64_t numOutput = 0;
+    const double seconds = TimeFastest([&]() {
+      numOutput = FilterAudio(filter, format, input);
+    });
+    if (!numOutput) {
+      return false;
+    }
+    printf("  to %u Hz%s: %.1lf M frames/s input, %.0lfx real time\n",
+           OutputRates[r], filter.IsResampling() ? ", resampled" : "",
+           NumSamples / 2 / seconds / 1e6, NumSamples / 2.0 / Rate / seconds);
+  }
+  return true;
+}
+
+bool
+CheckAudioBatching()
+{
+  // Mono 32 bit samples, each of which is its index, so that we can tell
+  // where each came from.
+  AudioFormat format;
+  format.sampleRate = 44100;
+  format.numChannels = 1;
+  format.bitsPerSample = 32;
+  static const uint32_t FramesPerBatch = 4;
+  static const uint32_t NumSamples = 441000;
+  // Half way through, the timestamps jump forward a tenth of a second.
+  static const uint32_t GapSample = NumSamples / 2;
+  static const uint32_t GapSamples = 4410;
+  std::vector<int32_t> samples(NumSamples);
+  for (uint32_t i = 0; i < NumSamples; i++) {
+    samples[i] = int32_t(i);
+  }
+  // Returns the exact time of sample aIndex, with the gap.
+  auto sampleTime = [&](uint64_t aIndex) {
+    const uint64_t position = aIndex + (aIndex >= GapSample ? GapSamples : 0);
+    return int64_t(position * TimeUnitsPerSecond / format.sampleRate);
+  };
+
+  AudioBatcher batcher;
+  if (!batcher.Init(format, FramesPerBatch)) {
+    return false;
+  }
+  const uint32_t batchSamples = batcher.GetBatchSamples();
+  std::vector<MediaFrame> batches;
+  std::vector<int32_t> output;
+  uint32_t numInput = 0;
+  uint32_t seed = 1;
+  bool ok = true;
+  uint32_t numBatches = 0;
+  uint32_t numShortBatches = 0;
+  int64_t expectedTimestamp = 0;
+  for (uint32_t i = 0; i < NumSamples; ) {
+    seed = seed * 1664525 + 1013904223;
+    uint32_t count = std::min(1 + (seed >> 16) % 3000, NumSamples - i);
+    if (i < GapSample) {
+      count = std::min(count, GapSample - i);
+    }
+    MediaFrame frame;
+    frame.stream = Stream_Audio;
+    frame.timestamp = sampleTime(i);
+    frame.duration = sampleTime(i + count) - frame.timestamp;
+    frame.data = reinterpret_cast<uint8_t*>(&samples[i]);
+    frame.length = count * sizeof(int32_t);
+    // Every other frame has storage, so both the copying and the
+    // passthrough paths are taken.
+    if (seed & 0x10000) {
+      frame.storage = std::shared_ptr<void>(&samples[0], [](void*) {});
+    }
+    batches.clear();
+    if (!batcher.Process(frame, &batches)) {
+      return false;
+    }
+    i += count;
+    numInput++;
+    if (i == NumSamples) {
+      batcher.Flush(&batches);
+    }
+    for (size_t b = 0; b < batches.size(); b++) {
+      const MediaFrame& batch = batches[b];
+      const int32_t* data = reinterpret_cast<const int32_t*>(batch.data);
+      const uint32_t numSamples = uint32_t(batch.length / sizeof(int32_t));
+      const uint32_t first = uint32_t(output.size());
+      output.insert(output.end(), data, data + numSamples);
+      numBatches++;
+      if (numSamples != batchSamples) {
+        // Only the batches before the gap, and at the end, may be short.
+        numShortBatches++;
+        if (first + numSamples != GapSample && first + numSamples != NumSamples) {
+          fprintf(stderr, "Short batch of %u samples at sample %u\n", numSamples, first);
+          ok = false;
+        }
+      }
+      // Each batch starts where the last ended, except after the gap,
+      // and within a tick of when its first sample is.
+      if (first == GapSample) {
+        expectedTimestamp = sampleTime(first);
+      }
+      if (batch.timestamp != expectedTimestamp ||
+          llabs(batch.timestamp - sampleTime(first)) > 1) {
+        fprintf(stderr, "Batch at sample %u has timestamp %lld, expected %lld\n",
+                first, (long long)batch.timestamp, (long long)sampleTime(first));
+        ok = false;
+      }
+      expectedTimestamp = batch.timestamp + batch.duration;
+    }
+  }
+  if (output != samples) {
+    fprintf(stderr, "The samples output aren't the samples input\n");
+    ok = false;
+  }
+  printf("%u frames in, %u batches of %u samples out, %u short: %s\n",
+         numInput, numBatches, batchSamples, numShortBatches, ok ? "OK" : "FAILED");
+  return ok;
+}
@@ -0,0 +1,129 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// A thread safe FIFO queue with a fixed capacity, for connecting pipeline
+// stages which run on different threads. Producers block while the queue is
+// full, so a fast stage can't run arbitrarily far ahead of a slow one and
+// fill memory with frames. The items are kept in a ring of slots allocated
+// up front, so pushing and popping don't allocate.
+
+#pragma once
+
+#include <stddef.h>
+#include <condition_variable>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+template<typename T>
+class BoundedQueue {
+public:
+  // aCapacity is the most items the queue holds; at least 1.
+  explicit BoundedQueue(size_t aCapacity)
+    : mCapacity(aCapacity ? aCapacity : 1),
+      mItems(mCapacity),
+      mHead(0),
+      mSize(0),
+      mPeakSize(0),
+      mClosed(false),
+      mAborted(false)
+  {
+  }
+
+  // Appends aItem, blocking while the queue is full. Returns false, and
+  // drops aItem, if the queue has been closed or aborted.
+  bool Push(T aItem) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (mSize >= mCapacity && !mClosed && !mAborted) {
+      mNotFull.wait(lock);
+    }
+    if (mClosed || mAborted) {
+      return false;
+    }
+    mItems[(mHead + mSize) % mCapacity] = std::move(aItem);
+    mSize++;
+    if (mSize > mPeakSize) {
+      mPeakSize = mSize;
+    }
+    mNotEmpty.notify_one();
+    return true;
+  }
+
+  // Removes the item at the front into *aOutItem, blocking while the queue
+  // is empty. Returns false once the queue has been closed and drained, or
+  // aborted.
+  bool Pop(T* aOutItem) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (!mSize && !mClosed && !mAborted) {
+      mNotEmpty.wait(lock);
+    }
+    if (mAborted || !mSize) {
+      return false;
+    }
+    *aOutItem = std::move(mItems[mHead]);
+    // Don't hold on to anything the moved-from item still refers to.
+    mItems[mHead] = T();
+    mHead = (mHead + 1) % mCapacity;
+    mSize--;
+    mNotFull.notify_one();
+    return true;
+  }
+
+  // Marks the end of the items. Items already queued can still be popped.
+  void Close() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mClosed = true;
+    mNotEmpty.notify_all();
+    mNotFull.notify_all();
+  }
+
+  // Discards the queued items, and makes every blocked and future Push()
+  // and Pop() fail. Used to tear down a pipeline when a stage fails.
+  void Abort() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mAborted = true;
+    for (; mSize; mSize--) {
+      mItems[mHead] = T();
+      mHead = (mHead + 1) % mCapacity;
+    }
+    mNotEmpty.notify_all();
+    mNotFull.notify_all();
+  }
+
+  size_t GetCapacity() const { return mCapacity; }
+
+  // The most items the queue has held at once. If this stays below the
+  // capacity, the stage after the queue keeps up with the one before it.
+  size_t GetPeakSize() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mPeakSize;
+  }
+
+private:
+  BoundedQueue(const BoundedQueue&);
+  BoundedQueue& operator=(const BoundedQueue&);
+
+  const size_t mCapacity;
+  std::mutex mMutex;
+  std::condition_variable mNotEmpty;
+  std::condition_variable mNotFull;
+  // mSize items, starting at mHead, wrapping around.
+  std::vector<T> mItems;
+  size_t mHead;
+  size_t mSize;
+  size_t mPeakSize;
+  bool mClosed;
+  bool mAborted;
+};
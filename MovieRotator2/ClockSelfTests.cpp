@@ -0,0 +1,297 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// The SelfTest tool's checks of the preview's clocks, and of the job
+// runner's throughput estimate and progress throttle.
+
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include "FrameSource.h"
+#include "PlaybackTiming.h"
+#include "SelfTest.h"
+#include "ThroughputEstimator.h"
+#include "TranscodeStats.h"
+
+// The fake clock --check-playback-clock and --check-throughput drive the
+// clocks with, in microseconds.
+static uint64_t sFakeTimeUs = 0;
+
+static uint64_t
+GetFakeTimeUs()
+{
+  return sFakeTimeUs;
+}
+
+bool
+CheckPlaybackClock()
+{
+  bool ok = true;
+  TimeSourceUs now = GetFakeTimeUs;
+
+  // The stopwatch only counts the time it's running, in microseconds.
+  PlaybackStopwatch stopwatch;
+  sFakeTimeUs = 1000;
+  stopwatch.Start(now());
+  sFakeTimeUs += 1500;
+  stopwatch.Pause(now());
+  sFakeTimeUs += 1000000;
+  const uint64_t paused = stopwatch.GetElapsedUs(now());
+  stopwatch.Start(now());
+  sFakeTimeUs += 250;
+  stopwatch.Start(now());
+  const uint64_t resumed = stopwatch.GetElapsedUs(now());
+  if (paused != 1500 || resumed != 1750) {
+    fprintf(stderr, "Stopwatch read %llu us paused and %llu us resumed, expected 1500 and 1750\n",
+            (unsigned long long)paused, (unsigned long long)resumed);
+    ok = false;
+  }
+
+  // A device whose clock runs 500 ppm fast, which only advances its
+  // position every 512 frames, polled at about the paint rate, with a
+  // second's pause half way through.
+  static const uint32_t Rate = 48000;
+  static const uint32_t DeviceUpdateFrames = 512;
+  static const double DeviceDriftPpm = 500;
+  static const uint64_t DurationUs = 60000000;
+  static const uint64_t PauseAtUs = DurationUs / 2;
+  AudioPositionInterpolator interpolator(Rate);
+  LatencyHistogram rawErrors;
+  LatencyHistogram errors;
+  uint64_t lastPositionUs = 0;
+  uint64_t numBackwards = 0;
+  // How long the device has played for, by our clock.
+  uint64_t playedUs = 0;
+  uint32_t seed = 1;
+  sFakeTimeUs = 5000000;
+  interpolator.Start(now());
+  bool devicePaused = false;
+  while (playedUs < DurationUs) {
+    seed = seed * 1664525 + 1013904223;
+    const uint64_t stepUs = 16667 + (seed >> 16) % 4000 - 2000;
+    sFakeTimeUs += stepUs;
+    if (!devicePaused) {
+      playedUs += stepUs;
+    }
+    if (!devicePaused && playedUs >= PauseAtUs && playedUs < PauseAtUs + stepUs) {
+      interpolator.Pause();
+      devicePaused = true;
+    } else if (devicePaused && now() >= 5000000 + PauseAtUs + 1000000) {
+      interpolator.Start(now());
+      devicePaused = false;
+    }
+    const double trueFrames = playedUs * (1.0 + DeviceDriftPpm / 1e6) * Rate / 1e6;
+    const uint64_t deviceFrames = uint64_t(trueFrames) / DeviceUpdateFrames * DeviceUpdateFrames;
+    const uint64_t positionUs = interpolator.GetPositionUs(now(), deviceFrames);
+    const int64_t trueUs = int64_t(trueFrames * 1e6 / Rate);
+    rawErrors.Add(uint64_t(llabs(trueUs - int64_t(deviceFrames * 1000000 / Rate))));
+    errors.Add(uint64_t(llabs(trueUs - int64_t(positionUs))));
+    if (positionUs < lastPositionUs) {
+      numBackwards++;
+    }
+    lastPositionUs = positionUs;
+  }
+  const uint64_t updateUs = uint64_t(DeviceUpdateFrames) * 1000000 / Rate;
+  printf("audio position vs device's clock, raw: p50 %.3lf ms, max %.3lf ms; "
+         "interpolated: p50 %.3lf ms, max %.3lf ms; %llu corrections\n",
+         rawErrors.GetPercentileUs(50) / 1e3, rawErrors.GetMaxUs() / 1e3,
+         errors.GetPercentileUs(50) / 1e3, errors.GetMaxUs() / 1e3,
+         (unsigned long long)interpolator.GetNumCorrections());
+  if (numBackwards || errors.GetMaxUs() > updateUs + 1000 ||
+      errors.GetPercentileUs(50) >= rawErrors.GetPercentileUs(50)) {
+    fprintf(stderr, "The interpolated position went backwards %llu times, or "
+            "strayed further than a device update from the device's\n",
+            (unsigned long long)numBackwards);
+    ok = false;
+  }
+
+  // Video shown at 30 frames per second drifting 1000 ppm ahead of the
+  // clock from 5 ms behind, with each frame up to a paint interval late.
+  static const double VideoDriftPpm = 1000;
+  AVDriftEstimator drift;
+  sFakeTimeUs = 0;
+  for (uint64_t t = 0; t < DurationUs; t += 33333) {
+    seed = seed * 1664525 + 1013904223;
+    const int64_t lateUs = (seed >> 16) % 33333;
+    drift.Add(t, int64_t(-5000 + VideoDriftPpm * t / 1e6) - lateUs);
+  }
+  const double expectedOffsetUs = -5000 + VideoDriftPpm * DurationUs / 1e6 - 33333 / 2;
+  printf("A/V offset %lld us, expected %.0lf us; drift %.1lf ppm, expected %.1lf ppm\n",
+         (long long)drift.GetOffsetUs(), expectedOffsetUs, drift.GetDriftPpm(), VideoDriftPpm);
+  if (fabs(drift.GetDriftPpm() - VideoDriftPpm) > VideoDriftPpm / 4 ||
+      fabs(drift.GetOffsetUs() - expectedOffsetUs) > 5000) {
+    fprintf(stderr, "The drift estimate is off\n");
+    ok = false;
+  }
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok;
+}
+
+// Drives aEstimator through a transcode of aDuration of media, in 100ns
+// units, on the fake clock, updating it every aUpdateUs with the position
+// reached, as TranscodeJobRunner does. The transcode runs at aSpeed(t)
+// media seconds per second, t microseconds after it starts. Calls
+// aObserve(t, position) after each update.
+template <typename Speed, typename Observe>
+static void
+SimulateTranscodeProgress(ThroughputEstimator& aEstimator,
+                          int64_t aDuration,
+                          uint64_t aUpdateUs,
+                          Speed aSpeed,
+                          Observe aObserve)
+{
+  TimeSourceUs now = GetFakeTimeUs;
+  sFakeTimeUs = 1000000;
+  const uint64_t start = now();
+  aEstimator.Start(start, aDuration);
+  double position = 0;
+  while (position < double(aDuration)) {
+    const uint64_t elapsedUs = now() - start;
+    position = std::min(position + aSpeed(elapsedUs) * aUpdateUs * (TimeUnitsPerSecond / 1e6),
+                        double(aDuration));
+    sFakeTimeUs += aUpdateUs;
+    aEstimator.Update(now(), int64_t(position));
+    aObserve(now() - start, int64_t(position));
+  }
+}
+
+bool
+CheckThroughput()
+{
+  bool ok = true;
+  static const int64_t Duration = 600 * TimeUnitsPerSecond;
+  static const uint64_t TimeConstantUs = ThroughputEstimator::DefaultTimeConstantUs;
+  ThroughputEstimator estimator;
+
+  // A steady 4x real time, updated about once a frame. Once the first
+  // interval has been sampled, the rate and the time left should be right.
+  double worstRemainingError = 0;
+  SimulateTranscodeProgress(estimator, Duration, 33333,
+    [](uint64_t) { return 4.0; },
+    [&](uint64_t /*aElapsedUs*/, int64_t aPosition) {
+      if (!estimator.HasEstimate() || aPosition == Duration) {
+        return;
+      }
+      const double remainingUs = double(Duration - aPosition) / TimeUnitsPerSecond / 4.0 * 1e6;
+      const double error = fabs(double(estimator.GetRemainingUs()) - remainingUs);
+      worstRemainingError = std::max(worstRemainingError, error / remainingUs);
+    });
+  printf("steady 4x: rate %.3lf, worst time left error %.2lf%%\n",
+         estimator.GetRate(), worstRemainingError * 100);
+  if (fabs(estimator.GetRate() - 4.0) > 0.01 || worstRemainingError > 0.01) {
+    fprintf(stderr, "The steady rate or time left is off\n");
+    ok = false;
+  }
+
+  // The encoder stalls for a second at every keyframe, every 10 seconds,
+  // so the average is 3.6x. The estimate should ride the stalls out.
+  double lowest = 1e9, highest = 0, sum = 0;
+  uint32_t numSamples = 0;
+  SimulateTranscodeProgress(estimator, Duration, 33333,
+    [](uint64_t aElapsedUs) { return (aElapsedUs % 10000000 < 9000000) ? 4.0 : 0.0; },
+    [&](uint64_t aElapsedUs, int64_t) {
+      if (aElapsedUs < 2 * TimeConstantUs) {
+        return;
+      }
+      lowest = std::min(lowest, estimator.GetRate());
+      highest = std::max(highest, estimator.GetRate());
+      sum += estimator.GetRate();
+      numSamples++;
+    });
+  const double mean = sum / std::max(numSamples, 1u);
+  printf("stalling, 3.6x on average: rate %.2lf to %.2lf, mean %.3lf\n", lowest, highest, mean);
+  if (fabs(mean - 3.6) > 0.05 || lowest < 3.6 * 0.75 || highest > 3.6 * 1.25) {
+    fprintf(stderr, "The estimate doesn't ride out the stalls\n");
+    ok = false;
+  }
+
+  // The speed halves 30 seconds in, and stays halved. After a time
+  // constant, the estimate should have moved about two thirds of the way,
+  // and after four it should have all but caught up. That shouldn't depend
+  // on how often it's updated.
+  static const uint64_t ChangeUs = 30000000;
+  static const uint64_t UpdateIntervals[] = { 5000, 100000 };
+  double followed[2] = { 0, 0 };
+  for (size_t i = 0; i < 2; i++) {
+    double caughtUp = 0;
+    SimulateTranscodeProgress(estimator, Duration, UpdateIntervals[i],
+      [](uint64_t aElapsedUs) { return (aElapsedUs < ChangeUs) ? 4.0 : 2.0; },
+      [&](uint64_t aElapsedUs, int64_t) {
+        if (aElapsedUs <= ChangeUs + TimeConstantUs) {
+          followed[i] = (4.0 - estimator.GetRate()) / 2.0;
+        }
+        if (aElapsedUs <= ChangeUs + 4 * TimeConstantUs) {
+          caughtUp = estimator.GetRate();
+        }
+      });
+    printf("halving, updated every %llu ms: %.0lf%% of the way after %llu s, "
+           "rate %.3lf after %llu s\n",
+           (unsigned long long)UpdateIntervals[i] / 1000, followed[i] * 100,
+           (unsigned long long)TimeConstantUs / 1000000, caughtUp,
+           (unsigned long long)TimeConstantUs * 4 / 1000000);
+    if (followed[i] < 0.55 || followed[i] > 0.75 || fabs(caughtUp - 2.0) > 0.06) {
+      fprintf(stderr, "The estimate doesn't follow the change in speed\n");
+      ok = false;
+    }
+  }
+  if (fabs(followed[0] - followed[1]) > 0.05) {
+    fprintf(stderr, "How fast the estimate follows depends on how often it's updated\n");
+    ok = false;
+  }
+
+  // A short job, whose progress moves a thousandth every millisecond, and
+  // a long one, whose progress moves a thousandth every 2 seconds, polled
+  // every 10 ms. The short job should be published about once an interval,
+  // and the long one every time its progress changes; both should publish
+  // the first and the final progress, and never the same progress twice.
+  static const uint64_t IntervalUs = 100000;
+  for (int slow = 0; slow < 2; slow++) {
+    const uint64_t pollUs = slow ? 10000 : 1000;
+    const uint64_t thousandthUs = slow ? 2000000 : 1000;
+    ProgressThrottle throttle(IntervalUs);
+    uint32_t numPublished = 0, numRepeated = 0, numEarly = 0, numLate = 0;
+    uint32_t lastProgress = UINT32_MAX, published = UINT32_MAX;
+    uint64_t lastPublishUs = 0, changedUs = 0;
+    for (uint64_t t = 0; published != 1000; t += pollUs) {
+      const uint32_t progress = uint32_t(std::min<uint64_t>(t / thousandthUs, 1000));
+      if (progress != lastProgress) {
+        changedUs = t;
+        lastProgress = progress;
+      }
+      if (!throttle.ShouldPublish(t, progress)) {
+        continue;
+      }
+      numPublished++;
+      numRepeated += (progress == published) ? 1 : 0;
+      numEarly += (numPublished > 1 && progress < 1000 && t < lastPublishUs + IntervalUs) ? 1 : 0;
+      // Progress which changes less often than the interval should be
+      // published when it changes.
+      numLate += (slow && t != changedUs) ? 1 : 0;
+      published = progress;
+      lastPublishUs = t;
+    }
+    const uint32_t expected = slow ? 1001 : 1000000 / IntervalUs + 1;
+    printf("%s job: %u progress updates published, expected %u; %u repeated, "
+           "%u early, %u late\n",
+           slow ? "long" : "short", numPublished, expected, numRepeated, numEarly, numLate);
+    if (numRepeated || numEarly || numLate ||
+        numPublished + 1 < expected || numPublished > expected + 1) {
+      fprintf(stderr, "The progress throttle publishes at the wrong times\n");
+      ok = false;
+    }
+  }
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok;
+}
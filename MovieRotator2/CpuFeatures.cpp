@@ -0,0 +1,150 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "CpuFeatures.h"
+
+#include <string.h>
+
+#if defined(HAVE_X86_SIMD)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(HAVE_X86_SIMD)
+
+static void
+CpuId(uint32_t aLeaf, uint32_t aSubLeaf, uint32_t aOutRegs[4])
+{
+#if defined(_MSC_VER)
+  int regs[4];
+  __cpuidex(regs, aLeaf, aSubLeaf);
+  for (int i = 0; i < 4; i++) {
+    aOutRegs[i] = regs[i];
+  }
+#else
+  __cpuid_count(aLeaf, aSubLeaf, aOutRegs[0], aOutRegs[1], aOutRegs[2], aOutRegs[3]);
+#endif
+}
+
+// Returns the OS's enabled register state mask, XCR0.
+static uint64_t
+GetXCR0()
+{
+#if defined(_MSC_VER)
+  return _xgetbv(0);
+#else
+  uint32_t eax, edx;
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return (uint64_t(edx) << 32) | eax;
+#endif
+}
+
+static uint32_t
+DetectCpuFeatures()
+{
+  uint32_t features = 0;
+  uint32_t regs[4];
+
+  CpuId(0, 0, regs);
+  const uint32_t maxLeaf = regs[0];
+  if (maxLeaf < 1) {
+    return 0;
+  }
+
+  CpuId(1, 0, regs);
+  const uint32_t ecx1 = regs[2];
+  const uint32_t edx1 = regs[3];
+  if (edx1 & (1 << 26)) {
+    features |= CPU_FEATURE_SSE2;
+  }
+
+  // AVX2 needs the CPU to support it, and the OS to save the YMM registers
+  // on context switch.
+  const bool osxsave = (ecx1 & (1 << 27)) != 0;
+  const bool avx = (ecx1 & (1 << 28)) != 0;
+  if (maxLeaf >= 7 && osxsave && avx && (GetXCR0() & 0x6) == 0x6) {
+    CpuId(7, 0, regs);
+    if (regs[1] & (1 << 5)) {
+      features |= CPU_FEATURE_AVX2;
+    }
+  }
+
+  return features;
+}
+
+static std::string
+DetectCpuModelName()
+{
+  uint32_t regs[4];
+  CpuId(0x80000000, 0, regs);
+  if (regs[0] < 0x80000004) {
+    return std::string();
+  }
+  char brand[49] = {0};
+  for (uint32_t i = 0; i < 3; i++) {
+    CpuId(0x80000002 + i, 0, regs);
+    memcpy(brand + i * 16, regs, 16);
+  }
+  return std::string(brand);
+}
+
+#else
+
+static uint32_t
+DetectCpuFeatures()
+{
+  return 0;
+}
+
+static std::string
+DetectCpuModelName()
+{
+  return std::string();
+}
+
+#endif
+
+// Top bit is set once the features have been detected. Detection always
+// produces the same result, so it doesn't matter if two threads race to
+// initialize this.
+static volatile uint32_t sCpuFeatures = 0;
+static const uint32_t CPU_FEATURES_DETECTED = 0x80000000;
+
+uint32_t
+GetCpuFeatures()
+{
+  uint32_t features = sCpuFeatures;
+  if (!(features & CPU_FEATURES_DETECTED)) {
+    features = DetectCpuFeatures() | CPU_FEATURES_DETECTED;
+    sCpuFeatures = features;
+  }
+  return features & ~CPU_FEATURES_DETECTED;
+}
+
+std::string
+GetCpuModelName()
+{
+  std::string name = DetectCpuModelName();
+  // Brand strings are padded with spaces, on some CPUs at the front.
+  size_t begin = name.find_first_not_of(' ');
+  if (begin == std::string::npos) {
+    return "unknown";
+  }
+  size_t end = name.find_last_not_of(' ');
+  return name.substr(begin, end - begin + 1);
+}
@@ -0,0 +1,56 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Runtime detection of the SIMD instruction sets we have optimized code
+// paths for.
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define HAVE_X86_SIMD 1
+#endif
+
+// MSVC lets us use any intrinsic in any function, but GCC and Clang require
+// functions which use intrinsics beyond the compilation target's baseline to
+// be marked as such.
+#if defined(HAVE_X86_SIMD) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+enum CpuFeature {
+  CPU_FEATURE_SSE2 = 1 << 0,
+  CPU_FEATURE_AVX2 = 1 << 1
+};
+
+// Returns a bitwise or of the CpuFeature flags which are supported by both
+// the CPU and the OS we're running on. Threadsafe.
+uint32_t GetCpuFeatures();
+
+inline bool
+HasCpuFeature(CpuFeature aFeature)
+{
+  return (GetCpuFeatures() & aFeature) != 0;
+}
+
+// Returns the CPU's brand string, e.g. "Intel(R) Core(TM) i7-3770 CPU @
+// 3.40GHz", or "unknown" if the CPU doesn't report one. Used to key
+// per-CPU tuning results.
+std::string GetCpuModelName();
@@ -0,0 +1,339 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "CubebNullBackend.h"
+#include "cubeb/cubeb-internal.h"
+#include "HighResClock.h"
+#include "WavFile.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Like cubeb_winmm.c, each stream's latency is split into this many
+// buffers, and the callback fills one at a time.
+static const uint32_t NumBuffers = 4;
+
+// The longest a real time stream sleeps between checking whether its
+// buffer has finished playing, and whether it's been stopped.
+static const uint64_t MaxSleepUs = 2000;
+
+struct cubeb {
+  const cubeb_ops* ops;
+  NullAudioOptions options;
+};
+
+struct cubeb_stream {
+  cubeb_stream()
+    : context(nullptr),
+      dataCallback(nullptr),
+      stateCallback(nullptr),
+      userPtr(nullptr),
+      frameSize(0),
+      bufferFrames(0),
+      writingWav(false),
+      running(false),
+      shutdown(false),
+      draining(false),
+      playedFrames(0),
+      playingFrames(0),
+      playingStartUs(0)
+  {
+  }
+
+  cubeb* context;
+  cubeb_stream_params params;
+  cubeb_data_callback dataCallback;
+  cubeb_state_callback stateCallback;
+  void* userPtr;
+  uint32_t frameSize;
+  uint32_t bufferFrames;
+  std::vector<uint8_t> buffer;
+  WavWriter wav;
+  bool writingWav;
+
+  // Calls the data callback, and plays what it returns.
+  std::thread thread;
+
+  // Synchronizes the following, and the stats.
+  std::mutex mutex;
+  std::condition_variable condVar;
+  bool running;
+  bool shutdown;
+  // True once the callback has returned short; the stream drains once
+  // what it returned has been played.
+  bool draining;
+  // The frames played before the buffer which is playing.
+  uint64_t playedFrames;
+  // The frames of the buffer which is playing that are left to play, and
+  // when they started.
+  uint32_t playingFrames;
+  uint64_t playingStartUs;
+  NullAudioStats stats;
+};
+
+// Returns how many frames of aStream's buffer have played by aNowUs.
+// Caller must hold aStream's mutex.
+static uint32_t
+GetElapsedFrames(cubeb_stream* aStream, uint64_t aNowUs)
+{
+  if (!aStream->running ||
+      aStream->context->options.pacing != NullAudioPacing_RealTime ||
+      aNowUs <= aStream->playingStartUs) {
+    return 0;
+  }
+  const uint64_t frames = (aNowUs - aStream->playingStartUs) * aStream->params.rate / 1000000;
+  return uint32_t(std::min<uint64_t>(frames, aStream->playingFrames));
+}
+
+static void
+RunNullStream(cubeb_stream* aStream)
+{
+  cubeb_stream* stm = aStream;
+  const bool realTime = stm->context->options.pacing == NullAudioPacing_RealTime;
+  // When the next callback should be called; when the last buffer
+  // finishes playing.
+  uint64_t dueUs = 0;
+  std::unique_lock<std::mutex> lock(stm->mutex);
+  while (!stm->shutdown) {
+    if (!stm->running) {
+      stm->condVar.wait(lock);
+      dueUs = 0;
+      continue;
+    }
+
+    if (stm->playingFrames) {
+      // Wait for the buffer to finish playing, or for us to be stopped.
+      const uint64_t nowUs = GetHighResTimeUs();
+      const uint64_t endUs = stm->playingStartUs +
+        (uint64_t(stm->playingFrames) * 1000000 + stm->params.rate - 1) / stm->params.rate;
+      if (nowUs < endUs) {
+        // Sleep in short steps, paced by GetHighResTimeUs(), rather than
+        // in a timed wait, which VS2012 bases on the system clock.
+        lock.unlock();
+        SleepUs(std::min(endUs - nowUs, MaxSleepUs));
+        lock.lock();
+        continue;
+      }
+      stm->playedFrames += stm->playingFrames;
+      stm->playingFrames = 0;
+      dueUs = endUs;
+    }
+
+    if (stm->draining) {
+      stm->running = false;
+      lock.unlock();
+      stm->stateCallback(stm, stm->userPtr, CUBEB_STATE_DRAINED);
+      lock.lock();
+      continue;
+    }
+
+    lock.unlock();
+    const uint64_t startUs = GetHighResTimeUs();
+    const long got = stm->dataCallback(stm, stm->userPtr, &stm->buffer[0], long(stm->bufferFrames));
+    const uint64_t endUs = GetHighResTimeUs();
+    if (stm->writingWav && got > 0 &&
+        !stm->wav.Write(&stm->buffer[0], size_t(got) * stm->frameSize)) {
+      // The WAV file is only for inspecting the output; carry on without it.
+      stm->writingWav = false;
+    }
+    lock.lock();
+
+    if (got < 0) {
+      stm->running = false;
+      lock.unlock();
+      stm->stateCallback(stm, stm->userPtr, CUBEB_STATE_ERROR);
+      lock.lock();
+      continue;
+    }
+    stm->stats.numCallbacks++;
+    stm->stats.numFrames += got;
+    stm->stats.callbackTime.Add(endUs - startUs);
+    if (realTime && dueUs) {
+      stm->stats.lateness.Add(startUs > dueUs ? startUs - dueUs : 0);
+    }
+    stm->draining = uint32_t(got) < stm->bufferFrames;
+    stm->playingFrames = uint32_t(got);
+    // The buffer starts playing when the last one finishes. A device
+    // queues the stream's latency, a few buffers, ahead, so only a callback
+    // later than the rest of that queue leaves a gap.
+    const uint64_t queuedUs = uint64_t(stm->bufferFrames) * 3 * 1000000 / stm->params.rate;
+    stm->playingStartUs = (dueUs && endUs <= dueUs + queuedUs) ? dueUs : endUs;
+    if (!realTime) {
+      stm->playedFrames += stm->playingFrames;
+      stm->playingFrames = 0;
+    }
+  }
+}
+
+static char const*
+null_get_backend_id(cubeb* /*aContext*/)
+{
+  return "null";
+}
+
+static void
+null_destroy(cubeb* aContext)
+{
+  delete aContext;
+}
+
+static void null_stream_destroy(cubeb_stream* aStream);
+
+static int
+null_stream_init(cubeb* aContext,
+                 cubeb_stream** aOutStream,
+                 char const* /*aStreamName*/,
+                 cubeb_stream_params aParams,
+                 unsigned int aLatency,
+                 cubeb_data_callback aDataCallback,
+                 cubeb_state_callback aStateCallback,
+                 void* aUserPtr)
+{
+  AudioFormat format;
+  format.sampleRate = aParams.rate;
+  format.numChannels = aParams.channels;
+  switch (aParams.format) {
+    case CUBEB_SAMPLE_S16NE:
+      format.bitsPerSample = 16;
+      break;
+    case CUBEB_SAMPLE_FLOAT32NE:
+      format.bitsPerSample = 32;
+      format.floatingPoint = true;
+      break;
+    default:
+      return CUBEB_ERROR_INVALID_FORMAT;
+  }
+
+  cubeb_stream* stm = new cubeb_stream();
+  stm->context = aContext;
+  stm->params = aParams;
+  stm->dataCallback = aDataCallback;
+  stm->stateCallback = aStateCallback;
+  stm->userPtr = aUserPtr;
+  stm->frameSize = format.numChannels * format.bitsPerSample / 8;
+  stm->bufferFrames = std::max<uint32_t>(1, aParams.rate * aLatency / 1000 / NumBuffers);
+  stm->buffer.resize(size_t(stm->bufferFrames) * stm->frameSize);
+  if (!aContext->options.wavFilename.empty()) {
+    if (!stm->wav.Open(aContext->options.wavFilename, format)) {
+      delete stm;
+      return CUBEB_ERROR;
+    }
+    stm->writingWav = true;
+  }
+  stm->thread = std::thread(RunNullStream, stm);
+  *aOutStream = stm;
+  return CUBEB_OK;
+}
+
+static void
+null_stream_destroy(cubeb_stream* aStream)
+{
+  {
+    std::lock_guard<std::mutex> lock(aStream->mutex);
+    aStream->shutdown = true;
+    aStream->condVar.notify_all();
+  }
+  aStream->thread.join();
+  aStream->wav.Close();
+  delete aStream;
+}
+
+static int
+null_stream_start(cubeb_stream* aStream)
+{
+  {
+    std::lock_guard<std::mutex> lock(aStream->mutex);
+    if (!aStream->running) {
+      aStream->running = true;
+      // The rest of the buffer that was playing when we stopped carries on.
+      aStream->playingStartUs = GetHighResTimeUs();
+      aStream->condVar.notify_all();
+    }
+  }
+  aStream->stateCallback(aStream, aStream->userPtr, CUBEB_STATE_STARTED);
+  return CUBEB_OK;
+}
+
+static int
+null_stream_stop(cubeb_stream* aStream)
+{
+  {
+    std::lock_guard<std::mutex> lock(aStream->mutex);
+    if (aStream->running) {
+      // Keep what's played of the buffer, so the position stays put.
+      const uint32_t elapsed = GetElapsedFrames(aStream, GetHighResTimeUs());
+      aStream->playedFrames += elapsed;
+      aStream->playingFrames -= elapsed;
+      aStream->running = false;
+      aStream->condVar.notify_all();
+    }
+  }
+  aStream->stateCallback(aStream, aStream->userPtr, CUBEB_STATE_STOPPED);
+  return CUBEB_OK;
+}
+
+static int
+null_stream_get_position(cubeb_stream* aStream, uint64_t* aOutPosition)
+{
+  std::lock_guard<std::mutex> lock(aStream->mutex);
+  *aOutPosition = aStream->playedFrames + GetElapsedFrames(aStream, GetHighResTimeUs());
+  return CUBEB_OK;
+}
+
+static const cubeb_ops NullOps = {
+  /*.init =*/ null_init,
+  /*.get_backend_id =*/ null_get_backend_id,
+  /*.destroy =*/ null_destroy,
+  /*.stream_init =*/ null_stream_init,
+  /*.stream_destroy =*/ null_stream_destroy,
+  /*.stream_start =*/ null_stream_start,
+  /*.stream_stop =*/ null_stream_stop,
+  /*.stream_get_position =*/ null_stream_get_position
+};
+
+int
+InitNullCubeb(cubeb** aOutContext,
+              const char* /*aContextName*/,
+              const NullAudioOptions& aOptions)
+{
+  if (!aOutContext) {
+    return CUBEB_ERROR_INVALID_PARAMETER;
+  }
+  cubeb* ctx = new cubeb();
+  ctx->ops = &NullOps;
+  ctx->options = aOptions;
+  *aOutContext = ctx;
+  return CUBEB_OK;
+}
+
+extern "C" int
+null_init(cubeb** aOutContext, char const* aContextName)
+{
+  return InitNullCubeb(aOutContext, aContextName, NullAudioOptions());
+}
+
+bool
+GetNullCubebStats(cubeb_stream* aStream, NullAudioStats* aOutStats)
+{
+  if (!aStream || aStream->context->ops != &NullOps) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(aStream->mutex);
+  *aOutStats = aStream->stats;
+  return true;
+}
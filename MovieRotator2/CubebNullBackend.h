@@ -0,0 +1,78 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// A cubeb backend with no audio device behind it, so that the preview's
+// audio path can be run and timed on machines without sound hardware, such
+// as CI machines. Its streams call the data callback a buffer at a time,
+// either paced in real time, as a device would, or as fast as the callback
+// can go, and can write what they're given to a WAV file. They measure how
+// late each callback is, so that the pacing's jitter can be reported.
+// cubeb_init() falls back to it in builds with no other backend, but not on
+// Windows, where a machine without audio should fail cubeb_init(); use
+// InitNullCubeb() to create and configure it on any platform.
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include "cubeb/cubeb.h"
+#include "TranscodeStats.h"
+
+enum NullAudioPacing {
+  // Each buffer is consumed in the time it would take to play, and the
+  // position advances with the clock.
+  NullAudioPacing_RealTime,
+  // Each buffer is consumed as soon as the callback fills it.
+  NullAudioPacing_Fast
+};
+
+struct NullAudioOptions {
+  NullAudioOptions()
+    : pacing(NullAudioPacing_RealTime)
+  {
+  }
+  NullAudioPacing pacing;
+  // If not empty, each stream writes the audio it consumes to this file.
+  std::string wavFilename;
+};
+
+struct NullAudioStats {
+  NullAudioStats()
+    : numCallbacks(0),
+      numFrames(0)
+  {
+  }
+  uint64_t numCallbacks;
+  // The frames the callbacks returned.
+  uint64_t numFrames;
+  // How late each callback was called, in microseconds, compared to when
+  // the buffer before it finished playing. Only measured in real time.
+  LatencyHistogram lateness;
+  // How long each callback took, in microseconds.
+  LatencyHistogram callbackTime;
+};
+
+// Creates a cubeb context for the null backend, configured with aOptions.
+// Returns a cubeb error code.
+int InitNullCubeb(cubeb** aOutContext,
+                  const char* aContextName,
+                  const NullAudioOptions& aOptions);
+
+// Copies the timing stats of aStream, which must be a stream of the null
+// backend, into *aOutStats. Returns false if it isn't. Threadsafe.
+bool GetNullCubebStats(cubeb_stream* aStream, NullAudioStats* aOutStats);
+
+// The backend's entry in cubeb_init()'s list; real time, without a WAV file.
+extern "C" int null_init(cubeb** aOutContext, char const* aContextName);
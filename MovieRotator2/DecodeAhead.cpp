@@ -0,0 +1,266 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "DecodeAhead.h"
+
+#include <math.h>
+#include <algorithm>
+
+// How much each video frame moves the moving statistics.
+static const double FrameWeight = 1.0 / 32;
+
+// The decode time statistics are only trusted after this many frames.
+static const uint64_t MinFramesForJitter = 8;
+
+// The video queue covers decode times up to this many standard deviations
+// above the mean.
+static const double JitterStdDevs = 3.0;
+
+// Gaps between frames longer than this, in 100ns units, are discontinuities
+// rather than the frame rate.
+static const int64_t MaxFrameInterval = 10000000;
+
+const char*
+GetDecodeAheadReasonName(DecodeAheadReason aReason)
+{
+  switch (aReason) {
+    case DecodeAheadReason_Initial: return "initial";
+    case DecodeAheadReason_DecodeJitter: return "decode jitter";
+    case DecodeAheadReason_LateFrames: return "late frames";
+    case DecodeAheadReason_AudioUnderrun: return "audio underrun";
+    case DecodeAheadReason_Settled: return "settled";
+    case DecodeAheadReason_MemoryBudget: return "memory budget";
+    default: return "unknown";
+  }
+}
+
+DecodeAheadController::DecodeAheadController(const DecodeAheadLimits& aLimits)
+  : mLimits(aLimits),
+    mVideoFrames(std::max<uint32_t>(aLimits.minVideoFrames, 1)),
+    mAudioMs(aLimits.minAudioMs),
+    mAudioBytesPerSecond(0),
+    mNumFrames(0),
+    mMeanDecodeUs(0),
+    mVarDecodeUs(0),
+    mFrameIntervalUs(0),
+    mLastTimestamp(0),
+    mFrameBytes(0),
+    mPendingLateFrames(0),
+    mPendingUnderruns(0),
+    mNumLateFrames(0),
+    mNumAudioUnderruns(0),
+    mLateBoost(0),
+    mUnderrunBoost(0),
+    mVideoChangedUs(0),
+    mAudioChangedUs(0),
+    mStarted(false)
+{
+  mLimits.minVideoFrames = mVideoFrames;
+  mLimits.maxVideoFrames = std::max(mLimits.maxVideoFrames, mLimits.minVideoFrames);
+  mLimits.maxAudioMs = std::max(mLimits.maxAudioMs, mLimits.minAudioMs);
+}
+
+void
+DecodeAheadController::SetAudioBytesPerSecond(uint32_t aBytesPerSecond)
+{
+  mAudioBytesPerSecond = aBytesPerSecond;
+}
+
+void
+DecodeAheadController::AddVideoFrame(int64_t aTimestamp, uint64_t aDecodeUs, uint64_t aBytes)
+{
+  const double decodeUs = double(aDecodeUs);
+  if (!mNumFrames) {
+    mMeanDecodeUs = decodeUs;
+    mVarDecodeUs = 0;
+  } else {
+    // An exponentially weighted mean and variance.
+    const double diff = decodeUs - mMeanDecodeUs;
+    const double increment = FrameWeight * diff;
+    mMeanDecodeUs += increment;
+    mVarDecodeUs = (1.0 - FrameWeight) * (mVarDecodeUs + diff * increment);
+
+    const int64_t interval = aTimestamp - mLastTimestamp;
+    if (interval > 0 && interval < MaxFrameInterval) {
+      const double intervalUs = double(interval) / 10;
+      if (mFrameIntervalUs > 0) {
+        mFrameIntervalUs += FrameWeight * (intervalUs - mFrameIntervalUs);
+      } else {
+        mFrameIntervalUs = intervalUs;
+      }
+    }
+  }
+  mNumFrames++;
+  mLastTimestamp = aTimestamp;
+  if (aBytes) {
+    mFrameBytes = aBytes;
+  }
+}
+
+void
+DecodeAheadController::AddLateFrames(uint64_t aCount)
+{
+  mPendingLateFrames += aCount;
+  mNumLateFrames += aCount;
+}
+
+void
+DecodeAheadController::AddAudioUnderruns(uint64_t aCount)
+{
+  mPendingUnderruns += aCount;
+  mNumAudioUnderruns += aCount;
+}
+
+uint32_t
+DecodeAheadController::GetJitterFrames() const
+{
+  if (mNumFrames < MinFramesForJitter || mFrameIntervalUs <= 0) {
+    return mLimits.minVideoFrames;
+  }
+  // While a slow frame is decoded, playback eats into the queue a frame
+  // per frame interval; one more frame covers the frame being shown.
+  const double slowUs = mMeanDecodeUs + JitterStdDevs * sqrt(mVarDecodeUs);
+  const double frames = 1.0 + ceil(slowUs / mFrameIntervalUs);
+  return uint32_t(std::min<double>(frames, mLimits.maxVideoFrames));
+}
+
+uint32_t
+DecodeAheadController::GetBudgetVideoFrames() const
+{
+  if (!mFrameBytes) {
+    return mLimits.maxVideoFrames;
+  }
+  const uint64_t audioBytes = uint64_t(mAudioMs) * mAudioBytesPerSecond / 1000;
+  const uint64_t videoBytes = mLimits.budgetBytes > audioBytes ?
+                              mLimits.budgetBytes - audioBytes : 0;
+  return uint32_t(std::min<uint64_t>(videoBytes / mFrameBytes, mLimits.maxVideoFrames));
+}
+
+uint32_t
+DecodeAheadController::GetBudgetAudioMs() const
+{
+  if (!mAudioBytesPerSecond) {
+    return mLimits.maxAudioMs;
+  }
+  const uint64_t videoBytes = uint64_t(mVideoFrames) * mFrameBytes;
+  const uint64_t audioBytes = mLimits.budgetBytes > videoBytes ?
+                              mLimits.budgetBytes - videoBytes : 0;
+  return uint32_t(std::min<uint64_t>(audioBytes * 1000 / mAudioBytesPerSecond,
+                                     mLimits.maxAudioMs));
+}
+
+bool
+DecodeAheadController::Update(uint64_t aNowUs)
+{
+  if (!mStarted) {
+    mStarted = true;
+    mVideoChangedUs = aNowUs;
+    mAudioChangedUs = aNowUs;
+    RecordChange(aNowUs, DecodeAheadReason_Initial);
+  }
+
+  // Video. Late frames raise the depth straight away, as does the decode
+  // time varying more; it's only lowered a step at a time, once nothing's
+  // been late for a while.
+  uint32_t videoFrames = mVideoFrames;
+  DecodeAheadReason videoReason = DecodeAheadReason_DecodeJitter;
+  if (mPendingLateFrames) {
+    mPendingLateFrames = 0;
+    mLateBoost = std::min(mLateBoost + 1, mLimits.maxVideoFrames);
+    videoFrames = std::max(GetJitterFrames() + mLateBoost, mVideoFrames + 1);
+    videoReason = DecodeAheadReason_LateFrames;
+  } else if (GetJitterFrames() + mLateBoost > mVideoFrames) {
+    videoFrames = GetJitterFrames() + mLateBoost;
+  } else if (aNowUs >= mVideoChangedUs + SettleTimeUs) {
+    mVideoChangedUs = aNowUs;
+    if (mLateBoost) {
+      mLateBoost--;
+    }
+    if (std::max(GetJitterFrames() + mLateBoost, mLimits.minVideoFrames) < mVideoFrames) {
+      videoFrames = mVideoFrames - 1;
+      videoReason = DecodeAheadReason_Settled;
+    }
+  }
+  videoFrames = std::min(std::max(videoFrames, mLimits.minVideoFrames), mLimits.maxVideoFrames);
+  const uint32_t budgetFrames = std::max<uint32_t>(GetBudgetVideoFrames(), 1);
+  if (videoFrames > budgetFrames) {
+    videoFrames = budgetFrames;
+    videoReason = DecodeAheadReason_MemoryBudget;
+  }
+  const bool videoChanged = videoFrames != mVideoFrames;
+  if (videoChanged) {
+    mVideoFrames = videoFrames;
+    mVideoChangedUs = aNowUs;
+  }
+
+  // Audio. Each underrun doubles the depth, and it's halved once nothing's
+  // been late for a while.
+  uint32_t audioMs = mAudioMs;
+  DecodeAheadReason audioReason = DecodeAheadReason_AudioUnderrun;
+  if (mPendingUnderruns) {
+    mPendingUnderruns = 0;
+    if ((uint64_t(mLimits.minAudioMs) << mUnderrunBoost) < mLimits.maxAudioMs) {
+      mUnderrunBoost++;
+    }
+  } else if (mUnderrunBoost && aNowUs >= mAudioChangedUs + SettleTimeUs) {
+    mUnderrunBoost--;
+    audioReason = DecodeAheadReason_Settled;
+  }
+  audioMs = uint32_t(std::min<uint64_t>(uint64_t(mLimits.minAudioMs) << mUnderrunBoost,
+                                        mLimits.maxAudioMs));
+  const uint32_t budgetMs = GetBudgetAudioMs();
+  if (audioMs > budgetMs) {
+    audioMs = budgetMs;
+    audioReason = DecodeAheadReason_MemoryBudget;
+  }
+  const bool audioChanged = audioMs != mAudioMs;
+  if (audioChanged) {
+    mAudioMs = audioMs;
+    mAudioChangedUs = aNowUs;
+  }
+
+  if (videoChanged || audioChanged) {
+    RecordChange(aNowUs, videoChanged ? videoReason : audioReason);
+  }
+  return videoChanged || audioChanged;
+}
+
+void
+DecodeAheadController::RecordChange(uint64_t aNowUs, DecodeAheadReason aReason)
+{
+  DecodeAheadChange change;
+  change.timeUs = aNowUs;
+  change.videoFrames = mVideoFrames;
+  change.audioMs = mAudioMs;
+  change.reason = aReason;
+  mChanges.push_back(change);
+  if (mChanges.size() > MaxChanges) {
+    mChanges.pop_front();
+  }
+}
+
+void
+DecodeAheadController::GetStats(DecodeAheadStats* aOutStats) const
+{
+  aOutStats->videoFrames = mVideoFrames;
+  aOutStats->audioMs = mAudioMs;
+  aOutStats->meanDecodeUs = mMeanDecodeUs;
+  aOutStats->stdDevDecodeUs = sqrt(mVarDecodeUs);
+  aOutStats->frameIntervalUs = mFrameIntervalUs;
+  aOutStats->frameBytes = mFrameBytes;
+  aOutStats->numLateFrames = mNumLateFrames;
+  aOutStats->numAudioUnderruns = mNumAudioUnderruns;
+  aOutStats->changes = mChanges;
+}
@@ -0,0 +1,178 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Decides how far ahead of playback the preview's decoder runs: how many
+// video frames, and how much audio, it keeps decoded. A fixed two frames
+// can't absorb the decode time of a heavy input, e.g. 4K HEVC, varying
+// from frame to frame, so the depths follow how much the decode time
+// varies, and how often frames or audio are late, within a budget of
+// bytes of decoded media.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+
+// Why the decode-ahead depths last changed.
+enum DecodeAheadReason {
+  // The depths we started with.
+  DecodeAheadReason_Initial,
+  // The video decode time varies more, or less, than the video queue
+  // could absorb.
+  DecodeAheadReason_DecodeJitter,
+  // Frames were shown late, or skipped.
+  DecodeAheadReason_LateFrames,
+  // The audio output underran.
+  DecodeAheadReason_AudioUnderrun,
+  // Nothing's been late for a while, so we're giving memory back.
+  DecodeAheadReason_Settled,
+  // The depth we wanted wouldn't fit in the budget.
+  DecodeAheadReason_MemoryBudget,
+  NumDecodeAheadReasons
+};
+
+// Returns the name a reason is reported as.
+const char* GetDecodeAheadReasonName(DecodeAheadReason aReason);
+
+struct DecodeAheadLimits {
+  DecodeAheadLimits()
+    : minVideoFrames(2),
+      maxVideoFrames(16),
+      minAudioMs(1000),
+      maxAudioMs(4000),
+      budgetBytes(256 * 1024 * 1024)
+  {
+  }
+  // The range the video queue's depth, in frames, is kept in; the budget
+  // can take it below the minimum, but never below one frame.
+  uint32_t minVideoFrames;
+  uint32_t maxVideoFrames;
+  // The range the audio queue's depth, in milliseconds, is kept in.
+  uint32_t minAudioMs;
+  uint32_t maxAudioMs;
+  // The most bytes of decoded video frames and audio to hold.
+  uint64_t budgetBytes;
+};
+
+struct DecodeAheadChange {
+  uint64_t timeUs;
+  uint32_t videoFrames;
+  uint32_t audioMs;
+  DecodeAheadReason reason;
+};
+
+struct DecodeAheadStats {
+  DecodeAheadStats()
+    : videoFrames(0),
+      audioMs(0),
+      meanDecodeUs(0),
+      stdDevDecodeUs(0),
+      frameIntervalUs(0),
+      frameBytes(0),
+      numLateFrames(0),
+      numAudioUnderruns(0)
+  {
+  }
+  // The current depths.
+  uint32_t videoFrames;
+  uint32_t audioMs;
+  // The moving mean and standard deviation of the time to decode a video
+  // frame, and the time between frames.
+  double meanDecodeUs;
+  double stdDevDecodeUs;
+  double frameIntervalUs;
+  // The size of the last decoded video frame.
+  uint64_t frameBytes;
+  uint64_t numLateFrames;
+  uint64_t numAudioUnderruns;
+  // The most recent changes of depth, oldest first.
+  std::deque<DecodeAheadChange> changes;
+};
+
+class DecodeAheadController {
+public:
+  // How many changes GetStats() reports.
+  static const size_t MaxChanges = 32;
+
+  // How long nothing must be late for before a depth is lowered a step.
+  static const uint64_t SettleTimeUs = 10000000;
+
+  explicit DecodeAheadController(const DecodeAheadLimits& aLimits = DecodeAheadLimits());
+
+  // Sets the number of bytes a second of decoded audio takes, so that
+  // it's counted against the budget. 0 if there's no audio.
+  void SetAudioBytesPerSecond(uint32_t aBytesPerSecond);
+
+  // Records that a video frame of aBytes at aTimestamp, in 100ns units,
+  // took aDecodeUs to decode.
+  void AddVideoFrame(int64_t aTimestamp, uint64_t aDecodeUs, uint64_t aBytes);
+
+  // Records that aCount more frames were late, or that the audio output
+  // underran, and played silence, aCount more times.
+  void AddLateFrames(uint64_t aCount);
+  void AddAudioUnderruns(uint64_t aCount);
+
+  // Recomputes the depths at aNowUs. Returns true if either changed.
+  bool Update(uint64_t aNowUs);
+
+  uint32_t GetVideoFrames() const { return mVideoFrames; }
+  uint32_t GetAudioMs() const { return mAudioMs; }
+
+  void GetStats(DecodeAheadStats* aOutStats) const;
+
+private:
+  // Returns the video depth which would absorb the decode time varying as
+  // it has been.
+  uint32_t GetJitterFrames() const;
+
+  // Returns the most video frames, and the most audio, which fit in the
+  // budget alongside the other's current depth.
+  uint32_t GetBudgetVideoFrames() const;
+  uint32_t GetBudgetAudioMs() const;
+
+  void RecordChange(uint64_t aNowUs, DecodeAheadReason aReason);
+
+  DecodeAheadLimits mLimits;
+  uint32_t mVideoFrames;
+  uint32_t mAudioMs;
+  uint32_t mAudioBytesPerSecond;
+
+  // Exponentially weighted moving statistics of the video frames.
+  uint64_t mNumFrames;
+  double mMeanDecodeUs;
+  double mVarDecodeUs;
+  double mFrameIntervalUs;
+  int64_t mLastTimestamp;
+  uint64_t mFrameBytes;
+
+  // Late frames and underruns not yet acted on, and in total.
+  uint64_t mPendingLateFrames;
+  uint64_t mPendingUnderruns;
+  uint64_t mNumLateFrames;
+  uint64_t mNumAudioUnderruns;
+
+  // Frames added to the video depth, and doublings of the audio depth,
+  // because things were late.
+  uint32_t mLateBoost;
+  uint32_t mUnderrunBoost;
+  // When a depth was last raised, or lowered a step; they're only lowered
+  // once SettleTimeUs has passed since.
+  uint64_t mVideoChangedUs;
+  uint64_t mAudioChangedUs;
+  bool mStarted;
+
+  std::deque<DecodeAheadChange> mChanges;
+};
@@ -0,0 +1,61 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// The loop each of VideoDecoder's decode threads runs: decode a sample
+// whenever the stream's queue has room, and otherwise sleep until the
+// consumer's pops make some. It's separate from VideoDecoder so that the
+// SelfTest tool can benchmark it with a stand-in for the source reader.
+
+#pragma once
+
+#include <atomic>
+
+#include "SpscRing.h"
+
+// Decodes a stream until it ends, or aShutdown is set. Each time round, it
+// calls aUpdate(), and then aDecodeSample() unless aIsQueueFull(). While
+// the queue is full, it waits on aWakeup, which the stream's consumer
+// notifies when a pop makes room, and the shutdown notifies.
+// aDecodeSample() reads and pushes one sample, and clears aHasStream once
+// it's pushed the last. It returns false if it failed, and then so does
+// this. aIsQueueFull() is also called by the waits, so it can only read
+// state which is atomic.
+template<typename Update, typename IsQueueFull, typename DecodeSample>
+bool
+DecodeStreamUntilEnd(const std::atomic<bool>& aHasStream,
+                     const std::atomic<bool>& aShutdown,
+                     WakeupEvent& aWakeup,
+                     Update aUpdate,
+                     IsQueueFull aIsQueueFull,
+                     DecodeSample aDecodeSample)
+{
+  while (aHasStream) {
+    if (aShutdown) {
+      return true;
+    }
+
+    aUpdate();
+
+    if (!aIsQueueFull() && !aDecodeSample()) {
+      return false;
+    }
+
+    // Wait while the queue is full and we're not shutdown.
+    aWakeup.Wait([&]() {
+      return aShutdown || (aHasStream && !aIsQueueFull());
+    });
+  }
+  return true;
+}
@@ -0,0 +1,113 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "EncoderSettings.h"
+
+static const char* const PresetNames[NumEncoderPresets] = {
+  "fast",
+  "balanced",
+  "archival"
+};
+
+EncoderSettings
+GetEncoderPresetSettings(EncoderPreset aPreset)
+{
+  EncoderSettings settings;
+  switch (aPreset) {
+    case EncoderPreset_Fast:
+      settings.rateControl = EncoderRateControl_Quality;
+      settings.quality = 60;
+      settings.qualityVsSpeed = 0;
+      settings.keyframeIntervalMs = 2000;
+      settings.numBFrames = 0;
+      break;
+    case EncoderPreset_Balanced:
+      settings.rateControl = EncoderRateControl_Quality;
+      settings.quality = 75;
+      settings.qualityVsSpeed = 50;
+      settings.keyframeIntervalMs = 2000;
+      settings.numBFrames = 1;
+      break;
+    case EncoderPreset_Archival:
+    default:
+      // What the encoder was always configured with before there were
+      // presets; everything else is left to the encoder.
+      settings.rateControl = EncoderRateControl_UnconstrainedVBR;
+      settings.quality = 100;
+      break;
+  }
+  return settings;
+}
+
+const char*
+GetEncoderPresetName(EncoderPreset aPreset)
+{
+  return (aPreset >= 0 && aPreset < NumEncoderPresets) ? PresetNames[aPreset] : "unknown";
+}
+
+bool
+ParseEncoderPreset(const std::string& aName, EncoderPreset* aOutPreset)
+{
+  for (int i = 0; i < NumEncoderPresets; i++) {
+    if (aName == PresetNames[i]) {
+      *aOutPreset = EncoderPreset(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t
+GetKeyframeIntervalFrames(const EncoderSettings& aSettings,
+                          uint32_t aFrameRateNumer,
+                          uint32_t aFrameRateDenom)
+{
+  if (!aSettings.keyframeIntervalMs || !aFrameRateNumer || !aFrameRateDenom) {
+    return 0;
+  }
+  const uint64_t perInterval = uint64_t(aFrameRateDenom) * 1000;
+  const uint64_t frames = (uint64_t(aSettings.keyframeIntervalMs) * aFrameRateNumer +
+                           perInterval / 2) / perInterval;
+  return frames ? uint32_t(frames) : 1;
+}
+
+bool
+ApplyEncoderSettings(const EncoderSettings& aSettings,
+                     uint32_t aFrameRateNumer,
+                     uint32_t aFrameRateDenom,
+                     IEncoderSettingsTarget* aTarget)
+{
+  if (!aTarget->SetRateControl(aSettings.rateControl, aSettings.quality)) {
+    // Windows 7's H.264 encoder doesn't have quality rate control, but
+    // every encoder we've used has unconstrained VBR.
+    if (aSettings.rateControl == EncoderRateControl_UnconstrainedVBR ||
+        !aTarget->SetRateControl(EncoderRateControl_UnconstrainedVBR, aSettings.quality)) {
+      return false;
+    }
+  }
+  if (aSettings.qualityVsSpeed >= 0) {
+    aTarget->SetQualityVsSpeed(uint32_t(aSettings.qualityVsSpeed));
+  }
+  const uint32_t keyframeInterval = GetKeyframeIntervalFrames(aSettings,
+                                                              aFrameRateNumer,
+                                                              aFrameRateDenom);
+  if (keyframeInterval) {
+    aTarget->SetKeyframeInterval(keyframeInterval);
+  }
+  if (aSettings.numBFrames >= 0) {
+    aTarget->SetNumBFrames(uint32_t(aSettings.numBFrames));
+  }
+  return true;
+}
@@ -0,0 +1,109 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Named speed/quality presets for the video encoder, and the settings they
+// map to. The settings are applied through IEncoderSettingsTarget, which
+// each encoder backend implements with its own controls, so that the app's
+// H.264 encoder and the stand-in encoders in benchmarks take the same
+// presets.
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+enum EncoderPreset {
+  // Fastest to encode, for bulk jobs; files are bigger, or worse looking,
+  // than balanced.
+  EncoderPreset_Fast,
+  // A good compromise between speed, size and quality.
+  EncoderPreset_Balanced,
+  // The best quality the encoder can do, however long it takes and however
+  // big the file is. This is what every job was encoded with before there
+  // were presets.
+  EncoderPreset_Archival,
+  NumEncoderPresets
+};
+
+enum EncoderRateControl {
+  // Targets a constant quality, letting the bit rate go wherever that
+  // takes it.
+  EncoderRateControl_Quality,
+  // Targets the mean bit rate, without limiting the peaks, at the given
+  // quality.
+  EncoderRateControl_UnconstrainedVBR
+};
+
+struct EncoderSettings {
+  EncoderSettings()
+    : rateControl(EncoderRateControl_Quality),
+      quality(75),
+      qualityVsSpeed(-1),
+      keyframeIntervalMs(0),
+      numBFrames(-1)
+  {
+  }
+  EncoderRateControl rateControl;
+  // 0 to 100; higher is better quality, and bigger.
+  uint32_t quality;
+  // 0 to 100; 0 is the fastest, 100 the best compression. -1 leaves it to
+  // the encoder.
+  int32_t qualityVsSpeed;
+  // The longest time between keyframes, in milliseconds. 0 leaves it to the
+  // encoder.
+  uint32_t keyframeIntervalMs;
+  // The number of B-frames between reference frames. -1 leaves it to the
+  // encoder.
+  int32_t numBFrames;
+};
+
+// Returns the settings aPreset maps to.
+EncoderSettings GetEncoderPresetSettings(EncoderPreset aPreset);
+
+// Returns the name of aPreset; "fast", "balanced" or "archival".
+const char* GetEncoderPresetName(EncoderPreset aPreset);
+
+// Sets *aOutPreset to the preset named aName. Returns false if there's no
+// preset of that name.
+bool ParseEncoderPreset(const std::string& aName, EncoderPreset* aOutPreset);
+
+// Returns the number of frames between keyframes which aSettings ask for,
+// at aFrameRateNumer/aFrameRateDenom frames per second, or 0 if they leave
+// it to the encoder.
+uint32_t GetKeyframeIntervalFrames(const EncoderSettings& aSettings,
+                                   uint32_t aFrameRateNumer,
+                                   uint32_t aFrameRateDenom);
+
+// An encoder which can be configured with EncoderSettings. Each setter
+// returns false if the encoder doesn't support the setting.
+class IEncoderSettingsTarget {
+public:
+  virtual ~IEncoderSettingsTarget() {}
+  virtual bool SetRateControl(EncoderRateControl aRateControl, uint32_t aQuality) = 0;
+  virtual bool SetQualityVsSpeed(uint32_t aQualityVsSpeed) = 0;
+  virtual bool SetKeyframeInterval(uint32_t aNumFrames) = 0;
+  virtual bool SetNumBFrames(uint32_t aNumBFrames) = 0;
+};
+
+// Configures aTarget, which encodes video at aFrameRateNumer/aFrameRateDenom
+// frames per second, with aSettings. Only the rate control is required;
+// if the encoder doesn't support quality rate control, it falls back to
+// unconstrained VBR at the same quality. The other settings are skipped if
+// the encoder doesn't support them, e.g. B-frames in the baseline profile.
+// Returns false if no rate control could be set.
+bool ApplyEncoderSettings(const EncoderSettings& aSettings,
+                          uint32_t aFrameRateNumer,
+                          uint32_t aFrameRateDenom,
+                          IEncoderSettingsTarget* aTarget);
@@ -0,0 +1,66 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// File helpers for the portable code, which has to open files by narrow
+// filenames without tripping MSVC's deprecation of fopen().
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+// Opens aFilename with fopen() style aMode. Returns null on failure.
+inline FILE*
+OpenFile(const std::string& aFilename, const char* aMode)
+{
+#if defined(_MSC_VER)
+  FILE* file = nullptr;
+  return (fopen_s(&file, aFilename.c_str(), aMode) == 0) ? file : nullptr;
+#else
+  return fopen(aFilename.c_str(), aMode);
+#endif
+}
+
+inline int64_t
+TellFile(FILE* aFile)
+{
+#if defined(_MSC_VER)
+  return _ftelli64(aFile);
+#else
+  return ftello(aFile);
+#endif
+}
+
+inline bool
+SeekFile(FILE* aFile, int64_t aOffset, int aOrigin)
+{
+#if defined(_MSC_VER)
+  return _fseeki64(aFile, aOffset, aOrigin) == 0;
+#else
+  return fseeko(aFile, aOffset, aOrigin) == 0;
+#endif
+}
+
+// Returns the size of aFile, leaving its position unchanged.
+inline int64_t
+GetFileSize(FILE* aFile)
+{
+  const int64_t position = TellFile(aFile);
+  SeekFile(aFile, 0, SEEK_END);
+  const int64_t size = TellFile(aFile);
+  SeekFile(aFile, position, SEEK_SET);
+  return size;
+}
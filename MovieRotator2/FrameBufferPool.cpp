@@ -0,0 +1,224 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "FrameBufferPool.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#if defined(_MSC_VER)
+#include <malloc.h>
+#endif
+
+static uint8_t*
+AlignedAlloc(size_t aSize)
+{
+#if defined(_MSC_VER)
+  return static_cast<uint8_t*>(_aligned_malloc(aSize, FrameBufferPool::Alignment));
+#else
+  void* ptr = nullptr;
+  if (posix_memalign(&ptr, FrameBufferPool::Alignment, aSize) != 0) {
+    return nullptr;
+  }
+  return static_cast<uint8_t*>(ptr);
+#endif
+}
+
+static void
+AlignedFree(uint8_t* aBuffer)
+{
+#if defined(_MSC_VER)
+  _aligned_free(aBuffer);
+#else
+  free(aBuffer);
+#endif
+}
+
+FrameBufferPool::FrameBufferPool(uint32_t aMaxIdleBuffersPerSize)
+  : mMaxIdleBuffersPerSize(aMaxIdleBuffersPerSize)
+{
+  memset(&mStats, 0, sizeof(mStats));
+}
+
+FrameBufferPool::~FrameBufferPool()
+{
+  Trim();
+}
+
+uint8_t*
+FrameBufferPool::Acquire(size_t aSize)
+{
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::vector<uint8_t*>& idle = mIdleBuffers[aSize];
+    if (!idle.empty()) {
+      uint8_t* buffer = idle.back();
+      idle.pop_back();
+      mStats.hits++;
+      return buffer;
+    }
+    mStats.misses++;
+  }
+
+  // Allocate outside the lock, it may take a while for a large buffer.
+  uint8_t* buffer = AlignedAlloc(aSize);
+  if (!buffer) {
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(mMutex);
+  mStats.allocatedBytes += aSize;
+  if (mStats.allocatedBytes > mStats.peakBytes) {
+    mStats.peakBytes = mStats.allocatedBytes;
+  }
+  // Reserve space to hold this buffer when it's released, so that
+  // releasing never allocates.
+  std::vector<uint8_t*>& idle = mIdleBuffers[aSize];
+  idle.reserve(std::min<size_t>(idle.capacity() + 1, mMaxIdleBuffersPerSize));
+  return buffer;
+}
+
+void
+FrameBufferPool::Release(uint8_t* aBuffer, size_t aSize)
+{
+  if (!aBuffer) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::vector<uint8_t*>& idle = mIdleBuffers[aSize];
+    if (idle.size() < mMaxIdleBuffersPerSize) {
+      idle.push_back(aBuffer);
+      return;
+    }
+    mStats.allocatedBytes -= aSize;
+  }
+  AlignedFree(aBuffer);
+}
+
+/* static */
+std::shared_ptr<uint8_t>
+FrameBufferPool::AcquireShared(const std::shared_ptr<FrameBufferPool>& aPool,
+                               size_t aSize)
+{
+  return aPool->AcquireSharedBuffer(aSize);
+}
+
+std::shared_ptr<uint8_t>
+FrameBufferPool::AcquireSharedBuffer(size_t aSize)
+{
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::vector<std::shared_ptr<uint8_t> >& buffers = mSharedBuffers[aSize];
+    for (size_t i = 0; i < buffers.size(); i++) {
+      // Only we can hand out more references to our buffers, and we hold the
+      // lock, so once we hold the only one, no one else can take another.
+      if (buffers[i].use_count() == 1) {
+        // Don't let our caller's writes to the buffer be reordered before
+        // the reads of whoever released it last.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        mStats.hits++;
+        return buffers[i];
+      }
+    }
+    mStats.misses++;
+  }
+
+  std::shared_ptr<uint8_t> buffer(AlignedAlloc(aSize), AlignedFree);
+  if (!buffer) {
+    return std::shared_ptr<uint8_t>();
+  }
+
+  std::lock_guard<std::mutex> lock(mMutex);
+  mStats.allocatedBytes += aSize;
+  if (mStats.allocatedBytes > mStats.peakBytes) {
+    mStats.peakBytes = mStats.allocatedBytes;
+  }
+  mSharedBuffers[aSize].push_back(buffer);
+  return buffer;
+}
+
+RecyclingBufferPool::RecyclingBufferPool()
+  : mNumAllocations(0)
+{
+}
+
+std::shared_ptr<uint8_t>
+RecyclingBufferPool::Acquire(size_t aSize)
+{
+  for (size_t i = 0; i < mBuffers.size(); i++) {
+    // Only we can hand out more references to our buffers, so once we hold
+    // the only one, no one else can take another.
+    Buffer& buffer = mBuffers[i];
+    if (buffer.capacity >= aSize && buffer.data.use_count() == 1) {
+      // Don't let our writes to the buffer be reordered before the reads
+      // of whoever released it last.
+      std::atomic_thread_fence(std::memory_order_acquire);
+      return buffer.data;
+    }
+  }
+
+  // Leave room for the sizes to vary, so that a buffer can be reused for
+  // most of the sizes asked for.
+  static const size_t Granularity = 4096;
+  const size_t capacity = (aSize + aSize / 4 + Granularity - 1) / Granularity * Granularity;
+  Buffer buffer;
+  buffer.data = std::shared_ptr<uint8_t>(AlignedAlloc(capacity), AlignedFree);
+  if (!buffer.data) {
+    return std::shared_ptr<uint8_t>();
+  }
+  buffer.capacity = capacity;
+  mBuffers.push_back(buffer);
+  mNumAllocations++;
+  return buffer.data;
+}
+
+void
+FrameBufferPool::Trim()
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  std::map<size_t, std::vector<uint8_t*> >::iterator itr = mIdleBuffers.begin();
+  for (; itr != mIdleBuffers.end(); ++itr) {
+    std::vector<uint8_t*>& idle = itr->second;
+    for (size_t i = 0; i < idle.size(); i++) {
+      AlignedFree(idle[i]);
+    }
+    mStats.allocatedBytes -= itr->first * idle.size();
+    idle.clear();
+  }
+  // Buffers which are still in use are freed by their last user.
+  std::map<size_t, std::vector<std::shared_ptr<uint8_t> > >::iterator shared =
+    mSharedBuffers.begin();
+  for (; shared != mSharedBuffers.end(); ++shared) {
+    std::vector<std::shared_ptr<uint8_t> >& buffers = shared->second;
+    for (size_t i = 0; i < buffers.size(); ) {
+      if (buffers[i].use_count() == 1) {
+        buffers[i] = buffers.back();
+        buffers.pop_back();
+        mStats.allocatedBytes -= shared->first;
+      } else {
+        i++;
+      }
+    }
+  }
+}
+
+FrameBufferPoolStats
+FrameBufferPool::GetStats()
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mStats;
+}
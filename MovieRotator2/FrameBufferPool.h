@@ -0,0 +1,123 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// A pool of reusable, aligned, frame sized buffers, so that we don't
+// allocate and free a frame's worth of memory for every frame we process.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct FrameBufferPoolStats {
+  // Number of Acquire() calls satisfied by a buffer already in the pool.
+  uint64_t hits;
+  // Number of Acquire() calls which had to allocate a new buffer.
+  uint64_t misses;
+  // Bytes currently allocated by the pool, whether in use or idle.
+  uint64_t allocatedBytes;
+  // The most bytes the pool has had allocated at once.
+  uint64_t peakBytes;
+};
+
+// Buffers are keyed by size; a buffer is only reused for requests of exactly
+// its size, which is what we get when processing frames of one stream.
+// Threadsafe; buffers can be released on any thread.
+class FrameBufferPool {
+public:
+  // Alignment of the buffers, in bytes. One cache line, which is also
+  // enough for any SIMD loads and stores we do.
+  static const size_t Alignment = 64;
+
+  // Keeps at most aMaxIdleBuffersPerSize idle buffers of each size. Any
+  // more than that are freed when they're released. Shared buffers are kept
+  // until Trim(), but there are only ever as many of them as were in use at
+  // once.
+  explicit FrameBufferPool(uint32_t aMaxIdleBuffersPerSize = 8);
+
+  // Frees the idle buffers. All acquired buffers must have been released.
+  ~FrameBufferPool();
+
+  // Returns an Alignment aligned buffer of aSize bytes, or nullptr if we're
+  // out of memory.
+  uint8_t* Acquire(size_t aSize);
+
+  // Returns aBuffer, which was acquired with aSize, to the pool.
+  void Release(uint8_t* aBuffer, size_t aSize);
+
+  // Like Acquire(), but the buffer can be reused once the last reference
+  // to it goes away. The pool keeps a reference to each shared buffer it
+  // has handed out, and hands out copies of it, so once it has as many as
+  // are in flight at once, this doesn't allocate, not even a shared_ptr
+  // control block. A buffer can outlive the pool; the last reference to it
+  // frees it. Returns null if we're out of memory.
+  static std::shared_ptr<uint8_t> AcquireShared(const std::shared_ptr<FrameBufferPool>& aPool,
+                                                size_t aSize);
+
+  // Frees all idle buffers, shared ones included.
+  void Trim();
+
+  FrameBufferPoolStats GetStats();
+
+private:
+  FrameBufferPool(const FrameBufferPool&);
+  FrameBufferPool& operator=(const FrameBufferPool&);
+
+  const uint32_t mMaxIdleBuffersPerSize;
+
+  std::shared_ptr<uint8_t> AcquireSharedBuffer(size_t aSize);
+
+  std::mutex mMutex;
+  std::map<size_t, std::vector<uint8_t*> > mIdleBuffers;
+  // The buffers AcquireShared() has handed out, in use or idle, by size.
+  // A buffer is idle once we hold the only reference to it.
+  std::map<size_t, std::vector<std::shared_ptr<uint8_t> > > mSharedBuffers;
+  FrameBufferPoolStats mStats;
+};
+
+// Buffers of varying sizes for one producer, such as an audio filter, whose
+// output sizes vary by a few samples from frame to frame. A buffer is
+// reused, for any size up to its capacity, once every frame it was handed
+// out in has gone away. The pool keeps a reference to each buffer, so once
+// it has as many buffers as are in flight at once, handing one out doesn't
+// allocate, not even a shared_ptr control block as AcquireShared() does.
+// Not threadsafe, except that the frames can be released on any thread.
+class RecyclingBufferPool {
+public:
+  RecyclingBufferPool();
+
+  // Returns a buffer of at least aSize bytes, Alignment aligned, which is
+  // ours to fill until its last copy goes away. Returns null if we're out
+  // of memory.
+  std::shared_ptr<uint8_t> Acquire(size_t aSize);
+
+  // The number of buffers the pool has allocated.
+  uint64_t GetNumAllocations() const { return mNumAllocations; }
+
+private:
+  RecyclingBufferPool(const RecyclingBufferPool&);
+  RecyclingBufferPool& operator=(const RecyclingBufferPool&);
+
+  struct Buffer {
+    std::shared_ptr<uint8_t> data;
+    size_t capacity;
+  };
+  std::vector<Buffer> mBuffers;
+  uint64_t mNumAllocations;
+};
@@ -1,39 +0,0 @@
-// Copyright 2013  Chris Pearce
-//
-// Licensed under the Apache License, Version 2.0 (the "License");
-// you may not use this file except in compliance with the License.
-// You may obtain a copy of the License at
-//
-//    http://www.apache.org/licenses/LICENSE-2.0
-//
-// Unless required by applicable law or agreed to in writing, software
-// distributed under the License is distributed on an "AS IS" BASIS,
-// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
-// See the License for the specific language governing permissions and
-// limitations under the License.
-
-#pragma once
-
-class FrameRotator {
-public:
-  HRESULT Init();
-
-  HRESULT RotateFrame(Rotation aRotation,
-                      IMFSample* aSample,
-                      const MFVideoArea* aPictureRegion,
-                      LONG aInputStride,
-                      LONG aOutputStride,
-                      IMFSample** aOutRotated);
-private:
-
-  HRESULT CreateBGRBitmap(UINT32 aWidth,
-                          UINT32 aHeight,
-                          IWICBitmap** aOutBitmap);
-
-  HRESULT CreateBitmapRenderTarget(IWICBitmap* aBitmap,
-                                   ID2D1RenderTarget** aOutRenderTarget);
-
-  ID2D1FactoryPtr mD2DFactory;
-  IWICImagingFactoryPtr mWICFactory;
-  IDWriteFactoryPtr mDWriteFactory;
-};
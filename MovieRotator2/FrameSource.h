@@ -0,0 +1,160 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// The interfaces between the transcode pipeline and the files it reads
+// frames from and writes them to, so that the pipeline doesn't depend on any
+// particular media framework. Media Foundation's source reader and sink
+// writer are one backend (MFFrameSource, MFFrameSink), and Y4M and WAV files
+// are another (RawFrameSource, RawFrameSink), which runs anywhere.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include "RotationKernels.h"
+
+class KeyframeIndex;
+
+// Times and durations are in 100ns units, as in Media Foundation.
+static const int64_t TimeUnitsPerSecond = 10000000;
+
+struct VideoFormat {
+  VideoFormat()
+    : pixelFormat(PixelFormat_I420),
+      width(0),
+      height(0),
+      frameRateNumer(0),
+      frameRateDenom(1),
+      pixelAspectNumer(1),
+      pixelAspectDenom(1),
+      horizontalSiting(ChromaSiting_Cosited),
+      verticalSiting(ChromaSiting_Centered)
+  {
+  }
+  PixelFormat pixelFormat;
+  // The size of the picture.
+  uint32_t width;
+  uint32_t height;
+  uint32_t frameRateNumer;
+  uint32_t frameRateDenom;
+  uint32_t pixelAspectNumer;
+  uint32_t pixelAspectDenom;
+  ChromaSiting horizontalSiting;
+  ChromaSiting verticalSiting;
+};
+
+// Interleaved signed integer PCM, or 32 bit float PCM, unless it's
+// compressed.
+struct AudioFormat {
+  AudioFormat()
+    : sampleRate(0), numChannels(0), bitsPerSample(16), floatingPoint(false), compressed(false) {}
+  uint32_t sampleRate;
+  uint32_t numChannels;
+  uint32_t bitsPerSample;
+  // True if the samples are 32 bit floats, nominally in [-1, 1].
+  bool floatingPoint;
+  // True if each frame is a compressed access unit, e.g. AAC being copied
+  // without being decoded, which can only be kept or dropped whole.
+  bool compressed;
+};
+
+enum StreamType {
+  Stream_Video,
+  Stream_Audio
+};
+
+// A decoded video frame, or a chunk of audio. Copying a frame doesn't copy
+// its data; the copies share it.
+struct MediaFrame {
+  MediaFrame()
+    : stream(Stream_Video),
+      timestamp(0),
+      duration(0),
+      data(nullptr),
+      length(0),
+      keyframe(false)
+  {
+    image.format = PixelFormat_I420;
+  }
+  StreamType stream;
+  int64_t timestamp;
+  int64_t duration;
+  // The buffer holding the frame. Null if there's no frame.
+  uint8_t* data;
+  size_t length;
+  // For video frames, where the picture's pixels are in the buffer.
+  Image image;
+  // Whether decoding can start at this frame. Only meaningful for
+  // compressed frames, which are copied from file to file without being
+  // decoded when segments are joined.
+  bool keyframe;
+  // Keeps the buffer alive, and returns it to wherever it came from when
+  // the last copy of the frame goes away.
+  std::shared_ptr<void> storage;
+};
+
+class IFrameSource {
+public:
+  virtual ~IFrameSource() {}
+
+  virtual bool HasVideo() const = 0;
+  virtual bool HasAudio() const = 0;
+  virtual const VideoFormat& GetVideoFormat() const = 0;
+  virtual const AudioFormat& GetAudioFormat() const = 0;
+
+  // Returns the duration of the longest stream, or 0 if it's unknown.
+  virtual int64_t GetDuration() const = 0;
+
+  // Reads the next frame of either stream, in the order they're
+  // interleaved in the file. Once every stream has ended, sets
+  // *aOutEndOfStream instead and returns true. Returns false on error.
+  virtual bool ReadFrame(MediaFrame* aOutFrame, bool* aOutEndOfStream) = 0;
+
+  // Seeks so that the next frame of video read is the keyframe at or before
+  // aTime, and the audio starts at about aTime. Returns false on error.
+  virtual bool Seek(int64_t aTime) = 0;
+
+  // Fills in the times of the video's keyframes, if they can be found
+  // without decoding the stream. Returns false otherwise.
+  virtual bool GetKeyframeIndex(KeyframeIndex* aOutIndex) = 0;
+};
+
+// Sinks are created for the formats of the frames they'll be given.
+class IFrameSink {
+public:
+  virtual ~IFrameSink() {}
+
+  virtual bool WriteFrame(const MediaFrame& aFrame) = 0;
+
+  // Completes the file. Called once, after the last frame.
+  virtual bool Finish() = 0;
+};
+
+// Converts audio between formats on its way from the source to the sink,
+// such as to a sample rate the encoder accepts.
+class IAudioFilter {
+public:
+  virtual ~IAudioFilter() {}
+
+  virtual const AudioFormat& GetOutputFormat() const = 0;
+
+  // Filters aInput into *aOutput. aLast is true for the last frame of the
+  // stream, so that the filter can drain. Filters which buffer may leave
+  // *aOutput without data. Returns false on error.
+  virtual bool Process(const MediaFrame& aInput,
+                       bool aLast,
+                       MediaFrame* aOutput) = 0;
+};
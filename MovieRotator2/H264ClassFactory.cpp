@@ -17,6 +17,74 @@
 #include "H264ClassFactory.h"
 #include <assert.h>
 
+// The settings for encoders created on this thread; see
+// AutoH264EncoderSettings.
+static __declspec(thread) const AutoH264EncoderSettings* sThreadEncoderSettings = nullptr;
+
+AutoH264EncoderSettings::AutoH264EncoderSettings(const EncoderSettings& aSettings,
+                                                 UINT32 aFrameRateNumer,
+                                                 UINT32 aFrameRateDenom)
+  : mSettings(aSettings),
+    mFrameRateNumer(aFrameRateNumer),
+    mFrameRateDenom(aFrameRateDenom),
+    mPrevious(sThreadEncoderSettings)
+{
+  sThreadEncoderSettings = this;
+}
+
+AutoH264EncoderSettings::~AutoH264EncoderSettings()
+{
+  sThreadEncoderSettings = mPrevious;
+}
+
+// Maps EncoderSettings onto the CODECAPI properties of a Media Foundation
+// encoder.
+class CodecApiSettingsTarget : public IEncoderSettingsTarget {
+public:
+  explicit CodecApiSettingsTarget(ICodecAPI* aCodecApi) : mCodecApi(aCodecApi) {}
+
+  bool SetRateControl(EncoderRateControl aRateControl, UINT32 aQuality) override {
+    const UINT32 mode = (aRateControl == EncoderRateControl_Quality)
+                      ? eAVEncCommonRateControlMode_Quality
+                      : eAVEncCommonRateControlMode_UnconstrainedVBR;
+    return SetValue(CODECAPI_AVEncCommonRateControlMode, L"AVEncCommonRateControlMode", mode) &&
+           SetValue(CODECAPI_AVEncCommonQuality, L"AVEncCommonQuality", aQuality);
+  }
+
+  bool SetQualityVsSpeed(UINT32 aQualityVsSpeed) override {
+    return SetValue(CODECAPI_AVEncCommonQualityVsSpeed, L"AVEncCommonQualityVsSpeed",
+                    aQualityVsSpeed);
+  }
+
+  bool SetKeyframeInterval(UINT32 aNumFrames) override {
+    return SetValue(CODECAPI_AVEncMPVGOPSize, L"AVEncMPVGOPSize", aNumFrames);
+  }
+
+  bool SetNumBFrames(UINT32 aNumBFrames) override {
+    return SetValue(CODECAPI_AVEncMPVDefaultBPictureCount, L"AVEncMPVDefaultBPictureCount",
+                    aNumBFrames);
+  }
+
+private:
+  // Sets the CODECAPI property aProperty, whose name is aName, to aValue.
+  // The name is only used to log which property the encoder rejected.
+  bool SetValue(const GUID& aProperty, const wchar_t* aName, UINT32 aValue) {
+    VARIANT var;
+    VariantInit(&var);
+    var.vt = VT_UI4;
+    var.ulVal = aValue;
+    HRESULT hr = mCodecApi->SetValue(&aProperty, &var);
+    VariantClear(&var);
+    if (FAILED(hr)) {
+      DBGMSG(L"Encoder rejected setting CODECAPI_%s to %u hr=0x%x\n", aName, aValue, hr);
+      return false;
+    }
+    return true;
+  }
+
+  ICodecAPI* mCodecApi;
+};
+
 
 // See: http://social.msdn.microsoft.com/Forums/en-US/mediafoundationdevelopment/thread/6da521e9-7bb3-4b79-a2b6-b31509224638
 class H264ClassFactory : public IClassFactory
@@ -89,20 +157,15 @@ public:
     ICodecAPIPtr pCodecApi = pEncoder; // QIs
     ENSURE_TRUE(pCodecApi, E_FAIL);
 
-    VARIANT var;
-    VariantInit(&var);
-    var.vt = VT_UI4;
-    var.ulVal = eAVEncCommonRateControlMode_UnconstrainedVBR;
-    hr = pCodecApi->SetValue(&CODECAPI_AVEncCommonRateControlMode, &var);
-    ENSURE_SUCCESS(hr, hr);
-    VariantClear(&var);
-
-    VariantInit(&var);
-    var.vt = VT_UI4;
-    var.ulVal = 100;
-    hr = pCodecApi->SetValue(&CODECAPI_AVEncCommonQuality, &var);
-    ENSURE_SUCCESS(hr, hr);
-    VariantClear(&var);
+    const AutoH264EncoderSettings* threadSettings = sThreadEncoderSettings;
+    EncoderSettings settings = threadSettings ? threadSettings->mSettings
+                                              : GetEncoderPresetSettings(EncoderPreset_Archival);
+    CodecApiSettingsTarget target(pCodecApi);
+    ENSURE_TRUE(ApplyEncoderSettings(settings,
+                                     threadSettings ? threadSettings->mFrameRateNumer : 0,
+                                     threadSettings ? threadSettings->mFrameRateDenom : 0,
+                                     &target),
+                E_FAIL);
 
     hr = pEncoder->QueryInterface(riid, ppv);
     ENSURE_SUCCESS(hr, hr);
@@ -174,9 +237,14 @@ volatile long H264ClassFactory::sServerLocks = 0;
 AutoRegisterH264ClassFactory::AutoRegisterH264ClassFactory()
 {
   mClassFactory = new H264ClassFactory();
-  MFT_REGISTER_TYPE_INFO infoInput = { MFMediaType_Video, MFVideoFormat_RGB32 };
+  MFT_REGISTER_TYPE_INFO infoInput[] = {
+    { MFMediaType_Video, MFVideoFormat_RGB32 },
+    { MFMediaType_Video, MFVideoFormat_NV12 },
+    { MFMediaType_Video, MFVideoFormat_I420 }
+  };
   MFT_REGISTER_TYPE_INFO infoOutput = { MFMediaType_Video, MFVideoFormat_H264 };
-  MFTRegisterLocal(mClassFactory, MFT_CATEGORY_VIDEO_ENCODER, L"ClassFactory", 0, 1, &infoInput, 1, &infoOutput);
+  MFTRegisterLocal(mClassFactory, MFT_CATEGORY_VIDEO_ENCODER, L"ClassFactory", 0,
+                   ARRAYSIZE(infoInput), infoInput, 1, &infoOutput);
 }
 
 AutoRegisterH264ClassFactory::~AutoRegisterH264ClassFactory()
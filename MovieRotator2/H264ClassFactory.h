@@ -15,11 +15,12 @@
 #pragma once
 
 #include "stdafx.h"
+#include "EncoderSettings.h"
 
 // Creates and registers a class factory that creates the H.264 encoder.
 // This is so that we can intercept the creation of the H.264 encoder and
-// crank up it's quality, as we can't do this once the sink writer has had
-// it's media type set.
+// configure its rate control and quality, as we can't do this once the
+// sink writer has had it's media type set.
 class AutoRegisterH264ClassFactory {
 public:
   AutoRegisterH264ClassFactory();
@@ -27,3 +28,23 @@ public:
 private:
   IClassFactoryPtr mClassFactory;
 };
+
+// Sets the settings the H.264 encoders created on this thread are
+// configured with, for the lifetime of a scope. The sink writer creates
+// its encoder in SetInputMediaType(), on the calling thread, so set this
+// around that call. Encoders created on a thread without settings get the
+// archival preset's.
+class AutoH264EncoderSettings {
+public:
+  AutoH264EncoderSettings(const EncoderSettings& aSettings,
+                          UINT32 aFrameRateNumer,
+                          UINT32 aFrameRateDenom);
+  ~AutoH264EncoderSettings();
+private:
+  EncoderSettings mSettings;
+  UINT32 mFrameRateNumer;
+  UINT32 mFrameRateDenom;
+  const AutoH264EncoderSettings* mPrevious;
+
+  friend class H264ClassFactory;
+};
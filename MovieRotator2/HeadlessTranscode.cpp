@@ -0,0 +1,796 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// A command line tool which rotates a Y4M file, and optionally a WAV file of
+// its audio, through the same TranscodePipeline the app transcodes with, and
+// reports how long it took. It doesn't depend on Windows, so the pipeline can
+// be built, run and benchmarked on CI machines. It's not part of the
+// MovieRotator project; build it by compiling it with AudioBatcher.cpp,
+// AudioConversion.cpp, AudioResampler.cpp, AudioRingBuffer.cpp,
+// CpuFeatures.cpp, CubebNullBackend.cpp, DecodeAhead.cpp,
+// EncoderSettings.cpp, FrameBufferPool.cpp, HighResClock.cpp,
+// ImageRotator.cpp, KeyframeIndex.cpp, Mp4Metadata.cpp, PlaybackTiming.cpp,
+// RawFrameSource.cpp, RotateScaler.cpp, RotationKernels.cpp,
+// SegmentedTranscode.cpp, ThreadPool.cpp, ThroughputEstimator.cpp,
+// TranscodePipeline.cpp, TranscodeStats.cpp, WavFile.cpp, Y4MFile.cpp and
+// cubeb/cubeb.c, e.g. with "g++ -O2 -std=c++11 -pthread", compiling cubeb.c
+// as C.
+//
+// Usage: HeadlessTranscode [options] <input.y4m> <output.y4m>
+//        HeadlessTranscode --play-audio [--fast] [--wav <out.wav>] <in.wav>
+//   --rotate <90|180|270>     The rotation; defaults to 90.
+//   --audio <in.wav> <out.wav>
+//                             Passes a WAV file through with the video.
+//   --resample <rate>         Converts the audio to 16 bit at rate Hz, and
+//                             mixes it down to stereo, as the app does for
+//                             the encoder. It's only resampled if its rate
+//                             differs.
+//   --resample-quality <fast|balanced|best>
+//                             The resampler's quality; best by default.
+//   --dither                  Dithers the converted audio.
+//   --audio-batch <n>         Writes the audio n AAC frames at a time; 4 by
+//                             default, as the app does. 0 writes it as it's
+//                             read.
+//   --fit <width>x<height>    Shrinks the frames to fit, as the app does for
+//                             the encoder.
+//   --threads <n>             Rotation threads; 0, the default, means one per
+//                             hardware thread.
+//   --depths <video>,<audio>,<encoder>
+//                             The pipeline's queue depths.
+//   --serial                  Runs the stages one after another.
+//   --segments <n>            Splits the input into up to n segments, which
+//                             are transcoded concurrently into temporary
+//                             files next to the output, and then joined.
+//   --compare                 Runs serially, then pipelined, and reports the
+//                             speedup.
+//   --report <file.json>      Writes how long each stage took to a JSON
+//                             report, as the app does when a job finishes.
+//                             With --compare, of the pipelined run.
+//   --preset <fast|balanced|archival>
+//                             The encoder preset, as a job would select it.
+//                             The output is raw, so this only configures a
+//                             stand-in encoder, which reports the settings
+//                             the preset maps to; archival by default.
+//
+// --play-audio plays a 16 bit or float WAV file as the preview plays audio,
+// through cubeb, with the null backend standing in for the audio device.
+// It's paced in real time, or with --fast, as fast as the feeder can keep
+// the stream fed; --wav writes what the device was given. It reports the
+// callbacks' jitter, how far the stream's position strays from the wall
+// clock, and how fast it drifts, and the underruns.
+//
+// The checks and benchmarks of the pipeline, the kernels and the preview's
+// playback are in the SelfTest tool; see SelfTest.cpp.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "AudioResampler.h"
+#include "AudioRingBuffer.h"
+#include "CubebNullBackend.h"
+#include "PlaybackTiming.h"
+#include "EncoderSettings.h"
+#include "FileIO.h"
+#include "HighResClock.h"
+#include "ImageRotator.h"
+#include "RawFrameSource.h"
+#include "WavFile.h"
+#include "Y4MFile.h"
+#include "SegmentedTranscode.h"
+#include "TranscodePipeline.h"
+#include "TranscodeStats.h"
+
+static const int64_t MinSegmentDuration = TimeUnitsPerSecond;
+
+struct HeadlessOptions {
+  HeadlessOptions()
+    : fitWidth(0),
+      fitHeight(0),
+      numSegments(1),
+      resampleRate(0),
+      resampleQuality(ResampleQuality_Best),
+      dither(false),
+      serial(false),
+      compare(false),
+      preset(EncoderPreset_Archival)
+  {
+  }
+  std::string inputVideo;
+  std::string outputVideo;
+  std::string inputAudio;
+  std::string outputAudio;
+  std::string report;
+  uint32_t fitWidth;
+  uint32_t fitHeight;
+  uint32_t numSegments;
+  // 0 if the audio isn't resampled.
+  uint32_t resampleRate;
+  ResampleQuality resampleQuality;
+  bool dither;
+  bool serial;
+  bool compare;
+  EncoderPreset preset;
+  TranscodeOptions transcode;
+};
+
+static bool
+ParseArgs(int aArgc, char** aArgv, HeadlessOptions* aOutOptions)
+{
+  HeadlessOptions& options = *aOutOptions;
+  int positional = 0;
+  for (int i = 1; i < aArgc; i++) {
+    const char* arg = aArgv[i];
+    const bool haveValue = i + 1 < aArgc;
+    if (!strcmp(arg, "--rotate") && haveValue) {
+      int degrees = atoi(aArgv[++i]);
+      if (degrees != 90 && degrees != 180 && degrees != 270) {
+        return false;
+      }
+      options.transcode.rotation = Rotation(degrees / 90);
+    } else if (!strcmp(arg, "--audio") && i + 2 < aArgc) {
+      options.inputAudio = aArgv[++i];
+      options.outputAudio = aArgv[++i];
+    } else if (!strcmp(arg, "--resample") && haveValue) {
+      options.resampleRate = uint32_t(atoi(aArgv[++i]));
+      if (!options.resampleRate) {
+        return false;
+      }
+    } else if (!strcmp(arg, "--resample-quality") && haveValue) {
+      const char* value = aArgv[++i];
+      int quality = 0;
+      while (quality < NumResampleQualities &&
+             strcmp(value, GetResampleQualityName(ResampleQuality(quality)))) {
+        quality++;
+      }
+      if (quality == NumResampleQualities) {
+        return false;
+      }
+      options.resampleQuality = ResampleQuality(quality);
+    } else if (!strcmp(arg, "--dither")) {
+      options.dither = true;
+    } else if (!strcmp(arg, "--audio-batch") && haveValue) {
+      options.transcode.audioBatchFrames = uint32_t(atoi(aArgv[++i]));
+    } else if (!strcmp(arg, "--fit") && haveValue) {
+      unsigned width = 0, height = 0;
+      const char* value = aArgv[++i];
+      const char* x = strchr(value, 'x');
+      width = x ? unsigned(atoi(value)) : 0;
+      height = x ? unsigned(atoi(x + 1)) : 0;
+      if (!width || !height) {
+        return false;
+      }
+      options.fitWidth = width;
+      options.fitHeight = height;
+    } else if (!strcmp(arg, "--threads") && haveValue) {
+      options.transcode.numRotationThreads = uint32_t(atoi(aArgv[++i]));
+    } else if (!strcmp(arg, "--depths") && haveValue) {
+      TranscodeQueueDepths& depths = options.transcode.queueDepths;
+      const char* value = aArgv[++i];
+      depths.decodedVideo = uint32_t(atoi(value));
+      value = strchr(value, ',');
+      depths.decodedAudio = value ? uint32_t(atoi(++value)) : 0;
+      value = value ? strchr(value, ',') : nullptr;
+      depths.encoder = value ? uint32_t(atoi(++value)) : 0;
+      if (!depths.decodedVideo || !depths.decodedAudio || !depths.encoder) {
+        return false;
+      }
+    } else if (!strcmp(arg, "--segments") && haveValue) {
+      options.numSegments = uint32_t(atoi(aArgv[++i]));
+      if (!options.numSegments) {
+        return false;
+      }
+    } else if (!strcmp(arg, "--serial")) {
+      options.serial = true;
+    } else if (!strcmp(arg, "--compare")) {
+      options.compare = true;
+    } else if (!strcmp(arg, "--report") && haveValue) {
+      options.report = aArgv[++i];
+    } else if (!strcmp(arg, "--preset") && haveValue) {
+      if (!ParseEncoderPreset(aArgv[++i], &options.preset)) {
+        return false;
+      }
+    } else if (arg[0] != '-' && positional == 0) {
+      options.inputVideo = arg;
+      positional++;
+    } else if (arg[0] != '-' && positional == 1) {
+      options.outputVideo = arg;
+      positional++;
+    } else {
+      return false;
+    }
+  }
+  return positional == 2;
+}
+
+// Returns the format of the frames written for frames of aInputFormat.
+static VideoFormat
+GetOutputFormat(const HeadlessOptions& aOptions, const VideoFormat& aInputFormat)
+{
+  VideoFormat outputFormat = aInputFormat;
+  if (aOptions.transcode.rotation != ROTATE_180) {
+    outputFormat.width = aInputFormat.height;
+    outputFormat.height = aInputFormat.width;
+    outputFormat.pixelAspectNumer = aInputFormat.pixelAspectDenom;
+    outputFormat.pixelAspectDenom = aInputFormat.pixelAspectNumer;
+  }
+  if (aOptions.fitWidth) {
+    FitFrameSize(outputFormat.width, outputFormat.height,
+                 aOptions.fitWidth, aOptions.fitHeight,
+                 &outputFormat.width, &outputFormat.height);
+  }
+  return outputFormat;
+}
+
+// Creates the filter --resample asks for, for audio in aFormat, in
+// *aOutFilter; leaves it null if the audio isn't resampled. Returns false
+// if the filter can't take the audio.
+static bool
+CreateAudioFilter(const HeadlessOptions& aOptions,
+                  const AudioFormat& aFormat,
+                  std::unique_ptr<IAudioFilter>* aOutFilter)
+{
+  aOutFilter->reset();
+  if (!aOptions.resampleRate || !aFormat.sampleRate) {
+    return true;
+  }
+  std::unique_ptr<ResamplingAudioFilter> filter(new ResamplingAudioFilter());
+  if (!filter->Init(aFormat, aOptions.resampleRate,
+                    std::min<uint32_t>(aFormat.numChannels, 2),
+                    aOptions.resampleQuality, aOptions.dither)) {
+    return false;
+  }
+  *aOutFilter = std::move(filter);
+  return true;
+}
+
+// Transcodes each segment from the input files into Y4M and WAV files
+// named after the output files, and joins them into the output files.
+class RawSegmentBackend : public ISegmentBackend {
+public:
+  explicit RawSegmentBackend(const HeadlessOptions& aOptions) : mOptions(aOptions) {}
+
+  bool OpenSegment(uint32_t aIndex,
+                   SegmentStreams* aOutStreams,
+                   TranscodeOptions* /*aOptions*/) override
+  {
+    std::unique_ptr<RawFrameSource> source(new RawFrameSource());
+    if (!source->Open(mOptions.inputVideo, mOptions.inputAudio)) {
+      return false;
+    }
+    std::unique_ptr<IAudioFilter> filter;
+    if (!CreateAudioFilter(mOptions, source->GetAudioFormat(), &filter)) {
+      return false;
+    }
+    std::unique_ptr<RawFrameSink> sink(new RawFrameSink());
+    if (!sink->Open(GetSegmentFilename(mOptions.outputVideo, aIndex),
+                    GetOutputFormat(mOptions, source->GetVideoFormat()),
+                    GetSegmentFilename(mOptions.outputAudio, aIndex),
+                    filter ? filter->GetOutputFormat() : source->GetAudioFormat())) {
+      return false;
+    }
+    aOutStreams->source = std::move(source);
+    aOutStreams->audioFilter = std::move(filter);
+    aOutStreams->sink = std::move(sink);
+    return true;
+  }
+
+  bool OpenSegmentOutput(uint32_t aIndex,
+                         std::unique_ptr<IFrameSource>* aOutSource) override
+  {
+    std::unique_ptr<RawFrameSource> source(new RawFrameSource());
+    if (!source->Open(GetSegmentFilename(mOptions.outputVideo, aIndex),
+                      GetSegmentFilename(mOptions.outputAudio, aIndex))) {
+      return false;
+    }
+    *aOutSource = std::move(source);
+    return true;
+  }
+
+  bool CreateJoinedSink(IFrameSource* aFirstSegment,
+                        std::unique_ptr<IFrameSink>* aOutSink) override
+  {
+    std::unique_ptr<RawFrameSink> sink(new RawFrameSink());
+    if (!sink->Open(mOptions.outputVideo, aFirstSegment->GetVideoFormat(),
+                    mOptions.outputAudio, aFirstSegment->GetAudioFormat())) {
+      return false;
+    }
+    *aOutSink = std::move(sink);
+    return true;
+  }
+
+  void RemoveSegmentOutput(uint32_t aIndex) override
+  {
+    remove(GetSegmentFilename(mOptions.outputVideo, aIndex).c_str());
+    if (!mOptions.outputAudio.empty()) {
+      remove(GetSegmentFilename(mOptions.outputAudio, aIndex).c_str());
+    }
+  }
+
+private:
+  // Returns the name of segment aIndex's part of aFilename, or an empty
+  // name if aFilename is empty.
+  static std::string GetSegmentFilename(const std::string& aFilename, uint32_t aIndex)
+  {
+    if (aFilename.empty()) {
+      return aFilename;
+    }
+    const size_t dot = aFilename.rfind('.');
+    const std::string extension = (dot == std::string::npos) ? std::string() : aFilename.substr(dot);
+    return aFilename + ".segment" + std::to_string(aIndex) + extension;
+  }
+
+  const HeadlessOptions& mOptions;
+};
+
+// Runs a segmented transcode, if the input splits into more than one
+// segment, and prints how long it took. Sets *aOutSplit to whether it did.
+// Stands in for the app's H.264 encoder, which isn't available here, so
+// that the presets are mapped onto encoder controls the same way as in the
+// app. It only reports what it was configured with.
+class StandInEncoder : public IEncoderSettingsTarget {
+public:
+  bool SetRateControl(EncoderRateControl aRateControl, uint32_t aQuality) override {
+    printf("  encoder: %s rate control at quality %u",
+           aRateControl == EncoderRateControl_Quality ? "quality" : "unconstrained VBR",
+           aQuality);
+    return true;
+  }
+  bool SetQualityVsSpeed(uint32_t aQualityVsSpeed) override {
+    printf(", quality vs speed %u", aQualityVsSpeed);
+    return true;
+  }
+  bool SetKeyframeInterval(uint32_t aNumFrames) override {
+    printf(", keyframe every %u frames", aNumFrames);
+    return true;
+  }
+  bool SetNumBFrames(uint32_t aNumBFrames) override {
+    printf(", %u B-frames", aNumBFrames);
+    return true;
+  }
+};
+
+// Configures a StandInEncoder with aOptions' preset, for frames of aFormat.
+static void
+ConfigureStandInEncoder(const HeadlessOptions& aOptions, const VideoFormat& aFormat)
+{
+  StandInEncoder encoder;
+  printf("%s preset:\n", GetEncoderPresetName(aOptions.preset));
+  ApplyEncoderSettings(GetEncoderPresetSettings(aOptions.preset),
+                       aFormat.frameRateNumer, aFormat.frameRateDenom,
+                       &encoder);
+  printf("\n");
+}
+
+// Returns the size of aFilename in bytes, or 0 if it can't be opened.
+static uint64_t
+GetFileSizeBytes(const std::string& aFilename)
+{
+  FILE* file = aFilename.empty() ? nullptr : OpenFile(aFilename, "rb");
+  if (!file) {
+    return 0;
+  }
+  const int64_t size = GetFileSize(file);
+  fclose(file);
+  return uint64_t(std::max<int64_t>(size, 0));
+}
+
+// Writes the report requested by --report, if any. aInfo has the stats
+// of the transcode filled in, and we fill in the files'. Returns false on
+// error.
+static bool
+WriteReport(const HeadlessOptions& aOptions,
+            TranscodeReportInfo& aInfo,
+            const TranscodeStats& aStats)
+{
+  if (aOptions.report.empty()) {
+    return true;
+  }
+  aInfo.inputFilename = aOptions.inputVideo;
+  aInfo.outputFilename = aOptions.outputVideo;
+  aInfo.inputBytes = GetFileSizeBytes(aOptions.inputVideo) +
+                     GetFileSizeBytes(aOptions.inputAudio);
+  aInfo.outputBytes = GetFileSizeBytes(aOptions.outputVideo) +
+                      GetFileSizeBytes(aOptions.outputAudio);
+  if (!WriteTranscodeReport(aOptions.report, aInfo, aStats)) {
+    fprintf(stderr, "Failed to write %s\n", aOptions.report.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Returns false on error.
+static bool
+TranscodeSegmented(const HeadlessOptions& aOptions,
+                   const TranscodeOptions& aTranscodeOptions,
+                   RawFrameSource& aSource,
+                   bool* aOutSplit)
+{
+  KeyframeIndex index;
+  std::vector<TranscodeSegment> segments;
+  if (aSource.GetKeyframeIndex(&index)) {
+    segments = SplitAtKeyframes(index, aSource.GetDuration(),
+                                aOptions.numSegments, MinSegmentDuration);
+  }
+  *aOutSplit = segments.size() > 1;
+  if (!*aOutSplit) {
+    return true;
+  }
+
+  RawSegmentBackend backend(aOptions);
+  SegmentedTranscode transcode(&backend);
+  if (!transcode.Init(segments, aSource.GetDuration(), aTranscodeOptions)) {
+    return false;
+  }
+  const uint64_t start = GetHighResTimeUs();
+  while (transcode.GetProgress() < 1000) {
+    if (!transcode.Transcode()) {
+      fprintf(stderr, "Segmented transcode failed\n");
+      return false;
+    }
+  }
+  const uint64_t elapsedUs = GetHighResTimeUs() - start;
+  const double seconds = elapsedUs / 1e6;
+
+  const uint64_t numFrames = transcode.GetNumVideoFramesWritten();
+  printf("%u segments: %llu frames in %.0lf ms, %.1lf fps\n",
+         transcode.GetNumSegments(),
+         (unsigned long long)numFrames, seconds * 1000.0,
+         numFrames / (seconds > 0 ? seconds : 1e-6));
+  for (size_t i = 0; i < segments.size(); i++) {
+    printf("  segment %u: %.3lf s to %.3lf s\n", unsigned(i),
+           double(segments[i].start) / TimeUnitsPerSecond,
+           double(std::min(segments[i].end, aSource.GetDuration())) / TimeUnitsPerSecond);
+  }
+
+  TranscodeReportInfo info;
+  info.pipelined = aTranscodeOptions.pipelined;
+  info.numSegments = transcode.GetNumSegments();
+  info.wallTimeUs = elapsedUs;
+  info.numVideoFrames = numFrames;
+  return WriteReport(aOptions, info, transcode.GetStats());
+}
+
+// Runs one transcode, and prints how long it took. Returns false on error.
+static bool
+Transcode(const HeadlessOptions& aOptions, bool aPipelined)
+{
+  TranscodeOptions options = aOptions.transcode;
+  options.pipelined = aPipelined;
+  options.tile = AutotuneRotateTileShape(GetBestRotateKernel());
+  // The app caches the tuned tile shape, so startup starts after tuning.
+  options.startTimeUs = GetHighResTimeUs();
+
+  RawFrameSource source;
+  if (!source.Open(aOptions.inputVideo, aOptions.inputAudio)) {
+    fprintf(stderr, "Failed to open %s\n", aOptions.inputVideo.c_str());
+    return false;
+  }
+
+  const VideoFormat& inputFormat = source.GetVideoFormat();
+  const VideoFormat outputFormat = GetOutputFormat(aOptions, inputFormat);
+  options.outputWidth = outputFormat.width;
+  options.outputHeight = outputFormat.height;
+  ConfigureStandInEncoder(aOptions, inputFormat);
+
+  if (aOptions.numSegments > 1) {
+    bool split = false;
+    if (!TranscodeSegmented(aOptions, options, source, &split)) {
+      return false;
+    }
+    if (split) {
+      return true;
+    }
+  }
+
+  std::unique_ptr<IAudioFilter> filter;
+  if (!CreateAudioFilter(aOptions, source.GetAudioFormat(), &filter)) {
+    fprintf(stderr, "Can't resample %s\n", aOptions.inputAudio.c_str());
+    return false;
+  }
+
+  RawFrameSink sink;
+  if (!sink.Open(aOptions.outputVideo, outputFormat,
+                 aOptions.outputAudio,
+                 filter ? filter->GetOutputFormat() : source.GetAudioFormat())) {
+    fprintf(stderr, "Failed to create %s\n", aOptions.outputVideo.c_str());
+    return false;
+  }
+
+  TranscodePipeline pipeline(&source, filter.get(), &sink);
+  if (!pipeline.Init(options)) {
+    fprintf(stderr, "Can't transcode %ux%u frames to %ux%u\n",
+            inputFormat.width, inputFormat.height,
+            outputFormat.width, outputFormat.height);
+    return false;
+  }
+
+  const uint64_t start = GetHighResTimeUs();
+  while (pipeline.GetProgress() < 1000) {
+    if (!pipeline.Transcode()) {
+      fprintf(stderr, "Transcode failed\n");
+      return false;
+    }
+  }
+  const uint64_t elapsedUs = GetHighResTimeUs() - start;
+  const double seconds = elapsedUs / 1e6;
+
+  const uint64_t numFrames = pipeline.GetNumVideoFramesWritten();
+  printf("%s: %ux%u -> %ux%u, %llu frames in %.0lf ms, %.1lf fps, %u rotation threads\n",
+         aPipelined ? "pipelined" : "serial",
+         inputFormat.width, inputFormat.height,
+         outputFormat.width, outputFormat.height,
+         (unsigned long long)numFrames, seconds * 1000.0,
+         numFrames / (seconds > 0 ? seconds : 1e-6),
+         pipeline.GetRotator().GetNumThreads());
+  printf("  startup latency: %.2lf ms to the first written frame\n",
+         pipeline.GetStartupLatencyUs() / 1000.0);
+  if (!aOptions.inputAudio.empty()) {
+    printf("  audio: %llu frames written\n",
+           (unsigned long long)pipeline.GetNumAudioFramesWritten());
+  }
+  if (aPipelined) {
+    TranscodeQueueDepths peaks = pipeline.GetPeakQueueDepths();
+    printf("  peak queue depths: decoded video %u/%u, decoded audio %u/%u, encoder %u/%u\n",
+           peaks.decodedVideo, options.queueDepths.decodedVideo,
+           peaks.decodedAudio, options.queueDepths.decodedAudio,
+           peaks.encoder, options.queueDepths.encoder);
+  }
+  const TranscodeStats& stats = pipeline.GetStats();
+  for (int i = 0; i < NumTranscodeStages; i++) {
+    const LatencyHistogram& latency = stats.Get(TranscodeStage(i)).latency;
+    if (latency.GetCount()) {
+      printf("  %-6s p50 %.3lf ms, p95 %.3lf ms, p99 %.3lf ms, max %.3lf ms\n",
+             GetTranscodeStageName(TranscodeStage(i)),
+             latency.GetPercentileUs(50) / 1000.0,
+             latency.GetPercentileUs(95) / 1000.0,
+             latency.GetPercentileUs(99) / 1000.0,
+             latency.GetMaxUs() / 1000.0);
+    }
+  }
+  if (filter) {
+    // CreateAudioFilter() only makes resampling filters.
+    const AudioFilterAllocationStats allocations =
+      static_cast<ResamplingAudioFilter*>(filter.get())->GetAllocationStats();
+    printf("  audio filter: %llu frames, %llu allocations, the last in frame %llu\n",
+           (unsigned long long)allocations.numFrames,
+           (unsigned long long)allocations.numAllocations,
+           (unsigned long long)allocations.lastAllocationFrame);
+  }
+
+  TranscodeReportInfo info;
+  info.pipelined = aPipelined;
+  info.wallTimeUs = elapsedUs;
+  info.startupLatencyUs = pipeline.GetStartupLatencyUs();
+  info.numVideoFrames = numFrames;
+  return WriteReport(aOptions, info, stats);
+}
+
+
+// The state shared with the callbacks of --play-audio's stream.
+struct HeadlessPlayback {
+  HeadlessPlayback()
+    : waitForData(false),
+      fed(false),
+      ended(false),
+      failed(false)
+  {
+  }
+  AudioRingBuffer buffer;
+  // When the stream isn't paced in real time, it would otherwise run far
+  // ahead of the feeder and play mostly silence, so the data callback waits
+  // for the feeder instead, and we measure how fast the two go together.
+  bool waitForData;
+  std::atomic<bool> fed;
+  std::mutex mutex;
+  std::condition_variable condVar;
+  bool ended;
+  bool failed;
+};
+
+static long
+HeadlessDataCallback(cubeb_stream* /*aStream*/, void* aUser, void* aBuffer, long aNumFrames)
+{
+  HeadlessPlayback* playback = static_cast<HeadlessPlayback*>(aUser);
+  while (playback->waitForData && !playback->fed &&
+         playback->buffer.GetAvailableFrames() < uint32_t(aNumFrames)) {
+    std::this_thread::yield();
+  }
+  return playback->buffer.Render(static_cast<uint8_t*>(aBuffer), uint32_t(aNumFrames));
+}
+
+static void
+HeadlessStateCallback(cubeb_stream* /*aStream*/, void* aUser, cubeb_state aState)
+{
+  HeadlessPlayback* playback = static_cast<HeadlessPlayback*>(aUser);
+  if (aState == CUBEB_STATE_DRAINED || aState == CUBEB_STATE_ERROR) {
+    std::lock_guard<std::mutex> lock(playback->mutex);
+    playback->ended = true;
+    playback->failed = (aState == CUBEB_STATE_ERROR);
+    playback->condVar.notify_all();
+  }
+}
+
+// Runs --play-audio. Plays aInput through the null cubeb backend, as the
+// preview plays audio: a feeder thread keeps an AudioRingBuffer topped up,
+// and the data callback renders from it. Reports how late the callbacks
+// were, how far the stream's position strayed from the wall clock, and
+// the underruns. Returns false on error.
+static bool
+PlayAudio(const std::string& aInput, const NullAudioOptions& aOptions)
+{
+  // How often the position is compared with the wall clock.
+  static const uint32_t PositionIntervalMs = 5;
+
+  WavReader reader;
+  if (!reader.Open(aInput)) {
+    fprintf(stderr, "Can't read %s\n", aInput.c_str());
+    return false;
+  }
+  const AudioFormat format = reader.GetFormat();
+  cubeb_stream_params params;
+  params.rate = format.sampleRate;
+  params.channels = format.numChannels;
+  if (format.floatingPoint) {
+    params.format = CUBEB_SAMPLE_FLOAT32NE;
+  } else if (format.bitsPerSample == 16) {
+    params.format = CUBEB_SAMPLE_S16NE;
+  } else {
+    fprintf(stderr, "Only 16 bit and float audio can be played\n");
+    return false;
+  }
+  const uint32_t frameSize = format.numChannels * format.bitsPerSample / 8;
+
+  HeadlessPlayback playback;
+  playback.waitForData = aOptions.pacing == NullAudioPacing_Fast;
+  cubeb* context = nullptr;
+  cubeb_stream* stream = nullptr;
+  if (!playback.buffer.Init(frameSize, format.sampleRate / 2) ||
+      InitNullCubeb(&context, "HeadlessTranscode", aOptions) != CUBEB_OK) {
+    return false;
+  }
+  if (cubeb_stream_init(context, &stream, "HeadlessTranscode", params, 250,
+                        HeadlessDataCallback, HeadlessStateCallback,
+                        &playback) != CUBEB_OK) {
+    fprintf(stderr, "Can't create the stream\n");
+    cubeb_destroy(context);
+    return false;
+  }
+
+  // As CubebAudioClock's feeder does, but polling more often, so that it
+  // can keep up when the stream runs as fast as it can.
+  std::atomic<bool> stop(false);
+  bool readOk = true;
+  std::thread feeder([&]() {
+    std::vector<uint8_t> chunk(AudioBatcher::AacFrameSamples * frameSize);
+    uint32_t numFrames = 0;
+    while (!stop && (readOk = reader.Read(&chunk[0], AudioBatcher::AacFrameSamples, &numFrames)) &&
+           numFrames) {
+      for (uint32_t written = 0; written < numFrames && !stop; ) {
+        written += playback.buffer.Write(&chunk[written * frameSize], numFrames - written);
+        if (written < numFrames) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+      }
+    }
+    playback.buffer.MarkEnded();
+    playback.fed = true;
+  });
+
+  // Start once the buffer's full, as the app does.
+  while (playback.buffer.GetFreeFrames() > AudioBatcher::AacFrameSamples &&
+         playback.buffer.GetAvailableFrames() < reader.GetNumFrames()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  const bool realTime = aOptions.pacing == NullAudioPacing_RealTime;
+  LatencyHistogram positionErrors;
+  AVDriftEstimator drift;
+  const uint64_t startUs = GetHighResTimeUs();
+  cubeb_stream_start(stream);
+  {
+    std::unique_lock<std::mutex> lock(playback.mutex);
+    while (!playback.ended) {
+      playback.condVar.wait_for(lock, std::chrono::milliseconds(PositionIntervalMs));
+      uint64_t position = 0;
+      if (realTime && !playback.ended &&
+          cubeb_stream_get_position(stream, &position) == CUBEB_OK) {
+        const int64_t elapsedUs = int64_t(GetHighResTimeUs() - startUs);
+        const int64_t positionUs = int64_t(position * 1000000 / format.sampleRate);
+        positionErrors.Add(uint64_t(llabs(elapsedUs - positionUs)));
+        drift.Add(uint64_t(elapsedUs), positionUs - elapsedUs);
+      }
+    }
+  }
+  const uint64_t wallTimeUs = GetHighResTimeUs() - startUs;
+  stop = true;
+  feeder.join();
+
+  NullAudioStats stats;
+  GetNullCubebStats(stream, &stats);
+  cubeb_stream_destroy(stream);
+  cubeb_destroy(context);
+  const AudioRingStats ringStats = playback.buffer.GetStats();
+
+  printf("null backend, %s: %.2lf s of audio in %.2lf s, %llu callbacks of %.0lf frames\n",
+         realTime ? "real time" : "fast",
+         double(stats.numFrames) / format.sampleRate, wallTimeUs / 1e6,
+         (unsigned long long)stats.numCallbacks,
+         stats.numCallbacks ? double(stats.numFrames) / stats.numCallbacks : 0.0);
+  if (realTime) {
+    printf("  callback lateness: p50 %.3lf ms, p99 %.3lf ms, max %.3lf ms\n",
+           stats.lateness.GetPercentileUs(50) / 1e3,
+           stats.lateness.GetPercentileUs(99) / 1e3,
+           stats.lateness.GetMaxUs() / 1e3);
+    printf("  position vs wall clock: p50 %.3lf ms, p99 %.3lf ms, max %.3lf ms\n",
+           positionErrors.GetPercentileUs(50) / 1e3,
+           positionErrors.GetPercentileUs(99) / 1e3,
+           positionErrors.GetMaxUs() / 1e3);
+    printf("  position drift from wall clock: %.1lf ppm\n", drift.GetDriftPpm());
+  }
+  printf("  callback time: p50 %llu us, max %llu us\n",
+         (unsigned long long)stats.callbackTime.GetPercentileUs(50),
+         (unsigned long long)stats.callbackTime.GetMaxUs());
+  printf("  %llu underruns, %.1lf ms of silence\n",
+         (unsigned long long)ringStats.numUnderruns,
+         ringStats.numSilentFrames * 1e3 / format.sampleRate);
+  return readOk && !playback.failed;
+}
+
+
+int
+main(int aArgc, char** aArgv)
+{
+  if (aArgc >= 3 && !strcmp(aArgv[1], "--play-audio")) {
+    NullAudioOptions options;
+    for (int i = 2; i + 1 < aArgc; i++) {
+      if (!strcmp(aArgv[i], "--fast")) {
+        options.pacing = NullAudioPacing_Fast;
+      } else if (!strcmp(aArgv[i], "--wav") && i + 2 < aArgc) {
+        options.wavFilename = aArgv[++i];
+      } else {
+        fprintf(stderr, "Unknown option %s\n", aArgv[i]);
+        return 2;
+      }
+    }
+    return PlayAudio(aArgv[aArgc - 1], options) ? 0 : 1;
+  }
+
+  HeadlessOptions options;
+  if (!ParseArgs(aArgc, aArgv, &options)) {
+    fprintf(stderr,
+            "Usage: %s [--rotate 90|180|270] [--audio <in.wav> <out.wav>]\n"
+            "         [--resample <rate>] [--resample-quality fast|balanced|best]\n"
+            "         [--dither] [--audio-batch <n>]\n"
+            "         [--fit <width>x<height>] [--threads <n>]\n"
+            "         [--depths <video>,<audio>,<encoder>] [--segments <n>]\n"
+            "         [--serial | --compare] [--report <file.json>]\n"
+            "         [--preset fast|balanced|archival]\n"
+            "         <input.y4m> <output.y4m>\n"
+            "       %s --play-audio [--fast] [--wav <out.wav>] <in.wav>\n",
+            aArgv[0], aArgv[0]);
+    return 2;
+  }
+
+  if (options.compare) {
+    return (Transcode(options, false) && Transcode(options, true)) ? 0 : 1;
+  }
+  return Transcode(options, !options.serial) ? 0 : 1;
+}
@@ -0,0 +1,69 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "HighResClock.h"
+
+#if defined(_WIN32)
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+uint64_t
+GetHighResTimeUs()
+{
+  // The counter frequency is fixed at boot, so it doesn't matter if two
+  // threads race to initialize this.
+  static volatile LONGLONG sFrequency = 0;
+  if (!sFrequency) {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    sFrequency = frequency.QuadPart;
+  }
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  // Split the conversion to avoid overflowing on machines which have been
+  // up for a long time.
+  uint64_t seconds = now.QuadPart / sFrequency;
+  uint64_t remainder = now.QuadPart % sFrequency;
+  return seconds * 1000000 + (remainder * 1000000) / sFrequency;
+}
+
+void
+SleepUs(uint64_t aDurationUs)
+{
+  Sleep(DWORD((aDurationUs + 999) / 1000));
+}
+
+#else
+
+#include <time.h>
+
+uint64_t
+GetHighResTimeUs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+void
+SleepUs(uint64_t aDurationUs)
+{
+  struct timespec ts;
+  ts.tv_sec = time_t(aDurationUs / 1000000);
+  ts.tv_nsec = long(aDurationUs % 1000000) * 1000;
+  nanosleep(&ts, nullptr);
+}
+
+#endif
@@ -0,0 +1,38 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+
+// Returns a monotonically increasing time in microseconds. Only the
+// difference between two times is meaningful. Threadsafe.
+//
+// Note: We don't use std::chrono here, as in VS2012 all the std::chrono
+// clocks are implemented on top of the system clock, which only has 1-16ms
+// resolution and isn't monotonic.
+uint64_t GetHighResTimeUs();
+
+// Blocks the calling thread for at least aDurationUs microseconds, which
+// should be short. Unlike std::this_thread::sleep_for() and the timed waits
+// of std::condition_variable, which VS2012 also bases on the system clock,
+// this isn't lengthened if the system clock is set back. On Windows it
+// sleeps in whole milliseconds, rounded up, and the scheduler may round
+// that up to its timer period.
+void SleepUs(uint64_t aDurationUs);
+
+// A function which returns a monotonic time in microseconds. Things which
+// read the time through one default to GetHighResTimeUs, and can be driven
+// by a fake clock instead.
+typedef uint64_t (*TimeSourceUs)();
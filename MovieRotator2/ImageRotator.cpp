@@ -0,0 +1,242 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "ImageRotator.h"
+#include "HighResClock.h"
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+ImageRotator::ImageRotator()
+  : mHorizontalSiting(ChromaSiting_Cosited),
+    mVerticalSiting(ChromaSiting_Centered),
+    mScaleFilter(ScaleFilter_Lanczos3),
+    mScalerRotation(ROTATE_0),
+    mScalerFormat(PixelFormat_RGB32),
+    mScalerSrcWidth(0),
+    mScalerSrcHeight(0),
+    mScalerDstWidth(0),
+    mScalerDstHeight(0),
+    mKernel(RotateKernel_Auto)
+{
+}
+
+void
+ImageRotator::Init(uint32_t aNumThreads, RotateTileShape aTile)
+{
+  mKernel = GetBestRotateKernel();
+  mTile = aTile;
+  mThreadPool.reset(new ThreadPool(aNumThreads));
+}
+
+void
+ImageRotator::SetChromaSiting(ChromaSiting aHorizontal, ChromaSiting aVertical)
+{
+  mHorizontalSiting = aHorizontal;
+  mVerticalSiting = aVertical;
+  // Make the next scaled image recompute the filters.
+  mScalerSrcWidth = 0;
+}
+
+void
+ImageRotator::SetScaleFilter(ScaleFilter aFilter)
+{
+  mScaleFilter = aFilter;
+  mScalerSrcWidth = 0;
+}
+
+uint32_t
+ImageRotator::GetNumThreads() const
+{
+  return mThreadPool ? mThreadPool->GetNumThreads() : 1;
+}
+
+bool
+ImageRotator::Rotate(Rotation aRotation, const Image& aSrc, const Image& aDst)
+{
+  if (aSrc.format != aDst.format) {
+    return false;
+  }
+  const bool swap = (aRotation == ROTATE_90 || aRotation == ROTATE_270);
+  const uint32_t rotatedWidth = swap ? aSrc.planes[0].height : aSrc.planes[0].width;
+  const uint32_t rotatedHeight = swap ? aSrc.planes[0].width : aSrc.planes[0].height;
+  if (aDst.planes[0].width != rotatedWidth || aDst.planes[0].height != rotatedHeight) {
+    return RotateAndScaleImage(aRotation, aSrc, aDst);
+  }
+  return RotateImage(aRotation, aSrc, aDst);
+}
+
+template<typename Function>
+bool
+ImageRotator::ForEachBand(uint32_t aNumRows, const Function& aFunction)
+{
+  const uint32_t numThreads = GetNumThreads();
+  if (numThreads == 1) {
+    return aFunction(0, aNumRows);
+  }
+
+  // Use a few bands per thread, so that a thread which is descheduled for a
+  // while doesn't hold up the whole image. Band heights are a multiple of 32
+  // rows, so that only the last band ends with a partial SIMD block or
+  // scaler tile.
+  uint32_t bandHeight = (aNumRows + numThreads * 4 - 1) / (numThreads * 4);
+  bandHeight = (bandHeight + 31) & ~31;
+  const uint32_t numBands = (aNumRows + bandHeight - 1) / bandHeight;
+
+  std::atomic<bool> succeeded(true);
+  mThreadPool->ParallelFor(numBands, [&](uint32_t aBand) {
+    uint32_t y0 = aBand * bandHeight;
+    uint32_t y1 = std::min(y0 + bandHeight, aNumRows);
+    if (!aFunction(y0, y1)) {
+      succeeded = false;
+    }
+  });
+  return succeeded;
+}
+
+bool
+ImageRotator::RotatePlane(Rotation aRotation,
+                          const ImagePlane& aSrc,
+                          const ImagePlane& aDst,
+                          uint32_t aBytesPerPixel)
+{
+  if (GetNumThreads() == 1) {
+    return ::RotatePlane(aRotation, aSrc, aDst, aBytesPerPixel, mKernel, mTile);
+  }
+  return ForEachBand(aDst.height, [&](uint32_t aY0, uint32_t aY1) {
+    return RotatePlaneBand(aRotation, aSrc, aDst, aBytesPerPixel,
+                           aY0, aY1, mKernel, mTile);
+  });
+}
+
+bool
+ImageRotator::RotateImage(Rotation aRotation,
+                          const Image& aSrc,
+                          const Image& aDst)
+{
+  for (uint32_t i = 0; i < GetNumPlanes(aSrc.format); i++) {
+    const uint32_t bytesPerPixel = GetBytesPerPixel(aSrc.format, i);
+    if (!RotatePlane(aRotation, aSrc.planes[i], aDst.planes[i], bytesPerPixel)) {
+      return false;
+    }
+    if (i > 0) {
+      ResiteRotatedChroma(aRotation, aDst.planes[i], bytesPerPixel,
+                          aSrc.planes[0].width, aSrc.planes[0].height,
+                          mHorizontalSiting, mVerticalSiting);
+    }
+  }
+  return true;
+}
+
+bool
+ImageRotator::RotateAndScaleImage(Rotation aRotation,
+                                  const Image& aSrc,
+                                  const Image& aDst)
+{
+  const uint32_t numPlanes = GetNumPlanes(aSrc.format);
+  if (aRotation != mScalerRotation ||
+      aSrc.format != mScalerFormat ||
+      aSrc.planes[0].width != mScalerSrcWidth ||
+      aSrc.planes[0].height != mScalerSrcHeight ||
+      aDst.planes[0].width != mScalerDstWidth ||
+      aDst.planes[0].height != mScalerDstHeight) {
+    for (uint32_t i = 0; i < numPlanes; i++) {
+      if (!mScalers[i].Init(aRotation,
+                            aSrc.planes[i].width, aSrc.planes[i].height,
+                            aDst.planes[i].width, aDst.planes[i].height,
+                            GetBytesPerPixel(aSrc.format, i), mScaleFilter,
+                            i > 0, mHorizontalSiting, mVerticalSiting)) {
+        mScalerSrcWidth = 0;
+        return false;
+      }
+    }
+    mScalerRotation = aRotation;
+    mScalerFormat = aSrc.format;
+    mScalerSrcWidth = aSrc.planes[0].width;
+    mScalerSrcHeight = aSrc.planes[0].height;
+    mScalerDstWidth = aDst.planes[0].width;
+    mScalerDstHeight = aDst.planes[0].height;
+  }
+
+  // The scalers sample the chroma at its rotated sites, so unlike
+  // RotateImage() there's no resiting afterwards.
+  for (uint32_t i = 0; i < numPlanes; i++) {
+    const RotateScaler& scaler = mScalers[i];
+    const ImagePlane& src = aSrc.planes[i];
+    const ImagePlane& dst = aDst.planes[i];
+    if (!ForEachBand(dst.height, [&](uint32_t aY0, uint32_t aY1) {
+          return scaler.ScaleBand(src, dst, aY0, aY1);
+        })) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void
+MeasureRotationScaling(uint32_t aMaxThreads,
+                       RotateTileShape aTile,
+                       const std::function<void(const RotationScalingSample&)>& aReport)
+{
+  static const uint32_t Sizes[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+  static const PixelFormat Formats[] = { PixelFormat_RGB32, PixelFormat_NV12 };
+  static const uint32_t NumFrames = 20;
+  const uint32_t maxThreads = std::max(1u, aMaxThreads);
+
+  for (size_t i = 0; i < sizeof(Sizes) / sizeof(Sizes[0]); i++) {
+    const uint32_t width = Sizes[i][0];
+    const uint32_t height = Sizes[i][1];
+    for (size_t j = 0; j < sizeof(Formats) / sizeof(Formats[0]); j++) {
+      const PixelFormat format = Formats[j];
+      const int32_t bpp = int32_t(GetBytesPerPixel(format, 0));
+      std::vector<uint8_t> srcPixels(GetImageBufferSize(format, width * bpp, height), 0x80);
+      std::vector<uint8_t> dstPixels(GetImageBufferSize(format, height * bpp, width));
+      Image src, dst;
+      GetImageLayout(format, &srcPixels[0], srcPixels.size(), width * bpp,
+                     height, width, height, &src);
+      GetImageLayout(format, &dstPixels[0], dstPixels.size(), height * bpp,
+                     width, height, width, &dst);
+
+      uint64_t singleThreadTime = 0;
+      for (uint32_t numThreads = 1; numThreads <= maxThreads; ) {
+        ImageRotator rotator;
+        rotator.Init(numThreads, aTile);
+        rotator.Rotate(ROTATE_90, src, dst);
+
+        const uint64_t start = GetHighResTimeUs();
+        for (uint32_t f = 0; f < NumFrames; f++) {
+          rotator.Rotate(ROTATE_90, src, dst);
+        }
+        const uint64_t elapsed = std::max<uint64_t>(GetHighResTimeUs() - start, 1);
+        if (numThreads == 1) {
+          singleThreadTime = elapsed;
+        }
+        RotationScalingSample sample;
+        sample.width = width;
+        sample.height = height;
+        sample.format = format;
+        sample.numThreads = numThreads;
+        sample.msPerFrame = double(elapsed) / (NumFrames * 1000);
+        sample.speedup = double(singleThreadTime) / double(elapsed);
+        aReport(sample);
+
+        // Powers of two, then the maximum.
+        numThreads = (numThreads < maxThreads && numThreads * 2 > maxThreads)
+                   ? maxThreads : numThreads * 2;
+      }
+    }
+  }
+}
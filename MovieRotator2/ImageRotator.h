@@ -0,0 +1,121 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include "RotateScaler.h"
+#include "RotationKernels.h"
+#include "ThreadPool.h"
+
+// Rotates RGB32, NV12 and I420 images. The pixels are moved in memory by the
+// kernels in RotationKernels.h, so the rotation is exact, there's no
+// interpolation, except where 4:2:0 chroma has to be resited. Images can also
+// be shrunk as they're rotated. Each image is split into bands of rows which
+// are rotated in parallel on a thread pool.
+class ImageRotator {
+public:
+  ImageRotator();
+
+  // Rotates with the fastest kernel this CPU supports, using aTile shaped
+  // transpose tiles; see AutotuneRotateTileShape(). Bands are rotated on
+  // aNumThreads threads, including the caller's. 0 means one thread per
+  // hardware thread.
+  void Init(uint32_t aNumThreads, RotateTileShape aTile);
+
+  // Sets where the chroma samples of the 4:2:0 images we're given are
+  // sited. The rotated images have the same siting.
+  void SetChromaSiting(ChromaSiting aHorizontal, ChromaSiting aVertical);
+
+  // Sets the filter images are scaled with. Defaults to Lanczos3.
+  void SetScaleFilter(ScaleFilter aFilter);
+
+  RotateKernel GetKernel() const { return mKernel; }
+
+  RotateTileShape GetTileShape() const { return mTile; }
+
+  uint32_t GetNumThreads() const;
+
+  // Rotates aSrc into aDst, which must be in the same format. If aDst isn't
+  // the size of the rotated aSrc, the picture is rotated and scaled to fit
+  // it in one pass.
+  bool Rotate(Rotation aRotation, const Image& aSrc, const Image& aDst);
+
+private:
+  ImageRotator(const ImageRotator&);
+  ImageRotator& operator=(const ImageRotator&);
+
+  // Rotates aSrc into aDst, one band of aDst rows per thread pool task.
+  bool RotatePlane(Rotation aRotation,
+                   const ImagePlane& aSrc,
+                   const ImagePlane& aDst,
+                   uint32_t aBytesPerPixel);
+
+  // Rotates each plane of aSrc into aDst, and resites 4:2:0 chroma.
+  bool RotateImage(Rotation aRotation,
+                   const Image& aSrc,
+                   const Image& aDst);
+
+  // Rotates and scales each plane of aSrc into aDst, which is the output
+  // size.
+  bool RotateAndScaleImage(Rotation aRotation,
+                           const Image& aSrc,
+                           const Image& aDst);
+
+  // Calls aFunction(y0, y1) on the thread pool for bands of rows which
+  // together cover [0, aNumRows). Returns false if any call did. Defined in
+  // ImageRotator.cpp, the only place it's called from.
+  template<typename Function>
+  bool ForEachBand(uint32_t aNumRows, const Function& aFunction);
+
+  ChromaSiting mHorizontalSiting;
+  ChromaSiting mVerticalSiting;
+
+  ScaleFilter mScaleFilter;
+  // One scaler per plane. Their filters are computed for the rotation and
+  // sizes below, and recomputed if an image differs.
+  RotateScaler mScalers[3];
+  Rotation mScalerRotation;
+  PixelFormat mScalerFormat;
+  uint32_t mScalerSrcWidth;
+  uint32_t mScalerSrcHeight;
+  uint32_t mScalerDstWidth;
+  uint32_t mScalerDstHeight;
+
+  RotateKernel mKernel;
+  RotateTileShape mTile;
+  std::unique_ptr<ThreadPool> mThreadPool;
+};
+
+// How long an ImageRotator took to rotate frames of one size and format by
+// 90 degrees on some number of threads.
+struct RotationScalingSample {
+  uint32_t width;
+  uint32_t height;
+  PixelFormat format;
+  uint32_t numThreads;
+  double msPerFrame;
+  // How many times faster than on one thread.
+  double speedup;
+};
+
+// Times ImageRotators rotating 1080p and 4K RGB32 and NV12 frames with aTile
+// shaped tiles, on 1 up to aMaxThreads threads, and calls aReport with each
+// result as it's measured. This takes a few seconds.
+void MeasureRotationScaling(uint32_t aMaxThreads,
+                            RotateTileShape aTile,
+                            const std::function<void(const RotationScalingSample&)>& aReport);
@@ -32,3 +32,22 @@ class Runnable {
 public:
   virtual void Run() = 0;
 };
+
+// Writes a rotated copy of a TranscodeJob's input file.
+class Transcoder {
+public:
+  virtual ~Transcoder() {}
+
+  virtual HRESULT Initialize() = 0;
+
+  // Does the next chunk of the work. Call this in a loop until
+  // GetProgress() returns 1000.
+  virtual HRESULT Transcode() = 0;
+
+  // Returns how many thousandths through the job we are.
+  virtual UINT32 GetProgress() = 0;
+
+  // Returns the duration of the input's media, in 100ns units, or 0 if it's
+  // unknown. Valid once Initialize() has succeeded.
+  virtual LONGLONG GetDuration() = 0;
+};
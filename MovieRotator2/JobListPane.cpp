@@ -153,6 +153,24 @@ GetProgressString(UINT32 aProgress)
   return std::wstring(text);
 }
 
+// Formats a time in microseconds as h:mm:ss, or m:ss if it's under an hour.
+static std::wstring
+GetDurationString(LONGLONG aTimeUs)
+{
+  UINT32 seconds = UINT32((aTimeUs + 999999) / 1000000);
+  UINT32 hours = seconds / 3600;
+  UINT32 minutes = (seconds / 60) % 60;
+  seconds %= 60;
+  const unsigned textLen = 20;
+  WCHAR text[textLen];
+  if (hours) {
+    StringCbPrintf(text, sizeof(text), L"%u:%02u:%02u", hours, minutes, seconds);
+  } else {
+    StringCbPrintf(text, sizeof(text), L"%u:%02u", minutes, seconds);
+  }
+  return std::wstring(text);
+}
+
 D2D1_RECT_F
 JobListPane::GetFilenameTextRect(UINT32 aIndex)
 {
@@ -182,21 +200,30 @@ static const std::wstring sStatusComplete(L"Status: Complete");
 static const std::wstring sStatus(L"Status: ");
 
 static const std::wstring
-GetStatusString(TranscodeJob* aJob)
+GetStatusString(TranscodeJobList* aJobList, UINT32 aIndex, TranscodeJob* aJob)
 {
   if (aJob->IsFailed()) {
     return sStatusFailed;
   }
   std::wstring status;
   UINT32 progress = aJob->GetProgress();
-  if (progress == 0) {
-    return sStatusPending;
-  }
   if (progress == 1000) {
     return sStatusComplete;
   }
+  LONGLONG remainingUs = 0;
+  bool haveEstimate = aJobList->GetProjectedRemainingUs(aIndex, &remainingUs);
+  if (progress == 0) {
+    if (!haveEstimate) {
+      return sStatusPending;
+    }
+    return sStatusPending + L", done in about " + GetDurationString(remainingUs);
+  }
 
-  return sStatus + GetProgressString(progress);
+  status = sStatus + GetProgressString(progress);
+  if (haveEstimate) {
+    status += L", " + GetDurationString(remainingUs) + L" left";
+  }
+  return status;
 }
 
 static const std::wstring eolText(L"\r\n");
@@ -246,7 +273,7 @@ JobListPane::Paint(ID2D1RenderTarget* aRenderTarget)
 
     D2D1_RECT_F filenameTextRect = GetFilenameTextRect(slot);
     std::wstring statusText = GetShortFilename(job->GetInputFilename(), index) +
-                              eolText + GetStatusString(job);
+                              eolText + GetStatusString(mJobList, index, job);
     IDWriteTextFormat* textFormat = D2DManager::GetGuiTextFormat();
     aRenderTarget->DrawText(statusText .c_str(),
                             statusText .size(),
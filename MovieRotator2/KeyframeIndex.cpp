@@ -0,0 +1,78 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "KeyframeIndex.h"
+
+#include <algorithm>
+
+void
+KeyframeIndex::Add(int64_t aTime)
+{
+  // Keyframes are almost always added in order, so this is usually an
+  // append.
+  if (mTimes.empty() || aTime > mTimes.back()) {
+    mTimes.push_back(aTime);
+    return;
+  }
+  std::vector<int64_t>::iterator position =
+    std::lower_bound(mTimes.begin(), mTimes.end(), aTime);
+  if (*position != aTime) {
+    mTimes.insert(position, aTime);
+  }
+}
+
+size_t
+KeyframeIndex::FindNearest(int64_t aTime) const
+{
+  std::vector<int64_t>::const_iterator after =
+    std::lower_bound(mTimes.begin(), mTimes.end(), aTime);
+  if (after == mTimes.begin()) {
+    return 0;
+  }
+  if (after == mTimes.end()) {
+    return mTimes.size() - 1;
+  }
+  std::vector<int64_t>::const_iterator before = after - 1;
+  const size_t index = size_t(after - mTimes.begin());
+  return (aTime - *before <= *after - aTime) ? index - 1 : index;
+}
+
+std::vector<TranscodeSegment>
+SplitAtKeyframes(const KeyframeIndex& aIndex,
+                 int64_t aDuration,
+                 uint32_t aNumSegments,
+                 int64_t aMinSegmentDuration)
+{
+  std::vector<TranscodeSegment> segments;
+  int64_t start = 0;
+  if (aIndex.GetLength() && aDuration > 0) {
+    for (uint32_t i = 1; i < aNumSegments; i++) {
+      const int64_t ideal = int64_t(double(aDuration) * i / aNumSegments);
+      const int64_t keyframe = aIndex.GetTime(aIndex.FindNearest(ideal));
+      if (keyframe - start < aMinSegmentDuration) {
+        // Too close to the previous split; try further on.
+        continue;
+      }
+      if (aDuration - keyframe < aMinSegmentDuration) {
+        // The rest of the stream is too short to split again.
+        break;
+      }
+      segments.push_back(TranscodeSegment(start, keyframe));
+      start = keyframe;
+    }
+  }
+  segments.push_back(TranscodeSegment(start, INT64_MAX));
+  return segments;
+}
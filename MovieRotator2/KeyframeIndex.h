@@ -0,0 +1,64 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// An index of where a video stream's keyframes are, and splitting a stream
+// into segments which start at keyframes, so that the segments can be
+// decoded independently, and transcoded concurrently.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// The presentation times of a video stream's keyframes, in the 100ns units
+// of FrameSource.h, in ascending order.
+class KeyframeIndex {
+public:
+  void Clear() { mTimes.clear(); }
+
+  // Adds a keyframe at aTime. Keyframes can be added in any order.
+  void Add(int64_t aTime);
+
+  size_t GetLength() const { return mTimes.size(); }
+  int64_t GetTime(size_t aIndex) const { return mTimes[aIndex]; }
+
+  // Returns the index of the keyframe nearest to aTime. The index must not
+  // be empty.
+  size_t FindNearest(int64_t aTime) const;
+
+private:
+  std::vector<int64_t> mTimes;
+};
+
+// A span [start, end) of a stream's presentation time. The first segment
+// of a stream starts at 0, and the last ends at INT64_MAX, so that frames
+// outside the stream's nominal duration aren't lost.
+struct TranscodeSegment {
+  TranscodeSegment() : start(0), end(INT64_MAX) {}
+  TranscodeSegment(int64_t aStart, int64_t aEnd) : start(aStart), end(aEnd) {}
+  int64_t start;
+  int64_t end;
+};
+
+// Splits a stream of aDuration into at most aNumSegments segments of about
+// equal length. Every segment but the first starts at the keyframe nearest
+// to where an even split would put it, and none is shorter than
+// aMinSegmentDuration, so short streams, or streams with few keyframes,
+// get fewer segments. Returns one segment if the stream can't be split.
+std::vector<TranscodeSegment> SplitAtKeyframes(const KeyframeIndex& aIndex,
+                                               int64_t aDuration,
+                                               uint32_t aNumSegments,
+                                               int64_t aMinSegmentDuration);
@@ -0,0 +1,409 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "stdafx.h"
+#include "MFFrameSink.h"
+#include "H264ClassFactory.h"
+#include "MFFrameSource.h"
+#include "MFMediaFrame.h"
+
+using std::wstring;
+
+MFFrameSink::MFFrameSink()
+  : mVideoStreamIndex(Unknown),
+    mAudioStreamIndex(Unknown),
+    mVideoStride(0),
+    mError(S_OK)
+{
+}
+
+HRESULT
+MFFrameSink::GetEncoderVideoOutputType(const MFFrameSource& aSource,
+                                       Rotation aRotation,
+                                       UINT32 aWidth,
+                                       UINT32 aHeight,
+                                       IMFMediaType** aOutVideoType)
+{
+  HRESULT hr;
+  const VideoFormat& format = aSource.GetVideoFormat();
+
+  IMFMediaTypePtr videoType;
+  hr = MFCreateMediaType(&videoType);
+  ENSURE_SUCCESS(hr, hr);
+  hr = videoType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+  ENSURE_SUCCESS(hr, hr);
+  hr = videoType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_H264);
+  ENSURE_SUCCESS(hr, hr);
+  // Note: The source may not have known its average bit rate, that's OK,
+  // provided we set it to -1, which is what it reports then.
+  hr = videoType->SetUINT32(MF_MT_AVG_BITRATE, aSource.GetAvgBitRate());
+  ENSURE_SUCCESS(hr, hr);
+  hr = videoType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
+  ENSURE_SUCCESS(hr, hr);
+  hr = MFSetAttributeSize(videoType, MF_MT_FRAME_SIZE, aWidth, aHeight);
+  ENSURE_SUCCESS(hr, hr);
+  hr = MFSetAttributeRatio(videoType, MF_MT_FRAME_RATE, format.frameRateNumer, format.frameRateDenom);
+  ENSURE_SUCCESS(hr, hr);
+
+  // Swap the pixel aspect ratio if the frame is rotated 90 or 270 degrees.
+  if (aRotation == ROTATE_180) {
+    hr = MFSetAttributeRatio(videoType, MF_MT_PIXEL_ASPECT_RATIO, format.pixelAspectNumer, format.pixelAspectDenom);
+  } else {
+    hr = MFSetAttributeRatio(videoType, MF_MT_PIXEL_ASPECT_RATIO, format.pixelAspectDenom, format.pixelAspectNumer);
+  }
+  ENSURE_SUCCESS(hr, hr);
+
+  UINT32 profile = aSource.GetH264Profile();
+  if (profile > eAVEncH264VProfile_Main /* && !IsWindows8())*/ ) {
+    // Note: Windows 8 Supports High as well.
+    profile = eAVEncH264VProfile_Main;
+  }
+  if (profile != Unknown) {
+    hr = videoType->SetUINT32(MF_MT_MPEG2_PROFILE, profile);
+    ENSURE_SUCCESS(hr, hr);
+  }
+  *aOutVideoType = videoType.Detach();
+
+  return S_OK;
+}
+
+HRESULT
+MFFrameSink::GetEncoderVideoInputType(const MFFrameSource& aSource,
+                                      UINT32 aWidth,
+                                      UINT32 aHeight,
+                                      IMFMediaType** aOutVideoType)
+{
+  HRESULT hr;
+  const VideoFormat& format = aSource.GetVideoFormat();
+  const GUID& subtype = aSource.GetVideoSubtype();
+
+  IMFMediaTypePtr videoType;
+  hr = MFCreateMediaType(&videoType);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = videoType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = videoType->SetGUID(MF_MT_SUBTYPE, subtype);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = videoType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = MFSetAttributeSize(videoType, MF_MT_FRAME_SIZE, aWidth, aHeight);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = MFSetAttributeRatio(videoType, MF_MT_FRAME_RATE, format.frameRateNumer, format.frameRateDenom);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = MFSetAttributeRatio(videoType, MF_MT_PIXEL_ASPECT_RATIO, format.pixelAspectNumer, format.pixelAspectDenom);
+  ENSURE_SUCCESS(hr, hr);
+
+  // Note: We *must* set the stride on the input video type, as if it's
+  // negative and we don't report that the image will be encoded upside down!
+  UINT32 stride = (subtype == MFVideoFormat_RGB32) ? aWidth * 4 : aWidth;
+  hr = videoType->SetUINT32(MF_MT_DEFAULT_STRIDE, stride);
+  ENSURE_SUCCESS(hr, hr);
+
+  // ImageRotator resites the rotated chroma to match the input's siting.
+  UINT32 siting;
+  if (SUCCEEDED(aSource.GetVideoMediaType()->GetUINT32(MF_MT_VIDEO_CHROMA_SITING, &siting))) {
+    hr = videoType->SetUINT32(MF_MT_VIDEO_CHROMA_SITING, siting);
+    ENSURE_SUCCESS(hr, hr);
+  }
+
+  *aOutVideoType = videoType.Detach();
+
+  return S_OK;
+}
+
+HRESULT
+MFFrameSink::GetEncoderAudioOutputType(IMFMediaType* aAudioInputType,
+                                       IMFMediaType** aOutAudioType)
+{
+  // Construct the encoder's output audio type. This is AAC, but with
+  // the channel/sample rate of the audio processor's output type.
+  // The AAC encoder only supports up to 2 channels, 44.1KHz or 48KHz,
+  // so the audio processor resamples for us if need be. We can't use
+  // the audio processor's output type, since it includes extra attributes
+  // which confuses the encoder.
+
+  HRESULT hr;
+
+  IMFMediaTypePtr outputAudioType;
+  hr = MFCreateMediaType(&outputAudioType);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = outputAudioType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = outputAudioType->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_AAC);
+  ENSURE_SUCCESS(hr, hr);
+
+  GUID attr[] = {
+    MF_MT_AUDIO_BITS_PER_SAMPLE,
+    MF_MT_AUDIO_NUM_CHANNELS,
+    MF_MT_AUDIO_SAMPLES_PER_SECOND,
+    MF_MT_AUDIO_AVG_BYTES_PER_SECOND
+  };
+
+  for (UINT i=0; i<ARRAYSIZE(attr); i++) {
+    UINT32 value;
+    hr = aAudioInputType->GetUINT32(attr[i], &value);
+    ENSURE_SUCCESS(hr, hr);
+
+    hr = outputAudioType->SetUINT32(attr[i], value);
+    ENSURE_SUCCESS(hr, hr);
+  }
+
+  // Just set the audio output average bit rate to the max 192 Kbps.
+  hr = outputAudioType->SetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND, 20000);
+  ENSURE_SUCCESS(hr, hr);
+
+  *aOutAudioType = outputAudioType.Detach();
+  return S_OK;
+}
+
+HRESULT
+MFFrameSink::GetEncoderAudioInputType(IMFMediaType* aAudioInputType,
+                                      IMFMediaType** aOutEncoderAudioInputType)
+{
+  HRESULT hr;
+
+  // Construct the audio input media type. We copy the relevant fields from
+  // the output type of the audio processor.
+
+  IMFMediaTypePtr encoderInputAudioType;
+  hr = MFCreateMediaType(&encoderInputAudioType);
+  ENSURE_SUCCESS(hr, hr);
+
+  GUID guidAttrs[] = {
+    MF_MT_MAJOR_TYPE,
+    MF_MT_SUBTYPE
+  };
+
+  for (UINT i=0; i<ARRAYSIZE(guidAttrs); i++) {
+    GUID value;
+    hr = aAudioInputType->GetGUID(guidAttrs[i], &value);
+    ENSURE_SUCCESS(hr, hr);
+
+    hr = encoderInputAudioType->SetGUID(guidAttrs[i], value);
+    ENSURE_SUCCESS(hr, hr);
+  }
+
+  GUID uintAttrs[] = {
+    MF_MT_AUDIO_BITS_PER_SAMPLE,
+    MF_MT_AUDIO_NUM_CHANNELS,
+    MF_MT_AUDIO_SAMPLES_PER_SECOND,
+    MF_MT_AUDIO_AVG_BYTES_PER_SECOND
+  };
+
+  for (UINT i=0; i<ARRAYSIZE(uintAttrs); i++) {
+    UINT32 value;
+    hr = aAudioInputType->GetUINT32(uintAttrs[i], &value);
+    ENSURE_SUCCESS(hr, hr);
+
+    hr = encoderInputAudioType->SetUINT32(uintAttrs[i], value);
+    ENSURE_SUCCESS(hr, hr);
+  }
+
+  *aOutEncoderAudioInputType = encoderInputAudioType.Detach();
+
+  return S_OK;
+}
+
+HRESULT
+MFFrameSink::Init(const wstring& aFilename,
+                  const MFFrameSource& aSource,
+                  Rotation aRotation,
+                  UINT32 aWidth,
+                  UINT32 aHeight,
+                  const EncoderSettings& aEncoderSettings,
+                  IMFMediaType* aAudioInputType)
+{
+  HRESULT hr;
+
+  IMFAttributesPtr attributes;
+  hr = MFCreateAttributes(&attributes, 1);
+  ENSURE_SUCCESS(hr, hr);
+  hr = attributes->SetGUID(MF_TRANSCODE_CONTAINERTYPE, MFTranscodeContainerType_MPEG4);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = attributes->SetUINT32(MF_READWRITE_ENABLE_HARDWARE_TRANSFORMS, TRUE);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = MFCreateSinkWriterFromURL(aFilename.c_str(), NULL, attributes, &mWriter);
+  ENSURE_SUCCESS(hr, hr);
+
+  // Set the encoded output video type.
+  IMFMediaTypePtr encoderVideoOutputType;
+  hr = GetEncoderVideoOutputType(aSource, aRotation, aWidth, aHeight, &encoderVideoOutputType);
+  ENSURE_SUCCESS(hr, hr);
+  hr = mWriter->AddStream(encoderVideoOutputType,
+                          &mVideoStreamIndex);
+  ENSURE_SUCCESS(hr, hr);
+  DBGMSG(L"Writer output video type:\n");
+  LogMediaType(encoderVideoOutputType);
+  DBGMSG(L"\n");
+
+  // Set the writer input video type.
+  IMFMediaTypePtr writerInputVideoType;
+  hr = GetEncoderVideoInputType(aSource, aWidth, aHeight, &writerInputVideoType);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = GetDefaultStride(writerInputVideoType, &mVideoStride);
+  ENSURE_SUCCESS(hr, hr);
+
+  DBGMSG(L"Writer input video type:\n");
+  LogMediaType(writerInputVideoType);
+  DBGMSG(L"\n");
+
+  {
+    // The writer creates the encoder here, through our class factory,
+    // which configures it with these.
+    const VideoFormat& format = aSource.GetVideoFormat();
+    AutoH264EncoderSettings encoderSettings(aEncoderSettings,
+                                            format.frameRateNumer,
+                                            format.frameRateDenom);
+    hr = mWriter->SetInputMediaType(mVideoStreamIndex,
+                                    writerInputVideoType,
+                                    NULL);
+  }
+  if (FAILED(hr)) {
+    DBGMSG(L"Failed to set writer input video type: hr=0x%x\n", hr);
+  }
+  ENSURE_SUCCESS(hr, hr);
+
+  BOOL audioCompressed = FALSE;
+  if (aAudioInputType) {
+    hr = aAudioInputType->IsCompressedFormat(&audioCompressed);
+    ENSURE_SUCCESS(hr, hr);
+  }
+
+  if (aAudioInputType && audioCompressed) {
+    // The audio's copied from the source. With no input type set, the
+    // stream takes samples in its output type, so no encoder is loaded.
+    hr = mWriter->AddStream(aAudioInputType, &mAudioStreamIndex);
+    ENSURE_SUCCESS(hr, hr);
+    DBGMSG(L"Writer passthrough audio type:\n");
+    LogMediaType(aAudioInputType);
+    DBGMSG(L"\n");
+  } else if (aAudioInputType) {
+    // We have audio. Set the encoded output audio type.
+    IMFMediaTypePtr encoderAudioOutputType;
+    hr = GetEncoderAudioOutputType(aAudioInputType, &encoderAudioOutputType);
+    ENSURE_SUCCESS(hr, hr);
+    hr = mWriter->AddStream(encoderAudioOutputType,
+                            &mAudioStreamIndex);
+    ENSURE_SUCCESS(hr, hr);
+
+    DBGMSG(L"Writer output audio type:\n");
+    LogMediaType(encoderAudioOutputType);
+    DBGMSG(L"\n");
+
+    // Set the writer's audio input type.
+    IMFMediaTypePtr writerInputAudioType;
+    hr = GetEncoderAudioInputType(aAudioInputType, &writerInputAudioType);
+    ENSURE_SUCCESS(hr, hr);
+    DBGMSG(L"Writer input audio type:\n");
+    LogMediaType(writerInputAudioType);
+    DBGMSG(L"\n");
+    hr = mWriter->SetInputMediaType(mAudioStreamIndex,
+                                    writerInputAudioType,
+                                    NULL);
+    if (FAILED(hr)) {
+      DBGMSG(L"Failed to set writer input audio type: hr=0x%x\n", hr);
+    }
+    ENSURE_SUCCESS(hr, hr);
+  }
+
+  hr = mWriter->BeginWriting();
+  ENSURE_SUCCESS(hr, hr);
+
+  return S_OK;
+}
+
+HRESULT
+MFFrameSink::InitPassthrough(const wstring& aFilename,
+                             IMFMediaType* aVideoType,
+                             IMFMediaType* aAudioType)
+{
+  ENSURE_TRUE(aVideoType, E_POINTER);
+  HRESULT hr;
+
+  IMFAttributesPtr attributes;
+  hr = MFCreateAttributes(&attributes, 1);
+  ENSURE_SUCCESS(hr, hr);
+  hr = attributes->SetGUID(MF_TRANSCODE_CONTAINERTYPE, MFTranscodeContainerType_MPEG4);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = MFCreateSinkWriterFromURL(aFilename.c_str(), NULL, attributes, &mWriter);
+  ENSURE_SUCCESS(hr, hr);
+
+  // Streams with no input type set take samples in their output type, so
+  // no encoder is loaded.
+  hr = mWriter->AddStream(aVideoType, &mVideoStreamIndex);
+  ENSURE_SUCCESS(hr, hr);
+  DBGMSG(L"Writer passthrough video type:\n");
+  LogMediaType(aVideoType);
+  DBGMSG(L"\n");
+
+  if (aAudioType) {
+    hr = mWriter->AddStream(aAudioType, &mAudioStreamIndex);
+    ENSURE_SUCCESS(hr, hr);
+    DBGMSG(L"Writer passthrough audio type:\n");
+    LogMediaType(aAudioType);
+    DBGMSG(L"\n");
+  }
+
+  hr = mWriter->BeginWriting();
+  ENSURE_SUCCESS(hr, hr);
+
+  return S_OK;
+}
+
+bool
+MFFrameSink::WriteFrame(const MediaFrame& aFrame)
+{
+  const bool isVideo = aFrame.stream == Stream_Video;
+  if (!isVideo && mAudioStreamIndex == -1) {
+    // We're not encoding audio.
+    return true;
+  }
+
+  IMFSamplePtr sample;
+  HRESULT hr = MediaFrameToSample(aFrame, &sample);
+  if (SUCCEEDED(hr)) {
+    hr = mWriter->WriteSample(isVideo ? mVideoStreamIndex : mAudioStreamIndex, sample);
+  }
+  if (FAILED(hr)) {
+    DBGMSG(L"Failed writing %s sample hr=0x%x\n", (isVideo ? L"video" : L"audio"), hr);
+    mError = hr;
+    return false;
+  }
+  return true;
+}
+
+bool
+MFFrameSink::Finish()
+{
+  HRESULT hr = mWriter->Finalize();
+  if (FAILED(hr)) {
+    DBGMSG(L"Failed to finalize writer hr=0x%x\n", hr);
+    mError = hr;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,86 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// The Media Foundation backend of IFrameSink; encodes frames to H.264 and
+// AAC in an MP4 file with a sink writer.
+
+#pragma once
+
+#include "EncoderSettings.h"
+#include "FrameSource.h"
+#include "Rotation.h"
+
+class MFFrameSource;
+
+class MFFrameSink : public IFrameSink {
+public:
+  MFFrameSink();
+
+  // Creates aFilename, and configures the writer to encode the video from
+  // aSource rotated by aRotation, as aWidth x aHeight frames in the
+  // source's video subtype, with aEncoderSettings. If aAudioInputType is
+  // non-null the writer has an audio stream too, taking PCM audio in that
+  // type, which it encodes to AAC, or if the type is compressed, taking
+  // compressed audio which it writes as it is.
+  HRESULT Init(const std::wstring& aFilename,
+               const MFFrameSource& aSource,
+               Rotation aRotation,
+               UINT32 aWidth,
+               UINT32 aHeight,
+               const EncoderSettings& aEncoderSettings,
+               IMFMediaType* aAudioInputType);
+
+  // Creates aFilename, and configures the writer to write compressed
+  // samples as they are, without encoding them, in streams of aVideoType
+  // and, if it's non-null, aAudioType; e.g. the native types of an
+  // MFFrameSource opened with InitCompressed().
+  HRESULT InitPassthrough(const std::wstring& aFilename,
+                          IMFMediaType* aVideoType,
+                          IMFMediaType* aAudioType);
+
+  // The stride the encoder expects the video frames to have.
+  LONG GetVideoStride() const { return mVideoStride; }
+
+  // The error which made WriteFrame() or Finish() fail.
+  HRESULT GetError() const { return mError; }
+
+  // IFrameSink methods.
+  bool WriteFrame(const MediaFrame& aFrame) override;
+  bool Finish() override;
+
+private:
+  HRESULT GetEncoderVideoOutputType(const MFFrameSource& aSource,
+                                    Rotation aRotation,
+                                    UINT32 aWidth,
+                                    UINT32 aHeight,
+                                    IMFMediaType** aOutVideoType);
+  HRESULT GetEncoderVideoInputType(const MFFrameSource& aSource,
+                                   UINT32 aWidth,
+                                   UINT32 aHeight,
+                                   IMFMediaType** aOutVideoType);
+  HRESULT GetEncoderAudioOutputType(IMFMediaType* aAudioInputType,
+                                    IMFMediaType** aOutAudioType);
+  HRESULT GetEncoderAudioInputType(IMFMediaType* aAudioInputType,
+                                   IMFMediaType** aOutAudioType);
+
+  IMFSinkWriterPtr mWriter;
+
+  DWORD mVideoStreamIndex;
+  DWORD mAudioStreamIndex;
+
+  LONG mVideoStride;
+
+  HRESULT mError;
+};
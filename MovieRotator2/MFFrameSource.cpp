@@ -0,0 +1,599 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "stdafx.h"
+#include "MFFrameSource.h"
+#include "MFMediaFrame.h"
+#include "Mp4Metadata.h"
+
+using std::wstring;
+
+MFFrameSource::MFFrameSource()
+  : mCompressed(false),
+    mVideoStreamIndex(Unknown),
+    mAudioStreamIndex(Unknown),
+    mVideoSubtype(GUID_NULL),
+    mVideoStride(0),
+    mVideoBufferHeight(0),
+    mH264Profile(Unknown),
+    mAvgBitRate(Unknown),
+    mInterlaceMode(MFVideoInterlace_Unknown),
+    mDuration(0),
+    mAudioEOS(false),
+    mVideoEOS(false),
+    mHasProbed(false),
+    mError(S_OK)
+{
+  memset(&mPictureRegion, 0, sizeof(mPictureRegion));
+}
+
+bool
+MFFrameSource::HasVideo() const
+{
+  return mVideoStreamIndex != -1;
+}
+
+bool
+MFFrameSource::HasAudio() const
+{
+  return mAudioStreamIndex != -1;
+}
+
+static HRESULT
+GetPixelFormat(const GUID& aSubtype, PixelFormat* aOutFormat)
+{
+  if (aSubtype == MFVideoFormat_RGB32) {
+    *aOutFormat = PixelFormat_RGB32;
+  } else if (aSubtype == MFVideoFormat_NV12) {
+    *aOutFormat = PixelFormat_NV12;
+  } else if (aSubtype == MFVideoFormat_I420 || aSubtype == MFVideoFormat_IYUV) {
+    *aOutFormat = PixelFormat_I420;
+  } else {
+    return MF_E_INVALIDMEDIATYPE;
+  }
+  return S_OK;
+}
+
+HRESULT
+MFFrameSource::DetermineOutputVideoType(IMFMediaType** aOutVideoType)
+{
+  HRESULT hr;
+
+  // Read the first video frame, so that we can detect a format change.
+  // Some videos have their frame size and/or aperature/pan/scan change
+  // on the first frame. The frame is kept, and is the first one we return.
+
+  IMFSamplePtr sample;
+  DWORD streamIndex, flags;
+  LONGLONG timestamp;
+  hr = mReader->ReadSample(mVideoStreamIndex,
+                           0,                // Flags.
+                           &streamIndex,     // Receives the actual stream index.
+                           &flags,           // Receives status flags.
+                           &timestamp,       // Receives the time stamp.
+                           &sample);         // Receives the sample or NULL.
+  if (FAILED(hr)) {
+    DBGMSG(L"DetermineOutputVideoType ReadSample failed with 0x%x\n", hr);
+    return hr;
+  }
+  ENSURE_TRUE(streamIndex == mVideoStreamIndex, E_FAIL);
+  mHasProbed = true;
+
+  if (flags & MF_SOURCE_READERF_CURRENTMEDIATYPECHANGED) {
+    DBGMSG(L"Detected type change on first video sample...\n");
+  }
+  if (flags & MF_SOURCE_READERF_ENDOFSTREAM) {
+    mVideoEOS = true;
+  }
+
+  IMFMediaTypePtr type;
+  hr = mReader->GetCurrentMediaType(mVideoStreamIndex, &type);
+  ENSURE_SUCCESS(hr, hr);
+
+  if (sample) {
+    ProbedSample probed;
+    probed.sample = sample;
+    probed.timestamp = timestamp;
+    probed.isVideo = true;
+    mProbedSamples.push_back(probed);
+  }
+
+  *aOutVideoType = type.Detach();
+
+  return S_OK;
+}
+
+HRESULT
+MFFrameSource::ConfigureVideoOutput(const GUID& aSubtype)
+{
+  HRESULT hr;
+
+  if (mHasProbed) {
+    // The samples we've read are in the old format.
+    hr = SetPosition(0);
+    ENSURE_SUCCESS(hr, hr);
+  }
+
+  // Get the native video output type of the reader, save the attributes that
+  // we need for the re-encode.
+  IMFMediaTypePtr nativeVideoType;
+  hr = mReader->GetNativeMediaType(mVideoStreamIndex,
+                                   0,
+                                   &nativeVideoType);
+  ENSURE_SUCCESS(hr, hr);
+  DBGMSG(L"Reader native video type:\n");
+  LogMediaType(nativeVideoType);
+  DBGMSG(L"\n");
+
+  // May not need these, encoder can calculate them or use default, but try
+  // to retrieve if possible.
+  nativeVideoType->GetUINT32(MF_MT_MPEG2_PROFILE, &mH264Profile);
+  nativeVideoType->GetUINT32(MF_MT_AVG_BITRATE, &mAvgBitRate);
+
+  hr = nativeVideoType->GetUINT32(MF_MT_INTERLACE_MODE, &mInterlaceMode);
+  ENSURE_SUCCESS(hr, hr);
+
+  // Configure video output in the format we'll rotate in.
+  {
+    IMFMediaTypePtr readerOutputVideoType;
+    hr = MFCreateMediaType(&readerOutputVideoType);
+    ENSURE_SUCCESS(hr, hr);
+    hr = readerOutputVideoType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+    ENSURE_SUCCESS(hr, hr);
+    hr = readerOutputVideoType->SetGUID(MF_MT_SUBTYPE, aSubtype);
+    ENSURE_SUCCESS(hr, hr);
+    hr = mReader->SetCurrentMediaType(mVideoStreamIndex,
+                                      NULL,
+                                      readerOutputVideoType);
+    ENSURE_SUCCESS(hr, hr);
+  }
+
+  hr = DetermineOutputVideoType(&mVideoType);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = GetDefaultStride(mVideoType, &mVideoStride);
+  ENSURE_SUCCESS(hr, hr);
+
+  VideoFormat format;
+  hr = GetPixelFormat(aSubtype, &format.pixelFormat);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = MFGetAttributeRatio(mVideoType,
+                           MF_MT_FRAME_RATE,
+                           &format.frameRateNumer,
+                           &format.frameRateDenom);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = MFGetAttributeRatio(mVideoType,
+                           MF_MT_PIXEL_ASPECT_RATIO,
+                           &format.pixelAspectNumer,
+                           &format.pixelAspectDenom);
+  ENSURE_SUCCESS(hr, hr);
+
+  UINT32 bufferWidth = 0;
+  hr = MFGetAttributeSize(mVideoType, MF_MT_FRAME_SIZE, &bufferWidth, &mVideoBufferHeight);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = GetVideoDisplayArea(mVideoType, &mPictureRegion);
+  ENSURE_SUCCESS(hr, hr);
+  format.width = mPictureRegion.Area.cx;
+  format.height = mPictureRegion.Area.cy;
+
+  // The encoder can't take 4:2:0 frames with odd dimensions.
+  if (aSubtype != MFVideoFormat_RGB32 && ((format.width | format.height) & 1)) {
+    DBGMSG(L"Picture region has odd dimensions, can't rotate in 4:2:0\n");
+    return MF_E_INVALIDMEDIATYPE;
+  }
+
+  // H.264 and MPEG-2 default to MPEG-2 chroma siting, so assume that if
+  // the type doesn't say otherwise.
+  UINT32 siting = MFVideoChromaSubsampling_Unknown;
+  mVideoType->GetUINT32(MF_MT_VIDEO_CHROMA_SITING, &siting);
+  if (siting == MFVideoChromaSubsampling_Unknown) {
+    siting = MFVideoChromaSubsampling_MPEG2;
+  }
+  format.horizontalSiting = (siting & MFVideoChromaSubsampling_Horizontally_Cosited)
+                          ? ChromaSiting_Cosited : ChromaSiting_Centered;
+  format.verticalSiting = (siting & MFVideoChromaSubsampling_Vertically_Cosited)
+                        ? ChromaSiting_Cosited : ChromaSiting_Centered;
+
+  mVideoFormat = format;
+  mVideoSubtype = aSubtype;
+
+  DBGMSG(L"Reader output video type:\n");
+  LogMediaType(mVideoType);
+  DBGMSG(L"\n");
+
+  return S_OK;
+}
+
+// Returns true if audio of aType can be copied into the MP4 files we write
+// without being decoded and encoded again. That's raw AAC of the sort the
+// AAC encoder would have produced; at most 2 channels, at 44.1KHz or 48KHz.
+static bool
+CanCopyAudioType(IMFMediaType* aType)
+{
+  GUID subtype = GUID_NULL;
+  if (FAILED(aType->GetGUID(MF_MT_SUBTYPE, &subtype)) ||
+      subtype != MFAudioFormat_AAC) {
+    return false;
+  }
+  // Payload type 0 is raw access units, as they're stored in MP4 files,
+  // rather than ADTS or LOAS framed.
+  if (MFGetAttributeUINT32(aType, MF_MT_AAC_PAYLOAD_TYPE, 0) != 0) {
+    return false;
+  }
+  // The writer needs the AudioSpecificConfig to write the esds box. The
+  // user data is the 12 bytes of HEAACWAVEINFO which follow its
+  // WAVEFORMATEX, then the AudioSpecificConfig.
+  static const UINT32 HeAacWaveInfoExtraSize = 12;
+  UINT32 userDataSize = 0;
+  if (FAILED(aType->GetBlobSize(MF_MT_USER_DATA, &userDataSize)) ||
+      userDataSize <= HeAacWaveInfoExtraSize) {
+    return false;
+  }
+  const UINT32 channels = MFGetAttributeUINT32(aType, MF_MT_AUDIO_NUM_CHANNELS, 0);
+  const UINT32 rate = MFGetAttributeUINT32(aType, MF_MT_AUDIO_SAMPLES_PER_SECOND, 0);
+  return channels >= 1 && channels <= 2 && (rate == 44100 || rate == 48000);
+}
+
+HRESULT
+MFFrameSource::ConfigureAudioOutput(bool aCopyAudio)
+{
+  HRESULT hr;
+
+  // Extract the audio native type, and determine how we're going to encode
+  // the audio, either by pass through, or by resampling decoded samples.
+  IMFMediaTypePtr nativeAudioType;
+  hr = mReader->GetNativeMediaType(mAudioStreamIndex,
+                                   0,
+                                   &nativeAudioType);
+  ENSURE_SUCCESS(hr, hr);
+
+  DBGMSG(L"Reader native audio type:\n");
+  LogMediaType(nativeAudioType);
+  DBGMSG(L"\n");
+
+  if (aCopyAudio && CanCopyAudioType(nativeAudioType)) {
+    // The audio's already in a form the writer can take, so read it as it
+    // is, and save decoding, resampling and encoding it again. The access
+    // units keep their timestamps, so the copy stays in sync.
+    hr = mReader->SetCurrentMediaType(mAudioStreamIndex, NULL, nativeAudioType);
+    ENSURE_SUCCESS(hr, hr);
+    mAudioType = nativeAudioType;
+    hr = mAudioType->GetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, &mAudioFormat.sampleRate);
+    ENSURE_SUCCESS(hr, hr);
+    hr = mAudioType->GetUINT32(MF_MT_AUDIO_NUM_CHANNELS, &mAudioFormat.numChannels);
+    ENSURE_SUCCESS(hr, hr);
+    mAudioFormat.bitsPerSample = 0;
+    mAudioFormat.compressed = true;
+    DBGMSG(L"Copying AAC audio without reencoding it\n");
+    return S_OK;
+  }
+
+  // We'll decode the audio to PCM, and it'll be resampled so that it meets
+  // the requirements of the AAC encoder (at most 2 channels, 44.1KHz or
+  // 48KHz).
+
+  // Configure the audio to be output in PCM.
+  IMFMediaTypePtr readerOutputAudioType;
+  hr = MFCreateMediaType(&readerOutputAudioType);
+  ENSURE_SUCCESS(hr, hr);
+  hr = readerOutputAudioType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio);
+  ENSURE_SUCCESS(hr, hr);
+  hr = readerOutputAudioType->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_PCM);
+  ENSURE_SUCCESS(hr, hr);
+  hr = mReader->SetCurrentMediaType(mAudioStreamIndex,
+                                    NULL,
+                                    readerOutputAudioType);
+  ENSURE_SUCCESS(hr, hr);
+
+  // Decode one sample, to force a media type change if we're decoding HE-AAC
+  // and the sample rate doesn't take into account SBR/PS. It will once we
+  // decode the first sample. The sample is kept, like the first video frame.
+  IMFSamplePtr sample;
+  DWORD actualStreamIndex, flags;
+  LONGLONG timestamp;
+  hr = mReader->ReadSample(mAudioStreamIndex, 0, &actualStreamIndex, &flags, &timestamp, &sample);
+  ENSURE_SUCCESS(hr, hr);
+
+  ENSURE_TRUE(actualStreamIndex == mAudioStreamIndex, E_FAIL);
+  mHasProbed = true;
+
+  if (flags & MF_SOURCE_READERF_CURRENTMEDIATYPECHANGED) {
+    DBGMSG(L"Detected type change on first audio sample...\n");
+  }
+  if (flags & MF_SOURCE_READERF_ENDOFSTREAM) {
+    mAudioEOS = true;
+  }
+
+  if (sample) {
+    ProbedSample probed;
+    probed.sample = sample;
+    probed.timestamp = timestamp;
+    probed.isVideo = false;
+    // Keep the probed samples in presentation order.
+    if (!mProbedSamples.empty() && timestamp < mProbedSamples.back().timestamp) {
+      mProbedSamples.push_front(probed);
+    } else {
+      mProbedSamples.push_back(probed);
+    }
+  }
+
+  // Extract the completed audio type, as determined by the reader.
+  hr = mReader->GetCurrentMediaType(mAudioStreamIndex, &mAudioType);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = mAudioType->GetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, &mAudioFormat.sampleRate);
+  ENSURE_SUCCESS(hr, hr);
+  hr = mAudioType->GetUINT32(MF_MT_AUDIO_NUM_CHANNELS, &mAudioFormat.numChannels);
+  ENSURE_SUCCESS(hr, hr);
+  hr = mAudioType->GetUINT32(MF_MT_AUDIO_BITS_PER_SAMPLE, &mAudioFormat.bitsPerSample);
+  ENSURE_SUCCESS(hr, hr);
+
+  DBGMSG(L"Reader output audio type:\n");
+  LogMediaType(mAudioType);
+  DBGMSG(L"\n");
+
+  return S_OK;
+}
+
+HRESULT
+MFFrameSource::SetPosition(LONGLONG aTime)
+{
+  AutoPropVar var;
+  HRESULT hr = InitPropVariantFromInt64(aTime, &var);
+  ENSURE_SUCCESS(hr, hr);
+  hr = mReader->SetCurrentPosition(GUID_NULL, var);
+  ENSURE_SUCCESS(hr, hr);
+
+  mProbedSamples.clear();
+  mVideoEOS = false;
+  mAudioEOS = (mAudioStreamIndex == -1);
+  mHasProbed = false;
+
+  return S_OK;
+}
+
+HRESULT
+MFFrameSource::Init(const wstring& aFilename, bool aCopyAudio)
+{
+  HRESULT hr;
+  mFilename = aFilename;
+  IMFAttributesPtr attributes;
+  hr = MFCreateAttributes(&attributes, 1);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = attributes->SetUINT32(MF_SOURCE_READER_ENABLE_VIDEO_PROCESSING, TRUE);
+
+  // Create the source reader from the URL.
+  hr = MFCreateSourceReaderFromURL(aFilename.c_str(), attributes, &mReader);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = GetSourceReaderDuration(mReader, &mDuration);
+
+  // Figure out the index of the audio and video stream, so that
+  // ReadSample(ANY_STREAM) can get the muxing order the same as the
+  // muxed file.
+  hr = GetReaderStreamIndexes(mReader,
+                              &mAudioStreamIndex,
+                              &mVideoStreamIndex);
+  ENSURE_SUCCESS(hr, hr);
+  ENSURE_TRUE(mVideoStreamIndex != -1, E_UNEXPECTED);
+
+  // Prefer NV12, since it's what H.264 decoders output and encoders take,
+  // so the frames don't need to be converted to RGB and back, and it's less
+  // than half the size. Fall back to RGB32 if the reader won't give us NV12.
+  hr = ConfigureVideoOutput(MFVideoFormat_NV12);
+  if (FAILED(hr)) {
+    DBGMSG(L"Failed to configure NV12 reader output hr=0x%x, using RGB32\n", hr);
+    hr = ConfigureVideoOutput(MFVideoFormat_RGB32);
+  }
+  ENSURE_SUCCESS(hr, hr);
+
+  if (mAudioStreamIndex != -1) {
+    hr = ConfigureAudioOutput(aCopyAudio);
+    ENSURE_SUCCESS(hr, hr);
+  } else {
+    mAudioEOS = true;
+  }
+
+  return S_OK;
+}
+
+HRESULT
+MFFrameSource::InitCompressed(const wstring& aFilename)
+{
+  HRESULT hr;
+  mFilename = aFilename;
+  mCompressed = true;
+
+  hr = MFCreateSourceReaderFromURL(aFilename.c_str(), NULL, &mReader);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = GetSourceReaderDuration(mReader, &mDuration);
+
+  hr = GetReaderStreamIndexes(mReader,
+                              &mAudioStreamIndex,
+                              &mVideoStreamIndex);
+  ENSURE_SUCCESS(hr, hr);
+  ENSURE_TRUE(mVideoStreamIndex != -1, E_UNEXPECTED);
+
+  // With their native types as their current types, the streams' samples
+  // come out of the reader as they are in the file.
+  hr = mReader->GetNativeMediaType(mVideoStreamIndex, 0, &mVideoType);
+  ENSURE_SUCCESS(hr, hr);
+  hr = mReader->SetCurrentMediaType(mVideoStreamIndex, NULL, mVideoType);
+  ENSURE_SUCCESS(hr, hr);
+  hr = mVideoType->GetGUID(MF_MT_SUBTYPE, &mVideoSubtype);
+  ENSURE_SUCCESS(hr, hr);
+  hr = MFGetAttributeSize(mVideoType, MF_MT_FRAME_SIZE, &mVideoFormat.width, &mVideoFormat.height);
+  ENSURE_SUCCESS(hr, hr);
+
+  if (mAudioStreamIndex != -1) {
+    hr = mReader->GetNativeMediaType(mAudioStreamIndex, 0, &mAudioType);
+    ENSURE_SUCCESS(hr, hr);
+    hr = mReader->SetCurrentMediaType(mAudioStreamIndex, NULL, mAudioType);
+    ENSURE_SUCCESS(hr, hr);
+    mAudioFormat.compressed = true;
+  } else {
+    mAudioEOS = true;
+  }
+
+  return S_OK;
+}
+
+bool
+MFFrameSource::Seek(int64_t aTime)
+{
+  HRESULT hr = SetPosition(aTime);
+  if (FAILED(hr)) {
+    mError = hr;
+    return false;
+  }
+  return true;
+}
+
+bool
+MFFrameSource::GetKeyframeIndex(KeyframeIndex* aOutIndex)
+{
+  FILE* file = nullptr;
+  if (_wfopen_s(&file, mFilename.c_str(), L"rb") != 0 || !file) {
+    return false;
+  }
+  Mp4File mp4(file);
+  bool found = ReadMp4KeyframeIndex(mp4, aOutIndex);
+  fclose(file);
+  return found && aOutIndex->GetLength() > 0;
+}
+
+bool
+MFFrameSource::ReadFrame(MediaFrame* aOutFrame, bool* aOutEndOfStream)
+{
+  HRESULT hr = ReadNextFrame(aOutFrame, aOutEndOfStream);
+  if (FAILED(hr)) {
+    mError = hr;
+    return false;
+  }
+  return true;
+}
+
+HRESULT
+MFFrameSource::SampleToFrame(IMFSample* aSample,
+                             bool aIsVideo,
+                             LONGLONG aTimestamp,
+                             MediaFrame* aOutFrame)
+{
+  HRESULT hr = SampleToMediaFrame(aSample, aIsVideo ? Stream_Video : Stream_Audio, aOutFrame);
+  ENSURE_SUCCESS(hr, hr);
+  aOutFrame->timestamp = aTimestamp;
+
+  if (!aIsVideo || mCompressed) {
+    return S_OK;
+  }
+
+  // If we don't know the frame height, assume the buffer holds only
+  // whole rows. That only works for single plane formats.
+  UINT32 bufferHeight = mVideoBufferHeight;
+  if (!bufferHeight && mVideoFormat.pixelFormat == PixelFormat_RGB32) {
+    bufferHeight = UINT32(aOutFrame->length / abs(mVideoStride));
+  }
+  // Cropping to the picture region only offsets the planes, so it costs
+  // nothing.
+  const UINT32 picX = max(mPictureRegion.OffsetX.value, 0);
+  const UINT32 picY = max(mPictureRegion.OffsetY.value, 0);
+  Image frame;
+  if (!GetImageLayout(mVideoFormat.pixelFormat, aOutFrame->data, aOutFrame->length,
+                      mVideoStride, bufferHeight,
+                      picX + mVideoFormat.width, picY + mVideoFormat.height, &frame) ||
+      !CropImage(frame, picX, picY, mVideoFormat.width, mVideoFormat.height,
+                 &aOutFrame->image)) {
+    DBGMSG(L"Decoded frame's buffer is too small for the frame\n");
+    return E_INVALIDARG;
+  }
+  return S_OK;
+}
+
+HRESULT
+MFFrameSource::ReadNextFrame(MediaFrame* aOutFrame, bool* aOutEndOfStream)
+{
+  *aOutEndOfStream = false;
+
+  if (!mProbedSamples.empty()) {
+    ProbedSample probed = mProbedSamples.front();
+    mProbedSamples.pop_front();
+    return SampleToFrame(probed.sample, probed.isVideo, probed.timestamp, aOutFrame);
+  }
+
+  while (!mVideoEOS || !mAudioEOS) {
+    IMFSamplePtr sample;
+    DWORD streamIndex, flags;
+    LONGLONG timestamp;
+    HRESULT hr;
+
+    hr = mReader->ReadSample(MF_SOURCE_READER_ANY_STREAM,
+                             0,                // Flags.
+                             &streamIndex,     // Receives the actual stream index.
+                             &flags,           // Receives status flags.
+                             &timestamp,       // Receives the time stamp.
+                             &sample);         // Receives the sample or NULL.
+    if (FAILED(hr)) {
+      DBGMSG(L"ReadSample failed with 0x%x\n", hr);
+      return hr;
+    }
+
+    bool isVideoSample = streamIndex == mVideoStreamIndex;
+    bool isAudioSample = streamIndex == mAudioStreamIndex;
+
+    if (flags & MF_SOURCE_READERF_ENDOFSTREAM) {
+      if (isVideoSample) {
+        mVideoEOS = true;
+      } else if (isAudioSample) {
+        mAudioEOS = true;
+      }
+    }
+    if (flags & MF_SOURCE_READERF_NEWSTREAM) {
+      DBGMSG(L"ReadSample flag: New stream\n");
+    }
+    if (flags & MF_SOURCE_READERF_CURRENTMEDIATYPECHANGED) {
+      DBGMSG(L"Current media type change to:\n");
+      IMFMediaTypePtr type;
+      hr = mReader->GetCurrentMediaType(streamIndex, &type);
+      ENSURE_SUCCESS(hr, hr)
+      LogMediaType(type);
+      DBGMSG(L"\n");
+    }
+    if (flags & MF_SOURCE_READERF_STREAMTICK) {
+      DBGMSG(L"Stream tick\n");
+    }
+    if (flags & MF_SOURCE_READERF_NATIVEMEDIATYPECHANGED) {
+      // The format changed. Reconfigure the decoder.
+      DBGMSG(L"MF_SOURCE_READERF_NATIVEMEDIATYPECHANGED\n");
+    }
+
+    if (!sample) {
+      continue;
+    }
+    if (!isAudioSample && !isVideoSample) {
+      DBGMSG(L"This stream should be deselected!\n");
+      continue;
+    }
+
+    return SampleToFrame(sample, isVideoSample, timestamp, aOutFrame);
+  }
+
+  *aOutEndOfStream = true;
+  return S_OK;
+}
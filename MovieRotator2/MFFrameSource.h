@@ -0,0 +1,143 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// The Media Foundation backend of IFrameSource; decodes a file with a
+// source reader.
+
+#pragma once
+
+#include "FrameSource.h"
+
+#include <deque>
+
+enum {
+  Unknown = -1
+};
+
+class MFFrameSource : public IFrameSource {
+public:
+  MFFrameSource();
+
+  // Opens aFilename, and configures the reader to output video as NV12, or
+  // RGB32 if it won't give us NV12, and audio as PCM. If aCopyAudio is true
+  // and the audio is AAC which the writer can take as it is, the audio is
+  // read without being decoded instead, so that it can be copied into the
+  // output; IsAudioCompressed() says which.
+  HRESULT Init(const std::wstring& aFilename, bool aCopyAudio);
+
+  // Opens aFilename to read its samples as they're stored, without decoding
+  // them, so that they can be copied into another file. The video and
+  // audio media types are the streams' native types.
+  HRESULT InitCompressed(const std::wstring& aFilename);
+
+  // Reconfigures the reader to output video in aSubtype, which is the
+  // format we rotate in; MFVideoFormat_NV12 or RGB32. Must be called before
+  // the first frame is read. Reconfiguring drops the probed first samples,
+  // and seeks back to decode them again in the new format.
+  HRESULT ConfigureVideoOutput(const GUID& aSubtype);
+
+  // The error which made ReadFrame() fail.
+  HRESULT GetError() const { return mError; }
+
+  // True if the audio is read as it's stored, rather than decoded to PCM.
+  bool IsAudioCompressed() const { return mAudioFormat.compressed; }
+
+  const GUID& GetVideoSubtype() const { return mVideoSubtype; }
+  IMFMediaType* GetVideoMediaType() const { return mVideoType; }
+  IMFMediaType* GetAudioMediaType() const { return mAudioType; }
+
+  // H.264 stream properties, extracted from the native video type, so the
+  // reencode can match them. Unknown if the stream doesn't say.
+  UINT32 GetH264Profile() const { return mH264Profile; }
+  UINT32 GetAvgBitRate() const { return mAvgBitRate; }
+
+  // IFrameSource methods.
+  bool HasVideo() const override;
+  bool HasAudio() const override;
+  const VideoFormat& GetVideoFormat() const override { return mVideoFormat; }
+  const AudioFormat& GetAudioFormat() const override { return mAudioFormat; }
+  int64_t GetDuration() const override { return mDuration; }
+  bool ReadFrame(MediaFrame* aOutFrame, bool* aOutEndOfStream) override;
+  bool Seek(int64_t aTime) override;
+  // Reads the index from the sample tables of MP4 files.
+  bool GetKeyframeIndex(KeyframeIndex* aOutIndex) override;
+
+private:
+  HRESULT ReadNextFrame(MediaFrame* aOutFrame, bool* aOutEndOfStream);
+
+  // Describes a sample read from the reader as a MediaFrame.
+  HRESULT SampleToFrame(IMFSample* aSample,
+                        bool aIsVideo,
+                        LONGLONG aTimestamp,
+                        MediaFrame* aOutFrame);
+
+  // Seeks the reader to aTime, and drops the probed samples.
+  HRESULT SetPosition(LONGLONG aTime);
+
+  // Configures the reader to output audio as PCM, or as it's stored if
+  // aCopyAudio is true and the writer can take it as it is.
+  HRESULT ConfigureAudioOutput(bool aCopyAudio);
+
+  HRESULT DetermineOutputVideoType(IMFMediaType** aOutVideoType);
+
+  std::wstring mFilename;
+  IMFSourceReaderPtr mReader;
+
+  // True if samples are read without being decoded.
+  bool mCompressed;
+
+  DWORD mVideoStreamIndex;
+  DWORD mAudioStreamIndex;
+
+  IMFMediaTypePtr mVideoType;
+  IMFMediaTypePtr mAudioType;
+
+  // The format frames are rotated in; MFVideoFormat_NV12 or RGB32.
+  GUID mVideoSubtype;
+
+  VideoFormat mVideoFormat;
+  AudioFormat mAudioFormat;
+
+  LONG mVideoStride;
+  // Number of rows in the decoded frames' buffers.
+  UINT32 mVideoBufferHeight;
+
+  // The region inside the frame in which the picture actually resides.
+  MFVideoArea mPictureRegion;
+
+  UINT32 mH264Profile;
+  UINT32 mAvgBitRate;
+  UINT32 mInterlaceMode;
+
+  LONGLONG mDuration;
+
+  bool mAudioEOS;
+  bool mVideoEOS;
+
+  // The first sample of each stream is decoded while we determine the
+  // streams' output types. Rather than seek back and decode them again,
+  // we hold onto them, and ReadFrame() returns them first.
+  struct ProbedSample {
+    IMFSamplePtr sample;
+    LONGLONG timestamp;
+    bool isVideo;
+  };
+  std::deque<ProbedSample> mProbedSamples;
+  // True once the probes have read from the reader, so that reconfiguring
+  // the video output needs to rewind.
+  bool mHasProbed;
+
+  HRESULT mError;
+};
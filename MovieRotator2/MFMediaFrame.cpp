@@ -0,0 +1,91 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "stdafx.h"
+#include "MFMediaFrame.h"
+#include "PooledMediaBuffer.h"
+
+HRESULT
+SampleToMediaFrame(IMFSample* aSample, StreamType aStream, MediaFrame* aOutFrame)
+{
+  ENSURE_TRUE(aSample, E_POINTER);
+  ENSURE_TRUE(aOutFrame, E_POINTER);
+  HRESULT hr;
+
+  IMFMediaBufferPtr buffer;
+  hr = aSample->ConvertToContiguousBuffer(&buffer);
+  ENSURE_SUCCESS(hr, hr);
+
+  BYTE* data = nullptr;
+  DWORD length = 0;
+  hr = buffer->Lock(&data, NULL, &length);
+  ENSURE_SUCCESS(hr, hr);
+
+  *aOutFrame = MediaFrame();
+  aOutFrame->stream = aStream;
+  LONGLONG time = 0;
+  if (SUCCEEDED(aSample->GetSampleTime(&time))) {
+    aOutFrame->timestamp = time;
+  }
+  if (SUCCEEDED(aSample->GetSampleDuration(&time))) {
+    aOutFrame->duration = time;
+  }
+  aOutFrame->keyframe = MFGetAttributeUINT32(aSample, MFSampleExtension_CleanPoint, FALSE) != FALSE;
+  aOutFrame->data = data;
+  aOutFrame->length = length;
+  // The frame takes over our reference to the buffer.
+  aOutFrame->storage = std::shared_ptr<void>(buffer.Detach(), [](IMFMediaBuffer* aBuffer) {
+    aBuffer->Unlock();
+    aBuffer->Release();
+  });
+
+  return S_OK;
+}
+
+HRESULT
+MediaFrameToSample(const MediaFrame& aFrame, IMFSample** aOutSample)
+{
+  ENSURE_TRUE(aOutSample, E_POINTER);
+  ENSURE_TRUE(aFrame.data, E_INVALIDARG);
+  ENSURE_TRUE(aFrame.length <= MAXDWORD, E_INVALIDARG);
+  HRESULT hr;
+
+  IMFMediaBufferPtr buffer;
+  hr = PooledMediaBuffer::Create(aFrame.storage, aFrame.data, DWORD(aFrame.length), &buffer);
+  ENSURE_SUCCESS(hr, hr);
+
+  IMFSamplePtr sample;
+  hr = MFCreateSample(&sample);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = sample->AddBuffer(buffer);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = sample->SetSampleTime(aFrame.timestamp);
+  ENSURE_SUCCESS(hr, hr);
+
+  hr = sample->SetSampleDuration(aFrame.duration);
+  ENSURE_SUCCESS(hr, hr);
+
+  if (aFrame.keyframe) {
+    // The writer needs to know where the sync samples are when it's
+    // writing compressed samples as they are.
+    hr = sample->SetUINT32(MFSampleExtension_CleanPoint, TRUE);
+    ENSURE_SUCCESS(hr, hr);
+  }
+
+  *aOutSample = sample.Detach();
+  return S_OK;
+}
@@ -0,0 +1,34 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Conversions between Media Foundation samples and the transcode pipeline's
+// MediaFrames. Neither copies the frame's data.
+
+#pragma once
+
+#include "FrameSource.h"
+
+// Describes the data in aSample as a MediaFrame of aStream. The sample's
+// buffer stays locked, and alive, until the last copy of the frame goes away.
+// The image of video frames isn't filled in; the caller knows the layout.
+HRESULT
+SampleToMediaFrame(IMFSample* aSample, StreamType aStream, MediaFrame* aOutFrame);
+
+// Wraps aFrame's data in a sample with the frame's time and duration. The
+// sample holds a reference to the frame's storage. Only the data is pooled;
+// the sample and the PooledMediaBuffer wrapping the data are small objects
+// created for every frame.
+HRESULT
+MediaFrameToSample(const MediaFrame& aFrame, IMFSample** aOutSample);
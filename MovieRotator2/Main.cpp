@@ -17,6 +17,7 @@
 #include "H264ClassFactory.h"
 #include "PlaybackClocks.h"
 #include "MovieRotator2.h"
+#include "RotationTranscoder.h"
 
 static bool
 Win7OrLater()
@@ -88,6 +89,29 @@ int APIENTRY _tWinMain(_In_ HINSTANCE hInstance,
   AutoRegisterH264ClassFactory initH264ClassFactory;
   AutoInitCubeb initCubeb;
 
+  // "MovieRotator.exe --benchmark-transcode <input> <output> [preset]" times
+  // the transcoder, logs the results, and exits without showing any UI. The
+  // preset is fast, balanced or archival; archival by default.
+  int argc = 0;
+  LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+  bool benchmark = argv &&
+                   (argc == 4 || argc == 5) &&
+                   wcscmp(argv[1], L"--benchmark-transcode") == 0;
+  if (benchmark) {
+    EncoderPreset preset = EncoderPreset_Archival;
+    if (argc == 5) {
+      std::wstring name(argv[4]);
+      if (!ParseEncoderPreset(std::string(name.begin(), name.end()), &preset)) {
+        DBGMSG(L"Unknown encoder preset %s\n", argv[4]);
+      }
+    }
+    RotationTranscoder::RunBenchmark(argv[2], argv[3], preset);
+  }
+  LocalFree(argv);
+  if (benchmark) {
+    return 0;
+  }
+
   MSG msg;
   HACCEL hAccelTable;
 
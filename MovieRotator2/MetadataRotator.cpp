@@ -0,0 +1,127 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "stdafx.h"
+#include "MetadataRotator.h"
+#include "Mp4Metadata.h"
+#include "TranscodeJobList.h"
+
+using std::wstring;
+
+// How much of the file each call to Transcode() copies.
+static const size_t CopyChunkSize = 4 * 1024 * 1024;
+
+MetadataRotator::MetadataRotator(const TranscodeJob* aJob)
+  : mJob(aJob),
+    mInput(nullptr),
+    mOutput(nullptr),
+    mLength(0),
+    mCopied(0),
+    mDuration(0),
+    mProgress(0)
+{
+}
+
+MetadataRotator::~MetadataRotator()
+{
+  Close();
+}
+
+void
+MetadataRotator::Close()
+{
+  if (mInput) {
+    fclose(mInput);
+    mInput = nullptr;
+  }
+  if (mOutput) {
+    fclose(mOutput);
+    mOutput = nullptr;
+  }
+}
+
+bool
+MetadataRotator::CanRotate(const wstring& aFilename)
+{
+  FILE* file = nullptr;
+  if (_wfopen_s(&file, aFilename.c_str(), L"rb") != 0 || !file) {
+    return false;
+  }
+  Mp4File mp4(file);
+  bool canRotate = CanRotateMp4Metadata(mp4);
+  fclose(file);
+  return canRotate;
+}
+
+HRESULT
+MetadataRotator::Initialize()
+{
+  ENSURE_TRUE(mJob, E_POINTER);
+
+  errno_t err = _wfopen_s(&mInput, mJob->GetInputFilename().c_str(), L"rb");
+  ENSURE_TRUE(err == 0 && mInput, E_FAIL);
+  Mp4File input(mInput);
+  ENSURE_TRUE(CanRotateMp4Metadata(input), MF_E_UNSUPPORTED_FORMAT);
+  mLength = input.GetLength();
+  // Only used to estimate how long the copy has left.
+  ReadMp4Duration(input, &mDuration);
+  ENSURE_TRUE(_fseeki64(mInput, 0, SEEK_SET) == 0, E_FAIL);
+
+  // The output is read back and patched once it's written.
+  err = _wfopen_s(&mOutput, mJob->GetOutputFilename().c_str(), L"w+b");
+  ENSURE_TRUE(err == 0 && mOutput, E_FAIL);
+
+  mBuffer.resize(CopyChunkSize);
+  return S_OK;
+}
+
+HRESULT
+MetadataRotator::Transcode()
+{
+  ENSURE_TRUE(mInput && mOutput, E_FAIL);
+
+  if (mCopied < mLength) {
+    size_t length = size_t(min(uint64_t(mBuffer.size()), mLength - mCopied));
+    ENSURE_TRUE(fread(&mBuffer[0], 1, length, mInput) == length, E_FAIL);
+    ENSURE_TRUE(fwrite(&mBuffer[0], 1, length, mOutput) == length, E_FAIL);
+    mCopied += length;
+    // Hold back the last thousandth until the matrix is written.
+    mProgress = min(999u, max(1u, UINT32(mCopied * 1000 / max(mLength, uint64_t(1)))));
+    return S_OK;
+  }
+
+  ENSURE_TRUE(fflush(mOutput) == 0, E_FAIL);
+  Mp4File output(mOutput);
+  ENSURE_TRUE(output.GetLength() == mLength, E_FAIL);
+  if (!RotateMp4Metadata(output, mJob->GetRotation())) {
+    DBGMSG(L"Failed to rewrite the display matrix\n");
+    return E_FAIL;
+  }
+  Close();
+  mProgress = 1000;
+  return S_OK;
+}
+
+UINT32
+MetadataRotator::GetProgress()
+{
+  return mProgress;
+}
+
+LONGLONG
+MetadataRotator::GetDuration()
+{
+  return mDuration;
+}
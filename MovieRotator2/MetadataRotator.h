@@ -0,0 +1,58 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+
+#include "Interfaces.h"
+#include <string>
+#include <vector>
+
+class TranscodeJob;
+
+// Rotates MP4 files without reencoding them; the input is copied byte for
+// byte, then the video track's display matrix is rewritten so that players
+// show the frames rotated. This runs as fast as the disk can copy the file,
+// and loses no quality. See Mp4Metadata.h.
+class MetadataRotator : public Transcoder {
+public:
+  MetadataRotator(const TranscodeJob* aJob);
+  ~MetadataRotator();
+
+  // Returns true if aFilename is an MP4 which plays back the same when
+  // rotated by rewriting its display matrix as when reencoded.
+  static bool CanRotate(const std::wstring& aFilename);
+
+  HRESULT Initialize() override;
+
+  // Copies the next chunk of the file, and once it's all copied, rewrites
+  // the matrix.
+  HRESULT Transcode() override;
+
+  UINT32 GetProgress() override;
+
+  LONGLONG GetDuration() override;
+
+private:
+  void Close();
+
+  const TranscodeJob* mJob;
+  FILE* mInput;
+  FILE* mOutput;
+  uint64_t mLength;
+  uint64_t mCopied;
+  int64_t mDuration;
+  std::vector<BYTE> mBuffer;
+  UINT32 mProgress;
+};
@@ -22,6 +22,7 @@
 #include "JobListScrollBar.h"
 #include "VideoPlayer.h"
 #include "EventListeners.h"
+#include "RotationTuning.h"
 
 #define SZ_WINDOW_CLASS L"MOVIEROTATOR2"
 #define SZ_WINDOW_TITLE L"Movie Rotator"
@@ -493,9 +494,46 @@ SetSuggestedOutputFilename(const wstring& aInFilename, wchar_t* aBuffer, const i
   return S_OK;
 }
 
+// The file types the save dialog offers, which choose how the job rotates
+// the movie, and which encoder preset it reencodes with. The first is the
+// default.
+struct SaveFileType {
+  const wchar_t* description;
+  TranscodeMode mode;
+  EncoderPreset preset;
+};
+
+static const SaveFileType SaveFileTypes[] = {
+  { L"MP4, reencoded at archival quality (*.mp4)",
+    TranscodeMode_Reencode, EncoderPreset_Archival },
+  { L"MP4, reencoded balancing speed and quality (*.mp4)",
+    TranscodeMode_Reencode, EncoderPreset_Balanced },
+  { L"MP4, reencoded fast (*.mp4)",
+    TranscodeMode_Reencode, EncoderPreset_Fast },
+  // Players such as Windows Media Player on Windows 7 ignore the rotation
+  // metadata, and play such files unrotated, so this is only done if the
+  // user asks for it.
+  { L"MP4, rotation metadata rewritten if possible; "
+    L"players must honor rotation metadata (*.mp4)",
+    TranscodeMode_Auto, EncoderPreset_Archival },
+};
+
 static HRESULT
-GetOutputFileName(const wstring& aInFilename, wstring& aOutFilename, wstring& aOutFileExtension)
+GetOutputFileName(const wstring& aInFilename,
+                  wstring& aOutFilename,
+                  wstring& aOutFileExtension,
+                  const SaveFileType** aOutType)
 {
+  // Each type is a description and a pattern, each null terminated, and
+  // the list ends with another null, which c_str() supplies.
+  wstring filter;
+  for (size_t i = 0; i < ARRAYSIZE(SaveFileTypes); i++) {
+    filter += SaveFileTypes[i].description;
+    filter.push_back(L'\0');
+    filter += L"*.mp4";
+    filter.push_back(L'\0');
+  }
+
   OPENFILENAME ofn;
   const int buflen = 255;
   wchar_t buf[buflen];
@@ -510,7 +548,7 @@ GetOutputFileName(const wstring& aInFilename, wstring& aOutFilename, wstring& aO
   ofn.hwndOwner = GetActiveWindow();
   ofn.lpstrFile = (LPWSTR)buf;
   ofn.nMaxFile  = buflen;
-  ofn.lpstrFilter = L"MP4 (*.mp4) \0 *.mp4;\0";
+  ofn.lpstrFilter = filter.c_str();
   ofn.nFilterIndex = 1;
   ofn.lpstrInitialDir = NULL;
   ofn.lpstrDefExt = L"mp4";
@@ -522,6 +560,9 @@ GetOutputFileName(const wstring& aInFilename, wstring& aOutFilename, wstring& aO
   if (GetSaveFileName(&ofn)) {
     aOutFilename = wstring(buf);
     aOutFileExtension = wstring(buf + ofn.nFileExtension);
+    // nFilterIndex counts from 1, and is 0 if there's no filter selected.
+    const DWORD index = ofn.nFilterIndex;
+    *aOutType = &SaveFileTypes[(index >= 1 && index <= ARRAYSIZE(SaveFileTypes)) ? index - 1 : 0];
     return S_OK;
   }
 
@@ -532,8 +573,9 @@ void
 MovieRotator::OnSaveRotation()
 {
   wstring outFilename, extension;
+  const SaveFileType* type = nullptr;
   const wstring& inFilename = mVideoPlayer->GetOpenFilename();
-  if (FAILED(GetOutputFileName(inFilename, outFilename, extension)) ||
+  if (FAILED(GetOutputFileName(inFilename, outFilename, extension, &type)) ||
       outFilename.empty()) {
     return;
   }
@@ -557,9 +599,12 @@ MovieRotator::OnSaveRotation()
   }
 
   // Start new transcode of rotation... Job starts automatically.
-  mTranscodeManager->AddJob(new TranscodeJob(inFilename,
-                                             outFilename,
-                                             mVideoPlayer->GetRotation()));
+  TranscodeJob* job = new TranscodeJob(inFilename,
+                                       outFilename,
+                                       mVideoPlayer->GetRotation());
+  job->SetMode(type->mode);
+  job->SetEncoderPreset(type->preset);
+  mTranscodeManager->AddJob(job);
 
   mVideoPlayer->Reset();
 }
@@ -602,6 +647,12 @@ MovieRotator::OnKeyDown(WPARAM wParam)
       break;
     }
 
+    case KEY_0 + 9: {
+      // Blocks the UI for a few seconds; results are in the log.
+      RunRotationBenchmark();
+      break;
+    }
+
   }
   #endif // _DEBUG
 }
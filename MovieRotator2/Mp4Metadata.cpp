@@ -0,0 +1,549 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "Mp4Metadata.h"
+
+static const uint32_t BOX_ftyp = MP4_FOURCC('f','t','y','p');
+static const uint32_t BOX_moov = MP4_FOURCC('m','o','o','v');
+static const uint32_t BOX_mvhd = MP4_FOURCC('m','v','h','d');
+static const uint32_t BOX_trak = MP4_FOURCC('t','r','a','k');
+static const uint32_t BOX_tkhd = MP4_FOURCC('t','k','h','d');
+static const uint32_t BOX_mdia = MP4_FOURCC('m','d','i','a');
+static const uint32_t BOX_hdlr = MP4_FOURCC('h','d','l','r');
+static const uint32_t BOX_minf = MP4_FOURCC('m','i','n','f');
+static const uint32_t BOX_stbl = MP4_FOURCC('s','t','b','l');
+static const uint32_t BOX_stsd = MP4_FOURCC('s','t','s','d');
+static const uint32_t BOX_mdhd = MP4_FOURCC('m','d','h','d');
+static const uint32_t BOX_stts = MP4_FOURCC('s','t','t','s');
+static const uint32_t BOX_ctts = MP4_FOURCC('c','t','t','s');
+static const uint32_t BOX_stss = MP4_FOURCC('s','t','s','s');
+static const uint32_t BOX_stsz = MP4_FOURCC('s','t','s','z');
+static const uint32_t BOX_stz2 = MP4_FOURCC('s','t','z','2');
+static const uint32_t BOX_uuid = MP4_FOURCC('u','u','i','d');
+
+static const uint32_t HANDLER_vide = MP4_FOURCC('v','i','d','e');
+static const uint32_t HANDLER_soun = MP4_FOURCC('s','o','u','n');
+
+static const uint32_t CODEC_avc1 = MP4_FOURCC('a','v','c','1');
+static const uint32_t CODEC_avc3 = MP4_FOURCC('a','v','c','3');
+static const uint32_t CODEC_mp4a = MP4_FOURCC('m','p','4','a');
+
+static const uint32_t BRAND_qt = MP4_FOURCC('q','t',' ',' ');
+
+static bool
+Seek(FILE* aFile, uint64_t aOffset, int aOrigin)
+{
+#if defined(_MSC_VER)
+  return _fseeki64(aFile, int64_t(aOffset), aOrigin) == 0;
+#else
+  return fseeko(aFile, off_t(aOffset), aOrigin) == 0;
+#endif
+}
+
+static uint64_t
+Tell(FILE* aFile)
+{
+#if defined(_MSC_VER)
+  return uint64_t(_ftelli64(aFile));
+#else
+  return uint64_t(ftello(aFile));
+#endif
+}
+
+Mp4File::Mp4File(FILE* aFile)
+  : mFile(aFile),
+    mLength(0)
+{
+  if (mFile && Seek(mFile, 0, SEEK_END)) {
+    mLength = Tell(mFile);
+  }
+}
+
+bool
+Mp4File::Read(uint64_t aOffset, void* aBuffer, size_t aLength)
+{
+  if (!mFile || aOffset > mLength || aLength > mLength - aOffset) {
+    return false;
+  }
+  return Seek(mFile, aOffset, SEEK_SET) &&
+         fread(aBuffer, 1, aLength, mFile) == aLength;
+}
+
+bool
+Mp4File::Write(uint64_t aOffset, const void* aBuffer, size_t aLength)
+{
+  // Only existing data is patched; boxes never grow.
+  if (!mFile || aOffset > mLength || aLength > mLength - aOffset) {
+    return false;
+  }
+  return Seek(mFile, aOffset, SEEK_SET) &&
+         fwrite(aBuffer, 1, aLength, mFile) == aLength &&
+         fflush(mFile) == 0;
+}
+
+bool
+Mp4File::ReadU32(uint64_t aOffset, uint32_t* aOutValue)
+{
+  uint8_t bytes[4];
+  if (!Read(aOffset, bytes, sizeof(bytes))) {
+    return false;
+  }
+  *aOutValue = (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) |
+               (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]);
+  return true;
+}
+
+bool
+Mp4File::WriteU32(uint64_t aOffset, uint32_t aValue)
+{
+  const uint8_t bytes[4] = {
+    uint8_t(aValue >> 24), uint8_t(aValue >> 16), uint8_t(aValue >> 8), uint8_t(aValue)
+  };
+  return Write(aOffset, bytes, sizeof(bytes));
+}
+
+bool
+Mp4File::ReadBox(uint64_t aOffset, uint64_t aEnd, Mp4Box* aOutBox)
+{
+  uint32_t size32;
+  if (aEnd > mLength || aOffset >= aEnd ||
+      !ReadU32(aOffset, &size32) ||
+      !ReadU32(aOffset + 4, &aOutBox->type)) {
+    return false;
+  }
+  aOutBox->offset = aOffset;
+  aOutBox->headerSize = 8;
+  if (size32 == 1) {
+    // A 64 bit size follows the type.
+    uint32_t high, low;
+    if (!ReadU32(aOffset + 8, &high) || !ReadU32(aOffset + 12, &low)) {
+      return false;
+    }
+    aOutBox->size = (uint64_t(high) << 32) | low;
+    aOutBox->headerSize = 16;
+  } else if (size32 == 0) {
+    // The box extends to the end of its parent.
+    aOutBox->size = aEnd - aOffset;
+  } else {
+    aOutBox->size = size32;
+  }
+  if (aOutBox->type == BOX_uuid) {
+    aOutBox->headerSize += 16;
+  }
+  return aOutBox->size >= aOutBox->headerSize &&
+         aOutBox->size <= aEnd - aOffset;
+}
+
+bool
+Mp4File::ReadBoxes(uint64_t aOffset, uint64_t aEnd, std::vector<Mp4Box>* aOutBoxes)
+{
+  aOutBoxes->clear();
+  for (uint64_t offset = aOffset; offset < aEnd; ) {
+    Mp4Box box;
+    if (!ReadBox(offset, aEnd, &box)) {
+      return false;
+    }
+    aOutBoxes->push_back(box);
+    offset = box.End();
+  }
+  return true;
+}
+
+bool
+Mp4File::FindChild(const Mp4Box& aParent, uint32_t aType, Mp4Box* aOutBox)
+{
+  for (uint64_t offset = aParent.BodyOffset(); offset < aParent.End(); ) {
+    if (!ReadBox(offset, aParent.End(), aOutBox)) {
+      return false;
+    }
+    if (aOutBox->type == aType) {
+      return true;
+    }
+    offset = aOutBox->End();
+  }
+  return false;
+}
+
+// Reads the parts of the trak box aTrak that we need.
+static bool
+ReadTrack(Mp4File& aFile, const Mp4Box& aTrak, Mp4Track* aOutTrack)
+{
+  Mp4Track& track = *aOutTrack;
+  if (!aFile.FindChild(aTrak, BOX_tkhd, &track.header)) {
+    return false;
+  }
+
+  // tkhd is a full box; a version byte and 3 bytes of flags, then the
+  // times, track ID and duration, which are bigger in version 1, then 16
+  // bytes of layer, volume etc. before the matrix, width and height.
+  uint8_t version;
+  if (!aFile.Read(track.header.BodyOffset(), &version, 1) || version > 1) {
+    return false;
+  }
+  const uint64_t matrixOffset = 4 + ((version == 1) ? 32 : 20) + 16;
+  if (track.header.BodySize() < matrixOffset + 9 * 4 + 2 * 4) {
+    return false;
+  }
+  track.matrixOffset = track.header.BodyOffset() + matrixOffset;
+  for (uint32_t i = 0; i < 9; i++) {
+    uint32_t value;
+    if (!aFile.ReadU32(track.matrixOffset + i * 4, &value)) {
+      return false;
+    }
+    track.matrix[i] = int32_t(value);
+  }
+  if (!aFile.ReadU32(track.matrixOffset + 36, &track.width) ||
+      !aFile.ReadU32(track.matrixOffset + 40, &track.height)) {
+    return false;
+  }
+
+  // hdlr is a full box; its handler type follows 4 bytes of pre_defined.
+  Mp4Box mdia, hdlr;
+  if (!aFile.FindChild(aTrak, BOX_mdia, &mdia) ||
+      !aFile.FindChild(mdia, BOX_hdlr, &hdlr) ||
+      !aFile.ReadU32(hdlr.BodyOffset() + 8, &track.handlerType)) {
+    return false;
+  }
+
+  // stsd is a full box; its entry count is followed by the sample entries,
+  // which are boxes whose type is the codec.
+  track.sampleEntryType = 0;
+  Mp4Box minf, stbl, stsd, entry;
+  uint32_t entryCount;
+  if (aFile.FindChild(mdia, BOX_minf, &minf) &&
+      aFile.FindChild(minf, BOX_stbl, &stbl) &&
+      aFile.FindChild(stbl, BOX_stsd, &stsd) &&
+      aFile.ReadU32(stsd.BodyOffset() + 4, &entryCount) && entryCount > 0 &&
+      aFile.ReadBox(stsd.BodyOffset() + 8, stsd.End(), &entry)) {
+    track.sampleEntryType = entry.type;
+  }
+  return true;
+}
+
+bool
+ReadMp4Tracks(Mp4File& aFile, uint32_t* aOutMajorBrand, std::vector<Mp4Track>* aOutTracks)
+{
+  std::vector<Mp4Box> boxes;
+  if (!aFile.ReadBoxes(0, aFile.GetLength(), &boxes) ||
+      boxes.empty() || boxes[0].type != BOX_ftyp ||
+      !aFile.ReadU32(boxes[0].BodyOffset(), aOutMajorBrand)) {
+    return false;
+  }
+
+  aOutTracks->clear();
+  bool haveMoov = false;
+  for (size_t i = 0; i < boxes.size(); i++) {
+    if (boxes[i].type != BOX_moov) {
+      continue;
+    }
+    if (haveMoov) {
+      return false;
+    }
+    haveMoov = true;
+    std::vector<Mp4Box> children;
+    if (!aFile.ReadChildren(boxes[i], &children)) {
+      return false;
+    }
+    for (size_t j = 0; j < children.size(); j++) {
+      if (children[j].type != BOX_trak) {
+        continue;
+      }
+      Mp4Track track;
+      if (!ReadTrack(aFile, children[j], &track)) {
+        return false;
+      }
+      aOutTracks->push_back(track);
+    }
+  }
+  return haveMoov;
+}
+
+bool
+CanRotateMp4Metadata(Mp4File& aFile)
+{
+  uint32_t brand;
+  std::vector<Mp4Track> tracks;
+  if (!ReadMp4Tracks(aFile, &brand, &tracks) || brand == BRAND_qt) {
+    return false;
+  }
+  // Other tracks, such as the timed metadata phones record, don't affect
+  // playback, so they can stay.
+  uint32_t numVideoTracks = 0;
+  for (size_t i = 0; i < tracks.size(); i++) {
+    const Mp4Track& track = tracks[i];
+    if (track.handlerType == HANDLER_vide) {
+      if (track.sampleEntryType != CODEC_avc1 && track.sampleEntryType != CODEC_avc3) {
+        return false;
+      }
+      numVideoTracks++;
+    } else if (track.handlerType == HANDLER_soun) {
+      if (track.sampleEntryType != CODEC_mp4a) {
+        return false;
+      }
+    }
+  }
+  return numVideoTracks == 1;
+}
+
+bool
+RotateMp4Metadata(Mp4File& aFile, Rotation aRotation)
+{
+  uint32_t brand;
+  std::vector<Mp4Track> tracks;
+  if (!ReadMp4Tracks(aFile, &brand, &tracks)) {
+    return false;
+  }
+  bool rotated = false;
+  for (size_t i = 0; i < tracks.size(); i++) {
+    const Mp4Track& track = tracks[i];
+    if (track.handlerType != HANDLER_vide) {
+      continue;
+    }
+    int32_t matrix[9];
+    GetMp4RotationMatrix(aRotation, track.width, track.height, matrix);
+    for (uint32_t j = 0; j < 9; j++) {
+      if (!aFile.WriteU32(track.matrixOffset + j * 4, uint32_t(matrix[j]))) {
+        return false;
+      }
+    }
+    rotated = true;
+  }
+  return rotated;
+}
+
+// Reads the entries of the sample table box aBox, a full box whose entry
+// count is followed by entries of aEntrySize bytes, into aOutEntries.
+static bool
+ReadSampleTable(Mp4File& aFile,
+                const Mp4Box& aBox,
+                uint32_t aEntrySize,
+                std::vector<uint8_t>* aOutEntries,
+                uint32_t* aOutCount)
+{
+  uint32_t count;
+  if (aBox.BodySize() < 8 ||
+      !aFile.ReadU32(aBox.BodyOffset() + 4, &count) ||
+      uint64_t(count) * aEntrySize > aBox.BodySize() - 8) {
+    return false;
+  }
+  aOutEntries->resize(size_t(count) * aEntrySize);
+  *aOutCount = count;
+  return !count || aFile.Read(aBox.BodyOffset() + 8, &(*aOutEntries)[0], aOutEntries->size());
+}
+
+static uint32_t
+ReadBigEndianU32(const uint8_t* aData)
+{
+  return (uint32_t(aData[0]) << 24) | (uint32_t(aData[1]) << 16) |
+         (uint32_t(aData[2]) << 8) | uint32_t(aData[3]);
+}
+
+bool
+ReadMp4KeyframeIndex(Mp4File& aFile, KeyframeIndex* aOutIndex)
+{
+  aOutIndex->Clear();
+
+  std::vector<Mp4Box> boxes;
+  if (!aFile.ReadBoxes(0, aFile.GetLength(), &boxes)) {
+    return false;
+  }
+  Mp4Box stbl;
+  uint32_t timescale = 0;
+  bool found = false;
+  for (size_t i = 0; i < boxes.size() && !found; i++) {
+    if (boxes[i].type != BOX_moov) {
+      continue;
+    }
+    std::vector<Mp4Box> children;
+    if (!aFile.ReadChildren(boxes[i], &children)) {
+      return false;
+    }
+    for (size_t j = 0; j < children.size() && !found; j++) {
+      Mp4Box mdia, hdlr, mdhd, minf;
+      uint32_t handlerType;
+      if (children[j].type != BOX_trak ||
+          !aFile.FindChild(children[j], BOX_mdia, &mdia) ||
+          !aFile.FindChild(mdia, BOX_hdlr, &hdlr) ||
+          !aFile.ReadU32(hdlr.BodyOffset() + 8, &handlerType) ||
+          handlerType != HANDLER_vide) {
+        continue;
+      }
+      // mdhd is a full box; the timescale follows the creation and
+      // modification times, which are 64 bit in version 1.
+      uint8_t version;
+      if (!aFile.FindChild(mdia, BOX_mdhd, &mdhd) ||
+          !aFile.Read(mdhd.BodyOffset(), &version, 1) ||
+          !aFile.ReadU32(mdhd.BodyOffset() + ((version == 1) ? 20 : 12), &timescale) ||
+          !timescale ||
+          !aFile.FindChild(mdia, BOX_minf, &minf) ||
+          !aFile.FindChild(minf, BOX_stbl, &stbl)) {
+        return false;
+      }
+      found = true;
+    }
+  }
+  if (!found) {
+    return false;
+  }
+
+  // The sample count is in stsz, or in the compact stz2; both are full
+  // boxes whose count follows a 32 bit field.
+  Mp4Box stsz;
+  uint32_t numSamples;
+  if ((!aFile.FindChild(stbl, BOX_stsz, &stsz) && !aFile.FindChild(stbl, BOX_stz2, &stsz)) ||
+      stsz.BodySize() < 12 ||
+      !aFile.ReadU32(stsz.BodyOffset() + 8, &numSamples)) {
+    return false;
+  }
+
+  // stts gives the decode times, as runs of samples with the same duration,
+  // and ctts the offsets from them to the presentation times. stss lists
+  // the 1 based numbers of the sync samples, in ascending order.
+  Mp4Box stts, ctts, stss;
+  std::vector<uint8_t> timeToSample, compositionOffsets, syncSamples;
+  uint32_t numTimeToSample = 0, numCompositionOffsets = 0, numSyncSamples = 0;
+  if (!aFile.FindChild(stbl, BOX_stts, &stts) ||
+      !ReadSampleTable(aFile, stts, 8, &timeToSample, &numTimeToSample)) {
+    return false;
+  }
+  // The runs mustn't describe more samples than there are, or a corrupt
+  // count would have us index billions of samples which don't exist.
+  uint64_t numTimedSamples = 0;
+  for (uint32_t i = 0; i < numTimeToSample; i++) {
+    numTimedSamples += ReadBigEndianU32(&timeToSample[i * 8]);
+  }
+  if (numTimedSamples > numSamples) {
+    return false;
+  }
+  const bool haveOffsets = aFile.FindChild(stbl, BOX_ctts, &ctts);
+  if (haveOffsets &&
+      !ReadSampleTable(aFile, ctts, 8, &compositionOffsets, &numCompositionOffsets)) {
+    return false;
+  }
+  const bool allSync = !aFile.FindChild(stbl, BOX_stss, &stss);
+  if (!allSync && !ReadSampleTable(aFile, stss, 4, &syncSamples, &numSyncSamples)) {
+    return false;
+  }
+
+  uint64_t decodeTime = 0;
+  uint32_t sampleNumber = 1;
+  uint32_t sync = 0;
+  uint32_t offsetEntry = 0;
+  uint32_t offsetRemaining = numCompositionOffsets ? ReadBigEndianU32(&compositionOffsets[0]) : 0;
+  for (uint32_t i = 0; i < numTimeToSample; i++) {
+    const uint32_t count = ReadBigEndianU32(&timeToSample[i * 8]);
+    const uint32_t delta = ReadBigEndianU32(&timeToSample[i * 8 + 4]);
+    for (uint32_t j = 0; j < count && sampleNumber <= numSamples;
+         j++, sampleNumber++, decodeTime += delta) {
+      // Find this sample's composition offset. Version 1 offsets are
+      // signed, and version 0 ones are in practice small enough that
+      // treating them as signed does no harm.
+      int64_t offset = 0;
+      while (offsetEntry < numCompositionOffsets && !offsetRemaining) {
+        offsetEntry++;
+        offsetRemaining = (offsetEntry < numCompositionOffsets)
+                        ? ReadBigEndianU32(&compositionOffsets[offsetEntry * 8]) : 0;
+      }
+      if (offsetEntry < numCompositionOffsets) {
+        offset = int32_t(ReadBigEndianU32(&compositionOffsets[offsetEntry * 8 + 4]));
+        offsetRemaining--;
+      }
+
+      if (!allSync) {
+        while (sync < numSyncSamples && ReadBigEndianU32(&syncSamples[sync * 4]) < sampleNumber) {
+          sync++;
+        }
+        if (sync == numSyncSamples) {
+          return true;
+        }
+        if (ReadBigEndianU32(&syncSamples[sync * 4]) != sampleNumber) {
+          continue;
+        }
+      }
+      const int64_t presentationTime = int64_t(decodeTime) + offset;
+      aOutIndex->Add(presentationTime * 10000000 / int64_t(timescale));
+    }
+  }
+  return true;
+}
+
+bool
+ReadMp4Duration(Mp4File& aFile, int64_t* aOutDuration)
+{
+  std::vector<Mp4Box> boxes;
+  if (!aFile.ReadBoxes(0, aFile.GetLength(), &boxes)) {
+    return false;
+  }
+  for (size_t i = 0; i < boxes.size(); i++) {
+    Mp4Box mvhd;
+    if (boxes[i].type != BOX_moov || !aFile.FindChild(boxes[i], BOX_mvhd, &mvhd)) {
+      continue;
+    }
+    // mvhd is a full box; the timescale follows the creation and
+    // modification times, and it and the duration are 64 bit in version 1.
+    uint8_t version;
+    uint32_t timescale, high = 0, low;
+    const uint64_t body = mvhd.BodyOffset();
+    if (!aFile.Read(body, &version, 1) ||
+        !aFile.ReadU32(body + ((version == 1) ? 20 : 12), &timescale) ||
+        !timescale ||
+        (version == 1 && !aFile.ReadU32(body + 24, &high)) ||
+        !aFile.ReadU32(body + ((version == 1) ? 28 : 16), &low)) {
+      return false;
+    }
+    const uint64_t duration = (uint64_t(high) << 32) | low;
+    *aOutDuration = int64_t(double(duration) * 10000000 / timescale);
+    return true;
+  }
+  return false;
+}
+
+void
+GetMp4RotationMatrix(Rotation aRotation,
+                     uint32_t aWidth,
+                     uint32_t aHeight,
+                     int32_t aOutMatrix[9])
+{
+  // A point (x, y) is displayed at (a*x + c*y + tx, b*x + d*y + ty); the
+  // translation moves the rotated picture back to the origin.
+  static const int32_t One = 0x10000;
+  int32_t a = One, b = 0, c = 0, d = One, tx = 0, ty = 0;
+  switch (aRotation) {
+    case ROTATE_90:
+      a = 0; b = One; c = -One; d = 0;
+      tx = int32_t(aHeight);
+      break;
+    case ROTATE_180:
+      a = -One; d = -One;
+      tx = int32_t(aWidth);
+      ty = int32_t(aHeight);
+      break;
+    case ROTATE_270:
+      a = 0; b = -One; c = One; d = 0;
+      ty = int32_t(aWidth);
+      break;
+    default:
+      break;
+  }
+  aOutMatrix[0] = a;
+  aOutMatrix[1] = b;
+  aOutMatrix[2] = 0;
+  aOutMatrix[3] = c;
+  aOutMatrix[4] = d;
+  aOutMatrix[5] = 0;
+  aOutMatrix[6] = tx;
+  aOutMatrix[7] = ty;
+  aOutMatrix[8] = 0x40000000;
+}
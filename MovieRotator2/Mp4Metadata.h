@@ -0,0 +1,133 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Reads and patches the boxes of ISO base media files (MP4, ISO/IEC
+// 14496-12), so that MP4 files can be rotated by rewriting the display
+// matrix in the video track's header, without touching the samples, and so
+// that we can find the keyframes of the video without decoding it.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include "KeyframeIndex.h"
+#include "Rotation.h"
+
+#define MP4_FOURCC(a, b, c, d) \
+  ((uint32_t(a) << 24) | (uint32_t(b) << 16) | (uint32_t(c) << 8) | uint32_t(d))
+
+// The header of a box; where it is in the file, and how big it is.
+struct Mp4Box {
+  uint32_t type;
+  // File offset of the box's header.
+  uint64_t offset;
+  // Size of the header, including the 64 bit size and uuid type if any.
+  uint32_t headerSize;
+  // Size of the whole box, including the header.
+  uint64_t size;
+
+  uint64_t BodyOffset() const { return offset + headerSize; }
+  uint64_t BodySize() const { return size - headerSize; }
+  uint64_t End() const { return offset + size; }
+};
+
+// Random access reads and writes of boxes and big endian fields in a file.
+// The file is owned by the caller, and must have been opened in binary mode;
+// "rb" for reading, "r+b" to patch it.
+class Mp4File {
+public:
+  explicit Mp4File(FILE* aFile);
+
+  uint64_t GetLength() const { return mLength; }
+
+  bool Read(uint64_t aOffset, void* aBuffer, size_t aLength);
+  bool Write(uint64_t aOffset, const void* aBuffer, size_t aLength);
+
+  bool ReadU32(uint64_t aOffset, uint32_t* aOutValue);
+  bool WriteU32(uint64_t aOffset, uint32_t aValue);
+
+  // Reads the header of the box at aOffset, which must end by aEnd, the end
+  // of its parent or of the file. Returns false if the box is malformed.
+  bool ReadBox(uint64_t aOffset, uint64_t aEnd, Mp4Box* aOutBox);
+
+  // Reads the headers of the boxes in [aOffset, aEnd); the top level boxes
+  // of the file, or the children of a box.
+  bool ReadBoxes(uint64_t aOffset, uint64_t aEnd, std::vector<Mp4Box>* aOutBoxes);
+  bool ReadChildren(const Mp4Box& aParent, std::vector<Mp4Box>* aOutBoxes) {
+    return ReadBoxes(aParent.BodyOffset(), aParent.End(), aOutBoxes);
+  }
+
+  // Finds the first child of aParent of type aType.
+  bool FindChild(const Mp4Box& aParent, uint32_t aType, Mp4Box* aOutBox);
+
+private:
+  FILE* mFile;
+  uint64_t mLength;
+};
+
+// What we need to know about a track to rotate it.
+struct Mp4Track {
+  // The tkhd box, and the file offset of its matrix.
+  Mp4Box header;
+  uint64_t matrixOffset;
+  // The handler type from the hdlr box; 'vide', 'soun' etc.
+  uint32_t handlerType;
+  // The type of the first sample entry in the stsd box; the codec, e.g.
+  // 'avc1' or 'mp4a'. 0 if there's no sample entry.
+  uint32_t sampleEntryType;
+  // The presentation size from tkhd, in 16.16 fixed point.
+  uint32_t width;
+  uint32_t height;
+  // The display matrix, {a, b, u, c, d, v, x, y, w}; a, b, c, d, x and y
+  // are 16.16 fixed point, u, v and w are 2.30.
+  int32_t matrix[9];
+};
+
+// Reads the file's brand and tracks. Returns false if it isn't an ISO base
+// media file with a moov box, or is malformed.
+bool ReadMp4Tracks(Mp4File& aFile, uint32_t* aOutMajorBrand, std::vector<Mp4Track>* aOutTracks);
+
+// Returns true if the file can be rotated by RotateMp4Metadata() with the
+// result playing back the same as a reencode would; it's an MP4 with one
+// H.264 video track, and any audio is AAC.
+bool CanRotateMp4Metadata(Mp4File& aFile);
+
+// Sets the display matrix of each video track of the file, which must be
+// writable, to rotate the decoded frames clockwise by aRotation. Any
+// rotation already in the file is replaced, as reencoding would discard it.
+// Only the matrices are written; nothing moves, so sample offsets stay
+// valid. Returns false if the file has no video track, or is malformed.
+bool RotateMp4Metadata(Mp4File& aFile, Rotation aRotation);
+
+// Reads the presentation times of the sync samples of the file's first
+// video track from its sample tables into aOutIndex. Every sample is a sync
+// sample if the track has no stss box. Edit lists aren't applied; they
+// usually shift presentation earlier, and a keyframe time which is a
+// little late only costs the decoder a few frames when it seeks there.
+// Returns false if the file has no video track, or is malformed, such as
+// if its stts describes more samples than its stsz counts.
+bool ReadMp4KeyframeIndex(Mp4File& aFile, KeyframeIndex* aOutIndex);
+
+// Reads the duration of the presentation from the movie header, in 100ns
+// units. Returns false if the file has no movie header, or is malformed.
+bool ReadMp4Duration(Mp4File& aFile, int64_t* aOutDuration);
+
+// Returns the display matrix which rotates a aWidth x aHeight picture, both
+// 16.16 fixed point, clockwise by aRotation. See Mp4Track::matrix.
+void GetMp4RotationMatrix(Rotation aRotation,
+                          uint32_t aWidth,
+                          uint32_t aHeight,
+                          int32_t aOutMatrix[9]);
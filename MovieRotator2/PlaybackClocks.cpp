@@ -15,9 +15,13 @@
 #include "stdafx.h"
 #include "PlaybackClocks.h"
 #include "VideoDecoder.h"
+#include "AudioRingBuffer.h"
+#include "FrameSource.h"
+#include "PlaybackTiming.h"
 
 using std::vector;
 using std::unique_ptr;
+using std::thread;
 
 
 static cubeb* sCubeb = nullptr;
@@ -32,59 +36,13 @@ AutoInitCubeb::~AutoInitCubeb()
   cubeb_destroy(sCubeb);
 }
 
-class LeftoverDataBuffer {
-public:
-  LeftoverDataBuffer() :
-    mOffset(0),
-    mLength(0),
-    mCapacity(32*1024)
-  {
-    mData = new short[mCapacity];
-  }
-  ~LeftoverDataBuffer() {
-    delete mData;
-  }
-
-  unsigned Length() const {
-    return mLength;
-  }
-
-  const short* Data() {
-    return mData + mOffset;
-  }
-
-  void MarkConsumed(unsigned n) {
-    mOffset += n;
-    mLength -= n;
-    if (mLength == 0) {
-      mOffset = 0;
-    }
-  }
-
-  HRESULT AddData(short* aData, unsigned n) {
-    ENSURE_TRUE(mOffset == 0 && Length() == 0, E_FAIL);
-    if (n > mCapacity) {
-      delete mData;
-      mCapacity = n;
-      mData = new short[mCapacity];
-    }
-    memcpy(mData, aData, n*sizeof(short));
-    mLength = n;
-    return S_OK;
-  }
-
-private:
-  short* mData;
+// How much decoded audio the feeder thread keeps ahead of the device.
+static const uint32_t AudioBufferMs = 500;
 
-  // Index in mData were actual data begins.
-  unsigned mOffset;
-
-  // Number of bytes stored after mOffset.
-  unsigned mLength;
-
-  // Total number of bytes in the storage.
-  unsigned mCapacity;
-};
+// How long the feeder thread sleeps when the ring is full, or the decoder
+// has no audio ready. It sleeps with SleepUs(), as VS2012's sleep_for() is
+// based on the system clock, and would oversleep if the clock were set back.
+static const uint64_t FeederIntervalUs = 10000;
 
 class CubebAudioClock : public PlaybackClock
 {
@@ -92,17 +50,21 @@ public:
   CubebAudioClock(VideoDecoder* aDecoder,
                   UINT32 aRate,
                   UINT32 aBytesPerSample,
-                  UINT32 aChannels)
+                  UINT32 aChannels,
+                  TimeSourceUs aTimeSource)
     : mDecoder(aDecoder),
       mRate(aRate),
       mBytesPerSample(aBytesPerSample),
       mChannels(aChannels),
+      mTimeSource(aTimeSource),
+      mInterpolator(aRate),
       mStream(nullptr),
-      mEOS(false),
+      mShutdown(false),
       mIsPaused(true)
   {}
 
   ~CubebAudioClock() {
+    StopFeeder();
   }
 
   HRESULT Init();
@@ -112,97 +74,113 @@ public:
   HRESULT Pause() override;
   HRESULT Shutdown() override;
   HRESULT GetPosition(LONGLONG* aOutPosition) override;
+  uint64_t GetNumUnderruns() override;
 
   long OnDataCallback(void* buffer, long nframes);
   void OnStateCallback(cubeb_state state);
 
+  // Called on the feeder thread. Don't call this.
+  void RunFeeder();
+
 private:
+  // Copies aSample's audio into mBuffer, waiting while it's full. Returns
+  // false if we failed, or were shutdown, first.
+  bool FeedSample(MediaSample* aSample);
+
+  // Stops the feeder thread, and waits for it to finish.
+  void StopFeeder();
+
   VideoDecoder* mDecoder;
   UINT32 mRate;
   UINT32 mChannels;
   UINT32 mBytesPerSample;
+  TimeSourceUs mTimeSource;
+  // Smooths the stream's position, which only advances a buffer at a time.
+  AudioPositionInterpolator mInterpolator;
   cubeb_stream* mStream;
-  LeftoverDataBuffer mLeftovers;
-  bool mEOS;
+
+  // Decoded audio, written by the feeder thread, and played by the data
+  // callback.
+  AudioRingBuffer mBuffer;
+
+  // Pops audio from the decoder and writes it into mBuffer, so that the
+  // data callback doesn't wait on the decoder.
+  std::thread mFeeder;
+  std::atomic<bool> mShutdown;
   bool mIsPaused;
 };
 
 long
 CubebAudioClock::OnDataCallback(void* aBuffer, long nframes)
 {
-  assert(sizeof(short) == mBytesPerSample);
-  long samplesToWrite = nframes * mChannels;
-  long framesWritten = 0;
-  short* outSamples = (short*)(aBuffer);
-  memset(outSamples, 0, sizeof(short)*samplesToWrite);
-
-  // Copy and remaining samples from the previous decoded
-  // IMFSample we pulled.
-  if (mLeftovers.Length() > 0) {
-    long toWrite = min(mLeftovers.Length(), samplesToWrite);
-    memcpy(outSamples, mLeftovers.Data(), toWrite*sizeof(short));
-    samplesToWrite -= toWrite;
-    outSamples += toWrite;
-    mLeftovers.MarkConsumed(toWrite);
-    framesWritten += toWrite / mChannels;
-  }
-  if (samplesToWrite == 0) {
-    return framesWritten;
-  }
+  // This runs on the audio device's thread, so it mustn't block, or the
+  // audio glitches. If the feeder hasn't kept up, we play silence, and the
+  // buffer counts the underrun.
+  return mBuffer.Render(static_cast<uint8_t*>(aBuffer), uint32_t(nframes));
+}
 
-  if (mEOS) {
-    return framesWritten;
+bool
+CubebAudioClock::FeedSample(MediaSample* aSample)
+{
+  IMFMediaBufferPtr buffer;
+  HRESULT hr = aSample->sample->ConvertToContiguousBuffer(&buffer);
+  ENSURE_SUCCESS(hr, false);
+
+  BYTE* data = nullptr; // Note: *data will be owned by the IMFMediaBuffer, we don't need to free it.
+  DWORD maxLength = 0, currentLength = 0;
+  hr = buffer->Lock(&data, &maxLength, &currentLength);
+  ENSURE_SUCCESS(hr, false);
+
+  const uint32_t frameSize = mBytesPerSample * mChannels;
+  const uint32_t numFrames = currentLength / frameSize;
+  uint32_t written = 0;
+  while (!mShutdown) {
+    written += mBuffer.Write(data + written * frameSize, numFrames - written);
+    if (written == numFrames) {
+      break;
+    }
+    SleepUs(FeederIntervalUs);
   }
+  buffer->Unlock();
 
-  // We should only get this far if we consumed all the previous leftover data.
-  assert(mLeftovers.Length() == 0);
-
-  while (samplesToWrite > 0) {
+  return written == numFrames;
+}
 
-    // Otherwise, we've still not written a full buffer, get another MediaBuffer
-    // from the decoder.
-    unique_ptr<MediaSample> mediaSample(mDecoder->PopAudio(true));
+static void
+CallCubebAudioClockRunFeeder(CubebAudioClock* aClock)
+{
+  aClock->RunFeeder();
+}
 
-    if (!mediaSample ||
-        mediaSample->flags & MF_SOURCE_READERF_ENDOFSTREAM) {
-      mEOS = true;
-    }
+void
+CubebAudioClock::RunFeeder()
+{
+  while (!mShutdown) {
+    unique_ptr<MediaSample> mediaSample(mDecoder->PopAudio(false));
     if (!mediaSample) {
-      return framesWritten;
-    }
-
-    IMFMediaBufferPtr buffer;
-    HRESULT hr = mediaSample->sample->ConvertToContiguousBuffer(&buffer);
-    ENSURE_SUCCESS(hr, -1);
-
-    BYTE* data = nullptr; // Note: *data will be owned by the IMFMediaBuffer, we don't need to free it.
-    DWORD maxLength = 0, currentLength = 0;
-    hr = buffer->Lock(&data, &maxLength, &currentLength);
-    ENSURE_SUCCESS(hr, -1);
-
-    uint32_t numSamples = currentLength / mBytesPerSample;
-
-    unsigned toWrite = min(samplesToWrite, numSamples);
-    memcpy(outSamples, data, sizeof(short) * toWrite);
-    outSamples += toWrite;
-    samplesToWrite -= toWrite;
-    framesWritten += toWrite / mChannels;
-
-    if (toWrite < numSamples) {
-      // We have leftovers, copy them into the leftovers buffer.
-      hr = mLeftovers.AddData((short*)(data) + toWrite, numSamples - toWrite);
-      ENSURE_SUCCESS(hr, -1);
-    } else {
-      // Insufficient data to complete buffer.
-      if (mEOS) {
-        buffer->Unlock();
+      if (!mDecoder->HasAudio()) {
+        // We've had all the audio.
         break;
       }
-      buffer->Unlock();
+      SleepUs(FeederIntervalUs);
+      continue;
+    }
+    if (!FeedSample(mediaSample.get()) ||
+        (mediaSample->flags & MF_SOURCE_READERF_ENDOFSTREAM)) {
+      break;
     }
   }
+  // Let the callback play out what's left, and then drain the stream.
+  mBuffer.MarkEnded();
+}
 
-  return framesWritten;
+void
+CubebAudioClock::StopFeeder()
+{
+  mShutdown = true;
+  if (mFeeder.joinable()) {
+    mFeeder.join();
+  }
 }
 
 void
@@ -238,6 +216,8 @@ CubebStateCallback(cubeb_stream * stm, void * user, cubeb_state state)
 HRESULT
 CubebAudioClock::Init()
 {
+  ENSURE_TRUE(mBuffer.Init(mBytesPerSample * mChannels, mRate * AudioBufferMs / 1000), E_FAIL);
+
   cubeb_stream_params params;
   params.format = CUBEB_SAMPLE_S16NE;
   params.rate = mRate;
@@ -253,6 +233,9 @@ CubebAudioClock::Init()
   if (res != CUBEB_OK) {
     return E_FAIL;
   }
+
+  // Start feeding the buffer now, so that it's full before we're started.
+  mFeeder = thread(CallCubebAudioClockRunFeeder, this);
   return S_OK;
 }
 
@@ -261,6 +244,7 @@ CubebAudioClock::Start()
 {
   if (mIsPaused) {
     cubeb_stream_start(mStream);
+    mInterpolator.Start(mTimeSource());
     mIsPaused = false;
   }
   return S_OK;
@@ -271,6 +255,7 @@ CubebAudioClock::Pause()
 {
   if (!mIsPaused) {
     cubeb_stream_stop(mStream);
+    mInterpolator.Pause();
     mIsPaused = true;
   }
   return S_OK;
@@ -280,29 +265,43 @@ HRESULT
 CubebAudioClock::Shutdown()
 {
   Pause();
+  StopFeeder();
   cubeb_stream_destroy(mStream);
+  mStream = nullptr;
+  AudioRingStats stats = mBuffer.GetStats();
+  DBGMSG(L"CubebAudioClock::Shutdown() %llu callbacks, %llu underruns, %llu frames of silence, %llu position corrections\n",
+         stats.numCallbacks, stats.numUnderruns, stats.numSilentFrames,
+         mInterpolator.GetNumCorrections());
   return S_OK;
 }
 
+uint64_t
+CubebAudioClock::GetNumUnderruns()
+{
+  return mBuffer.GetStats().numUnderruns;
+}
+
 
 HRESULT
 CubebAudioClock::GetPosition(LONGLONG* aOutPosition)
 {
+  ENSURE_TRUE(aOutPosition, E_POINTER);
   uint64_t nframes;
   if (CUBEB_OK != cubeb_stream_get_position(mStream, &nframes)) {
     return E_FAIL;
   }
-  // Cubeb reports the time in frames, but we require it in 100-nanosecond
-  // units. Convert it.
-  static const double HundredNsPerS = 10000000;
-  double pos = double(nframes) * HundredNsPerS / double(mRate);
-  *aOutPosition = (LONGLONG)pos;
+  // Cubeb reports the time in frames, which only advances when the device
+  // takes another buffer. Interpolate between those, and convert to
+  // 100-nanosecond units.
+  const uint64_t us = mInterpolator.GetPositionUs(mTimeSource(), nframes);
+  *aOutPosition = LONGLONG(us * (TimeUnitsPerSecond / 1000000));
   return S_OK;
 }
 
 HRESULT
 CreateAudioPlaybackClock(VideoDecoder* aDecoder,
-                         PlaybackClock** aOutPlaybackClock)
+                         PlaybackClock** aOutPlaybackClock,
+                         TimeSourceUs aTimeSource)
 {
   HRESULT hr;
   IMFMediaTypePtr type;
@@ -314,7 +313,7 @@ CreateAudioPlaybackClock(VideoDecoder* aDecoder,
   UINT32 channels = MFGetAttributeUINT32(type, MF_MT_AUDIO_NUM_CHANNELS, 0);
   UINT32 bps = MFGetAttributeUINT32(type, MF_MT_AUDIO_BITS_PER_SAMPLE, 16) / 8;
 
-  CubebAudioClock* clock = new CubebAudioClock(aDecoder, rate, bps, channels);
+  CubebAudioClock* clock = new CubebAudioClock(aDecoder, rate, bps, channels, aTimeSource);
   hr = clock->Init();
   if (FAILED(hr)) {
     delete clock;
@@ -331,12 +330,10 @@ CreateAudioPlaybackClock(VideoDecoder* aDecoder,
 class SystemClock : public PlaybackClock
 {
 public:
-  SystemClock(VideoDecoder* aDecoder)
+  SystemClock(VideoDecoder* aDecoder, TimeSourceUs aTimeSource)
     : mDecoder(aDecoder),
-      mEOS(false),
-      mIsPaused(true),
-      mStart(0),
-      mElapsed(0)
+      mTimeSource(aTimeSource),
+      mEOS(false)
   {
     mDuration = aDecoder->GetDuration();
   }
@@ -352,35 +349,26 @@ public:
 
 private:
   VideoDecoder* mDecoder;
+  TimeSourceUs mTimeSource;
 
-  uint64_t mStart;
-  uint64_t mElapsed;
+  PlaybackStopwatch mStopwatch;
   uint64_t mDuration;
 
   bool mEOS;
-  bool mIsPaused;
 
 };
 
 HRESULT
 SystemClock::Start()
 {
-  if (mIsPaused) {
-    mStart = GetTickCount64_DLL();
-    mIsPaused = false;
-  }
+  mStopwatch.Start(mTimeSource());
   return S_OK;
 }
 
 HRESULT
 SystemClock::Pause()
 {
-  if (!mIsPaused) {
-    uint64_t end = GetTickCount64_DLL();
-    uint64_t elapsed = end - mStart;
-    mElapsed += elapsed;
-    mIsPaused = true;
-  }
+  mStopwatch.Pause(mTimeSource());
   return S_OK;
 }
 
@@ -394,12 +382,8 @@ HRESULT
 SystemClock::GetPosition(LONGLONG* aOutPosition)
 {
   ENSURE_TRUE(aOutPosition, E_POINTER);
-  if (mIsPaused) {
-    *aOutPosition = mElapsed;
-    return S_OK;
-  }
-  uint64_t elapsed = mElapsed + GetTickCount64_DLL() - mStart;
-  uint64_t hns = elapsed * 10000;
+  const uint64_t elapsedUs = mStopwatch.GetElapsedUs(mTimeSource());
+  uint64_t hns = elapsedUs * (TimeUnitsPerSecond / 1000000);
   if (hns > mDuration) {
     hns = mDuration;
     if (!mEOS) {
@@ -407,14 +391,15 @@ SystemClock::GetPosition(LONGLONG* aOutPosition)
       NotifyListeners(PlaybackClock_Ended);
     }
   }
-  *aOutPosition = hns <= mDuration ? hns : mDuration;
+  *aOutPosition = hns;
   return S_OK;
 }
 
 HRESULT
 CreateSystemPlaybackClock(VideoDecoder* aDecoder,
-                          PlaybackClock** aOutPlaybackClock)
+                          PlaybackClock** aOutPlaybackClock,
+                          TimeSourceUs aTimeSource)
 {
-  *aOutPlaybackClock = new SystemClock(aDecoder);
+  *aOutPlaybackClock = new SystemClock(aDecoder, aTimeSource);
   return S_OK;
 }
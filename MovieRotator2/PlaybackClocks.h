@@ -16,6 +16,7 @@
 
 #include "cubeb\cubeb.h"
 #include "EventListeners.h"
+#include "HighResClock.h"
 
 // Inteface to define behaviour of a clock that runs playback.
 class PlaybackClock : public EventSource {
@@ -32,8 +33,14 @@ public:
   // Shutsdown the clock. Synchronous!
   virtual HRESULT Shutdown() = 0;
 
-  // Returns the position in 100-nanosecond units.
+  // Returns the position in 100-nanosecond units. It advances smoothly,
+  // with microsecond resolution, and never goes backwards.
   virtual HRESULT GetPosition(LONGLONG* aOutPosition) = 0;
+
+  // Returns the number of times playback has run out of decoded audio, and
+  // played silence. Only audio clocks can underrun. The painter passes it
+  // on to the decoder. Threadsafe.
+  virtual uint64_t GetNumUnderruns() { return 0; }
 };
 
 class AutoInitCubeb {
@@ -44,10 +51,14 @@ public:
 
 class VideoDecoder;
 
+// The clocks read the time from aTimeSource, so that they can be driven by
+// a fake clock.
 HRESULT
 CreateAudioPlaybackClock(VideoDecoder* aDecoder,
-                         PlaybackClock** aOutPlaybackClock);
+                         PlaybackClock** aOutPlaybackClock,
+                         TimeSourceUs aTimeSource = GetHighResTimeUs);
 
 HRESULT
 CreateSystemPlaybackClock(VideoDecoder* aDecoder,
-                          PlaybackClock** aOutPlaybackClock);
+                          PlaybackClock** aOutPlaybackClock,
+                          TimeSourceUs aTimeSource = GetHighResTimeUs);
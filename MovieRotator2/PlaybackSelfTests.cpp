@@ -0,0 +1,682 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// The SelfTest tool's checks and benchmarks of the preview's playback: its
+// sample queues, audio callback, decode-ahead and decode threads.
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "AudioRingBuffer.h"
+#include "DecodeAhead.h"
+#include "DecodeLoop.h"
+#include "SelfTest.h"
+#include "SpscRing.h"
+#include "TranscodeStats.h"
+
+// The depth of the audio queue in --benchmark-queues; about a second of AAC
+// frames, as VideoDecoder keeps.
+static const size_t BenchmarkAudioQueueTarget = 48;
+static const size_t BenchmarkVideoQueueTarget = 2;
+
+// The sample queues as VideoDecoder had them before they were SpscRings:
+// one mutex and condition variable shared by both queues, the decode thread,
+// and both consumers, and every pop signalling the decode thread.
+class LockedSampleQueues {
+public:
+  LockedSampleQueues()
+    : mNumWakeups(0)
+  {
+  }
+  bool IsAudioFull() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mAudio.size() >= BenchmarkAudioQueueTarget;
+  }
+  bool IsVideoFull() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mVideo.size() >= BenchmarkVideoQueueTarget;
+  }
+  void PushAudio(uint64_t aItem) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mAudio.push_back(aItem);
+    mNumWakeups++;
+    mCondVar.notify_one();
+  }
+  void PushVideo(uint64_t aItem) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mVideo.push_back(aItem);
+  }
+  void WaitForRoom(bool aAudio, bool aVideo) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    while ((!aAudio || mAudio.size() >= BenchmarkAudioQueueTarget) &&
+           (!aVideo || mVideo.size() >= BenchmarkVideoQueueTarget)) {
+      mCondVar.wait(lock);
+    }
+  }
+  bool PopAudio(uint64_t* aOutItem) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mAudio.empty()) {
+      return false;
+    }
+    *aOutItem = mAudio.front();
+    mAudio.pop_front();
+    mNumWakeups++;
+    mCondVar.notify_one();
+    return true;
+  }
+  bool PeekVideo(uint64_t* aOutItem) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mVideo.empty()) {
+      return false;
+    }
+    *aOutItem = mVideo.front();
+    return true;
+  }
+  void PopVideo() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mVideo.pop_front();
+    mNumWakeups++;
+    mCondVar.notify_one();
+  }
+  // The number of times the condition variable was signalled.
+  uint64_t GetNumWakeups() { return mNumWakeups; }
+
+private:
+  std::mutex mMutex;
+  std::condition_variable mCondVar;
+  std::deque<uint64_t> mAudio;
+  std::deque<uint64_t> mVideo;
+  uint64_t mNumWakeups;
+};
+
+// The sample queues as VideoDecoder has them now: an SpscRing for each, and
+// the decode thread only signalled when it's waiting, and a pop makes room
+// in the video queue, or drains the audio queue to half its target.
+class RingSampleQueues {
+public:
+  RingSampleQueues()
+    : mAudio(64),
+      mVideo(BenchmarkVideoQueueTarget)
+  {
+  }
+  bool IsAudioFull() { return mAudio.Size() >= BenchmarkAudioQueueTarget; }
+  bool IsVideoFull() { return mVideo.Size() >= BenchmarkVideoQueueTarget; }
+  void PushAudio(uint64_t aItem) { mAudio.TryPush(aItem); }
+  void PushVideo(uint64_t aItem) { mVideo.TryPush(aItem); }
+  void WaitForRoom(bool aAudio, bool aVideo) {
+    mDecodeEvent.Wait([&]() {
+      return (aAudio && !IsAudioFull()) || (aVideo && !IsVideoFull());
+    });
+  }
+  bool PopAudio(uint64_t* aOutItem) {
+    if (!mAudio.TryPop(aOutItem)) {
+      return false;
+    }
+    mDecodeEvent.NotifyIf([this]() {
+      return mAudio.Size() <= BenchmarkAudioQueueTarget / 2;
+    });
+    return true;
+  }
+  bool PeekVideo(uint64_t* aOutItem) {
+    uint64_t* front = mVideo.Peek();
+    if (!front) {
+      return false;
+    }
+    *aOutItem = *front;
+    return true;
+  }
+  void PopVideo() {
+    uint64_t item;
+    mVideo.TryPop(&item);
+    mDecodeEvent.NotifyIf([this]() { return !IsVideoFull(); });
+  }
+  uint64_t GetNumWakeups() { return mDecodeEvent.GetNumWakeups(); }
+
+private:
+  SpscRing<uint64_t> mAudio;
+  SpscRing<uint64_t> mVideo;
+  WakeupEvent mDecodeEvent;
+};
+
+// Returns a time in nanoseconds, as pops are too quick to time with
+// GetHighResTimeUs().
+static uint64_t
+GetTimeNs()
+{
+  return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static void
+PrintLatencies(const char* aName, const char* aUnit, const LatencyHistogram& aLatencies)
+{
+  printf("  %s: %llu %s, p50 %llu ns, p99 %llu ns, p99.9 %llu ns, max %llu ns\n",
+         aName, (unsigned long long)aLatencies.GetCount(), aUnit,
+         (unsigned long long)aLatencies.GetPercentileUs(50),
+         (unsigned long long)aLatencies.GetPercentileUs(99),
+         (unsigned long long)aLatencies.GetPercentileUs(99.9),
+         (unsigned long long)aLatencies.GetMaxUs());
+}
+
+// Benchmarks one design of the sample queues: a decode thread keeps both queues
+// topped up, while an audio thread and a paint thread pop from them as fast
+// as they can, so that all three contend. Every pop is timed, including
+// those which find the queue empty, as the audio callback can't wait for
+// the decode thread either way; the consumers yield after those, so that
+// the decode thread gets to run on machines with few cores. Returns false
+// if an item was lost, or came out of order.
+template<typename Queues>
+static bool
+BenchmarkSampleQueues(const char* aName)
+{
+  static const uint64_t NumItems = 200000;
+  Queues queues;
+  const uint64_t startUs = GetHighResTimeUs();
+  std::thread decoder([&]() {
+    uint64_t audio = 0;
+    uint64_t video = 0;
+    while (audio < NumItems || video < NumItems) {
+      bool pushed = false;
+      if (audio < NumItems && !queues.IsAudioFull()) {
+        queues.PushAudio(audio++);
+        pushed = true;
+      }
+      if (video < NumItems && !queues.IsVideoFull()) {
+        queues.PushVideo(video++);
+        pushed = true;
+      }
+      if (!pushed) {
+        queues.WaitForRoom(audio < NumItems, video < NumItems);
+      }
+    }
+  });
+  // The latencies are in nanoseconds here.
+  LatencyHistogram audioLatencies;
+  LatencyHistogram videoLatencies;
+  bool audioOk = true;
+  bool videoOk = true;
+  std::thread audio([&]() {
+    for (uint64_t expected = 0; expected < NumItems; ) {
+      uint64_t item;
+      const uint64_t start = GetTimeNs();
+      const bool popped = queues.PopAudio(&item);
+      audioLatencies.Add(GetTimeNs() - start);
+      if (popped) {
+        audioOk &= (item == expected++);
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  });
+  for (uint64_t expected = 0; expected < NumItems; ) {
+    // As the paint thread does; peek at the next frame, then pop it.
+    uint64_t item;
+    const uint64_t start = GetTimeNs();
+    const bool peeked = queues.PeekVideo(&item);
+    if (peeked) {
+      queues.PopVideo();
+    }
+    videoLatencies.Add(GetTimeNs() - start);
+    if (peeked) {
+      videoOk &= (item == expected++);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  audio.join();
+  decoder.join();
+  const uint64_t wallTimeUs = GetHighResTimeUs() - startUs;
+
+  printf("%s: %llu items each way in %.1lf ms, %llu wakeups signalled%s\n",
+         aName, (unsigned long long)NumItems, wallTimeUs / 1e3,
+         (unsigned long long)queues.GetNumWakeups(),
+         (audioOk && videoOk) ? "" : ", FAILED, items lost or reordered");
+  PrintLatencies("audio", "pops", audioLatencies);
+  PrintLatencies("video", "pops", videoLatencies);
+  return audioOk && videoOk;
+}
+
+bool
+BenchmarkQueues()
+{
+  const bool locked = BenchmarkSampleQueues<LockedSampleQueues>("mutex + condvar");
+  const bool rings = BenchmarkSampleQueues<RingSampleQueues>("SPSC rings");
+  return locked && rings;
+}
+
+// A simulated audio device thread renders
+// from an AudioRingBuffer, as the cubeb callback does, at ten times real
+// time, while a decode thread writes AAC sized frames into it, stalling now
+// and then, and once for longer than the buffer lasts. Checks that every
+// frame is played once, in order, that the silence played is what was
+// counted as underruns, and that the stream ends.
+bool
+StressAudioCallback()
+{
+  static const uint32_t Rate = 48000;
+  static const uint32_t FrameSize = 4;
+  static const uint32_t SpeedUp = 10;
+  static const uint32_t CallbackFrames = Rate / 100;
+  static const uint32_t DecodedFrames = 1024;
+  static const uint32_t NumFrames = Rate * 20;
+  // Half way through, the decoder stalls for a second of audio.
+  static const uint32_t LongStallFrame = NumFrames / 2;
+  static const uint32_t LongStallMs = 1000 / SpeedUp;
+
+  AudioRingBuffer buffer;
+  if (!buffer.Init(FrameSize, Rate / 2)) {
+    return false;
+  }
+
+  // Each frame holds its index plus one, so that silence can be told apart.
+  std::thread decoder([&]() {
+    std::vector<uint8_t> frames(DecodedFrames * FrameSize);
+    uint32_t seed = 1;
+    for (uint32_t f = 0; f < NumFrames; ) {
+      const uint32_t count = std::min(DecodedFrames, NumFrames - f);
+      for (uint32_t i = 0; i < count; i++) {
+        const uint32_t value = f + i + 1;
+        memcpy(&frames[i * FrameSize], &value, FrameSize);
+      }
+      if (f <= LongStallFrame && LongStallFrame < f + count) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(LongStallMs));
+      }
+      seed = seed * 1664525 + 1013904223;
+      if ((seed >> 16) % 16 == 0) {
+        // A short stall, which the buffer should ride out.
+        std::this_thread::sleep_for(std::chrono::milliseconds((seed >> 8) % 10));
+      }
+      for (uint32_t written = 0; written < count; ) {
+        written += buffer.Write(&frames[written * FrameSize], count - written);
+        if (written < count) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+      }
+      f += count;
+    }
+    buffer.MarkEnded();
+  });
+
+  // The device starts once the buffer has filled, as the app's does.
+  while (buffer.GetFreeFrames() > DecodedFrames) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // The latencies are in nanoseconds here.
+  LatencyHistogram renderLatencies;
+  uint64_t numSilentFrames = 0;
+  uint32_t expected = 1;
+  bool ok = true;
+  std::vector<uint8_t> output(CallbackFrames * FrameSize);
+  const std::chrono::microseconds period(1000000 / 100 / SpeedUp);
+  std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+  const uint64_t startUs = GetHighResTimeUs();
+  std::thread device([&]() {
+    while (true) {
+      next += period;
+      std::this_thread::sleep_until(next);
+      const uint64_t start = GetTimeNs();
+      const uint32_t rendered = buffer.Render(&output[0], CallbackFrames);
+      renderLatencies.Add(GetTimeNs() - start);
+      for (uint32_t i = 0; i < rendered; i++) {
+        uint32_t value;
+        memcpy(&value, &output[i * FrameSize], FrameSize);
+        if (!value) {
+          numSilentFrames++;
+        } else if (value == expected) {
+          expected++;
+        } else {
+          ok = false;
+        }
+      }
+      if (rendered < CallbackFrames) {
+        // The stream has drained.
+        break;
+      }
+    }
+  });
+  device.join();
+  decoder.join();
+  const uint64_t wallTimeUs = GetHighResTimeUs() - startUs;
+
+  const AudioRingStats stats = buffer.GetStats();
+  if (expected != NumFrames + 1) {
+    fprintf(stderr, "Played %u frames of %u\n", expected - 1, NumFrames);
+    ok = false;
+  }
+  if (numSilentFrames != stats.numSilentFrames) {
+    fprintf(stderr, "Played %llu frames of silence, but counted %llu\n",
+            (unsigned long long)numSilentFrames,
+            (unsigned long long)stats.numSilentFrames);
+    ok = false;
+  }
+  if (!stats.numUnderruns) {
+    fprintf(stderr, "The long stall didn't underrun\n");
+    ok = false;
+  }
+  printf("%llu callbacks of %u frames in %.1lf s, %llu underruns, "
+         "%.1lf ms of silence: %s\n",
+         (unsigned long long)stats.numCallbacks, CallbackFrames, wallTimeUs / 1e6,
+         (unsigned long long)stats.numUnderruns, stats.numSilentFrames * 1e3 / Rate,
+         ok ? "OK" : "FAILED");
+  PrintLatencies("render", "callbacks", renderLatencies);
+  return ok;
+}
+
+
+struct DecodeAheadRun {
+  DecodeAheadRun()
+    : numLateFrames(0),
+      maxDepth(0),
+      maxQueuedBytes(0)
+  {
+  }
+  uint64_t numLateFrames;
+  uint32_t maxDepth;
+  uint64_t maxQueuedBytes;
+  DecodeAheadStats stats;
+};
+
+// Simulates the preview decoding 4K frames, with a heavy section in the
+// middle whose decode time varies a lot, and showing them at 30 fps, with
+// decode-ahead depths aLimits allows, for --simulate-decode-ahead. The
+// decode thread decodes a frame whenever the queue's below the depth; a
+// frame is late if it's decoded after it's due.
+static void
+SimulateDecodeAhead(const DecodeAheadLimits& aLimits, DecodeAheadRun* aOutRun)
+{
+  static const uint32_t NumFrames = 1800;
+  static const uint64_t FrameIntervalUs = 33333;
+  static const uint64_t FrameBytes = 3840 * 2160 * 4;
+  static const uint32_t HeavyStart = NumFrames / 3;
+  static const uint32_t HeavyEnd = NumFrames * 2 / 3;
+  DecodeAheadController controller(aLimits);
+  // 48 kHz stereo 16 bit.
+  controller.SetAudioBytesPerSecond(48000 * 4);
+  std::vector<uint64_t> decodedUs(NumFrames);
+  std::vector<uint64_t> shownUs(NumFrames);
+  uint64_t startUs = 0;
+  uint32_t seed = 1;
+  uint32_t numShown = 0;
+  for (uint32_t i = 0; i < NumFrames; i++) {
+    seed = seed * 1664525 + 1013904223;
+    uint64_t decodeUs = 6000 + (seed >> 16) % 4000;
+    if (i >= HeavyStart && i < HeavyEnd) {
+      decodeUs = 18000 + (seed >> 16) % 10000 + (i % 12 == 0 ? 70000 : 0);
+    }
+    // Wait until the frame the depth's worth before this one has been shown.
+    uint64_t beginUs = i ? decodedUs[i - 1] : 0;
+    const uint32_t depth = controller.GetVideoFrames();
+    if (i >= depth && startUs) {
+      beginUs = std::max(beginUs, shownUs[i - depth]);
+    }
+    const uint64_t nowUs = beginUs + decodeUs;
+    decodedUs[i] = nowUs;
+    // Playback starts once the minimum depth is decoded.
+    if (!startUs && i + 1 == aLimits.minVideoFrames) {
+      startUs = nowUs;
+      for (uint32_t j = 0; j <= i; j++) {
+        shownUs[j] = startUs + j * FrameIntervalUs;
+      }
+    }
+    if (startUs && i + 1 > aLimits.minVideoFrames) {
+      const uint64_t dueUs = startUs + i * FrameIntervalUs;
+      shownUs[i] = std::max(dueUs, nowUs);
+      if (nowUs > dueUs) {
+        aOutRun->numLateFrames++;
+        controller.AddLateFrames(1);
+      }
+    }
+    controller.AddVideoFrame(int64_t(i) * FrameIntervalUs * 10, decodeUs, FrameBytes);
+    controller.Update(nowUs);
+    aOutRun->maxDepth = std::max(aOutRun->maxDepth, controller.GetVideoFrames());
+    // The frames decoded but not yet shown.
+    while (numShown < i && startUs && shownUs[numShown] <= nowUs) {
+      numShown++;
+    }
+    aOutRun->maxQueuedBytes = std::max(aOutRun->maxQueuedBytes,
+                                       uint64_t(i + 1 - numShown) * FrameBytes);
+  }
+  controller.GetStats(&aOutRun->stats);
+}
+
+bool
+SimulateDecodeAhead()
+{
+  DecodeAheadLimits fixed;
+  fixed.maxVideoFrames = fixed.minVideoFrames;
+  DecodeAheadRun fixedRun;
+  SimulateDecodeAhead(fixed, &fixedRun);
+
+  DecodeAheadLimits adaptive;
+  DecodeAheadRun adaptiveRun;
+  SimulateDecodeAhead(adaptive, &adaptiveRun);
+
+  printf("fixed %u frames: %llu late frames\n", fixed.minVideoFrames,
+         (unsigned long long)fixedRun.numLateFrames);
+  printf("adaptive: %llu late frames, up to %u frames, %.0lf MB of %.0lf MB budget\n",
+         (unsigned long long)adaptiveRun.numLateFrames, adaptiveRun.maxDepth,
+         adaptiveRun.maxQueuedBytes / 1048576.0, adaptive.budgetBytes / 1048576.0);
+  const DecodeAheadStats& stats = adaptiveRun.stats;
+  for (size_t i = 0; i < stats.changes.size(); i++) {
+    const DecodeAheadChange& change = stats.changes[i];
+    printf("  %6.2lf s: %u frames, %u ms of audio (%s)\n", change.timeUs / 1e6,
+           change.videoFrames, change.audioMs, GetDecodeAheadReasonName(change.reason));
+  }
+  const bool ok = adaptiveRun.numLateFrames * 2 < fixedRun.numLateFrames &&
+                  adaptiveRun.maxQueuedBytes <= adaptive.budgetBytes &&
+                  stats.videoFrames < adaptiveRun.maxDepth;
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok;
+}
+
+// The timings of StandInDecoder's media, in microseconds.
+static const uint64_t StandInAudioSampleUs = 21333;
+static const uint64_t StandInAudioDecodeUs = 500;
+static const uint64_t StandInFrameIntervalUs = 33333;
+static const uint64_t StandInVideoDecodeUs = 45000;
+// About a second of audio, as VideoDecoder keeps.
+static const size_t StandInAudioQueueTarget = 47;
+static const size_t StandInVideoQueueTarget = 2;
+
+// A stand-in for VideoDecoder for --benchmark-decode-threads, whose
+// ReadSample() sleeps, as a hardware decoder's blocks. Video frames take
+// longer to decode than they play for, as a heavy input does on a slow
+// machine, and audio is cheap. It decodes either as VideoDecoder used to,
+// alternating audio and video on one thread, or as it does now, with a
+// thread and a wakeup event for each, running VideoDecoder's
+// DecodeStreamUntilEnd().
+class StandInDecoder {
+public:
+  explicit StandInDecoder(bool aSeparateThreads)
+    : mSeparateThreads(aSeparateThreads),
+      mAudio(64),
+      mVideo(StandInVideoQueueTarget),
+      mNextFrame(0),
+      mHasAudio(true),
+      mHasVideo(true),
+      mShutdown(false)
+  {
+  }
+
+  void Start() {
+    if (mSeparateThreads) {
+      mThreads.push_back(std::thread([this]() { RunAudio(); }));
+      mThreads.push_back(std::thread([this]() { RunVideo(); }));
+    } else {
+      mThreads.push_back(std::thread([this]() { RunBoth(); }));
+    }
+  }
+
+  void Shutdown() {
+    mShutdown = true;
+    mAudioEvent.Notify();
+    mVideoEvent.Notify();
+    for (size_t i = 0; i < mThreads.size(); i++) {
+      mThreads[i].join();
+    }
+  }
+
+  bool IsFull() { return IsAudioFull() && IsVideoFull(); }
+
+  bool PopAudio() {
+    uint64_t item;
+    if (!mAudio.TryPop(&item)) {
+      return false;
+    }
+    // VideoDecoder has only one event when it's only got one thread.
+    WakeupEvent& event = mSeparateThreads ? mAudioEvent : mVideoEvent;
+    event.NotifyIf([this]() { return mAudio.Size() <= StandInAudioQueueTarget / 2; });
+    return true;
+  }
+
+  // Pops the frames due by aFrame. Returns the index of the last popped,
+  // or -1 if there wasn't one.
+  int64_t PopVideo(uint64_t aFrame) {
+    int64_t popped = -1;
+    uint64_t* front = nullptr;
+    while ((front = mVideo.Peek()) && *front <= aFrame) {
+      popped = int64_t(*front);
+      uint64_t item;
+      mVideo.TryPop(&item);
+    }
+    mVideoEvent.NotifyIf([this]() { return !IsVideoFull(); });
+    return popped;
+  }
+
+private:
+  bool IsAudioFull() { return mAudio.Size() >= StandInAudioQueueTarget; }
+  bool IsVideoFull() { return mVideo.Size() >= StandInVideoQueueTarget; }
+
+  static void ReadSample(uint64_t aDecodeUs) {
+    SleepUs(aDecodeUs);
+  }
+
+  bool DecodeAudio() {
+    ReadSample(StandInAudioDecodeUs);
+    uint64_t item = 0;
+    return mAudio.TryPush(item);
+  }
+
+  bool DecodeVideo() {
+    ReadSample(StandInVideoDecodeUs);
+    uint64_t item = mNextFrame++;
+    return mVideo.TryPush(item);
+  }
+
+  // The loop VideoDecoder ran before it had a thread per stream.
+  void RunBoth() {
+    while (!mShutdown) {
+      if (!IsAudioFull()) {
+        DecodeAudio();
+      }
+      if (!IsVideoFull()) {
+        DecodeVideo();
+      }
+      mVideoEvent.Wait([this]() {
+        return mShutdown || !IsAudioFull() || !IsVideoFull();
+      });
+    }
+  }
+
+  void RunAudio() {
+    DecodeStreamUntilEnd(mHasAudio, mShutdown, mAudioEvent,
+                         []() {},
+                         [this]() { return IsAudioFull(); },
+                         [this]() { return DecodeAudio(); });
+  }
+
+  void RunVideo() {
+    DecodeStreamUntilEnd(mHasVideo, mShutdown, mVideoEvent,
+                         []() {},
+                         [this]() { return IsVideoFull(); },
+                         [this]() { return DecodeVideo(); });
+  }
+
+  const bool mSeparateThreads;
+  SpscRing<uint64_t> mAudio;
+  SpscRing<uint64_t> mVideo;
+  WakeupEvent mAudioEvent;
+  WakeupEvent mVideoEvent;
+  uint64_t mNextFrame;
+  // The stand-in's streams don't end.
+  std::atomic<bool> mHasAudio;
+  std::atomic<bool> mHasVideo;
+  std::atomic<bool> mShutdown;
+  std::vector<std::thread> mThreads;
+};
+
+// Plays from a StandInDecoder for a few seconds, with an audio callback
+// which pops a sample every sample's duration, and a paint thread which
+// pops the frames due every frame interval, and reports how often the
+// audio underran, and how far behind the video fell.
+static void
+PlayFromStandInDecoder(bool aSeparateThreads)
+{
+  static const uint64_t PlaybackUs = 6000000;
+  StandInDecoder decoder(aSeparateThreads);
+  decoder.Start();
+  while (!decoder.IsFull()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  typedef std::chrono::steady_clock Clock;
+  const Clock::time_point start = Clock::now();
+  const uint64_t numSamples = PlaybackUs / StandInAudioSampleUs;
+  const uint64_t numFrames = PlaybackUs / StandInFrameIntervalUs;
+
+  uint64_t numUnderruns = 0;
+  std::thread audio([&]() {
+    for (uint64_t i = 0; i < numSamples; i++) {
+      std::this_thread::sleep_until(start + std::chrono::microseconds(i * StandInAudioSampleUs));
+      if (!decoder.PopAudio()) {
+        numUnderruns++;
+      }
+    }
+  });
+  uint64_t numBehind = 0;
+  uint64_t maxBehind = 0;
+  int64_t shown = -1;
+  for (uint64_t i = 0; i < numFrames; i++) {
+    std::this_thread::sleep_until(start + std::chrono::microseconds(i * StandInFrameIntervalUs));
+    shown = std::max(shown, decoder.PopVideo(i));
+    if (shown < int64_t(i)) {
+      numBehind++;
+      maxBehind = std::max(maxBehind, uint64_t(int64_t(i) - shown));
+    }
+  }
+  audio.join();
+  decoder.Shutdown();
+  printf("%-17s audio underran %llu of %llu times; video behind at %llu of %llu paints, "
+         "by up to %.0lf ms\n",
+         aSeparateThreads ? "thread per stream:" : "one thread:",
+         (unsigned long long)numUnderruns, (unsigned long long)numSamples,
+         (unsigned long long)numBehind, (unsigned long long)numFrames,
+         maxBehind * StandInFrameIntervalUs / 1e3);
+}
+
+bool
+BenchmarkDecodeThreads()
+{
+  PlayFromStandInDecoder(false);
+  PlayFromStandInDecoder(true);
+  return true;
+}
@@ -0,0 +1,190 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "PlaybackTiming.h"
+
+#include <math.h>
+#include <algorithm>
+
+PlaybackStopwatch::PlaybackStopwatch()
+  : mStartUs(0),
+    mElapsedUs(0),
+    mRunning(false)
+{
+}
+
+void
+PlaybackStopwatch::Start(uint64_t aNowUs)
+{
+  if (!mRunning) {
+    mStartUs = aNowUs;
+    mRunning = true;
+  }
+}
+
+void
+PlaybackStopwatch::Pause(uint64_t aNowUs)
+{
+  if (mRunning) {
+    mElapsedUs = GetElapsedUs(aNowUs);
+    mRunning = false;
+  }
+}
+
+uint64_t
+PlaybackStopwatch::GetElapsedUs(uint64_t aNowUs) const
+{
+  if (!mRunning || aNowUs < mStartUs) {
+    return mElapsedUs;
+  }
+  return mElapsedUs + (aNowUs - mStartUs);
+}
+
+AudioPositionInterpolator::AudioPositionInterpolator(uint32_t aRate)
+  : mRate(std::max<uint32_t>(aRate, 1)),
+    mRunning(false),
+    mSynced(false),
+    mOriginUs(0),
+    mLastFrames(0),
+    mLastReadUs(0),
+    mPositionUs(0),
+    mNumCorrections(0)
+{
+}
+
+void
+AudioPositionInterpolator::Start(uint64_t aNowUs)
+{
+  if (!mRunning) {
+    mRunning = true;
+    mSynced = false;
+    mLastReadUs = aNowUs;
+  }
+}
+
+void
+AudioPositionInterpolator::Pause()
+{
+  mRunning = false;
+}
+
+uint64_t
+AudioPositionInterpolator::GetPositionUs(uint64_t aNowUs, uint64_t aDeviceFrames)
+{
+  const int64_t now = int64_t(aNowUs);
+  const int64_t deviceUs = int64_t(aDeviceFrames * 1000000 / mRate);
+  int64_t position = deviceUs;
+  if (mRunning) {
+    if (!mSynced) {
+      mOriginUs = now - deviceUs;
+      mSynced = true;
+    } else if (aDeviceFrames != mLastFrames) {
+      // The device's position moved on at some point since we last asked,
+      // and it's been playing since, so it's now somewhere between what it
+      // reports and that plus the time since we asked. Pull the position
+      // back into that window if it's strayed out.
+      const int64_t sinceReadUs = int64_t(std::min(aNowUs - mLastReadUs,
+                                                   uint64_t(MaxInterpolationUs)));
+      const int64_t predicted = now - mOriginUs;
+      const int64_t corrected = std::min(std::max(predicted, deviceUs),
+                                         deviceUs + sinceReadUs);
+      if (corrected != predicted) {
+        mOriginUs = now - corrected;
+        mNumCorrections++;
+      }
+    }
+    position = std::min(now - mOriginUs, deviceUs + int64_t(MaxInterpolationUs));
+    mLastFrames = aDeviceFrames;
+    mLastReadUs = aNowUs;
+  }
+  // Never go backwards; if we got ahead of the device, we wait for it.
+  mPositionUs = std::max(mPositionUs, uint64_t(std::max<int64_t>(position, 0)));
+  return mPositionUs;
+}
+
+AVDriftEstimator::AVDriftEstimator(uint64_t aTimeConstantUs)
+  : mTimeConstantS(double(std::max<uint64_t>(aTimeConstantUs, 1)) / 1e6)
+{
+  Reset();
+}
+
+void
+AVDriftEstimator::Reset()
+{
+  mOffsets = LatencyHistogram();
+  mFirstUs = 0;
+  mLastUs = 0;
+  mHasOffset = false;
+  mSumW = 0.0;
+  mSumT = 0.0;
+  mSumTT = 0.0;
+  mSumY = 0.0;
+  mSumTY = 0.0;
+}
+
+void
+AVDriftEstimator::Add(uint64_t aNowUs, int64_t aOffsetUs)
+{
+  mOffsets.Add(uint64_t(aOffsetUs < 0 ? -aOffsetUs : aOffsetUs));
+  if (!mHasOffset) {
+    mFirstUs = aNowUs;
+    mLastUs = aNowUs;
+    mHasOffset = true;
+  }
+  // Age the offsets we have by the time since the last, so that the fit's
+  // response doesn't depend on the frame rate.
+  const uint64_t nowUs = std::max(aNowUs, mLastUs);
+  const double decay = exp(-double(nowUs - mLastUs) / 1e6 / mTimeConstantS);
+  const double t = double(nowUs - mFirstUs) / 1e6;
+  const double y = double(aOffsetUs);
+  mSumW = mSumW * decay + 1.0;
+  mSumT = mSumT * decay + t;
+  mSumTT = mSumTT * decay + t * t;
+  mSumY = mSumY * decay + y;
+  mSumTY = mSumTY * decay + t * y;
+  mLastUs = nowUs;
+}
+
+double
+AVDriftEstimator::GetSlope() const
+{
+  const double denominator = mSumW * mSumTT - mSumT * mSumT;
+  if (denominator <= 1e-9 * mSumW * mSumW) {
+    return 0.0;
+  }
+  return (mSumW * mSumTY - mSumT * mSumY) / denominator;
+}
+
+int64_t
+AVDriftEstimator::GetOffsetUs() const
+{
+  if (!mHasOffset) {
+    return 0;
+  }
+  // Where the fitted line is now.
+  const double t = double(mLastUs - mFirstUs) / 1e6;
+  const double meanT = mSumT / mSumW;
+  const double meanY = mSumY / mSumW;
+  return int64_t(floor(meanY + GetSlope() * (t - meanT) + 0.5));
+}
+
+double
+AVDriftEstimator::GetDriftPpm() const
+{
+  if (!mHasOffset || mLastUs - mFirstUs < 1000000) {
+    return 0.0;
+  }
+  return GetSlope();
+}
@@ -0,0 +1,151 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// The timekeeping behind the preview's playback clocks: a stopwatch for
+// when there's no audio, smoothing of the audio device's position, which
+// only advances when the device consumes a buffer, and an estimate of how
+// far the video is out of sync with the clock. Times are in microseconds,
+// and are passed in.
+
+#pragma once
+
+#include "TranscodeStats.h"
+
+#include <stdint.h>
+
+// Measures how long playback has been running, excluding the time it was
+// paused.
+class PlaybackStopwatch {
+public:
+  PlaybackStopwatch();
+
+  // Starts, or resumes, timing at aNowUs. Does nothing if it's running.
+  void Start(uint64_t aNowUs);
+
+  // Pauses timing at aNowUs. Does nothing if it's paused.
+  void Pause(uint64_t aNowUs);
+
+  bool IsRunning() const { return mRunning; }
+
+  // Returns how long it had been running for by aNowUs, in microseconds.
+  uint64_t GetElapsedUs(uint64_t aNowUs) const;
+
+private:
+  // The time we were last started.
+  uint64_t mStartUs;
+  // How long we ran for before we were last paused.
+  uint64_t mElapsedUs;
+  bool mRunning;
+};
+
+// Turns the position an audio device reports, which only advances when the
+// device takes another buffer, tens of milliseconds at a time, into a
+// position which advances smoothly with the monotonic clock, so that video
+// frames are shown when they're due, rather than in bursts. The position
+// is corrected whenever the device's changes, so that it follows the
+// device's clock when it drifts from ours, and it never goes backwards.
+// Not threadsafe.
+class AudioPositionInterpolator {
+public:
+  // We stop extrapolating once the device's position has been stuck for
+  // this long, e.g. because it's starved of audio, rather than run ahead of
+  // what's been heard.
+  static const uint64_t MaxInterpolationUs = 100000;
+
+  explicit AudioPositionInterpolator(uint32_t aRate);
+
+  // Called when the device is started, or resumed, at aNowUs.
+  void Start(uint64_t aNowUs);
+
+  // Called when the device is paused. The position stops where it is.
+  void Pause();
+
+  bool IsRunning() const { return mRunning; }
+
+  // Returns the position at aNowUs, in microseconds, given that the device
+  // reported aDeviceFrames frames played when we asked it at aNowUs.
+  uint64_t GetPositionUs(uint64_t aNowUs, uint64_t aDeviceFrames);
+
+  // The number of times the position was corrected because it had strayed
+  // outside what the device's position allows.
+  uint64_t GetNumCorrections() const { return mNumCorrections; }
+
+private:
+  uint32_t mRate;
+  bool mRunning;
+  // Whether we've had a position from the device since we were started.
+  bool mSynced;
+  // The monotonic time at which the interpolated position would have been
+  // 0; the position at aNowUs is aNowUs - mOriginUs.
+  int64_t mOriginUs;
+  // The device's position, and the time, when we last asked it.
+  uint64_t mLastFrames;
+  uint64_t mLastReadUs;
+  // The position we last returned.
+  uint64_t mPositionUs;
+  uint64_t mNumCorrections;
+};
+
+// Estimates how far, and how fast, the video drifts out of sync with the
+// playback clock, from the offset of each frame shown from the time it's
+// shown at. Each offset is tens of milliseconds out, as frames are only
+// shown at the paint rate, so it fits a line through the offsets by least
+// squares, weighting each less exponentially as it ages, so that it rides
+// out noise and late frames, but follows a lasting change in the drift.
+class AVDriftEstimator {
+public:
+  // How quickly the estimates follow a change; an offset's weight falls to
+  // about a third after this long.
+  static const uint64_t DefaultTimeConstantUs = 10000000;
+
+  explicit AVDriftEstimator(uint64_t aTimeConstantUs = DefaultTimeConstantUs);
+
+  void Reset();
+
+  // Records that at aNowUs, the video was aOffsetUs ahead of the clock;
+  // negative if it was behind.
+  void Add(uint64_t aNowUs, int64_t aOffsetUs);
+
+  bool HasEstimate() const { return mHasOffset; }
+
+  // The smoothed offset of the video from the clock, in microseconds.
+  int64_t GetOffsetUs() const;
+
+  // How fast the offset is changing, in microseconds per second, i.e. parts
+  // per million; positive if the video is running ahead. 0 until the
+  // offsets span a second.
+  double GetDriftPpm() const;
+
+  // The size of every offset added, either way.
+  const LatencyHistogram& GetOffsets() const { return mOffsets; }
+
+private:
+  // Returns the slope of the fitted line, in microseconds per second, or
+  // 0 if the offsets don't determine one.
+  double GetSlope() const;
+
+  double mTimeConstantS;
+  LatencyHistogram mOffsets;
+  uint64_t mFirstUs;
+  uint64_t mLastUs;
+  bool mHasOffset;
+  // The exponentially decayed sums of the weights, times in seconds since
+  // the first offset, offsets, and their products, for the fit.
+  double mSumW;
+  double mSumT;
+  double mSumTT;
+  double mSumY;
+  double mSumTY;
+};
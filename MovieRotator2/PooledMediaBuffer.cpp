@@ -0,0 +1,136 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "stdafx.h"
+#include "PooledMediaBuffer.h"
+
+PooledMediaBuffer::PooledMediaBuffer(const std::shared_ptr<void>& aStorage,
+                                     BYTE* aData,
+                                     DWORD aMaxLength)
+  : mRefCount(1),
+    mStorage(aStorage),
+    mData(aData),
+    mMaxLength(aMaxLength),
+    mCurrentLength(aMaxLength)
+{
+}
+
+PooledMediaBuffer::~PooledMediaBuffer()
+{
+}
+
+HRESULT
+PooledMediaBuffer::Create(const std::shared_ptr<void>& aStorage,
+                          BYTE* aData,
+                          DWORD aLength,
+                          IMFMediaBuffer** aOutBuffer)
+{
+  ENSURE_TRUE(aStorage, E_POINTER);
+  ENSURE_TRUE(aData, E_POINTER);
+  ENSURE_TRUE(aOutBuffer, E_POINTER);
+
+  *aOutBuffer = new PooledMediaBuffer(aStorage, aData, aLength);
+  return S_OK;
+}
+
+STDMETHODIMP
+PooledMediaBuffer::QueryInterface(REFIID aIID, void** aOutObject)
+{
+  if (!aOutObject) {
+    return E_POINTER;
+  }
+  if (aIID == __uuidof(IUnknown)) {
+    *aOutObject = static_cast<IUnknown*>(this);
+  } else if (aIID == __uuidof(IMFMediaBuffer)) {
+    *aOutObject = static_cast<IMFMediaBuffer*>(this);
+  } else {
+    *aOutObject = NULL;
+    return E_NOINTERFACE;
+  }
+  AddRef();
+  return S_OK;
+}
+
+STDMETHODIMP_(ULONG)
+PooledMediaBuffer::AddRef()
+{
+  return InterlockedIncrement(&mRefCount);
+}
+
+STDMETHODIMP_(ULONG)
+PooledMediaBuffer::Release()
+{
+  ULONG count = InterlockedDecrement(&mRefCount);
+  if (count == 0) {
+    delete this;
+  }
+  // Return the temporary variable, not the member variable, for thread
+  // safety.
+  return count;
+}
+
+STDMETHODIMP
+PooledMediaBuffer::Lock(BYTE** aOutBuffer, DWORD* aOutMaxLength, DWORD* aOutCurrentLength)
+{
+  if (!aOutBuffer) {
+    return E_POINTER;
+  }
+  // Like the system memory buffers, we don't need to do anything to make
+  // the memory accessible, so nested locks are fine.
+  *aOutBuffer = mData;
+  if (aOutMaxLength) {
+    *aOutMaxLength = mMaxLength;
+  }
+  if (aOutCurrentLength) {
+    *aOutCurrentLength = mCurrentLength;
+  }
+  return S_OK;
+}
+
+STDMETHODIMP
+PooledMediaBuffer::Unlock()
+{
+  return S_OK;
+}
+
+STDMETHODIMP
+PooledMediaBuffer::GetCurrentLength(DWORD* aOutCurrentLength)
+{
+  if (!aOutCurrentLength) {
+    return E_POINTER;
+  }
+  *aOutCurrentLength = mCurrentLength;
+  return S_OK;
+}
+
+STDMETHODIMP
+PooledMediaBuffer::SetCurrentLength(DWORD aCurrentLength)
+{
+  if (aCurrentLength > mMaxLength) {
+    return E_INVALIDARG;
+  }
+  mCurrentLength = aCurrentLength;
+  return S_OK;
+}
+
+STDMETHODIMP
+PooledMediaBuffer::GetMaxLength(DWORD* aOutMaxLength)
+{
+  if (!aOutMaxLength) {
+    return E_POINTER;
+  }
+  *aOutMaxLength = mMaxLength;
+  return S_OK;
+}
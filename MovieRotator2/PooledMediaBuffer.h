@@ -0,0 +1,58 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+
+#include <memory>
+
+// An IMFMediaBuffer over memory someone else owns, typically a frame buffer
+// from a FrameBufferPool; see FrameBufferPool::AcquireShared(). The buffer
+// holds a reference to aStorage, so the memory goes back to the pool when
+// the last reference to the buffer is released, which is typically when the
+// encoder has finished with the sample holding it. This lets frames the
+// transcode pipeline produced be passed to Media Foundation without copying.
+class PooledMediaBuffer : public IMFMediaBuffer {
+public:
+  // Creates a buffer of the aLength bytes at aData, which aStorage keeps
+  // alive. The buffer's current length is initially aLength.
+  static HRESULT Create(const std::shared_ptr<void>& aStorage,
+                        BYTE* aData,
+                        DWORD aLength,
+                        IMFMediaBuffer** aOutBuffer);
+
+  // IUnknown methods.
+  STDMETHODIMP QueryInterface(REFIID aIID, void** aOutObject) override;
+  STDMETHODIMP_(ULONG) AddRef() override;
+  STDMETHODIMP_(ULONG) Release() override;
+
+  // IMFMediaBuffer methods.
+  STDMETHODIMP Lock(BYTE** aOutBuffer, DWORD* aOutMaxLength, DWORD* aOutCurrentLength) override;
+  STDMETHODIMP Unlock() override;
+  STDMETHODIMP GetCurrentLength(DWORD* aOutCurrentLength) override;
+  STDMETHODIMP SetCurrentLength(DWORD aCurrentLength) override;
+  STDMETHODIMP GetMaxLength(DWORD* aOutMaxLength) override;
+
+private:
+  PooledMediaBuffer(const std::shared_ptr<void>& aStorage,
+                    BYTE* aData,
+                    DWORD aMaxLength);
+  ~PooledMediaBuffer();
+
+  volatile long mRefCount;
+  std::shared_ptr<void> mStorage;
+  BYTE* mData;
+  const DWORD mMaxLength;
+  DWORD mCurrentLength;
+};
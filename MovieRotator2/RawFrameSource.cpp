@@ -0,0 +1,223 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "RawFrameSource.h"
+#include "KeyframeIndex.h"
+
+#include <algorithm>
+
+// The number of audio frames we read at a time. This is an AAC frame's
+// worth, which is about 20ms.
+static const uint32_t AudioChunkFrames = 1024;
+
+RawFrameSource::RawFrameSource()
+  : mHasAudio(false),
+    mBufferPool(std::make_shared<FrameBufferPool>()),
+    mNumVideoFramesRead(0),
+    mNumAudioFramesRead(0),
+    mVideoEnded(false),
+    mAudioEnded(true),
+    mDuration(0)
+{
+}
+
+bool
+RawFrameSource::Open(const std::string& aY4MFilename, const std::string& aWavFilename)
+{
+  if (!mVideo.Open(aY4MFilename)) {
+    return false;
+  }
+  const VideoFormat& format = mVideo.GetFormat();
+  if ((format.width | format.height) & 1) {
+    return false;
+  }
+  mDuration = GetVideoTime(mVideo.GetNumFrames());
+
+  if (!aWavFilename.empty()) {
+    if (!mAudio.Open(aWavFilename)) {
+      return false;
+    }
+    mHasAudio = true;
+    mAudioEnded = false;
+    mDuration = std::max(mDuration, GetAudioTime(mAudio.GetNumFrames()));
+  }
+  return true;
+}
+
+int64_t
+RawFrameSource::GetVideoTime(uint64_t aFrame) const
+{
+  const VideoFormat& format = mVideo.GetFormat();
+  return int64_t(aFrame * format.frameRateDenom * TimeUnitsPerSecond / format.frameRateNumer);
+}
+
+int64_t
+RawFrameSource::GetAudioTime(uint64_t aFrame) const
+{
+  return int64_t(aFrame * TimeUnitsPerSecond / mAudio.GetFormat().sampleRate);
+}
+
+bool
+RawFrameSource::ReadFrame(MediaFrame* aOutFrame, bool* aOutEndOfStream)
+{
+  *aOutEndOfStream = false;
+  while (!mVideoEnded || !mAudioEnded) {
+    // Interleave the streams by time, as a muxed file would be.
+    const bool video = !mVideoEnded &&
+                       (mAudioEnded ||
+                        GetVideoTime(mNumVideoFramesRead) <= GetAudioTime(mNumAudioFramesRead));
+    if (!(video ? ReadVideoFrame(aOutFrame) : ReadAudioFrame(aOutFrame))) {
+      return false;
+    }
+    if (aOutFrame->data) {
+      return true;
+    }
+  }
+  *aOutEndOfStream = true;
+  return true;
+}
+
+bool
+RawFrameSource::Seek(int64_t aTime)
+{
+  // Start at the frames which are playing at aTime. Timestamps are rounded
+  // down, so the frame before the one at aTime may be read first.
+  const uint64_t time = uint64_t(std::max<int64_t>(aTime, 0));
+  const VideoFormat& format = mVideo.GetFormat();
+  mNumVideoFramesRead = time * format.frameRateNumer / (uint64_t(format.frameRateDenom) * TimeUnitsPerSecond);
+  mVideoEnded = false;
+  if (!mVideo.Seek(mNumVideoFramesRead)) {
+    return false;
+  }
+  if (!mHasAudio) {
+    return true;
+  }
+  mNumAudioFramesRead = std::min(time * mAudio.GetFormat().sampleRate / TimeUnitsPerSecond,
+                                 mAudio.GetNumFrames());
+  mAudioEnded = false;
+  return mAudio.Seek(mNumAudioFramesRead);
+}
+
+bool
+RawFrameSource::GetKeyframeIndex(KeyframeIndex* aOutIndex)
+{
+  aOutIndex->Clear();
+  const uint64_t numFrames = mVideo.GetNumFrames();
+  for (uint64_t i = 0; i < numFrames; i++) {
+    aOutIndex->Add(GetVideoTime(i));
+  }
+  return numFrames != 0;
+}
+
+bool
+RawFrameSource::ReadVideoFrame(MediaFrame* aOutFrame)
+{
+  const VideoFormat& format = mVideo.GetFormat();
+  const size_t length = mVideo.GetFrameSize();
+  std::shared_ptr<uint8_t> buffer = FrameBufferPool::AcquireShared(mBufferPool, length);
+  if (!buffer) {
+    return false;
+  }
+  bool endOfFile = false;
+  if (!mVideo.ReadFrame(buffer.get(), &endOfFile)) {
+    return false;
+  }
+  *aOutFrame = MediaFrame();
+  if (endOfFile) {
+    mVideoEnded = true;
+    return true;
+  }
+
+  aOutFrame->stream = Stream_Video;
+  aOutFrame->timestamp = GetVideoTime(mNumVideoFramesRead);
+  aOutFrame->duration = GetVideoTime(mNumVideoFramesRead + 1) - aOutFrame->timestamp;
+  aOutFrame->data = buffer.get();
+  aOutFrame->length = length;
+  aOutFrame->keyframe = true;
+  aOutFrame->storage = buffer;
+  mNumVideoFramesRead++;
+  return GetImageLayout(PixelFormat_I420, buffer.get(), length, format.width,
+                        format.height, format.width, format.height,
+                        &aOutFrame->image);
+}
+
+bool
+RawFrameSource::ReadAudioFrame(MediaFrame* aOutFrame)
+{
+  const AudioFormat& format = mAudio.GetFormat();
+  const size_t frameSize = format.numChannels * format.bitsPerSample / 8;
+  const size_t length = AudioChunkFrames * frameSize;
+  std::shared_ptr<uint8_t> buffer = FrameBufferPool::AcquireShared(mBufferPool, length);
+  if (!buffer) {
+    return false;
+  }
+  uint32_t numFrames = 0;
+  if (!mAudio.Read(buffer.get(), AudioChunkFrames, &numFrames)) {
+    return false;
+  }
+  *aOutFrame = MediaFrame();
+  if (!numFrames) {
+    mAudioEnded = true;
+    return true;
+  }
+
+  aOutFrame->stream = Stream_Audio;
+  aOutFrame->timestamp = GetAudioTime(mNumAudioFramesRead);
+  aOutFrame->duration = GetAudioTime(mNumAudioFramesRead + numFrames) - aOutFrame->timestamp;
+  aOutFrame->data = buffer.get();
+  aOutFrame->length = numFrames * frameSize;
+  aOutFrame->storage = buffer;
+  mNumAudioFramesRead += numFrames;
+  return true;
+}
+
+RawFrameSink::RawFrameSink()
+  : mHasAudio(false)
+{
+}
+
+bool
+RawFrameSink::Open(const std::string& aY4MFilename,
+                   const VideoFormat& aVideoFormat,
+                   const std::string& aWavFilename,
+                   const AudioFormat& aAudioFormat)
+{
+  if (!mVideo.Open(aY4MFilename, aVideoFormat)) {
+    return false;
+  }
+  if (!aWavFilename.empty()) {
+    if (!mAudio.Open(aWavFilename, aAudioFormat)) {
+      return false;
+    }
+    mHasAudio = true;
+  }
+  return true;
+}
+
+bool
+RawFrameSink::WriteFrame(const MediaFrame& aFrame)
+{
+  if (aFrame.stream == Stream_Video) {
+    return mVideo.WriteFrame(aFrame.image);
+  }
+  return !mHasAudio || mAudio.Write(aFrame.data, aFrame.length);
+}
+
+bool
+RawFrameSink::Finish()
+{
+  bool succeeded = mVideo.Close();
+  return mAudio.Close() && succeeded;
+}
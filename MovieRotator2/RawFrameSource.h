@@ -0,0 +1,88 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// An IFrameSource and IFrameSink which read and write raw video in Y4M
+// files, and raw audio in WAV files. They let the transcode pipeline run,
+// and be benchmarked, on any platform, without a decoder or encoder.
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include "FrameBufferPool.h"
+#include "FrameSource.h"
+#include "WavFile.h"
+#include "Y4MFile.h"
+
+class RawFrameSource : public IFrameSource {
+public:
+  RawFrameSource();
+
+  // Opens a Y4M file of video, and, unless aWavFilename is empty, a WAV file
+  // of audio which starts at the same time. The video must have even
+  // dimensions.
+  bool Open(const std::string& aY4MFilename, const std::string& aWavFilename);
+
+  bool HasVideo() const override { return true; }
+  bool HasAudio() const override { return mHasAudio; }
+  const VideoFormat& GetVideoFormat() const override { return mVideo.GetFormat(); }
+  const AudioFormat& GetAudioFormat() const override { return mAudio.GetFormat(); }
+  int64_t GetDuration() const override { return mDuration; }
+  bool ReadFrame(MediaFrame* aOutFrame, bool* aOutEndOfStream) override;
+  bool Seek(int64_t aTime) override;
+  // Every frame of raw video is a keyframe.
+  bool GetKeyframeIndex(KeyframeIndex* aOutIndex) override;
+
+  // The stats of the pool the frames' buffers come from.
+  FrameBufferPoolStats GetBufferPoolStats() const { return mBufferPool->GetStats(); }
+
+private:
+  int64_t GetVideoTime(uint64_t aFrame) const;
+  int64_t GetAudioTime(uint64_t aFrame) const;
+
+  bool ReadVideoFrame(MediaFrame* aOutFrame);
+  bool ReadAudioFrame(MediaFrame* aOutFrame);
+
+  Y4MReader mVideo;
+  WavReader mAudio;
+  bool mHasAudio;
+  std::shared_ptr<FrameBufferPool> mBufferPool;
+  uint64_t mNumVideoFramesRead;
+  uint64_t mNumAudioFramesRead;
+  bool mVideoEnded;
+  bool mAudioEnded;
+  int64_t mDuration;
+};
+
+class RawFrameSink : public IFrameSink {
+public:
+  RawFrameSink();
+
+  // Creates aY4MFilename for video in aVideoFormat, which must be I420, and,
+  // unless aWavFilename is empty, aWavFilename for audio in aAudioFormat.
+  // If there's no WAV file, audio frames are dropped.
+  bool Open(const std::string& aY4MFilename,
+            const VideoFormat& aVideoFormat,
+            const std::string& aWavFilename,
+            const AudioFormat& aAudioFormat);
+
+  bool WriteFrame(const MediaFrame& aFrame) override;
+  bool Finish() override;
+
+private:
+  Y4MWriter mVideo;
+  WavWriter mAudio;
+  bool mHasAudio;
+};
@@ -0,0 +1,588 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "RotateScaler.h"
+#include "CpuFeatures.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(HAVE_X86_SIMD)
+#include <emmintrin.h>
+#endif
+
+RotateScaler::RotateScaler()
+  : mTransposed(false),
+    mSrcWidth(0),
+    mSrcHeight(0),
+    mDstWidth(0),
+    mDstHeight(0),
+    mBytesPerPixel(0)
+{
+  mColumns.numTaps = 0;
+  mRows.numTaps = 0;
+}
+
+static const double Pi = 3.14159265358979323846;
+
+static double
+Sinc(double aX)
+{
+  if (aX == 0.0) {
+    return 1.0;
+  }
+  return sin(Pi * aX) / (Pi * aX);
+}
+
+static double
+Lanczos3(double aX)
+{
+  if (aX <= -3.0 || aX >= 3.0) {
+    return 0.0;
+  }
+  return Sinc(aX) * Sinc(aX / 3.0);
+}
+
+static double
+Triangle(double aX)
+{
+  return std::max(0.0, 1.0 - fabs(aX));
+}
+
+void
+RotateScaler::InitAxis(Axis& aAxis,
+                       uint32_t aSrcLength,
+                       uint32_t aDstLength,
+                       bool aReversed,
+                       ScaleFilter aFilter,
+                       uint32_t aFactor,
+                       double aSrcOffset,
+                       double aDstOffset)
+{
+  // Work out where each destination sample lies in the source, in luma
+  // units; aFactor is 2 for subsampled chroma, and the offsets are where
+  // the sample sites lie relative to the luma samples. Pixel centers, not
+  // edges, are mapped, so the image is scaled about its center.
+  const double scale = double(aSrcLength) / double(aDstLength);
+  const double srcLumaLength = double(aSrcLength) * aFactor;
+
+  // When shrinking, Lanczos is stretched to cover every source sample.
+  // Bilinear isn't; it stays cheap, and looks the same as it always does.
+  const double stretch = (aFilter == ScaleFilter_Lanczos3) ? std::max(scale, 1.0) : 1.0;
+  const double radius = ((aFilter == ScaleFilter_Lanczos3) ? 3.0 : 1.0) * stretch;
+
+  // The taps lie strictly within radius of the sample's position; any on
+  // the boundary have zero weight.
+  aAxis.numTaps = std::min(uint32_t(ceil(radius * 2.0)), aSrcLength);
+  aAxis.tapStride = (aAxis.numTaps + 7) & ~7;
+  aAxis.starts.assign(aDstLength, 0);
+  aAxis.weights.assign(size_t(aDstLength) * aAxis.tapStride, 0);
+
+  const uint32_t numFilterTaps = uint32_t(ceil(radius * 2.0));
+  std::vector<double> weights(aAxis.tapStride);
+  for (uint32_t i = 0; i < aDstLength; i++) {
+    double pos = (double(i) * aFactor + aDstOffset + 0.5) * scale - 0.5;
+    if (aReversed) {
+      pos = srcLumaLength - 1.0 - pos;
+    }
+    const double center = (pos - aSrcOffset) / aFactor;
+
+    // Samples beyond the edges are the edge samples repeated, so taps off
+    // the edges add their weight to the edge samples' taps.
+    const int32_t first = int32_t(floor(center - radius)) + 1;
+    const int32_t lastStart = int32_t(aSrcLength - aAxis.numTaps);
+    const int32_t start = std::min(std::max(first, 0), lastStart);
+    std::fill(weights.begin(), weights.end(), 0.0);
+    double sum = 0.0;
+    for (uint32_t k = 0; k < numFilterTaps; k++) {
+      const double x = (double(first + int32_t(k)) - center) / stretch;
+      const double weight = (aFilter == ScaleFilter_Lanczos3) ? Lanczos3(x) : Triangle(x);
+      const int32_t index = std::min(std::max(first + int32_t(k), 0), int32_t(aSrcLength) - 1);
+      weights[index - start] += weight;
+      sum += weight;
+    }
+    aAxis.starts[i] = uint32_t(start);
+
+    // Quantize the weights, and give the rounding error to the largest, so
+    // that they sum to exactly 1 and flat areas stay flat.
+    int16_t* fixedWeights = &aAxis.weights[size_t(i) * aAxis.tapStride];
+    int32_t total = 0;
+    uint32_t largest = 0;
+    for (uint32_t k = 0; k < aAxis.numTaps; k++) {
+      fixedWeights[k] = int16_t(floor(weights[k] / sum * (1 << WeightBits) + 0.5));
+      total += fixedWeights[k];
+      if (fixedWeights[k] > fixedWeights[largest]) {
+        largest = k;
+      }
+    }
+    fixedWeights[largest] += int16_t((1 << WeightBits) - total);
+  }
+}
+
+bool
+RotateScaler::Init(Rotation aRotation,
+                   uint32_t aSrcWidth,
+                   uint32_t aSrcHeight,
+                   uint32_t aDstWidth,
+                   uint32_t aDstHeight,
+                   uint32_t aBytesPerPixel,
+                   ScaleFilter aFilter,
+                   bool aSubsampled,
+                   ChromaSiting aHorizontal,
+                   ChromaSiting aVertical)
+{
+  if (!aSrcWidth || !aSrcHeight || !aDstWidth || !aDstHeight ||
+      (aBytesPerPixel != 1 && aBytesPerPixel != 2 && aBytesPerPixel != 4)) {
+    return false;
+  }
+
+  mTransposed = (aRotation == ROTATE_90 || aRotation == ROTATE_270);
+  mSrcWidth = aSrcWidth;
+  mSrcHeight = aSrcHeight;
+  mDstWidth = aDstWidth;
+  mDstHeight = aDstHeight;
+  mBytesPerPixel = aBytesPerPixel;
+
+  // Centered chroma sites lie half a luma sample after the cosited ones.
+  const uint32_t factor = aSubsampled ? 2 : 1;
+  const double horizontalOffset =
+    (aSubsampled && aHorizontal == ChromaSiting_Centered) ? 0.5 : 0.0;
+  const double verticalOffset =
+    (aSubsampled && aVertical == ChromaSiting_Centered) ? 0.5 : 0.0;
+
+  // Which source axis each destination axis runs along, and whether it
+  // runs backwards. See the mappings in RotationKernels.cpp; for example
+  // rotating 90 degrees, dst(x, y) = src(y, H - 1 - x).
+  switch (aRotation) {
+    case ROTATE_0:
+      InitAxis(mColumns, aSrcWidth, aDstWidth, false, aFilter, factor,
+               horizontalOffset, horizontalOffset);
+      InitAxis(mRows, aSrcHeight, aDstHeight, false, aFilter, factor,
+               verticalOffset, verticalOffset);
+      break;
+    case ROTATE_90:
+      InitAxis(mColumns, aSrcHeight, aDstWidth, true, aFilter, factor,
+               verticalOffset, horizontalOffset);
+      InitAxis(mRows, aSrcWidth, aDstHeight, false, aFilter, factor,
+               horizontalOffset, verticalOffset);
+      break;
+    case ROTATE_180:
+      InitAxis(mColumns, aSrcWidth, aDstWidth, true, aFilter, factor,
+               horizontalOffset, horizontalOffset);
+      InitAxis(mRows, aSrcHeight, aDstHeight, true, aFilter, factor,
+               verticalOffset, verticalOffset);
+      break;
+    case ROTATE_270:
+      InitAxis(mColumns, aSrcHeight, aDstWidth, false, aFilter, factor,
+               verticalOffset, horizontalOffset);
+      InitAxis(mRows, aSrcWidth, aDstHeight, true, aFilter, factor,
+               horizontalOffset, verticalOffset);
+      break;
+    default:
+      return false;
+  }
+  return true;
+}
+
+// The destination is produced in tiles of this many pixels square. The
+// source pixels a tile needs, and the intermediate sums, fit in the L2
+// cache even when shrinking 4K frames.
+static const uint32_t TileSize = 32;
+
+// The first pass keeps 6 of its 14 fractional bits, so that its results fit
+// in 16 bits, even with Lanczos' negative lobes, and the second pass can
+// multiply them by the 16 bit weights.
+static const int IntermediateShift = 8;
+static const int FinalShift = 2 * 14 - IntermediateShift;
+
+// Adds aWeight0 * aRow0[i] + aWeight1 * aRow1[i] to each aSums[i].
+static void
+AccumulateRows_Scalar(int32_t* aSums,
+                      const uint8_t* aRow0,
+                      const uint8_t* aRow1,
+                      int16_t aWeight0,
+                      int16_t aWeight1,
+                      uint32_t aLength)
+{
+  for (uint32_t i = 0; i < aLength; i++) {
+    aSums[i] += aWeight0 * aRow0[i] + aWeight1 * aRow1[i];
+  }
+}
+
+// Rounds and shifts the first pass's sums down to 16 bits.
+static void
+NarrowSums_Scalar(int16_t* aDst, const int32_t* aSums, uint32_t aLength)
+{
+  for (uint32_t i = 0; i < aLength; i++) {
+    int32_t sum = (aSums[i] + (1 << (IntermediateShift - 1))) >> IntermediateShift;
+    aDst[i] = int16_t(std::min(std::max(sum, -32768), 32767));
+  }
+}
+
+#if defined(HAVE_X86_SIMD)
+
+// Interleaves the rows' bytes into 16 bit pairs, so that one madd
+// multiplies both rows by their weights and adds the products.
+static TARGET_SSE2 void
+AccumulateRows_SSE2(int32_t* aSums,
+                    const uint8_t* aRow0,
+                    const uint8_t* aRow1,
+                    int16_t aWeight0,
+                    int16_t aWeight1,
+                    uint32_t aLength)
+{
+  const __m128i weights =
+    _mm_set1_epi32(int32_t(uint16_t(aWeight0) | (uint32_t(uint16_t(aWeight1)) << 16)));
+  const __m128i zero = _mm_setzero_si128();
+  uint32_t i = 0;
+  for (; i + 16 <= aLength; i += 16) {
+    __m128i row0 = _mm_loadu_si128((const __m128i*)(aRow0 + i));
+    __m128i row1 = _mm_loadu_si128((const __m128i*)(aRow1 + i));
+    __m128i lo = _mm_unpacklo_epi8(row0, row1);
+    __m128i hi = _mm_unpackhi_epi8(row0, row1);
+    __m128i* sums = (__m128i*)(aSums + i);
+    _mm_storeu_si128(sums + 0, _mm_add_epi32(_mm_loadu_si128(sums + 0),
+      _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), weights)));
+    _mm_storeu_si128(sums + 1, _mm_add_epi32(_mm_loadu_si128(sums + 1),
+      _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), weights)));
+    _mm_storeu_si128(sums + 2, _mm_add_epi32(_mm_loadu_si128(sums + 2),
+      _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), weights)));
+    _mm_storeu_si128(sums + 3, _mm_add_epi32(_mm_loadu_si128(sums + 3),
+      _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), weights)));
+  }
+  AccumulateRows_Scalar(aSums + i, aRow0 + i, aRow1 + i, aWeight0, aWeight1, aLength - i);
+}
+
+static TARGET_SSE2 void
+NarrowSums_SSE2(int16_t* aDst, const int32_t* aSums, uint32_t aLength)
+{
+  const __m128i round = _mm_set1_epi32(1 << (IntermediateShift - 1));
+  uint32_t i = 0;
+  for (; i + 8 <= aLength; i += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(aSums + i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(aSums + i + 4));
+    a = _mm_srai_epi32(_mm_add_epi32(a, round), IntermediateShift);
+    b = _mm_srai_epi32(_mm_add_epi32(b, round), IntermediateShift);
+    _mm_storeu_si128((__m128i*)(aDst + i), _mm_packs_epi32(a, b));
+  }
+  NarrowSums_Scalar(aDst + i, aSums + i, aLength - i);
+}
+
+#endif
+
+// Sets *aOut to the Bpp channels of the pixel which is the weighted sum of
+// the aNumTaps pixels at aIn, rounded and clamped.
+template<uint32_t Bpp>
+static inline void
+FilterPixel_Scalar(uint8_t* aOut, const int16_t* aIn, const int16_t* aWeights,
+                   uint32_t aNumTaps)
+{
+  int32_t pixel[Bpp];
+  for (uint32_t c = 0; c < Bpp; c++) {
+    pixel[c] = 1 << (FinalShift - 1);
+  }
+  for (uint32_t k = 0; k < aNumTaps; k++) {
+    for (uint32_t c = 0; c < Bpp; c++) {
+      pixel[c] += aWeights[k] * aIn[k * Bpp + c];
+    }
+  }
+  for (uint32_t c = 0; c < Bpp; c++) {
+    aOut[c] = uint8_t(std::min(std::max(pixel[c] >> FinalShift, 0), 255));
+  }
+}
+
+#if defined(HAVE_X86_SIMD)
+
+static inline TARGET_SSE2 int32_t
+FinishChannel_SSE2(__m128i aSum)
+{
+  int32_t sum = (_mm_cvtsi128_si32(aSum) + (1 << (FinalShift - 1))) >> FinalShift;
+  return std::min(std::max(sum, 0), 255);
+}
+
+// The SSE2 versions multiply pairs of taps with madd, so their inputs are
+// shuffled to put the same channel of adjacent taps side by side. They
+// read weights and pixels up to the next multiple of 8, 4 and 2 taps; the
+// extra weights are 0.
+template<uint32_t Bpp>
+static inline TARGET_SSE2 void
+FilterPixel_SSE2(uint8_t* aOut, const int16_t* aIn, const int16_t* aWeights,
+                 uint32_t aNumTaps);
+
+template<>
+inline TARGET_SSE2 void
+FilterPixel_SSE2<1>(uint8_t* aOut, const int16_t* aIn, const int16_t* aWeights,
+                    uint32_t aNumTaps)
+{
+  __m128i sum = _mm_setzero_si128();
+  for (uint32_t k = 0; k < aNumTaps; k += 8) {
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(aIn + k)),
+                                            _mm_loadu_si128((const __m128i*)(aWeights + k))));
+  }
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+  aOut[0] = uint8_t(FinishChannel_SSE2(sum));
+}
+
+template<>
+inline TARGET_SSE2 void
+FilterPixel_SSE2<2>(uint8_t* aOut, const int16_t* aIn, const int16_t* aWeights,
+                    uint32_t aNumTaps)
+{
+  __m128i sum = _mm_setzero_si128();
+  for (uint32_t k = 0; k < aNumTaps; k += 4) {
+    // u0 v0 u1 v1 u2 v2 u3 v3 -> u0 u1 v0 v1 u2 u3 v2 v3.
+    __m128i in = _mm_loadu_si128((const __m128i*)(aIn + k * 2));
+    in = _mm_shufflelo_epi16(in, _MM_SHUFFLE(3, 1, 2, 0));
+    in = _mm_shufflehi_epi16(in, _MM_SHUFFLE(3, 1, 2, 0));
+    // w0 w1 w2 w3 -> w0 w1 w0 w1 w2 w3 w2 w3.
+    __m128i weights = _mm_loadl_epi64((const __m128i*)(aWeights + k));
+    weights = _mm_shuffle_epi32(weights, _MM_SHUFFLE(1, 1, 0, 0));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(in, weights));
+  }
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  aOut[0] = uint8_t(FinishChannel_SSE2(sum));
+  aOut[1] = uint8_t(FinishChannel_SSE2(_mm_srli_si128(sum, 4)));
+}
+
+template<>
+inline TARGET_SSE2 void
+FilterPixel_SSE2<4>(uint8_t* aOut, const int16_t* aIn, const int16_t* aWeights,
+                    uint32_t aNumTaps)
+{
+  __m128i sum = _mm_set1_epi32(1 << (FinalShift - 1));
+  for (uint32_t k = 0; k < aNumTaps; k += 2) {
+    // b0 g0 r0 a0 b1 g1 r1 a1 -> b0 b1 g0 g1 r0 r1 a0 a1.
+    __m128i in = _mm_loadu_si128((const __m128i*)(aIn + k * 4));
+    in = _mm_unpacklo_epi16(in, _mm_unpackhi_epi64(in, in));
+    const int32_t pair = int32_t(uint16_t(aWeights[k]) | (uint32_t(uint16_t(aWeights[k + 1])) << 16));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(in, _mm_set1_epi32(pair)));
+  }
+  sum = _mm_srai_epi32(sum, FinalShift);
+  sum = _mm_packs_epi32(sum, sum);
+  sum = _mm_packus_epi16(sum, sum);
+  const uint32_t pixel = uint32_t(_mm_cvtsi128_si32(sum));
+  memcpy(aOut, &pixel, 4);
+}
+
+#endif
+
+struct TileArgs {
+  const ImagePlane* src;
+  const ImagePlane* dst;
+  bool transposed;
+  uint32_t numColumnTaps;
+  uint32_t columnTapStride;
+  const uint32_t* columnStarts;
+  const int16_t* columnWeights;
+  uint32_t numRowTaps;
+  uint32_t rowTapStride;
+  const uint32_t* rowStarts;
+  const int16_t* rowWeights;
+  uint32_t x0, x1, y0, y1;
+  std::vector<int32_t>* sums;
+  std::vector<int16_t>* lines;
+};
+
+// Resamples a tile in two separable passes. The first pass runs down the
+// source's columns; for each destination line in the tile, it sums whole
+// spans of the source rows it needs, which are contiguous in memory, so
+// it's done with SIMD. The second pass filters along those sums. Which
+// destination axis each pass produces depends on whether the rotation
+// transposes.
+template<uint32_t Bpp, bool UseSSE2>
+static void
+ScaleTile(const TileArgs& aArgs)
+{
+  const ImagePlane& src = *aArgs.src;
+  const ImagePlane& dst = *aArgs.dst;
+
+  // The first pass filters along whichever destination axis maps to the
+  // source's rows; the second along the axis which maps to its columns.
+  uint32_t firstBegin, firstEnd, secondBegin, secondEnd;
+  uint32_t numFirstTaps, firstTapStride, numSecondTaps, secondTapStride;
+  const uint32_t* firstStarts;
+  const int16_t* firstWeights;
+  const uint32_t* secondStarts;
+  const int16_t* secondWeights;
+  if (aArgs.transposed) {
+    firstBegin = aArgs.x0; firstEnd = aArgs.x1;
+    numFirstTaps = aArgs.numColumnTaps;
+    firstTapStride = aArgs.columnTapStride;
+    firstStarts = aArgs.columnStarts;
+    firstWeights = aArgs.columnWeights;
+    secondBegin = aArgs.y0; secondEnd = aArgs.y1;
+    numSecondTaps = aArgs.numRowTaps;
+    secondTapStride = aArgs.rowTapStride;
+    secondStarts = aArgs.rowStarts;
+    secondWeights = aArgs.rowWeights;
+  } else {
+    firstBegin = aArgs.y0; firstEnd = aArgs.y1;
+    numFirstTaps = aArgs.numRowTaps;
+    firstTapStride = aArgs.rowTapStride;
+    firstStarts = aArgs.rowStarts;
+    firstWeights = aArgs.rowWeights;
+    secondBegin = aArgs.x0; secondEnd = aArgs.x1;
+    numSecondTaps = aArgs.numColumnTaps;
+    secondTapStride = aArgs.columnTapStride;
+    secondStarts = aArgs.columnStarts;
+    secondWeights = aArgs.columnWeights;
+  }
+
+  // The span of source columns the tile reads.
+  uint32_t first = UINT32_MAX;
+  uint32_t last = 0;
+  for (uint32_t j = secondBegin; j < secondEnd; j++) {
+    first = std::min(first, secondStarts[j]);
+    last = std::max(last, secondStarts[j] + numSecondTaps - 1);
+  }
+  const uint32_t spanLength = (last - first + 1) * Bpp;
+
+  // The SIMD filters can read a few taps past the end of the last line.
+  std::vector<int32_t>& sums = *aArgs.sums;
+  std::vector<int16_t>& lines = *aArgs.lines;
+  sums.resize(spanLength);
+  lines.resize(size_t(firstEnd - firstBegin) * spanLength + 8 * Bpp);
+
+  for (uint32_t i = firstBegin; i < firstEnd; i++) {
+    const uint32_t start = firstStarts[i];
+    const int16_t* weights = firstWeights + size_t(i) * firstTapStride;
+    std::fill(sums.begin(), sums.end(), 0);
+    // Rows are accumulated in pairs; an odd one out is paired with itself,
+    // with no weight.
+    for (uint32_t k = 0; k < numFirstTaps; k += 2) {
+      const uint32_t k1 = std::min(k + 1, numFirstTaps - 1);
+      const int16_t weight1 = (k1 != k) ? weights[k1] : 0;
+      if (!weights[k] && !weight1) {
+        continue;
+      }
+      const uint8_t* row0 = src.data + ptrdiff_t(start + k) * src.stride + first * Bpp;
+      const uint8_t* row1 = src.data + ptrdiff_t(start + k1) * src.stride + first * Bpp;
+#if defined(HAVE_X86_SIMD)
+      if (UseSSE2) {
+        AccumulateRows_SSE2(&sums[0], row0, row1, weights[k], weight1, spanLength);
+        continue;
+      }
+#endif
+      AccumulateRows_Scalar(&sums[0], row0, row1, weights[k], weight1, spanLength);
+    }
+    int16_t* line = &lines[size_t(i - firstBegin) * spanLength];
+#if defined(HAVE_X86_SIMD)
+    if (UseSSE2) {
+      NarrowSums_SSE2(line, &sums[0], spanLength);
+      continue;
+    }
+#endif
+    NarrowSums_Scalar(line, &sums[0], spanLength);
+  }
+
+  for (uint32_t y = aArgs.y0; y < aArgs.y1; y++) {
+    uint8_t* out = dst.data + ptrdiff_t(y) * dst.stride + aArgs.x0 * Bpp;
+    for (uint32_t x = aArgs.x0; x < aArgs.x1; x++, out += Bpp) {
+      uint32_t i, j;
+      if (aArgs.transposed) {
+        i = x; j = y;
+      } else {
+        i = y; j = x;
+      }
+      const int16_t* in = &lines[size_t(i - firstBegin) * spanLength +
+                                 (secondStarts[j] - first) * Bpp];
+      const int16_t* weights = secondWeights + size_t(j) * secondTapStride;
+#if defined(HAVE_X86_SIMD)
+      if (UseSSE2) {
+        FilterPixel_SSE2<Bpp>(out, in, weights, numSecondTaps);
+        continue;
+      }
+#endif
+      FilterPixel_Scalar<Bpp>(out, in, weights, numSecondTaps);
+    }
+  }
+}
+
+bool
+RotateScaler::ScaleBand(const ImagePlane& aSrc,
+                        const ImagePlane& aDst,
+                        uint32_t aDstY0,
+                        uint32_t aDstY1) const
+{
+  if (!mBytesPerPixel ||
+      aSrc.width != mSrcWidth || aSrc.height != mSrcHeight ||
+      aDst.width != mDstWidth || aDst.height != mDstHeight ||
+      aDstY0 > aDstY1 || aDstY1 > mDstHeight) {
+    return false;
+  }
+
+  TileArgs args;
+  args.src = &aSrc;
+  args.dst = &aDst;
+  args.transposed = mTransposed;
+  args.numColumnTaps = mColumns.numTaps;
+  args.columnTapStride = mColumns.tapStride;
+  args.columnStarts = &mColumns.starts[0];
+  args.columnWeights = &mColumns.weights[0];
+  args.numRowTaps = mRows.numTaps;
+  args.rowTapStride = mRows.tapStride;
+  args.rowStarts = &mRows.starts[0];
+  args.rowWeights = &mRows.weights[0];
+  std::vector<int32_t> sums;
+  std::vector<int16_t> lines;
+  args.sums = &sums;
+  args.lines = &lines;
+
+  void (*scaleTile)(const TileArgs&) = nullptr;
+#if defined(HAVE_X86_SIMD)
+  if (HasCpuFeature(CPU_FEATURE_SSE2)) {
+    scaleTile = (mBytesPerPixel == 1) ? ScaleTile<1, true> :
+                (mBytesPerPixel == 2) ? ScaleTile<2, true> : ScaleTile<4, true>;
+  }
+#endif
+  if (!scaleTile) {
+    scaleTile = (mBytesPerPixel == 1) ? ScaleTile<1, false> :
+                (mBytesPerPixel == 2) ? ScaleTile<2, false> : ScaleTile<4, false>;
+  }
+
+  for (uint32_t y = aDstY0; y < aDstY1; y += TileSize) {
+    args.y0 = y;
+    args.y1 = std::min(y + TileSize, aDstY1);
+    for (uint32_t x = 0; x < mDstWidth; x += TileSize) {
+      args.x0 = x;
+      args.x1 = std::min(x + TileSize, mDstWidth);
+      scaleTile(args);
+    }
+  }
+  return true;
+}
+
+void
+FitFrameSize(uint32_t aWidth,
+             uint32_t aHeight,
+             uint32_t aMaxWidth,
+             uint32_t aMaxHeight,
+             uint32_t* aOutWidth,
+             uint32_t* aOutHeight)
+{
+  if (aWidth <= aMaxWidth && aHeight <= aMaxHeight) {
+    *aOutWidth = aWidth;
+    *aOutHeight = aHeight;
+    return;
+  }
+  const double scale = std::min(double(aMaxWidth) / aWidth,
+                                double(aMaxHeight) / aHeight);
+  uint32_t width = uint32_t(floor(aWidth * scale / 2.0 + 0.5)) * 2;
+  uint32_t height = uint32_t(floor(aHeight * scale / 2.0 + 0.5)) * 2;
+  *aOutWidth = std::max(2u, std::min(width, aMaxWidth & ~1u));
+  *aOutHeight = std::max(2u, std::min(height, aMaxHeight & ~1u));
+}
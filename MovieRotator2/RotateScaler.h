@@ -0,0 +1,122 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// A fused pass which rotates an image by a multiple of 90 degrees and
+// resamples it to a different size, reading each source pixel from memory
+// once. Crop the source first with CropImage(); that only adjusts pointers.
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "RotationKernels.h"
+
+// The filters we can resample with.
+enum ScaleFilter {
+  // 2x2 taps. Cheap, but aliases when shrinking by more than 2x.
+  ScaleFilter_Bilinear,
+  // Lanczos with 3 lobes, widened by the downscale factor so that every
+  // source pixel contributes. Sharper and without aliasing, but costs
+  // several times more than bilinear.
+  ScaleFilter_Lanczos3
+};
+
+// Rotates and resamples planes of one size to planes of another. The filter
+// weights depend only on the sizes, so they're computed once by Init(), and
+// reused for every frame.
+class RotateScaler {
+public:
+  RotateScaler();
+
+  // Prepares to rotate aSrcWidth x aSrcHeight planes clockwise by aRotation,
+  // and resample them to aDstWidth x aDstHeight, which are the dimensions
+  // after rotation. aBytesPerPixel is 1, 2 or 4; each byte is filtered as
+  // a separate 8 bit channel.
+  // If aSubsampled is true the planes are 4:2:0 chroma planes, whose samples
+  // are sited relative to the luma as aHorizontal and aVertical say, in both
+  // the source and the destination. The filters sample at the rotated
+  // sites, so the chroma needn't be resited afterwards.
+  // Returns false if any size is 0 or aBytesPerPixel isn't supported.
+  bool Init(Rotation aRotation,
+            uint32_t aSrcWidth,
+            uint32_t aSrcHeight,
+            uint32_t aDstWidth,
+            uint32_t aDstHeight,
+            uint32_t aBytesPerPixel,
+            ScaleFilter aFilter,
+            bool aSubsampled = false,
+            ChromaSiting aHorizontal = ChromaSiting_Cosited,
+            ChromaSiting aVertical = ChromaSiting_Cosited);
+
+  // Rotates and resamples aSrc into the rows [aDstY0, aDstY1) of aDst. The
+  // planes must have the sizes passed to Init(). Disjoint bands can be
+  // produced concurrently on different threads.
+  // Returns false if the sizes don't match.
+  bool ScaleBand(const ImagePlane& aSrc,
+                 const ImagePlane& aDst,
+                 uint32_t aDstY0,
+                 uint32_t aDstY1) const;
+
+  bool Scale(const ImagePlane& aSrc, const ImagePlane& aDst) const {
+    return ScaleBand(aSrc, aDst, 0, aDst.height);
+  }
+
+private:
+  // The taps for each destination sample along one axis. Each sample reads
+  // a contiguous run of source samples along the corresponding source axis,
+  // starting at starts[i], with weights in 1/(1 << WeightBits) units which
+  // sum to exactly 1. The runs are numTaps long, but each sample's weights
+  // are padded with zeros to tapStride, so SIMD code can read whole
+  // vectors of them.
+  struct Axis {
+    uint32_t numTaps;
+    uint32_t tapStride;
+    std::vector<uint32_t> starts;
+    std::vector<int16_t> weights;
+  };
+
+  static const int WeightBits = 14;
+
+  static void InitAxis(Axis& aAxis,
+                       uint32_t aSrcLength,
+                       uint32_t aDstLength,
+                       bool aReversed,
+                       ScaleFilter aFilter,
+                       uint32_t aFactor,
+                       double aSrcOffset,
+                       double aDstOffset);
+
+  // mColumns filters along the destination's rows, mRows along its
+  // columns. For 90 and 270 degree rotations, the destination's columns
+  // are source rows; mTransposed is true.
+  Axis mColumns;
+  Axis mRows;
+  bool mTransposed;
+  uint32_t mSrcWidth;
+  uint32_t mSrcHeight;
+  uint32_t mDstWidth;
+  uint32_t mDstHeight;
+  uint32_t mBytesPerPixel;
+};
+
+// Returns the largest size with the aspect ratio of aWidth x aHeight which
+// fits in aMaxWidth x aMaxHeight, with even dimensions so that 4:2:0 images
+// of that size are whole. Sizes which already fit are returned unchanged.
+void FitFrameSize(uint32_t aWidth,
+                  uint32_t aHeight,
+                  uint32_t aMaxWidth,
+                  uint32_t aMaxHeight,
+                  uint32_t* aOutWidth,
+                  uint32_t* aOutHeight);
@@ -0,0 +1,25 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// Clockwise rotation, in multiples of 90 degrees. Note: this header is
+// shared with the portable (non-Windows) code, so don't include any Windows
+// headers here.
+enum Rotation {
+  ROTATE_0 = 0,
+  ROTATE_90 = 1,
+  ROTATE_180  = 2,
+  ROTATE_270 = 3
+};
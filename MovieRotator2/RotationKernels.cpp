@@ -0,0 +1,1116 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "RotationKernels.h"
+#include "CpuFeatures.h"
+#include "HighResClock.h"
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#if defined(HAVE_X86_SIMD)
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+// All rotations are built from two primitives; a transpose, and a horizontal
+// mirror. The vertical flips they need are free, we just start at the last row
+// and negate the stride:
+//
+//   90:  dst(x, y) = src(y, H-1-x)    Transpose of the vertically flipped src.
+//   180: dst(x, y) = src(W-1-x, H-1-y) Mirror of the vertically flipped src.
+//   270: dst(x, y) = src(W-1-y, x)    Transpose, written into a vertically
+//                                     flipped dst.
+
+// Transposes the pixels in [aX0,aX1) x [aY0,aY1) of the source into
+// [aY0,aY1) x [aX0,aX1) of the dest.
+typedef void (*TransposeFn)(const uint8_t* aSrc, int32_t aSrcStride,
+                            uint8_t* aDst, int32_t aDstStride,
+                            uint32_t aX0, uint32_t aX1,
+                            uint32_t aY0, uint32_t aY1);
+
+// Copies each of aHeight rows of aWidth pixels into aDst, reversing the
+// order of the pixels in each row.
+typedef void (*MirrorFn)(const uint8_t* aSrc, int32_t aSrcStride,
+                         uint8_t* aDst, int32_t aDstStride,
+                         uint32_t aWidth, uint32_t aHeight);
+
+// Pixels are loaded and stored with memcpy, as rows needn't be aligned.
+template<typename Pixel>
+static inline Pixel
+LoadPixel(const uint8_t* aPtr)
+{
+  Pixel v;
+  memcpy(&v, aPtr, sizeof(v));
+  return v;
+}
+
+template<typename Pixel>
+static inline void
+StorePixel(uint8_t* aPtr, Pixel aValue)
+{
+  memcpy(aPtr, &aValue, sizeof(aValue));
+}
+
+template<typename Pixel>
+static void
+Transpose_Scalar(const uint8_t* aSrc, int32_t aSrcStride,
+                 uint8_t* aDst, int32_t aDstStride,
+                 uint32_t aX0, uint32_t aX1,
+                 uint32_t aY0, uint32_t aY1)
+{
+  for (uint32_t x = aX0; x < aX1; x++) {
+    const uint8_t* s = aSrc + intptr_t(aY0) * aSrcStride + x * sizeof(Pixel);
+    uint8_t* d = aDst + intptr_t(x) * aDstStride + aY0 * sizeof(Pixel);
+    for (uint32_t y = aY0; y < aY1; y++) {
+      StorePixel<Pixel>(d, LoadPixel<Pixel>(s));
+      s += aSrcStride;
+      d += sizeof(Pixel);
+    }
+  }
+}
+
+template<typename Pixel>
+static void
+Mirror_Scalar(const uint8_t* aSrc, int32_t aSrcStride,
+              uint8_t* aDst, int32_t aDstStride,
+              uint32_t aWidth, uint32_t aHeight)
+{
+  for (uint32_t y = 0; y < aHeight; y++) {
+    const uint8_t* s = aSrc + intptr_t(y) * aSrcStride + (aWidth - 1) * sizeof(Pixel);
+    uint8_t* d = aDst + intptr_t(y) * aDstStride;
+    for (uint32_t x = 0; x < aWidth; x++) {
+      StorePixel<Pixel>(d, LoadPixel<Pixel>(s));
+      s -= sizeof(Pixel);
+      d += sizeof(Pixel);
+    }
+  }
+}
+
+#if defined(HAVE_X86_SIMD)
+
+// Transposes a 4x4 block of pixels.
+static inline TARGET_SSE2 void
+Transpose32Block4x4_SSE2(const uint8_t* aSrc, int32_t aSrcStride,
+                         uint8_t* aDst, int32_t aDstStride)
+{
+  __m128i r0 = _mm_loadu_si128((const __m128i*)(aSrc));
+  __m128i r1 = _mm_loadu_si128((const __m128i*)(aSrc + aSrcStride));
+  __m128i r2 = _mm_loadu_si128((const __m128i*)(aSrc + 2 * aSrcStride));
+  __m128i r3 = _mm_loadu_si128((const __m128i*)(aSrc + 3 * aSrcStride));
+
+  __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+  __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+  __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+  __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+
+  _mm_storeu_si128((__m128i*)(aDst), _mm_unpacklo_epi64(t0, t1));
+  _mm_storeu_si128((__m128i*)(aDst + aDstStride), _mm_unpackhi_epi64(t0, t1));
+  _mm_storeu_si128((__m128i*)(aDst + 2 * aDstStride), _mm_unpacklo_epi64(t2, t3));
+  _mm_storeu_si128((__m128i*)(aDst + 3 * aDstStride), _mm_unpackhi_epi64(t2, t3));
+}
+
+static TARGET_SSE2 void
+Transpose32_SSE2(const uint8_t* aSrc, int32_t aSrcStride,
+                 uint8_t* aDst, int32_t aDstStride,
+                 uint32_t aX0, uint32_t aX1,
+                 uint32_t aY0, uint32_t aY1)
+{
+  const uint32_t x4 = aX0 + ((aX1 - aX0) & ~3);
+  const uint32_t y4 = aY0 + ((aY1 - aY0) & ~3);
+  for (uint32_t x = aX0; x < x4; x += 4) {
+    for (uint32_t y = aY0; y < y4; y += 4) {
+      Transpose32Block4x4_SSE2(aSrc + intptr_t(y) * aSrcStride + x * 4,
+                               aSrcStride,
+                               aDst + intptr_t(x) * aDstStride + y * 4,
+                               aDstStride);
+    }
+  }
+  // Right and bottom edges which don't fill a whole block.
+  Transpose_Scalar<uint32_t>(aSrc, aSrcStride, aDst, aDstStride,
+                             x4, aX1, aY0, aY1);
+  Transpose_Scalar<uint32_t>(aSrc, aSrcStride, aDst, aDstStride,
+                             aX0, x4, y4, aY1);
+}
+
+static TARGET_SSE2 void
+Mirror32_SSE2(const uint8_t* aSrc, int32_t aSrcStride,
+              uint8_t* aDst, int32_t aDstStride,
+              uint32_t aWidth, uint32_t aHeight)
+{
+  const uint32_t w4 = aWidth & ~3;
+  for (uint32_t y = 0; y < aHeight; y++) {
+    const uint8_t* s = aSrc + intptr_t(y) * aSrcStride;
+    uint8_t* d = aDst + intptr_t(y) * aDstStride;
+    uint32_t x = 0;
+    for (; x < w4; x += 4) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(s + (aWidth - x - 4) * 4));
+      _mm_storeu_si128((__m128i*)(d + x * 4),
+                       _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3)));
+    }
+    for (; x < aWidth; x++) {
+      StorePixel<uint32_t>(d + x * 4, LoadPixel<uint32_t>(s + (aWidth - x - 1) * 4));
+    }
+  }
+}
+
+// Transposes an 8x8 block of 8 bit pixels.
+static inline TARGET_SSE2 void
+Transpose8Block8x8_SSE2(const uint8_t* aSrc, int32_t aSrcStride,
+                        uint8_t* aDst, int32_t aDstStride)
+{
+  __m128i r0 = _mm_loadl_epi64((const __m128i*)(aSrc));
+  __m128i r1 = _mm_loadl_epi64((const __m128i*)(aSrc + aSrcStride));
+  __m128i r2 = _mm_loadl_epi64((const __m128i*)(aSrc + 2 * aSrcStride));
+  __m128i r3 = _mm_loadl_epi64((const __m128i*)(aSrc + 3 * aSrcStride));
+  __m128i r4 = _mm_loadl_epi64((const __m128i*)(aSrc + 4 * aSrcStride));
+  __m128i r5 = _mm_loadl_epi64((const __m128i*)(aSrc + 5 * aSrcStride));
+  __m128i r6 = _mm_loadl_epi64((const __m128i*)(aSrc + 6 * aSrcStride));
+  __m128i r7 = _mm_loadl_epi64((const __m128i*)(aSrc + 7 * aSrcStride));
+
+  // Interleave pairs of rows; t0 = a0 b0 a1 b1 ... a7 b7, etc.
+  __m128i t0 = _mm_unpacklo_epi8(r0, r1);
+  __m128i t1 = _mm_unpacklo_epi8(r2, r3);
+  __m128i t2 = _mm_unpacklo_epi8(r4, r5);
+  __m128i t3 = _mm_unpacklo_epi8(r6, r7);
+
+  // Interleave pairs of pairs; u0 = a0 b0 c0 d0 ... a3 b3 c3 d3, etc.
+  __m128i u0 = _mm_unpacklo_epi16(t0, t1);
+  __m128i u1 = _mm_unpackhi_epi16(t0, t1);
+  __m128i u2 = _mm_unpacklo_epi16(t2, t3);
+  __m128i u3 = _mm_unpackhi_epi16(t2, t3);
+
+  // Each of these holds two whole columns.
+  __m128i c01 = _mm_unpacklo_epi32(u0, u2);
+  __m128i c23 = _mm_unpackhi_epi32(u0, u2);
+  __m128i c45 = _mm_unpacklo_epi32(u1, u3);
+  __m128i c67 = _mm_unpackhi_epi32(u1, u3);
+
+  _mm_storel_epi64((__m128i*)(aDst), c01);
+  _mm_storel_epi64((__m128i*)(aDst + aDstStride), _mm_unpackhi_epi64(c01, c01));
+  _mm_storel_epi64((__m128i*)(aDst + 2 * aDstStride), c23);
+  _mm_storel_epi64((__m128i*)(aDst + 3 * aDstStride), _mm_unpackhi_epi64(c23, c23));
+  _mm_storel_epi64((__m128i*)(aDst + 4 * aDstStride), c45);
+  _mm_storel_epi64((__m128i*)(aDst + 5 * aDstStride), _mm_unpackhi_epi64(c45, c45));
+  _mm_storel_epi64((__m128i*)(aDst + 6 * aDstStride), c67);
+  _mm_storel_epi64((__m128i*)(aDst + 7 * aDstStride), _mm_unpackhi_epi64(c67, c67));
+}
+
+// Transposes an 8x8 block of 16 bit pixels.
+static inline TARGET_SSE2 void
+Transpose16Block8x8_SSE2(const uint8_t* aSrc, int32_t aSrcStride,
+                         uint8_t* aDst, int32_t aDstStride)
+{
+  __m128i r0 = _mm_loadu_si128((const __m128i*)(aSrc));
+  __m128i r1 = _mm_loadu_si128((const __m128i*)(aSrc + aSrcStride));
+  __m128i r2 = _mm_loadu_si128((const __m128i*)(aSrc + 2 * aSrcStride));
+  __m128i r3 = _mm_loadu_si128((const __m128i*)(aSrc + 3 * aSrcStride));
+  __m128i r4 = _mm_loadu_si128((const __m128i*)(aSrc + 4 * aSrcStride));
+  __m128i r5 = _mm_loadu_si128((const __m128i*)(aSrc + 5 * aSrcStride));
+  __m128i r6 = _mm_loadu_si128((const __m128i*)(aSrc + 6 * aSrcStride));
+  __m128i r7 = _mm_loadu_si128((const __m128i*)(aSrc + 7 * aSrcStride));
+
+  // Interleave pairs of rows; t0 = a0 b0 a1 b1 a2 b2 a3 b3, etc.
+  __m128i t0 = _mm_unpacklo_epi16(r0, r1);
+  __m128i t1 = _mm_unpackhi_epi16(r0, r1);
+  __m128i t2 = _mm_unpacklo_epi16(r2, r3);
+  __m128i t3 = _mm_unpackhi_epi16(r2, r3);
+  __m128i t4 = _mm_unpacklo_epi16(r4, r5);
+  __m128i t5 = _mm_unpackhi_epi16(r4, r5);
+  __m128i t6 = _mm_unpacklo_epi16(r6, r7);
+  __m128i t7 = _mm_unpackhi_epi16(r6, r7);
+
+  // Interleave pairs of pairs; u0 = a0 b0 c0 d0 a1 b1 c1 d1, etc.
+  __m128i u0 = _mm_unpacklo_epi32(t0, t2);
+  __m128i u1 = _mm_unpackhi_epi32(t0, t2);
+  __m128i u2 = _mm_unpacklo_epi32(t4, t6);
+  __m128i u3 = _mm_unpackhi_epi32(t4, t6);
+  __m128i u4 = _mm_unpacklo_epi32(t1, t3);
+  __m128i u5 = _mm_unpackhi_epi32(t1, t3);
+  __m128i u6 = _mm_unpacklo_epi32(t5, t7);
+  __m128i u7 = _mm_unpackhi_epi32(t5, t7);
+
+  _mm_storeu_si128((__m128i*)(aDst), _mm_unpacklo_epi64(u0, u2));
+  _mm_storeu_si128((__m128i*)(aDst + aDstStride), _mm_unpackhi_epi64(u0, u2));
+  _mm_storeu_si128((__m128i*)(aDst + 2 * aDstStride), _mm_unpacklo_epi64(u1, u3));
+  _mm_storeu_si128((__m128i*)(aDst + 3 * aDstStride), _mm_unpackhi_epi64(u1, u3));
+  _mm_storeu_si128((__m128i*)(aDst + 4 * aDstStride), _mm_unpacklo_epi64(u4, u6));
+  _mm_storeu_si128((__m128i*)(aDst + 5 * aDstStride), _mm_unpackhi_epi64(u4, u6));
+  _mm_storeu_si128((__m128i*)(aDst + 6 * aDstStride), _mm_unpacklo_epi64(u5, u7));
+  _mm_storeu_si128((__m128i*)(aDst + 7 * aDstStride), _mm_unpackhi_epi64(u5, u7));
+}
+
+// Transposes a region of the image in 8x8 blocks of Pixels with aBlock, and
+// finishes the partial blocks on the edges with the scalar code.
+template<typename Pixel>
+static inline TARGET_SSE2 void
+TransposeIn8x8Blocks(void (*aBlock)(const uint8_t*, int32_t, uint8_t*, int32_t),
+                     const uint8_t* aSrc, int32_t aSrcStride,
+                     uint8_t* aDst, int32_t aDstStride,
+                     uint32_t aX0, uint32_t aX1,
+                     uint32_t aY0, uint32_t aY1)
+{
+  const uint32_t x8 = aX0 + ((aX1 - aX0) & ~7);
+  const uint32_t y8 = aY0 + ((aY1 - aY0) & ~7);
+  for (uint32_t x = aX0; x < x8; x += 8) {
+    for (uint32_t y = aY0; y < y8; y += 8) {
+      aBlock(aSrc + intptr_t(y) * aSrcStride + x * sizeof(Pixel),
+             aSrcStride,
+             aDst + intptr_t(x) * aDstStride + y * sizeof(Pixel),
+             aDstStride);
+    }
+  }
+  Transpose_Scalar<Pixel>(aSrc, aSrcStride, aDst, aDstStride,
+                          x8, aX1, aY0, aY1);
+  Transpose_Scalar<Pixel>(aSrc, aSrcStride, aDst, aDstStride,
+                          aX0, x8, y8, aY1);
+}
+
+static TARGET_SSE2 void
+Transpose8_SSE2(const uint8_t* aSrc, int32_t aSrcStride,
+                uint8_t* aDst, int32_t aDstStride,
+                uint32_t aX0, uint32_t aX1,
+                uint32_t aY0, uint32_t aY1)
+{
+  TransposeIn8x8Blocks<uint8_t>(Transpose8Block8x8_SSE2,
+                                aSrc, aSrcStride, aDst, aDstStride,
+                                aX0, aX1, aY0, aY1);
+}
+
+static TARGET_SSE2 void
+Transpose16_SSE2(const uint8_t* aSrc, int32_t aSrcStride,
+                 uint8_t* aDst, int32_t aDstStride,
+                 uint32_t aX0, uint32_t aX1,
+                 uint32_t aY0, uint32_t aY1)
+{
+  TransposeIn8x8Blocks<uint16_t>(Transpose16Block8x8_SSE2,
+                                 aSrc, aSrcStride, aDst, aDstStride,
+                                 aX0, aX1, aY0, aY1);
+}
+
+// Reverses the order of the 16 bit lanes of aValue.
+static inline TARGET_SSE2 __m128i
+Reverse16_SSE2(__m128i aValue)
+{
+  aValue = _mm_shuffle_epi32(aValue, _MM_SHUFFLE(1, 0, 3, 2));
+  aValue = _mm_shufflelo_epi16(aValue, _MM_SHUFFLE(0, 1, 2, 3));
+  return _mm_shufflehi_epi16(aValue, _MM_SHUFFLE(0, 1, 2, 3));
+}
+
+static TARGET_SSE2 void
+Mirror16_SSE2(const uint8_t* aSrc, int32_t aSrcStride,
+              uint8_t* aDst, int32_t aDstStride,
+              uint32_t aWidth, uint32_t aHeight)
+{
+  const uint32_t w8 = aWidth & ~7;
+  for (uint32_t y = 0; y < aHeight; y++) {
+    const uint8_t* s = aSrc + intptr_t(y) * aSrcStride;
+    uint8_t* d = aDst + intptr_t(y) * aDstStride;
+    uint32_t x = 0;
+    for (; x < w8; x += 8) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(s + (aWidth - x - 8) * 2));
+      _mm_storeu_si128((__m128i*)(d + x * 2), Reverse16_SSE2(v));
+    }
+    for (; x < aWidth; x++) {
+      StorePixel<uint16_t>(d + x * 2, LoadPixel<uint16_t>(s + (aWidth - x - 1) * 2));
+    }
+  }
+}
+
+static TARGET_SSE2 void
+Mirror8_SSE2(const uint8_t* aSrc, int32_t aSrcStride,
+             uint8_t* aDst, int32_t aDstStride,
+             uint32_t aWidth, uint32_t aHeight)
+{
+  const uint32_t w16 = aWidth & ~15;
+  for (uint32_t y = 0; y < aHeight; y++) {
+    const uint8_t* s = aSrc + intptr_t(y) * aSrcStride;
+    uint8_t* d = aDst + intptr_t(y) * aDstStride;
+    uint32_t x = 0;
+    for (; x < w16; x += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(s + aWidth - x - 16));
+      // Swap the bytes in each 16 bit lane, then reverse the lanes. SSE2
+      // has no byte shuffle.
+      v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+      _mm_storeu_si128((__m128i*)(d + x), Reverse16_SSE2(v));
+    }
+    for (; x < aWidth; x++) {
+      d[x] = s[aWidth - x - 1];
+    }
+  }
+}
+
+// Transposes an 8x8 block of pixels.
+static inline TARGET_AVX2 void
+Transpose32Block8x8_AVX2(const uint8_t* aSrc, int32_t aSrcStride,
+                         uint8_t* aDst, int32_t aDstStride)
+{
+  __m256i r0 = _mm256_loadu_si256((const __m256i*)(aSrc));
+  __m256i r1 = _mm256_loadu_si256((const __m256i*)(aSrc + aSrcStride));
+  __m256i r2 = _mm256_loadu_si256((const __m256i*)(aSrc + 2 * aSrcStride));
+  __m256i r3 = _mm256_loadu_si256((const __m256i*)(aSrc + 3 * aSrcStride));
+  __m256i r4 = _mm256_loadu_si256((const __m256i*)(aSrc + 4 * aSrcStride));
+  __m256i r5 = _mm256_loadu_si256((const __m256i*)(aSrc + 5 * aSrcStride));
+  __m256i r6 = _mm256_loadu_si256((const __m256i*)(aSrc + 6 * aSrcStride));
+  __m256i r7 = _mm256_loadu_si256((const __m256i*)(aSrc + 7 * aSrcStride));
+
+  // Interleave pairs of rows; t0 = a0 b0 a1 b1 | a4 b4 a5 b5, etc.
+  __m256i t0 = _mm256_unpacklo_epi32(r0, r1);
+  __m256i t1 = _mm256_unpackhi_epi32(r0, r1);
+  __m256i t2 = _mm256_unpacklo_epi32(r2, r3);
+  __m256i t3 = _mm256_unpackhi_epi32(r2, r3);
+  __m256i t4 = _mm256_unpacklo_epi32(r4, r5);
+  __m256i t5 = _mm256_unpackhi_epi32(r4, r5);
+  __m256i t6 = _mm256_unpacklo_epi32(r6, r7);
+  __m256i t7 = _mm256_unpackhi_epi32(r6, r7);
+
+  // Interleave pairs of pairs; u0 = a0 b0 c0 d0 | a4 b4 c4 d4, etc.
+  __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+  __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+  __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+  __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+  __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+  __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+  __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+  __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+  // Combine the 128 bit lanes.
+  _mm256_storeu_si256((__m256i*)(aDst), _mm256_permute2x128_si256(u0, u4, 0x20));
+  _mm256_storeu_si256((__m256i*)(aDst + aDstStride), _mm256_permute2x128_si256(u1, u5, 0x20));
+  _mm256_storeu_si256((__m256i*)(aDst + 2 * aDstStride), _mm256_permute2x128_si256(u2, u6, 0x20));
+  _mm256_storeu_si256((__m256i*)(aDst + 3 * aDstStride), _mm256_permute2x128_si256(u3, u7, 0x20));
+  _mm256_storeu_si256((__m256i*)(aDst + 4 * aDstStride), _mm256_permute2x128_si256(u0, u4, 0x31));
+  _mm256_storeu_si256((__m256i*)(aDst + 5 * aDstStride), _mm256_permute2x128_si256(u1, u5, 0x31));
+  _mm256_storeu_si256((__m256i*)(aDst + 6 * aDstStride), _mm256_permute2x128_si256(u2, u6, 0x31));
+  _mm256_storeu_si256((__m256i*)(aDst + 7 * aDstStride), _mm256_permute2x128_si256(u3, u7, 0x31));
+}
+
+static TARGET_AVX2 void
+Transpose32_AVX2(const uint8_t* aSrc, int32_t aSrcStride,
+                 uint8_t* aDst, int32_t aDstStride,
+                 uint32_t aX0, uint32_t aX1,
+                 uint32_t aY0, uint32_t aY1)
+{
+  const uint32_t x8 = aX0 + ((aX1 - aX0) & ~7);
+  const uint32_t y8 = aY0 + ((aY1 - aY0) & ~7);
+  for (uint32_t x = aX0; x < x8; x += 8) {
+    for (uint32_t y = aY0; y < y8; y += 8) {
+      Transpose32Block8x8_AVX2(aSrc + intptr_t(y) * aSrcStride + x * 4,
+                               aSrcStride,
+                               aDst + intptr_t(x) * aDstStride + y * 4,
+                               aDstStride);
+    }
+  }
+  // Right and bottom edges which don't fill a whole block.
+  Transpose_Scalar<uint32_t>(aSrc, aSrcStride, aDst, aDstStride,
+                             x8, aX1, aY0, aY1);
+  Transpose_Scalar<uint32_t>(aSrc, aSrcStride, aDst, aDstStride,
+                             aX0, x8, y8, aY1);
+}
+
+static TARGET_AVX2 void
+Mirror32_AVX2(const uint8_t* aSrc, int32_t aSrcStride,
+              uint8_t* aDst, int32_t aDstStride,
+              uint32_t aWidth, uint32_t aHeight)
+{
+  const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+  const uint32_t w8 = aWidth & ~7;
+  for (uint32_t y = 0; y < aHeight; y++) {
+    const uint8_t* s = aSrc + intptr_t(y) * aSrcStride;
+    uint8_t* d = aDst + intptr_t(y) * aDstStride;
+    uint32_t x = 0;
+    for (; x < w8; x += 8) {
+      __m256i v = _mm256_loadu_si256((const __m256i*)(s + (aWidth - x - 8) * 4));
+      _mm256_storeu_si256((__m256i*)(d + x * 4),
+                          _mm256_permutevar8x32_epi32(v, reverse));
+    }
+    for (; x < aWidth; x++) {
+      StorePixel<uint32_t>(d + x * 4, LoadPixel<uint32_t>(s + (aWidth - x - 1) * 4));
+    }
+  }
+}
+
+#endif // HAVE_X86_SIMD
+
+// Transposes the aWidth x aHeight source into the aHeight x aWidth dest, one
+// tile at a time.
+static void
+TransposeTiled(TransposeFn aTranspose,
+               const RotateTileShape& aTile,
+               const uint8_t* aSrc, int32_t aSrcStride,
+               uint8_t* aDst, int32_t aDstStride,
+               uint32_t aWidth, uint32_t aHeight)
+{
+  if (!aTile.width || !aTile.height) {
+    aTranspose(aSrc, aSrcStride, aDst, aDstStride, 0, aWidth, 0, aHeight);
+    return;
+  }
+  // Walk down each column of tiles in turn, so that consecutive tiles carry
+  // on writing the same destination rows.
+  for (uint32_t x = 0; x < aWidth; x += aTile.width) {
+    const uint32_t x1 = std::min(x + aTile.width, aWidth);
+    for (uint32_t y = 0; y < aHeight; y += aTile.height) {
+      const uint32_t y1 = std::min(y + aTile.height, aHeight);
+      aTranspose(aSrc, aSrcStride, aDst, aDstStride, x, x1, y, y1);
+    }
+  }
+}
+
+RotateKernel
+GetBestRotateKernel()
+{
+  if (HasCpuFeature(CPU_FEATURE_AVX2)) {
+    return RotateKernel_AVX2;
+  }
+  if (HasCpuFeature(CPU_FEATURE_SSE2)) {
+    return RotateKernel_SSE2;
+  }
+  return RotateKernel_Scalar;
+}
+
+bool
+IsRotateKernelSupported(RotateKernel aKernel)
+{
+  switch (aKernel) {
+    case RotateKernel_Auto:
+    case RotateKernel_Scalar:
+      return true;
+    case RotateKernel_SSE2:
+      return HasCpuFeature(CPU_FEATURE_SSE2);
+    case RotateKernel_AVX2:
+      return HasCpuFeature(CPU_FEATURE_AVX2);
+  }
+  return false;
+}
+
+const char*
+GetRotateKernelName(RotateKernel aKernel)
+{
+  switch (aKernel) {
+    case RotateKernel_Auto: return "auto";
+    case RotateKernel_Scalar: return "scalar";
+    case RotateKernel_SSE2: return "SSE2";
+    case RotateKernel_AVX2: return "AVX2";
+  }
+  return "?";
+}
+
+// Returns false if aBytesPerPixel isn't 1, 2 or 4.
+static bool
+GetKernels(RotateKernel aKernel,
+           uint32_t aBytesPerPixel,
+           TransposeFn* aOutTranspose,
+           MirrorFn* aOutMirror)
+{
+  if (aKernel == RotateKernel_Auto) {
+    aKernel = GetBestRotateKernel();
+  }
+  switch (aBytesPerPixel) {
+    case 1:
+      *aOutTranspose = Transpose_Scalar<uint8_t>;
+      *aOutMirror = Mirror_Scalar<uint8_t>;
+#if defined(HAVE_X86_SIMD)
+      // There are no AVX2 kernels for 8 and 16 bit pixels; the planes are
+      // small enough that the SSE2 kernels are memory bound.
+      if (aKernel == RotateKernel_SSE2 || aKernel == RotateKernel_AVX2) {
+        *aOutTranspose = Transpose8_SSE2;
+        *aOutMirror = Mirror8_SSE2;
+      }
+#endif
+      return true;
+    case 2:
+      *aOutTranspose = Transpose_Scalar<uint16_t>;
+      *aOutMirror = Mirror_Scalar<uint16_t>;
+#if defined(HAVE_X86_SIMD)
+      if (aKernel == RotateKernel_SSE2 || aKernel == RotateKernel_AVX2) {
+        *aOutTranspose = Transpose16_SSE2;
+        *aOutMirror = Mirror16_SSE2;
+      }
+#endif
+      return true;
+    case 4:
+      *aOutTranspose = Transpose_Scalar<uint32_t>;
+      *aOutMirror = Mirror_Scalar<uint32_t>;
+#if defined(HAVE_X86_SIMD)
+      if (aKernel == RotateKernel_SSE2) {
+        *aOutTranspose = Transpose32_SSE2;
+        *aOutMirror = Mirror32_SSE2;
+      } else if (aKernel == RotateKernel_AVX2) {
+        *aOutTranspose = Transpose32_AVX2;
+        *aOutMirror = Mirror32_AVX2;
+      }
+#endif
+      return true;
+  }
+  return false;
+}
+
+// Returns a plane which addresses the same pixels as aPlane, but with the
+// rows in reverse order.
+static ImagePlane
+FlipVertically(const ImagePlane& aPlane)
+{
+  ImagePlane flipped = aPlane;
+  flipped.data = aPlane.data + intptr_t(aPlane.height - 1) * aPlane.stride;
+  flipped.stride = -aPlane.stride;
+  return flipped;
+}
+
+// Returns true if aDst has the dimensions of aSrc rotated by aRotation.
+static bool
+HaveRotatedDimensions(Rotation aRotation,
+                      const ImagePlane& aSrc,
+                      const ImagePlane& aDst)
+{
+  const bool swapsDimensions = (aRotation == ROTATE_90 || aRotation == ROTATE_270);
+  const uint32_t dstWidth = swapsDimensions ? aSrc.height : aSrc.width;
+  const uint32_t dstHeight = swapsDimensions ? aSrc.width : aSrc.height;
+  return aDst.width == dstWidth && aDst.height == dstHeight;
+}
+
+bool
+RotatePlane(Rotation aRotation,
+            const ImagePlane& aSrc,
+            const ImagePlane& aDst,
+            uint32_t aBytesPerPixel,
+            RotateKernel aKernel,
+            RotateTileShape aTile)
+{
+  if (!aSrc.data || !aDst.data || !IsRotateKernelSupported(aKernel)) {
+    return false;
+  }
+  if (!HaveRotatedDimensions(aRotation, aSrc, aDst)) {
+    return false;
+  }
+  if (aSrc.width == 0 || aSrc.height == 0) {
+    return true;
+  }
+
+  TransposeFn transpose = nullptr;
+  MirrorFn mirror = nullptr;
+  if (!GetKernels(aKernel, aBytesPerPixel, &transpose, &mirror)) {
+    return false;
+  }
+
+  // The tile shape is tuned for 32 bit pixels. Scale it for smaller pixels,
+  // so that the tile rows span the same number of bytes.
+  aTile.width = aTile.width * 4 / aBytesPerPixel;
+  aTile.height = aTile.height * 4 / aBytesPerPixel;
+
+  switch (aRotation) {
+    case ROTATE_0: {
+      for (uint32_t y = 0; y < aSrc.height; y++) {
+        memcpy(aDst.data + intptr_t(y) * aDst.stride,
+               aSrc.data + intptr_t(y) * aSrc.stride,
+               aSrc.width * aBytesPerPixel);
+      }
+      return true;
+    }
+    case ROTATE_90: {
+      ImagePlane src = FlipVertically(aSrc);
+      TransposeTiled(transpose, aTile,
+                     src.data, src.stride, aDst.data, aDst.stride,
+                     src.width, src.height);
+      return true;
+    }
+    case ROTATE_180: {
+      ImagePlane src = FlipVertically(aSrc);
+      mirror(src.data, src.stride, aDst.data, aDst.stride,
+             src.width, src.height);
+      return true;
+    }
+    case ROTATE_270: {
+      ImagePlane dst = FlipVertically(aDst);
+      TransposeTiled(transpose, aTile,
+                     aSrc.data, aSrc.stride, dst.data, dst.stride,
+                     aSrc.width, aSrc.height);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool
+RotatePlaneBand(Rotation aRotation,
+                const ImagePlane& aSrc,
+                const ImagePlane& aDst,
+                uint32_t aBytesPerPixel,
+                uint32_t aDstY0,
+                uint32_t aDstY1,
+                RotateKernel aKernel,
+                RotateTileShape aTile)
+{
+  if (!HaveRotatedDimensions(aRotation, aSrc, aDst) ||
+      aDstY0 > aDstY1 || aDstY1 > aDst.height) {
+    return false;
+  }
+  const uint32_t numRows = aDstY1 - aDstY0;
+
+  ImagePlane dst = aDst;
+  dst.data += intptr_t(aDstY0) * aDst.stride;
+  dst.height = numRows;
+
+  // Find the part of the source which the band is rotated from. See the
+  // mapping at the top of this file.
+  ImagePlane src = aSrc;
+  switch (aRotation) {
+    case ROTATE_0:
+      src.data += intptr_t(aDstY0) * aSrc.stride;
+      src.height = numRows;
+      break;
+    case ROTATE_90:
+      src.data += aDstY0 * aBytesPerPixel;
+      src.width = numRows;
+      break;
+    case ROTATE_180:
+      src.data += intptr_t(aSrc.height - aDstY1) * aSrc.stride;
+      src.height = numRows;
+      break;
+    case ROTATE_270:
+      src.data += (aSrc.width - aDstY1) * aBytesPerPixel;
+      src.width = numRows;
+      break;
+  }
+  return RotatePlane(aRotation, src, dst, aBytesPerPixel, aKernel, aTile);
+}
+
+uint32_t
+GetNumPlanes(PixelFormat aFormat)
+{
+  switch (aFormat) {
+    case PixelFormat_RGB32: return 1;
+    case PixelFormat_NV12: return 2;
+    case PixelFormat_I420: return 3;
+  }
+  return 0;
+}
+
+const char*
+GetPixelFormatName(PixelFormat aFormat)
+{
+  switch (aFormat) {
+    case PixelFormat_RGB32: return "RGB32";
+    case PixelFormat_NV12: return "NV12";
+    case PixelFormat_I420: return "I420";
+  }
+  return "?";
+}
+
+uint32_t
+GetBytesPerPixel(PixelFormat aFormat, uint32_t aPlane)
+{
+  switch (aFormat) {
+    case PixelFormat_RGB32: return 4;
+    case PixelFormat_NV12: return aPlane == 0 ? 1 : 2;
+    case PixelFormat_I420: return 1;
+  }
+  return 0;
+}
+
+size_t
+GetImageBufferSize(PixelFormat aFormat,
+                   int32_t aStride,
+                   uint32_t aBufferHeight)
+{
+  const size_t pitch = size_t(aStride < 0 ? -aStride : aStride);
+  const size_t lumaSize = pitch * aBufferHeight;
+  const size_t chromaRows = (aBufferHeight + 1) / 2;
+  switch (aFormat) {
+    case PixelFormat_RGB32: return lumaSize;
+    case PixelFormat_NV12: return lumaSize + pitch * chromaRows;
+    case PixelFormat_I420: return lumaSize + 2 * (pitch / 2) * chromaRows;
+  }
+  return 0;
+}
+
+bool
+GetImageLayout(PixelFormat aFormat,
+               uint8_t* aData,
+               size_t aLength,
+               int32_t aStride,
+               uint32_t aBufferHeight,
+               uint32_t aWidth,
+               uint32_t aHeight,
+               Image* aOutImage)
+{
+  if (!aData || !aOutImage || aHeight > aBufferHeight ||
+      GetImageBufferSize(aFormat, aStride, aBufferHeight) > aLength) {
+    return false;
+  }
+  // Planar images are never bottom-up.
+  if (aStride < 0 && aFormat != PixelFormat_RGB32) {
+    return false;
+  }
+  const size_t pitch = size_t(aStride < 0 ? -aStride : aStride);
+  if (pitch < size_t(aWidth) * GetBytesPerPixel(aFormat, 0)) {
+    return false;
+  }
+  aOutImage->format = aFormat;
+
+  ImagePlane& luma = aOutImage->planes[0];
+  luma.data = (aStride < 0) ? aData + (aBufferHeight - 1) * pitch : aData;
+  luma.stride = aStride;
+  luma.width = aWidth;
+  luma.height = aHeight;
+
+  uint8_t* chromaData = aData + pitch * aBufferHeight;
+  const size_t chromaPitch = (aFormat == PixelFormat_I420) ? pitch / 2 : pitch;
+  const uint32_t chromaWidth = (aWidth + 1) / 2;
+  for (uint32_t i = 1; i < GetNumPlanes(aFormat); i++) {
+    if (chromaPitch < size_t(chromaWidth) * GetBytesPerPixel(aFormat, i)) {
+      return false;
+    }
+    ImagePlane& chroma = aOutImage->planes[i];
+    chroma.data = chromaData;
+    chroma.stride = int32_t(chromaPitch);
+    chroma.width = chromaWidth;
+    chroma.height = (aHeight + 1) / 2;
+    chromaData += chromaPitch * ((aBufferHeight + 1) / 2);
+  }
+  return true;
+}
+
+bool
+CropImage(const Image& aImage,
+          uint32_t aX,
+          uint32_t aY,
+          uint32_t aWidth,
+          uint32_t aHeight,
+          Image* aOutImage)
+{
+  const ImagePlane& luma = aImage.planes[0];
+  if (!aOutImage || aX > luma.width || aWidth > luma.width - aX ||
+      aY > luma.height || aHeight > luma.height - aY) {
+    return false;
+  }
+  const bool subsampled = GetNumPlanes(aImage.format) > 1;
+  if (subsampled && ((aX | aY) & 1)) {
+    return false;
+  }
+  aOutImage->format = aImage.format;
+  for (uint32_t i = 0; i < GetNumPlanes(aImage.format); i++) {
+    const uint32_t shift = (i > 0) ? 1 : 0;
+    const ImagePlane& in = aImage.planes[i];
+    ImagePlane& out = aOutImage->planes[i];
+    out.data = in.data + ptrdiff_t(aY >> shift) * in.stride +
+               (aX >> shift) * GetBytesPerPixel(aImage.format, i);
+    out.stride = in.stride;
+    out.width = (aWidth + shift) >> shift;
+    out.height = (aHeight + shift) >> shift;
+  }
+  return true;
+}
+
+// Sets each aDst[i] to a rounded blend of aNear[i] and aFar[i], with aFar
+// weighted by 1/4 or, if aHalf, 1/2. aDst may be aNear.
+static void
+BlendRow_Scalar(uint8_t* aDst, const uint8_t* aNear, const uint8_t* aFar,
+                uint32_t aCount, bool aHalf)
+{
+  if (aHalf) {
+    for (uint32_t i = 0; i < aCount; i++) {
+      aDst[i] = uint8_t((aNear[i] + aFar[i] + 1) >> 1);
+    }
+  } else {
+    for (uint32_t i = 0; i < aCount; i++) {
+      aDst[i] = uint8_t((3 * aNear[i] + aFar[i] + 2) >> 2);
+    }
+  }
+}
+
+#if defined(HAVE_X86_SIMD)
+static TARGET_SSE2 void
+BlendRow_SSE2(uint8_t* aDst, const uint8_t* aNear, const uint8_t* aFar,
+              uint32_t aCount, bool aHalf)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i two = _mm_set1_epi16(2);
+  const uint32_t n16 = aCount & ~15;
+  for (uint32_t i = 0; i < n16; i += 16) {
+    __m128i n = _mm_loadu_si128((const __m128i*)(aNear + i));
+    __m128i f = _mm_loadu_si128((const __m128i*)(aFar + i));
+    __m128i blend;
+    if (aHalf) {
+      blend = _mm_avg_epu8(n, f);
+    } else {
+      // (3 * near + far + 2) >> 2, in 16 bits.
+      __m128i nlo = _mm_unpacklo_epi8(n, zero);
+      __m128i nhi = _mm_unpackhi_epi8(n, zero);
+      __m128i lo = _mm_add_epi16(_mm_add_epi16(nlo, _mm_add_epi16(nlo, nlo)),
+                                 _mm_add_epi16(_mm_unpacklo_epi8(f, zero), two));
+      __m128i hi = _mm_add_epi16(_mm_add_epi16(nhi, _mm_add_epi16(nhi, nhi)),
+                                 _mm_add_epi16(_mm_unpackhi_epi8(f, zero), two));
+      blend = _mm_packus_epi16(_mm_srli_epi16(lo, 2), _mm_srli_epi16(hi, 2));
+    }
+    _mm_storeu_si128((__m128i*)(aDst + i), blend);
+  }
+  BlendRow_Scalar(aDst + n16, aNear + n16, aFar + n16, aCount - n16, aHalf);
+}
+#endif
+
+static void
+BlendRow(uint8_t* aDst, const uint8_t* aNear, const uint8_t* aFar,
+         uint32_t aCount, bool aHalf)
+{
+#if defined(HAVE_X86_SIMD)
+  if (HasCpuFeature(CPU_FEATURE_SSE2)) {
+    BlendRow_SSE2(aDst, aNear, aFar, aCount, aHalf);
+    return;
+  }
+#endif
+  BlendRow_Scalar(aDst, aNear, aFar, aCount, aHalf);
+}
+
+// Shifts every row of aPlane horizontally by aShift quarter samples, which
+// is in [-2,2], with samples beyond the ends clamped to the ends. Each
+// component of interleaved planes is shifted separately.
+static void
+ShiftPlaneHorizontally(const ImagePlane& aPlane,
+                       uint32_t aBytesPerPixel,
+                       int aShift)
+{
+  if (aPlane.width < 2 || aShift == 0) {
+    return;
+  }
+  const bool half = (aShift == 2 || aShift == -2);
+  const uint32_t rowBytes = aPlane.width * aBytesPerPixel;
+  const uint32_t count = rowBytes - aBytesPerPixel;
+  // Each row is copied out first, so that we can shift it in place. Rows of
+  // up to 8K video's chroma fit on the stack, so that resiting doesn't
+  // allocate for every frame.
+  uint8_t stackCopy[8192];
+  std::vector<uint8_t> heapCopy;
+  uint8_t* copy = stackCopy;
+  if (rowBytes > sizeof(stackCopy)) {
+    heapCopy.resize(rowBytes);
+    copy = &heapCopy[0];
+  }
+  const uint8_t* c = copy;
+  for (uint32_t y = 0; y < aPlane.height; y++) {
+    uint8_t* row = aPlane.data + intptr_t(y) * aPlane.stride;
+    memcpy(copy, row, rowBytes);
+    if (aShift > 0) {
+      BlendRow(row, c, c + aBytesPerPixel, count, half);
+    } else {
+      BlendRow(row + aBytesPerPixel, c + aBytesPerPixel, c, count, half);
+    }
+  }
+}
+
+// Shifts every column of aPlane vertically by aShift quarter samples, in
+// place. This works away from the neighbouring row it reads, so that it's
+// not yet overwritten.
+static void
+ShiftPlaneVertically(const ImagePlane& aPlane,
+                     uint32_t aBytesPerPixel,
+                     int aShift)
+{
+  if (aPlane.height < 2 || aShift == 0) {
+    return;
+  }
+  const bool half = (aShift == 2 || aShift == -2);
+  const uint32_t rowBytes = aPlane.width * aBytesPerPixel;
+  const intptr_t stride = aPlane.stride;
+  if (aShift > 0) {
+    for (uint32_t y = 0; y + 1 < aPlane.height; y++) {
+      uint8_t* row = aPlane.data + intptr_t(y) * stride;
+      BlendRow(row, row, row + stride, rowBytes, half);
+    }
+  } else {
+    for (uint32_t y = aPlane.height - 1; y > 0; y--) {
+      uint8_t* row = aPlane.data + intptr_t(y) * stride;
+      BlendRow(row, row, row - stride, rowBytes, half);
+    }
+  }
+}
+
+// Positions of chroma samples along an axis are measured in half luma
+// samples from the chroma sample's "own" even luma sample; cosited chroma
+// is at 0, and centered chroma is at 1.
+static int
+GetSitingOffset(ChromaSiting aSiting)
+{
+  return aSiting == ChromaSiting_Centered ? 1 : 0;
+}
+
+// Returns where chroma at aOffset ends up after an axis of aLumaLength luma
+// samples is reversed. With an even length, the last luma sample is odd, so
+// cosited chroma ends up on the odd samples.
+static int
+GetReversedSitingOffset(int aOffset, uint32_t aLumaLength)
+{
+  return (aLumaLength % 2 == 0) ? 2 - aOffset : -aOffset;
+}
+
+void
+ResiteRotatedChroma(Rotation aRotation,
+                    const ImagePlane& aChroma,
+                    uint32_t aBytesPerPixel,
+                    uint32_t aSrcLumaWidth,
+                    uint32_t aSrcLumaHeight,
+                    ChromaSiting aHorizontal,
+                    ChromaSiting aVertical)
+{
+  const int wantX = GetSitingOffset(aHorizontal);
+  const int wantY = GetSitingOffset(aVertical);
+  int haveX = wantX;
+  int haveY = wantY;
+  // See the mapping at the top of this file for which source axis ends up
+  // on which destination axis, and which are reversed.
+  switch (aRotation) {
+    case ROTATE_0:
+      break;
+    case ROTATE_90:
+      haveX = GetReversedSitingOffset(wantY, aSrcLumaHeight);
+      haveY = wantX;
+      break;
+    case ROTATE_180:
+      haveX = GetReversedSitingOffset(wantX, aSrcLumaWidth);
+      haveY = GetReversedSitingOffset(wantY, aSrcLumaHeight);
+      break;
+    case ROTATE_270:
+      haveX = wantY;
+      haveY = GetReversedSitingOffset(wantX, aSrcLumaWidth);
+      break;
+  }
+  // A chroma sample spans two luma samples, so a difference of one half
+  // luma sample is a quarter of a chroma sample.
+  ShiftPlaneHorizontally(aChroma, aBytesPerPixel, wantX - haveX);
+  ShiftPlaneVertically(aChroma, aBytesPerPixel, wantY - haveY);
+}
+
+bool
+RotateImage(Rotation aRotation,
+            const Image& aSrc,
+            const Image& aDst,
+            ChromaSiting aHorizontal,
+            ChromaSiting aVertical,
+            RotateKernel aKernel,
+            RotateTileShape aTile)
+{
+  if (aSrc.format != aDst.format) {
+    return false;
+  }
+  for (uint32_t i = 0; i < GetNumPlanes(aSrc.format); i++) {
+    const uint32_t bytesPerPixel = GetBytesPerPixel(aSrc.format, i);
+    if (!RotatePlane(aRotation, aSrc.planes[i], aDst.planes[i],
+                     bytesPerPixel, aKernel, aTile)) {
+      return false;
+    }
+    if (i > 0) {
+      ResiteRotatedChroma(aRotation, aDst.planes[i], bytesPerPixel,
+                          aSrc.planes[0].width, aSrc.planes[0].height,
+                          aHorizontal, aVertical);
+    }
+  }
+  return true;
+}
+
+RotateTileShape
+AutotuneRotateTileShape(RotateKernel aKernel)
+{
+  // Tile dimensions are multiples of the largest SIMD block size, so that
+  // only the tiles on the right and bottom edges have partial blocks. The
+  // first, untiled, is what we keep unless another shape beats it.
+  static const RotateTileShape candidates[] = {
+    RotateTileShape(),
+    RotateTileShape(16, 16),
+    RotateTileShape(32, 32),
+    RotateTileShape(64, 64),
+    RotateTileShape(128, 128),
+    RotateTileShape(32, 64),
+    RotateTileShape(64, 32),
+    RotateTileShape(16, 128),
+    RotateTileShape(128, 16)
+  };
+  static const size_t NumCandidates = sizeof(candidates) / sizeof(candidates[0]);
+  // The planes of 1080p and 4K frames in each format we rotate: RGB32, and
+  // the luma and chroma of NV12 and I420. A shape which suits a frame which
+  // fits in the cache can be slower on one which doesn't, and RotatePlane()
+  // scales the shape for smaller pixels.
+  struct Plane {
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytesPerPixel;
+  };
+  static const Plane planes[] = {
+    // RGB32.
+    { 1920, 1080, 4 },
+    { 3840, 2160, 4 },
+    // Luma, and 4K I420 chroma.
+    { 1920, 1080, 1 },
+    { 3840, 2160, 1 },
+    // NV12 chroma.
+    { 960, 540, 2 },
+    { 1920, 1080, 2 },
+    // 1080p I420 chroma.
+    { 960, 540, 1 }
+  };
+  static const size_t NumPlanes = sizeof(planes) / sizeof(planes[0]);
+  static const uint32_t NumRuns = 3;
+
+  std::vector<uint8_t> srcPixels(3840 * 2160 * 4, 0x80);
+  std::vector<uint8_t> dstPixels(3840 * 2160 * 4);
+
+  // Each candidate's time on each plane, relative to untiled.
+  double ratios[NumCandidates][NumPlanes];
+  for (size_t p = 0; p < NumPlanes; p++) {
+    const Plane& plane = planes[p];
+    ImagePlane src = { &srcPixels[0], int32_t(plane.width * plane.bytesPerPixel),
+                       plane.width, plane.height };
+    ImagePlane dst = { &dstPixels[0], int32_t(plane.height * plane.bytesPerPixel),
+                       plane.height, plane.width };
+    uint64_t untiledTime = 1;
+    for (size_t i = 0; i < NumCandidates; i++) {
+      const RotateTileShape& tile = candidates[i];
+      // Warm up, so that the first candidate doesn't pay for faulting in
+      // the pages.
+      RotatePlane(ROTATE_90, src, dst, plane.bytesPerPixel, aKernel, tile);
+      // Take the fastest run, as that's the one with the least interference
+      // from other processes. 90 and 270 degree rotations walk the frame in
+      // opposite directions, so time both.
+      uint64_t fastest = UINT64_MAX;
+      for (uint32_t run = 0; run < NumRuns; run++) {
+        uint64_t start = GetHighResTimeUs();
+        RotatePlane(ROTATE_90, src, dst, plane.bytesPerPixel, aKernel, tile);
+        RotatePlane(ROTATE_270, src, dst, plane.bytesPerPixel, aKernel, tile);
+        fastest = std::min(fastest, GetHighResTimeUs() - start);
+      }
+      fastest = std::max<uint64_t>(fastest, 1);
+      if (i == 0) {
+        untiledTime = fastest;
+      }
+      ratios[i][p] = double(fastest) / double(untiledTime);
+    }
+  }
+
+  // Take the shape which is fastest over all the planes, as long as it's
+  // faster than untiled on every one of them.
+  size_t best = 0;
+  double bestTotal = double(NumPlanes);
+  for (size_t i = 1; i < NumCandidates; i++) {
+    double total = 0.0;
+    bool winsEverywhere = true;
+    for (size_t p = 0; p < NumPlanes; p++) {
+      total += ratios[i][p];
+      winsEverywhere = winsEverywhere && ratios[i][p] < 1.0;
+    }
+    if (winsEverywhere && total < bestTotal) {
+      bestTotal = total;
+      best = i;
+    }
+  }
+  return candidates[best];
+}
@@ -0,0 +1,197 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Kernels which rotate images in plain memory by exact multiples of 90
+// degrees. Pixels are moved, not interpolated, so the output is bit exact,
+// except for chroma planes which need resiting; see ResiteRotatedChroma().
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Rotation.h"
+
+// A 2D array of pixels in plain memory. |data| points to the first byte of
+// the top row of the image, and |stride| is the signed distance in bytes from
+// the start of one row to the start of the next. Bottom-up images have a
+// negative stride.
+struct ImagePlane {
+  uint8_t* data;
+  int32_t stride;
+  uint32_t width;
+  uint32_t height;
+};
+
+// The size of the tiles, in source pixels, that the transposes behind 90 and
+// 270 degree rotations work through one at a time. A naive transpose writes
+// one destination column per source row, which for a large frame touches a
+// new cache line and often a new page for every pixel. Working tile by tile
+// keeps the rows being read and written resident in the cache. A zero width
+// or height means the transpose is done untiled, in one pass.
+struct RotateTileShape {
+  RotateTileShape() : width(0), height(0) {}
+  RotateTileShape(uint32_t aWidth, uint32_t aHeight)
+    : width(aWidth), height(aHeight) {}
+  uint32_t width;
+  uint32_t height;
+};
+
+// The implementations of the kernels. RotateKernel_Auto picks the fastest
+// one supported by the CPU we're running on.
+enum RotateKernel {
+  RotateKernel_Auto,
+  RotateKernel_Scalar,
+  RotateKernel_SSE2,
+  RotateKernel_AVX2
+};
+
+// Returns the kernel which RotateKernel_Auto resolves to on this CPU.
+RotateKernel GetBestRotateKernel();
+
+// Returns true if aKernel can run on this CPU.
+bool IsRotateKernelSupported(RotateKernel aKernel);
+
+// Returns a human readable name for aKernel, for logging.
+const char* GetRotateKernelName(RotateKernel aKernel);
+
+// Rotates an image with aBytesPerPixel bytes per pixel, which must be 1, 2 or
+// 4, clockwise by aRotation. aDst must have aSrc's dimensions swapped for 90
+// and 270 degree rotations, and the same dimensions as aSrc otherwise. The
+// planes must not overlap.
+// Returns false if the dimensions don't match, aBytesPerPixel isn't
+// supported, or aKernel isn't supported by this CPU.
+bool RotatePlane(Rotation aRotation,
+                 const ImagePlane& aSrc,
+                 const ImagePlane& aDst,
+                 uint32_t aBytesPerPixel,
+                 RotateKernel aKernel = RotateKernel_Auto,
+                 RotateTileShape aTile = RotateTileShape());
+
+// Rotates only the rows [aDstY0, aDstY1) of the destination of the rotation
+// RotatePlane() would perform. Bands which don't overlap write disjoint
+// memory, so they can be rotated concurrently on different threads.
+bool RotatePlaneBand(Rotation aRotation,
+                     const ImagePlane& aSrc,
+                     const ImagePlane& aDst,
+                     uint32_t aBytesPerPixel,
+                     uint32_t aDstY0,
+                     uint32_t aDstY1,
+                     RotateKernel aKernel = RotateKernel_Auto,
+                     RotateTileShape aTile = RotateTileShape());
+
+// The pixel formats we can rotate.
+enum PixelFormat {
+  // One plane of 32 bit pixels.
+  PixelFormat_RGB32,
+  // A plane of 8 bit luma, then a half width, half height plane of
+  // interleaved 8 bit U and V pairs.
+  PixelFormat_NV12,
+  // A plane of 8 bit luma, then half width, half height U and V planes.
+  PixelFormat_I420
+};
+
+// Returns a human readable name for aFormat, for logging.
+const char* GetPixelFormatName(PixelFormat aFormat);
+
+// Returns the number of planes images in aFormat have.
+uint32_t GetNumPlanes(PixelFormat aFormat);
+
+// Returns the size of the pixels in aPlane of an image in aFormat. For NV12's
+// chroma plane a "pixel" is a U and V pair, as they're moved together.
+uint32_t GetBytesPerPixel(PixelFormat aFormat, uint32_t aPlane);
+
+// An image in one of the PixelFormats. Only the first GetNumPlanes(format)
+// planes are used.
+struct Image {
+  PixelFormat format;
+  ImagePlane planes[3];
+};
+
+// Returns the size of a buffer laid out as GetImageLayout() describes.
+size_t GetImageBufferSize(PixelFormat aFormat,
+                          int32_t aStride,
+                          uint32_t aBufferHeight);
+
+// Describes the top-left aWidth x aHeight pixels of an image stored in a
+// contiguous buffer the way Media Foundation lays them out; the buffer is
+// aBufferHeight rows of aStride bytes of luma (or RGB), followed by the
+// chroma planes, which have half as many rows. I420's chroma planes also
+// have half the stride. A negative aStride means a bottom-up RGB32 image,
+// whose top row is the last row in the buffer.
+// Returns false if the buffer's too small to hold the image.
+bool GetImageLayout(PixelFormat aFormat,
+                    uint8_t* aData,
+                    size_t aLength,
+                    int32_t aStride,
+                    uint32_t aBufferHeight,
+                    uint32_t aWidth,
+                    uint32_t aHeight,
+                    Image* aOutImage);
+
+// Describes the aWidth x aHeight region of aImage whose top-left pixel is
+// at (aX, aY), such as the picture region of a decoded frame. No pixels are
+// copied. 4:2:0 images can only be cropped at even offsets.
+// Returns false if the region isn't inside aImage.
+bool CropImage(const Image& aImage,
+               uint32_t aX,
+               uint32_t aY,
+               uint32_t aWidth,
+               uint32_t aHeight,
+               Image* aOutImage);
+
+// Where the chroma samples of a 4:2:0 image lie relative to the luma samples
+// along one axis; either on the even luma samples, or half way between
+// pairs of luma samples. Most video has MPEG-2 siting, which is cosited
+// horizontally and centered vertically.
+enum ChromaSiting {
+  ChromaSiting_Cosited,
+  ChromaSiting_Centered
+};
+
+// Rotating the planes of a 4:2:0 image moves the chroma samples relative to
+// the luma samples. For example rotating MPEG-2 sited chroma by 90 degrees
+// leaves it centered horizontally and cosited vertically, and rotating it
+// by 180 degrees leaves it cosited with the odd columns. Decoders render the
+// chroma where the stream says it's sited, which is where the source's was,
+// so this resamples the rotated chroma plane aChroma in place, with 2 tap
+// filters, to put its samples back at aHorizontal and aVertical siting.
+// aSrcLumaWidth and aSrcLumaHeight are the dimensions of the source's luma
+// plane. This does nothing when the rotation doesn't move the samples, such
+// as when the chroma is centered on both axes, so those rotations stay bit
+// exact.
+void ResiteRotatedChroma(Rotation aRotation,
+                         const ImagePlane& aChroma,
+                         uint32_t aBytesPerPixel,
+                         uint32_t aSrcLumaWidth,
+                         uint32_t aSrcLumaHeight,
+                         ChromaSiting aHorizontal,
+                         ChromaSiting aVertical);
+
+// Rotates every plane of aSrc into aDst, which must be in the same format,
+// and resites the chroma of 4:2:0 images. See RotatePlane().
+bool RotateImage(Rotation aRotation,
+                 const Image& aSrc,
+                 const Image& aDst,
+                 ChromaSiting aHorizontal,
+                 ChromaSiting aVertical,
+                 RotateKernel aKernel = RotateKernel_Auto,
+                 RotateTileShape aTile = RotateTileShape());
+
+// Times rotations of the planes of synthetic 1080p and 4K RGB32, NV12 and
+// I420 frames with aKernel using each of a set of candidate tile shapes,
+// and returns the fastest over all of them, or untiled if no shape beats
+// untiled on every plane. This takes a second or two, so callers should
+// cache the result; the best shape depends on the CPU's cache hierarchy,
+// not on the video.
+RotateTileShape AutotuneRotateTileShape(RotateKernel aKernel);
@@ -0,0 +1,733 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// The SelfTest tool's checks and benchmarks of the rotation kernels,
+// ImageRotator and RotateScaler.
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "ImageRotator.h"
+#include "RotateScaler.h"
+#include "RotationKernels.h"
+#include "SelfTest.h"
+
+// Rotates aSrc into aDst a pixel at a time, straight from the definition of
+// each rotation, as a reference to check the kernels against.
+static void
+ReferenceRotatePlane(Rotation aRotation,
+                     const ImagePlane& aSrc,
+                     const ImagePlane& aDst,
+                     uint32_t aBytesPerPixel)
+{
+  for (uint32_t y = 0; y < aDst.height; y++) {
+    for (uint32_t x = 0; x < aDst.width; x++) {
+      uint32_t srcX = x, srcY = y;
+      switch (aRotation) {
+        case ROTATE_0: break;
+        case ROTATE_90: srcX = y; srcY = aSrc.height - 1 - x; break;
+        case ROTATE_180: srcX = aSrc.width - 1 - x; srcY = aSrc.height - 1 - y; break;
+        case ROTATE_270: srcX = aSrc.width - 1 - y; srcY = x; break;
+      }
+      memcpy(aDst.data + ptrdiff_t(y) * aDst.stride + x * aBytesPerPixel,
+             aSrc.data + ptrdiff_t(srcY) * aSrc.stride + srcX * aBytesPerPixel,
+             aBytesPerPixel);
+    }
+  }
+}
+
+// Returns true if aA and aB have the same dimensions and pixels.
+static bool
+PlanesEqual(const ImagePlane& aA, const ImagePlane& aB, uint32_t aBytesPerPixel)
+{
+  if (aA.width != aB.width || aA.height != aB.height) {
+    return false;
+  }
+  for (uint32_t y = 0; y < aA.height; y++) {
+    if (memcmp(aA.data + ptrdiff_t(y) * aA.stride,
+               aB.data + ptrdiff_t(y) * aB.stride,
+               size_t(aA.width) * aBytesPerPixel)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static const RotateKernel RotateKernels[] = {
+  RotateKernel_Scalar,
+  RotateKernel_SSE2,
+  RotateKernel_AVX2
+};
+static const size_t NumRotateKernels = sizeof(RotateKernels) / sizeof(RotateKernels[0]);
+
+bool
+BenchmarkRotate()
+{
+  // 720p, 1080p and 4K, and a size which isn't a multiple of any of the
+  // kernels' block sizes, so that they all have partial blocks at the edges.
+  static const uint32_t Sizes[][2] = {
+    { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 }, { 1283, 723 }
+  };
+  static const Rotation Rotations[] = { ROTATE_90, ROTATE_180, ROTATE_270 };
+  bool exact = true;
+  for (size_t s = 0; s < sizeof(Sizes) / sizeof(Sizes[0]); s++) {
+    const uint32_t width = Sizes[s][0];
+    const uint32_t height = Sizes[s][1];
+    printf("%ux%u RGB32:\n", width, height);
+    for (int bottomUp = 0; bottomUp < 2; bottomUp++) {
+      OwnedImage src;
+      if (!MakeImage(PixelFormat_RGB32, width, height, bottomUp != 0, &src)) {
+        return false;
+      }
+      for (size_t r = 0; r < sizeof(Rotations) / sizeof(Rotations[0]); r++) {
+        const Rotation rotation = Rotations[r];
+        const bool swap = (rotation == ROTATE_90 || rotation == ROTATE_270);
+        const uint32_t dstWidth = swap ? height : width;
+        const uint32_t dstHeight = swap ? width : height;
+        OwnedImage expected, dst;
+        if (!MakeImage(PixelFormat_RGB32, dstWidth, dstHeight, false, &expected) ||
+            !MakeImage(PixelFormat_RGB32, dstWidth, dstHeight, bottomUp != 0, &dst)) {
+          return false;
+        }
+        const ImagePlane& srcPlane = src.image.planes[0];
+        const ImagePlane& dstPlane = dst.image.planes[0];
+        ReferenceRotatePlane(rotation, srcPlane, expected.image.planes[0], 4);
+        printf("  %3u degrees, %s stride:", unsigned(rotation) * 90,
+               bottomUp ? "negative" : "positive");
+        for (size_t k = 0; k < NumRotateKernels; k++) {
+          const RotateKernel kernel = RotateKernels[k];
+          if (!IsRotateKernelSupported(kernel)) {
+            continue;
+          }
+          memset(&dst.buffer[0], 0, dst.buffer.size());
+          if (!RotatePlane(rotation, srcPlane, dstPlane, 4, kernel)) {
+            return false;
+          }
+          const bool matches = PlanesEqual(dstPlane, expected.image.planes[0], 4);
+          exact = exact && matches;
+          const double seconds = TimeFastest([&]() {
+            RotatePlane(rotation, srcPlane, dstPlane, 4, kernel);
+          });
+          printf(" %s %.0lf MPix/s%s", GetRotateKernelName(kernel),
+                 width * height / seconds / 1e6, matches ? "" : " (MISMATCH)");
+        }
+        printf("\n");
+      }
+    }
+  }
+  if (!exact) {
+    fprintf(stderr, "Rotated pixels differ from the reference rotation's\n");
+  }
+  return exact;
+}
+
+// Counts the cache and data TLB misses of the calling thread, with Linux's
+// perf_event_open(). Either count is unavailable on other OSs, on CPUs or
+// VMs without the counter, or when perf_event_paranoid doesn't allow it.
+class MissCounters {
+public:
+  enum Counter {
+    Counter_Cache,
+    Counter_TLB,
+    NumCounters
+  };
+
+  MissCounters()
+  {
+    for (int i = 0; i < NumCounters; i++) {
+      mFds[i] = -1;
+    }
+#if defined(__linux__)
+    // Last level cache misses, and data TLB load misses.
+    const uint32_t types[NumCounters] = { PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE };
+    const uint64_t configs[NumCounters] = {
+      PERF_COUNT_HW_CACHE_MISSES,
+      PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+    };
+    for (int i = 0; i < NumCounters; i++) {
+      perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = types[i];
+      attr.config = configs[i];
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      mFds[i] = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+#endif
+  }
+
+  ~MissCounters()
+  {
+#if defined(__linux__)
+    for (int i = 0; i < NumCounters; i++) {
+      if (mFds[i] >= 0) {
+        close(mFds[i]);
+      }
+    }
+#endif
+  }
+
+  bool IsAvailable(Counter aCounter) const { return mFds[aCounter] >= 0; }
+
+  void Start()
+  {
+#if defined(__linux__)
+    for (int i = 0; i < NumCounters; i++) {
+      if (mFds[i] >= 0) {
+        ioctl(mFds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(mFds[i], PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+#endif
+  }
+
+  // Stops counting, and returns the count since Start(), or 0 if the counter
+  // isn't available.
+  uint64_t Stop(Counter aCounter)
+  {
+    uint64_t count = 0;
+#if defined(__linux__)
+    if (mFds[aCounter] >= 0) {
+      ioctl(mFds[aCounter], PERF_EVENT_IOC_DISABLE, 0);
+      if (read(mFds[aCounter], &count, sizeof(count)) != sizeof(count)) {
+        count = 0;
+      }
+    }
+#endif
+    return count;
+  }
+
+private:
+  int mFds[NumCounters];
+};
+
+bool
+BenchmarkRotateTiles()
+{
+  static const uint32_t Sizes[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+  static const Rotation Rotations[] = { ROTATE_90, ROTATE_270 };
+  MissCounters counters;
+  if (!counters.IsAvailable(MissCounters::Counter_Cache) &&
+      !counters.IsAvailable(MissCounters::Counter_TLB)) {
+    printf("Cache and TLB miss counters are unavailable\n");
+  }
+  for (size_t k = 0; k < NumRotateKernels; k++) {
+    const RotateKernel kernel = RotateKernels[k];
+    if (!IsRotateKernelSupported(kernel)) {
+      continue;
+    }
+    const RotateTileShape tuned = AutotuneRotateTileShape(kernel);
+    printf("%s: autotuned tile ", GetRotateKernelName(kernel));
+    if (tuned.width && tuned.height) {
+      printf("%ux%u\n", tuned.width, tuned.height);
+    } else {
+      printf("untiled\n");
+    }
+    const RotateTileShape tiles[] = { RotateTileShape(), tuned };
+    for (size_t s = 0; s < sizeof(Sizes) / sizeof(Sizes[0]); s++) {
+      const uint32_t width = Sizes[s][0];
+      const uint32_t height = Sizes[s][1];
+      OwnedImage src, dst;
+      if (!MakeImage(PixelFormat_RGB32, width, height, false, &src) ||
+          !MakeImage(PixelFormat_RGB32, height, width, false, &dst)) {
+        return false;
+      }
+      const ImagePlane& srcPlane = src.image.planes[0];
+      const ImagePlane& dstPlane = dst.image.planes[0];
+      for (size_t r = 0; r < sizeof(Rotations) / sizeof(Rotations[0]); r++) {
+        const Rotation rotation = Rotations[r];
+        for (size_t t = 0; t < sizeof(tiles) / sizeof(tiles[0]); t++) {
+          const RotateTileShape& tile = tiles[t];
+          if (!RotatePlane(rotation, srcPlane, dstPlane, 4, kernel, tile)) {
+            return false;
+          }
+          const double seconds = TimeFastest([&]() {
+            RotatePlane(rotation, srcPlane, dstPlane, 4, kernel, tile);
+          });
+          // Count the misses of one more rotation, now the pages are
+          // faulted in.
+          counters.Start();
+          RotatePlane(rotation, srcPlane, dstPlane, 4, kernel, tile);
+          const uint64_t cacheMisses = counters.Stop(MissCounters::Counter_Cache);
+          const uint64_t tlbMisses = counters.Stop(MissCounters::Counter_TLB);
+          const double numPixels = double(width) * height;
+          printf("  %ux%u %3u degrees, %-8s %5.0lf MPix/s", width, height,
+                 unsigned(rotation) * 90, t ? "tiled" : "untiled",
+                 numPixels / seconds / 1e6);
+          if (counters.IsAvailable(MissCounters::Counter_Cache)) {
+            printf(", %.4lf cache misses", cacheMisses / numPixels);
+          }
+          if (counters.IsAvailable(MissCounters::Counter_TLB)) {
+            printf(", %.4lf dTLB misses", tlbMisses / numPixels);
+          }
+          printf("%s\n", counters.IsAvailable(MissCounters::Counter_Cache) ||
+                         counters.IsAvailable(MissCounters::Counter_TLB)
+                         ? " per pixel" : "");
+        }
+      }
+    }
+  }
+  return true;
+}
+
+bool
+BenchmarkRotateThreads()
+{
+  const RotateTileShape tile = AutotuneRotateTileShape(GetBestRotateKernel());
+  printf("%s kernel, %ux%u tiles\n", GetRotateKernelName(GetBestRotateKernel()),
+         tile.width, tile.height);
+  MeasureRotationScaling(std::max(1u, std::thread::hardware_concurrency()), tile,
+                         [](const RotationScalingSample& aSample) {
+    printf("%ux%u %-5s %2u threads: %6.2lf ms/frame, %.2lfx speedup\n",
+           aSample.width, aSample.height, GetPixelFormatName(aSample.format),
+           aSample.numThreads, aSample.msPerFrame, aSample.speedup);
+    fflush(stdout);
+  });
+  return true;
+}
+
+// Returns where chroma which is aOffset half luma samples from its own even
+// luma sample, along an axis of aLumaLength luma samples, is from its own
+// even luma sample after the axis is reversed. Chroma sample i is at
+// 4i + aOffset, which moves to 2(aLumaLength - 1) - 4i - aOffset, and it
+// becomes chroma sample ceil(aLumaLength / 2) - 1 - i.
+static int
+ReferenceReversedChromaOffset(int aOffset, uint32_t aLumaLength)
+{
+  const int chromaLength = int((aLumaLength + 1) / 2);
+  return 2 * (int(aLumaLength) - 1) - 4 * (chromaLength - 1) - aOffset;
+}
+
+// Returns the rounded linear interpolation aShift quarter samples of the
+// way from aNear to aFar.
+static uint8_t
+Interpolate(uint8_t aNear, uint8_t aFar, int aShift)
+{
+  const int weight = aShift < 0 ? -aShift : aShift;
+  return uint8_t(((4 - weight) * aNear + weight * aFar + 2) >> 2);
+}
+
+// Resamples each component of aPlane in place, aShiftX quarter samples to
+// the right, then aShiftY quarter samples down, with samples beyond the
+// edges clamped to the edges, and the result of each pass rounded.
+static void
+ReferenceShiftPlane(const ImagePlane& aPlane, uint32_t aBytesPerPixel, int aShiftX, int aShiftY)
+{
+  const uint32_t rowBytes = aPlane.width * aBytesPerPixel;
+  std::vector<uint8_t> copy(size_t(rowBytes) * aPlane.height);
+  for (int pass = 0; pass < 2; pass++) {
+    const int shift = pass ? aShiftY : aShiftX;
+    for (uint32_t y = 0; y < aPlane.height; y++) {
+      memcpy(&copy[y * rowBytes], aPlane.data + ptrdiff_t(y) * aPlane.stride, rowBytes);
+    }
+    for (uint32_t y = 0; y < aPlane.height; y++) {
+      for (uint32_t x = 0; x < aPlane.width; x++) {
+        int farX = int(x), farY = int(y);
+        if (pass) {
+          farY = std::min(std::max(farY + (shift > 0) - (shift < 0), 0), int(aPlane.height) - 1);
+        } else {
+          farX = std::min(std::max(farX + (shift > 0) - (shift < 0), 0), int(aPlane.width) - 1);
+        }
+        for (uint32_t c = 0; c < aBytesPerPixel; c++) {
+          aPlane.data[ptrdiff_t(y) * aPlane.stride + x * aBytesPerPixel + c] =
+            Interpolate(copy[y * rowBytes + x * aBytesPerPixel + c],
+                        copy[farY * rowBytes + farX * aBytesPerPixel + c], shift);
+        }
+      }
+    }
+  }
+}
+
+// Rotates each plane of aSrc into aDst a pixel at a time, and resamples the
+// chroma of 4:2:0 images back to aHorizontal and aVertical siting, as a
+// reference to check RotateImage() against.
+static void
+ReferenceRotateImage(Rotation aRotation,
+                     const Image& aSrc,
+                     const Image& aDst,
+                     ChromaSiting aHorizontal,
+                     ChromaSiting aVertical)
+{
+  const uint32_t numPlanes = GetNumPlanes(aSrc.format);
+  for (uint32_t i = 0; i < numPlanes; i++) {
+    ReferenceRotatePlane(aRotation, aSrc.planes[i], aDst.planes[i],
+                         GetBytesPerPixel(aSrc.format, i));
+  }
+  if (numPlanes == 1) {
+    return;
+  }
+  // Offsets are in half luma samples, so they're quarter chroma samples.
+  const int wantX = (aHorizontal == ChromaSiting_Centered) ? 1 : 0;
+  const int wantY = (aVertical == ChromaSiting_Centered) ? 1 : 0;
+  const uint32_t srcWidth = aSrc.planes[0].width;
+  const uint32_t srcHeight = aSrc.planes[0].height;
+  int haveX = wantX, haveY = wantY;
+  switch (aRotation) {
+    case ROTATE_0:
+      break;
+    case ROTATE_90:
+      // The destination's rows are the source's columns, bottom to top.
+      haveX = ReferenceReversedChromaOffset(wantY, srcHeight);
+      haveY = wantX;
+      break;
+    case ROTATE_180:
+      haveX = ReferenceReversedChromaOffset(wantX, srcWidth);
+      haveY = ReferenceReversedChromaOffset(wantY, srcHeight);
+      break;
+    case ROTATE_270:
+      // The destination's rows are the source's columns, right to left.
+      haveX = wantY;
+      haveY = ReferenceReversedChromaOffset(wantX, srcWidth);
+      break;
+  }
+  for (uint32_t i = 1; i < numPlanes; i++) {
+    ReferenceShiftPlane(aDst.planes[i], GetBytesPerPixel(aSrc.format, i),
+                        wantX - haveX, wantY - haveY);
+  }
+}
+
+// Returns true if every plane of aA matches aB's. If not, prints which
+// differs, prefixed with aWhat.
+static bool
+ImagesEqual(const Image& aA, const Image& aB, const char* aWhat)
+{
+  for (uint32_t i = 0; i < GetNumPlanes(aA.format); i++) {
+    if (!PlanesEqual(aA.planes[i], aB.planes[i], GetBytesPerPixel(aA.format, i))) {
+      fprintf(stderr, "%s: plane %u differs from the reference\n", aWhat, i);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool
+CheckPlanarRotation()
+{
+  static const PixelFormat Formats[] = { PixelFormat_NV12, PixelFormat_I420 };
+  // Sizes whose chroma planes have even and odd dimensions, and odd luma
+  // dimensions, which move chroma sited on the last luma sample onto the
+  // first when the axis is reversed.
+  static const uint32_t Sizes[][2] = {
+    { 1920, 1080 }, { 640, 360 }, { 638, 358 }, { 641, 361 }
+  };
+  static const Rotation Rotations[] = { ROTATE_0, ROTATE_90, ROTATE_180, ROTATE_270 };
+  static const ChromaSiting Sitings[] = { ChromaSiting_Cosited, ChromaSiting_Centered };
+  ImageRotator rotator;
+  rotator.Init(4, RotateTileShape(32, 32));
+  bool exact = true;
+  for (size_t f = 0; f < sizeof(Formats) / sizeof(Formats[0]); f++) {
+    const PixelFormat format = Formats[f];
+    for (size_t s = 0; s < sizeof(Sizes) / sizeof(Sizes[0]); s++) {
+      const uint32_t width = Sizes[s][0];
+      const uint32_t height = Sizes[s][1];
+      OwnedImage src;
+      if (!MakeImage(format, width, height, false, &src)) {
+        return false;
+      }
+      uint32_t numChecks = 0, numFailures = 0;
+      for (size_t r = 0; r < sizeof(Rotations) / sizeof(Rotations[0]); r++) {
+        const Rotation rotation = Rotations[r];
+        const bool swap = (rotation == ROTATE_90 || rotation == ROTATE_270);
+        const uint32_t dstWidth = swap ? height : width;
+        const uint32_t dstHeight = swap ? width : height;
+        for (size_t h = 0; h < 2; h++) {
+          for (size_t v = 0; v < 2; v++) {
+            OwnedImage expected, dst;
+            if (!MakeImage(format, dstWidth, dstHeight, false, &expected) ||
+                !MakeImage(format, dstWidth, dstHeight, false, &dst)) {
+              return false;
+            }
+            ReferenceRotateImage(rotation, src.image, expected.image, Sitings[h], Sitings[v]);
+            char what[128];
+            for (size_t k = 0; k <= NumRotateKernels; k++) {
+              // Each kernel, then ImageRotator, in bands on its thread pool.
+              const bool banded = (k == NumRotateKernels);
+              if (!banded && !IsRotateKernelSupported(RotateKernels[k])) {
+                continue;
+              }
+              memset(&dst.buffer[0], 0, dst.buffer.size());
+              bool rotated;
+              if (banded) {
+                rotator.SetChromaSiting(Sitings[h], Sitings[v]);
+                rotated = rotator.Rotate(rotation, src.image, dst.image);
+              } else {
+                rotated = RotateImage(rotation, src.image, dst.image,
+                                      Sitings[h], Sitings[v], RotateKernels[k]);
+              }
+              if (!rotated) {
+                return false;
+              }
+              snprintf(what, sizeof(what), "%s %ux%u, %u degrees, %s/%s siting, %s",
+                       GetPixelFormatName(format), width, height,
+                       unsigned(rotation) * 90,
+                       h ? "centered" : "cosited", v ? "centered" : "cosited",
+                       banded ? "ImageRotator" : GetRotateKernelName(RotateKernels[k]));
+              numChecks++;
+              if (!ImagesEqual(dst.image, expected.image, what)) {
+                numFailures++;
+              }
+            }
+          }
+        }
+      }
+      printf("%s %ux%u: %u of %u rotations match the reference\n",
+             GetPixelFormatName(format), width, height, numChecks - numFailures, numChecks);
+      exact = exact && !numFailures;
+    }
+  }
+
+  // How fast one thread rotates each format by 90 degrees, compared with
+  // RGB32.
+  static const PixelFormat ThroughputFormats[] = {
+    PixelFormat_RGB32, PixelFormat_NV12, PixelFormat_I420
+  };
+  const RotateKernel kernel = GetBestRotateKernel();
+  const RotateTileShape tile = AutotuneRotateTileShape(kernel);
+  for (size_t s = 0; s < 2; s++) {
+    const uint32_t width = s ? 3840 : 1920;
+    const uint32_t height = s ? 2160 : 1080;
+    printf("%ux%u, 90 degrees, %s kernel:", width, height, GetRotateKernelName(kernel));
+    double rgbRate = 0;
+    for (size_t f = 0; f < sizeof(ThroughputFormats) / sizeof(ThroughputFormats[0]); f++) {
+      const PixelFormat format = ThroughputFormats[f];
+      OwnedImage src, dst;
+      if (!MakeImage(format, width, height, false, &src) ||
+          !MakeImage(format, height, width, false, &dst)) {
+        return false;
+      }
+      const double seconds = TimeFastest([&]() {
+        RotateImage(ROTATE_90, src.image, dst.image, ChromaSiting_Cosited,
+                    ChromaSiting_Centered, kernel, tile);
+      });
+      const double rate = width * height / seconds / 1e6;
+      if (format == PixelFormat_RGB32) {
+        rgbRate = rate;
+        printf(" %s %.0lf MPix/s", GetPixelFormatName(format), rate);
+      } else {
+        printf(", %s %.0lf MPix/s (%.2lfx)", GetPixelFormatName(format), rate, rate / rgbRate);
+      }
+    }
+    printf("\n");
+  }
+  return exact;
+}
+
+// The value of byte aByte of every pixel in plane aPlane of a flat test
+// image. The channels differ, and include the extremes, where the ringing
+// of Lanczos' negative lobes would be clamped.
+static uint8_t
+FlatValue(uint32_t aPlane, uint32_t aByte)
+{
+  static const uint8_t Values[] = { 0, 255, 16, 235, 128 };
+  return Values[(aPlane * 4 + aByte) % 5];
+}
+
+// Fills aImage with FlatValue()s.
+static void
+FillFlat(const Image& aImage)
+{
+  for (uint32_t i = 0; i < GetNumPlanes(aImage.format); i++) {
+    const ImagePlane& plane = aImage.planes[i];
+    const uint32_t bytesPerPixel = GetBytesPerPixel(aImage.format, i);
+    for (uint32_t y = 0; y < plane.height; y++) {
+      uint8_t* row = plane.data + ptrdiff_t(y) * plane.stride;
+      for (uint32_t x = 0; x < plane.width * bytesPerPixel; x++) {
+        row[x] = FlatValue(i, x % bytesPerPixel);
+      }
+    }
+  }
+}
+
+// Returns true if every pixel of aImage has the FlatValue()s.
+static bool
+IsFlat(const Image& aImage)
+{
+  for (uint32_t i = 0; i < GetNumPlanes(aImage.format); i++) {
+    const ImagePlane& plane = aImage.planes[i];
+    const uint32_t bytesPerPixel = GetBytesPerPixel(aImage.format, i);
+    for (uint32_t y = 0; y < plane.height; y++) {
+      const uint8_t* row = plane.data + ptrdiff_t(y) * plane.stride;
+      for (uint32_t x = 0; x < plane.width * bytesPerPixel; x++) {
+        if (row[x] != FlatValue(i, x % bytesPerPixel)) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// Returns the number of planes of aSrc which, scaled by a RotateScaler to
+// the size they are rotated, don't match RotatePlane()'s rotation of them
+// exactly. Each plane is treated as full resolution, since unscaled chroma
+// only needs resiting, which RotateImage() does separately.
+static uint32_t
+CountUnscaledMismatches(Rotation aRotation,
+                        const Image& aSrc,
+                        ScaleFilter aFilter,
+                        uint32_t* aNumChecks)
+{
+  const bool swap = (aRotation == ROTATE_90 || aRotation == ROTATE_270);
+  uint32_t numMismatches = 0;
+  for (uint32_t i = 0; i < GetNumPlanes(aSrc.format); i++) {
+    const ImagePlane& src = aSrc.planes[i];
+    const uint32_t bytesPerPixel = GetBytesPerPixel(aSrc.format, i);
+    const uint32_t dstWidth = swap ? src.height : src.width;
+    const uint32_t dstHeight = swap ? src.width : src.height;
+    std::vector<uint8_t> expectedPixels(size_t(dstWidth) * dstHeight * bytesPerPixel);
+    std::vector<uint8_t> scaledPixels(expectedPixels.size());
+    ImagePlane expected = { &expectedPixels[0], int32_t(dstWidth * bytesPerPixel),
+                            dstWidth, dstHeight };
+    ImagePlane scaled = expected;
+    scaled.data = &scaledPixels[0];
+    RotateScaler scaler;
+    if (!RotatePlane(aRotation, src, expected, bytesPerPixel) ||
+        !scaler.Init(aRotation, src.width, src.height, dstWidth, dstHeight,
+                     bytesPerPixel, aFilter) ||
+        !scaler.Scale(src, scaled) ||
+        !PlanesEqual(scaled, expected, bytesPerPixel)) {
+      numMismatches++;
+    }
+    (*aNumChecks)++;
+  }
+  return numMismatches;
+}
+
+bool
+CheckRotateScaler()
+{
+  static const PixelFormat Formats[] = {
+    PixelFormat_RGB32, PixelFormat_NV12, PixelFormat_I420
+  };
+  static const Rotation Rotations[] = { ROTATE_0, ROTATE_90, ROTATE_180, ROTATE_270 };
+  static const ScaleFilter Filters[] = { ScaleFilter_Bilinear, ScaleFilter_Lanczos3 };
+  static const char* const FilterNames[] = { "bilinear", "Lanczos3" };
+  static const size_t NumFormats = sizeof(Formats) / sizeof(Formats[0]);
+  static const size_t NumRotations = sizeof(Rotations) / sizeof(Rotations[0]);
+  static const size_t NumFilters = sizeof(Filters) / sizeof(Filters[0]);
+  bool passed = true;
+
+  // Unscaled, every tap but the one on the source pixel has no weight, so
+  // the output should be the plain rotation's, bit for bit.
+  static const uint32_t UnscaledSizes[][2] = { { 1920, 1080 }, { 641, 361 } };
+  for (size_t s = 0; s < sizeof(UnscaledSizes) / sizeof(UnscaledSizes[0]); s++) {
+    for (size_t f = 0; f < NumFormats; f++) {
+      OwnedImage src;
+      if (!MakeImage(Formats[f], UnscaledSizes[s][0], UnscaledSizes[s][1], false, &src)) {
+        return false;
+      }
+      for (size_t k = 0; k < NumFilters; k++) {
+        uint32_t numChecks = 0, numMismatches = 0;
+        for (size_t r = 0; r < NumRotations; r++) {
+          numMismatches += CountUnscaledMismatches(Rotations[r], src.image,
+                                                   Filters[k], &numChecks);
+        }
+        printf("Unscaled %s %ux%u, %s: %u of %u planes match RotatePlane()\n",
+               GetPixelFormatName(Formats[f]), UnscaledSizes[s][0], UnscaledSizes[s][1],
+               FilterNames[k], numChecks - numMismatches, numChecks);
+        passed = passed && !numMismatches;
+      }
+    }
+  }
+
+  // Scaled, through ImageRotator's bands, as the pipeline scales; the
+  // weights sum to exactly 1, so flat frames should stay exactly flat,
+  // chroma included, shrinking and enlarging by awkward factors.
+  static const uint32_t ScaledSizes[][4] = {
+    { 1920, 1080, 640, 360 }, { 640, 360, 1280, 720 }, { 1283, 723, 500, 302 }
+  };
+  ImageRotator rotator;
+  rotator.Init(4, RotateTileShape(32, 32));
+  for (size_t s = 0; s < sizeof(ScaledSizes) / sizeof(ScaledSizes[0]); s++) {
+    const uint32_t width = ScaledSizes[s][0];
+    const uint32_t height = ScaledSizes[s][1];
+    for (size_t f = 0; f < NumFormats; f++) {
+      OwnedImage src;
+      if (!MakeImage(Formats[f], width, height, false, &src)) {
+        return false;
+      }
+      FillFlat(src.image);
+      for (size_t k = 0; k < NumFilters; k++) {
+        rotator.SetScaleFilter(Filters[k]);
+        uint32_t numFlat = 0;
+        for (size_t r = 0; r < NumRotations; r++) {
+          const bool swap = (Rotations[r] == ROTATE_90 || Rotations[r] == ROTATE_270);
+          OwnedImage dst;
+          if (!MakeImage(Formats[f], ScaledSizes[s][swap ? 3 : 2],
+                         ScaledSizes[s][swap ? 2 : 3], false, &dst) ||
+              !rotator.Rotate(Rotations[r], src.image, dst.image)) {
+            return false;
+          }
+          numFlat += IsFlat(dst.image) ? 1 : 0;
+        }
+        printf("Flat %s %ux%u to %ux%u, %s: %u of %u rotations stay flat\n",
+               GetPixelFormatName(Formats[f]), width, height, ScaledSizes[s][2],
+               ScaledSizes[s][3], FilterNames[k], numFlat, unsigned(NumRotations));
+        passed = passed && numFlat == NumRotations;
+      }
+    }
+  }
+
+  // Cropped, as decoded frames are cropped to their picture region: the
+  // scaler must only read the region, even where the filter reaches past
+  // its edges. Unscaled, the cropped noise should be rotated exactly; and
+  // with a flat region in noise, the scaled frame should be flat.
+  static const uint32_t CropX = 250, CropY = 120, CropWidth = 1280, CropHeight = 720;
+  for (size_t f = 0; f < NumFormats; f++) {
+    OwnedImage frame;
+    Image region;
+    if (!MakeImage(Formats[f], 1920, 1080, false, &frame) ||
+        !CropImage(frame.image, CropX, CropY, CropWidth, CropHeight, &region)) {
+      return false;
+    }
+    uint32_t numChecks = 0, numMismatches = 0;
+    for (size_t k = 0; k < NumFilters; k++) {
+      for (size_t r = 0; r < NumRotations; r++) {
+        numMismatches += CountUnscaledMismatches(Rotations[r], region, Filters[k], &numChecks);
+      }
+    }
+    FillFlat(region);
+    uint32_t numFlat = 0;
+    for (size_t k = 0; k < NumFilters; k++) {
+      rotator.SetScaleFilter(Filters[k]);
+      for (size_t r = 0; r < NumRotations; r++) {
+        const bool swap = (Rotations[r] == ROTATE_90 || Rotations[r] == ROTATE_270);
+        OwnedImage dst;
+        if (!MakeImage(Formats[f], swap ? 360 : 640, swap ? 640 : 360, false, &dst) ||
+            !rotator.Rotate(Rotations[r], region, dst.image)) {
+          return false;
+        }
+        numFlat += IsFlat(dst.image) ? 1 : 0;
+      }
+    }
+    printf("Cropped %s %ux%u at (%u, %u): %u of %u unscaled planes match RotatePlane(), "
+           "%u of %u scaled rotations stay flat\n",
+           GetPixelFormatName(Formats[f]), CropWidth, CropHeight, CropX, CropY,
+           numChecks - numMismatches, numChecks, numFlat, unsigned(NumFilters * NumRotations));
+    passed = passed && !numMismatches && numFlat == NumFilters * NumRotations;
+  }
+  return passed;
+}
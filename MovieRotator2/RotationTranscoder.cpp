@@ -15,261 +15,60 @@
 #include "stdafx.h"
 #include "RotationTranscoder.h"
 #include "TranscodeJobList.h"
-#include "D2DManager.h"
+#include "RotationTuning.h"
 #include "Utils.h"
+#include "HighResClock.h"
 
 using std::wstring;
 
-RotationTranscoder::RotationTranscoder(const TranscodeJob* aJob)
-  : mJob(aJob),
-    mDecoderAudioStreamIndex(Unknown),
-    mDecoderVideoStreamIndex(Unknown),
-    mEncoderAudioStreamIndex(Unknown),
-    mEncoderVideoStreamIndex(Unknown),
-    mReaderOutputVideoStride(0),
-    mWriterInputVideoStride(0),
-    mH264Profile(Unknown),
-    mProgress(0),
-    mDuration(0),
-    mLastVideoTimestamp(0),
-    mInitialized(false),
-    mAudioEOS(false),
-    mVideoEOS(false)
+// Inputs are split into segments of at least this long, so that short
+// inputs aren't split into segments which take longer to set up than to
+// transcode.
+static const LONGLONG MinSegmentDuration = 120 * TimeUnitsPerSecond;
+
+// When the job leaves the number of segments up to us, each segment gets
+// this many hardware threads, up to this many segments. Encoders, hardware
+// ones especially, don't scale much past that.
+static const UINT32 HardwareThreadsPerSegment = 4;
+static const UINT32 MaxAutoSegments = 4;
+
+// Initializes COM on the threads the transcode starts, which create and
+// call into Media Foundation objects.
+static void
+InitComOnThread(bool aStarting)
 {
-}
-
-RotationTranscoder::~RotationTranscoder()
-{
-}
-
-HRESULT
-RotationTranscoder::DetermineReaderOutputVideoType(IMFMediaType** aOutVideoType)
-{
-  HRESULT hr;
-
-  // Read the first video frame, so that we can detect a format change.
-  // Some videos have their frame size and/or aperature/pan/scan change
-  // on the first frame.
-
-  IMFSamplePtr sample;
-  DWORD streamIndex, flags;
-  LONGLONG timestamp;
-  uint64_t videoSampleNum = 0;
-  hr = mReader->ReadSample(mDecoderVideoStreamIndex,
-                           0,                // Flags.
-                           &streamIndex,     // Receives the actual stream index.
-                           &flags,           // Receives status flags.
-                           &timestamp,       // Receives the time stamp.
-                           &sample);         // Receives the sample or NULL.
-  if (FAILED(hr)) {
-    DBGMSG(L"DetermineReaderOutputVideoType ReadSample failed with 0x%x\n", hr);
-    return hr;
-  }
-  ENSURE_TRUE(streamIndex == mDecoderVideoStreamIndex, E_FAIL);
-
-  if (flags & MF_SOURCE_READERF_CURRENTMEDIATYPECHANGED) {
-    DBGMSG(L"Detected type change on first video sample...\n");
+  if (aStarting) {
+    CoInitializeEx(0, COINIT_MULTITHREADED);
+  } else {
+    CoUninitialize();
   }
-
-  IMFMediaTypePtr type;  
-  hr = mReader->GetCurrentMediaType(mDecoderVideoStreamIndex, &type);
-  ENSURE_SUCCESS(hr, hr);
-
-  // Seek the reader back to the first frame.
-  AutoPropVar var;
-  hr = InitPropVariantFromInt64(0, &var);
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = mReader->SetCurrentPosition(GUID_NULL, var);
-  ENSURE_SUCCESS(hr, hr);
-
-  *aOutVideoType = type.Detach();
-
-  return S_OK;
 }
 
-HRESULT
-RotationTranscoder::ConfigureReaderVideoOutput()
+RotationTranscoder::RotationTranscoder(const TranscodeJob* aJob)
+  : mJob(aJob),
+    mStartTimeUs(0),
+    mOutputWidth(0),
+    mOutputHeight(0),
+    mReportWritten(false)
 {
-  HRESULT hr;
-
-  // Get the native video output type of the reader, save the attributes that
-  // we need for the re-encode.
-  IMFMediaTypePtr nativeVideoType;
-  hr = mReader->GetNativeMediaType(mDecoderVideoStreamIndex,
-                                   0,
-                                   &nativeVideoType);
-  ENSURE_SUCCESS(hr, hr);
-  DBGMSG(L"Reader native video type:\n");
-  LogMediaType(nativeVideoType);
-  DBGMSG(L"\n");
-
-  // May not need these, encoder can calculate them or use default, but try
-  // to retrieve if possible.
-  nativeVideoType->GetUINT32(MF_MT_MPEG2_PROFILE, &mH264Profile);
-  nativeVideoType->GetUINT32(MF_MT_AVG_BITRATE, &mAvgBitRate);
-
-  hr = nativeVideoType->GetUINT32(MF_MT_INTERLACE_MODE, &mInterlaceMode);
-  ENSURE_SUCCESS(hr, hr);
-
-  // Configure video output for RGB.
-  {
-    IMFMediaTypePtr readerOutputVideoType;
-    hr = MFCreateMediaType(&readerOutputVideoType);
-    ENSURE_SUCCESS(hr, hr);
-    hr = readerOutputVideoType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
-    ENSURE_SUCCESS(hr, hr);
-    hr = readerOutputVideoType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_RGB32);
-    ENSURE_SUCCESS(hr, hr);
-    hr = mReader->SetCurrentMediaType(mDecoderVideoStreamIndex,
-                                      NULL,
-                                      readerOutputVideoType);
-    ENSURE_SUCCESS(hr, hr);
-  }
-
-  hr = DetermineReaderOutputVideoType(&mReaderOutputRGBVideoType);
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = GetDefaultStride(mReaderOutputRGBVideoType, &mReaderOutputVideoStride);
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = MFGetAttributeRatio(mReaderOutputRGBVideoType,
-                           MF_MT_FRAME_RATE,
-                           &mFrameRateNumer,
-                           &mFrameRateDenom);
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = MFGetAttributeRatio(mReaderOutputRGBVideoType,
-                           MF_MT_PIXEL_ASPECT_RATIO,
-                           &mPixelAspectRatioNumer,
-                           &mPixelAspectRatioDenom);
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = GetVideoDisplayArea(mReaderOutputRGBVideoType, &mReaderOuptutPictureRegion);
-  ENSURE_SUCCESS(hr, hr);
-
-  DBGMSG(L"Reader output video type:\n");
-  LogMediaType(mReaderOutputRGBVideoType);
-  DBGMSG(L"\n");
-
-  return S_OK;
 }
 
-HRESULT
-RotationTranscoder::ConfigureReaderAudioOutput()
-{
-  HRESULT hr;
-
-  // Extract the audio native type, and determine how we're going to encode
-  // the audio, either by pass through, or by resampling decoded samples.
-  IMFMediaTypePtr nativeAudioType;
-  hr = mReader->GetNativeMediaType(mDecoderAudioStreamIndex,
-                                   0,
-                                   &nativeAudioType);
-  ENSURE_SUCCESS(hr, hr);
-
-  DBGMSG(L"Reader native audio type:\n");
-  LogMediaType(nativeAudioType);
-  DBGMSG(L"\n");
-
-  GUID subtype;
-  hr = nativeAudioType->GetGUID(MF_MT_SUBTYPE, &subtype);
-  ENSURE_SUCCESS(hr, hr);
-
-
-  // The audio isn't AAC. We'll decode it to PCM, and resample it so that
-  // it meets the requirements of the AAC encoder (at most 2 channels,
-  // 44.1KHz or 48KHz).
-
-  // Configure the audio to be output in PCM.
-  IMFMediaTypePtr readerOutputAudioType;
-  hr = MFCreateMediaType(&readerOutputAudioType);
-  ENSURE_SUCCESS(hr, hr);
-  hr = readerOutputAudioType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio);
-  ENSURE_SUCCESS(hr, hr);
-  hr = readerOutputAudioType->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_PCM);
-  ENSURE_SUCCESS(hr, hr);
-  hr = mReader->SetCurrentMediaType(mDecoderAudioStreamIndex,
-                                    NULL,
-                                    readerOutputAudioType);
-  ENSURE_SUCCESS(hr, hr);
-
-  // Decode one sample, to force a media type change if we're decoding HE-AAC
-  // and the sample rate doesn't take into account SBR/PS. It will once we
-  // decode the first sample.
-  IMFSamplePtr sample;
-  DWORD actualStreamIndex, flags;
-  LONGLONG timestamp;
-  hr = mReader->ReadSample(mDecoderAudioStreamIndex, 0, &actualStreamIndex, &flags, &timestamp, &sample);
-  ENSURE_SUCCESS(hr, hr);
-
-  ENSURE_TRUE(actualStreamIndex == mDecoderAudioStreamIndex, E_FAIL);
-
-  if (flags & MF_SOURCE_READERF_CURRENTMEDIATYPECHANGED) {
-    DBGMSG(L"Detected type change on first audio sample...\n");
-  }
-
-  // Seek the reader back to the first frame.
-  AutoPropVar var;
-  hr = InitPropVariantFromInt64(0, &var);
-  ENSURE_SUCCESS(hr, hr);
-  hr = mReader->SetCurrentPosition(GUID_NULL, var);
-  ENSURE_SUCCESS(hr, hr);
-
-  // Extract the completed audio type, as determined by the reader.
-  hr = mReader->GetCurrentMediaType(mDecoderAudioStreamIndex, &readerOutputAudioType);
-  ENSURE_SUCCESS(hr, hr);
-
-  DBGMSG(L"Reader output audio type:\n");
-  LogMediaType(readerOutputAudioType);
-  DBGMSG(L"\n");
-
-  // Pass the type to the resampler, it'll figure out the encode media type.
-  hr = mAudioProcessor.SetInputType(readerOutputAudioType);
-  ENSURE_SUCCESS(hr, hr);
-
-  return S_OK;
-}
-
-HRESULT
-RotationTranscoder::CreateReader()
+RotationTranscoder::~RotationTranscoder()
 {
-  const wstring& inputFilename = mJob->GetInputFilename();
-  const Rotation rotation = mJob->GetRotation();
-
-  HRESULT hr;
-  IMFAttributesPtr attributes;
-  hr = MFCreateAttributes(&attributes, 1);
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = attributes->SetUINT32(MF_SOURCE_READER_ENABLE_VIDEO_PROCESSING, TRUE);
-
-  // Create the source mReader from the URL.
-  hr = MFCreateSourceReaderFromURL(inputFilename.c_str(), attributes, &mReader);
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = GetSourceReaderDuration(mReader, &mDuration);
-
-  // Figure out the index of the audio and video stream, so that
-  // ReadSample(ANY_STREAM) can get the muxing order the same as the
-  // muxed file.
-  hr = GetReaderStreamIndexes(mReader,
-                              &mDecoderAudioStreamIndex,
-                              &mDecoderVideoStreamIndex);
-  ENSURE_SUCCESS(hr, hr);
-  ENSURE_TRUE(mDecoderVideoStreamIndex != -1, E_UNEXPECTED);
-
-  hr = ConfigureReaderVideoOutput();
-  ENSURE_SUCCESS(hr, hr);
-
-  if (mDecoderAudioStreamIndex != -1) {
-    hr = ConfigureReaderAudioOutput();
-    ENSURE_SUCCESS(hr, hr);
-  } else {
-    mAudioEOS = true;
+  if (!mPipeline) {
+    return;
   }
-
-  return S_OK;
+  DBGMSG(L"Startup latency to first encoded sample: %.1lf ms\n",
+         mPipeline->GetStartupLatencyUs() / 1000.0);
+  FrameBufferPoolStats stats = mPipeline->GetBufferPoolStats();
+  DBGMSG(L"Rotated frame buffer pool: %llu hits, %llu misses, peak %llu bytes\n",
+         stats.hits, stats.misses, stats.peakBytes);
+  TranscodeQueueDepths peaks = mPipeline->GetPeakQueueDepths();
+  const TranscodeQueueDepths& depths = mJob->GetQueueDepths();
+  DBGMSG(L"Pipeline queue peaks: decoded video %u/%u, decoded audio %u/%u, encoder %u/%u\n",
+         peaks.decodedVideo, depths.decodedVideo,
+         peaks.decodedAudio, depths.decodedAudio,
+         peaks.encoder, depths.encoder);
 }
 
 HRESULT
@@ -288,400 +87,382 @@ AdjustFrameSizeForRotation(Rotation aRotation, UINT32* aWidth, UINT32* aHeight)
   return S_OK;
 }
 
-HRESULT
-RotationTranscoder::GetEncoderVideoOutputType(IMFMediaType** aOutVideoType)
+// The largest frames the encoder accepts.
+static const UINT32 MaxOutputWidth = 1920;
+static const UINT32 MaxOutputHeight = 1080;
+
+// Creates *aOutSink, writing aFilename, for aSource's frames rotated by
+// aRotation and scaled to aWidth x aHeight, encoded with aEncoderSettings,
+// and the audio aAudioProcessor outputs, if it's non-null, or else
+// aSource's audio as it is, if it's compressed. If the encoder
+// won't take the frames in aSource's video subtype, reconfigures aSource to
+// output RGB32 instead.
+static HRESULT
+CreateSinkForSource(const wstring& aFilename,
+                    Rotation aRotation,
+                    MFFrameSource& aSource,
+                    AudioProcessor* aAudioProcessor,
+                    UINT32 aWidth,
+                    UINT32 aHeight,
+                    const EncoderSettings& aEncoderSettings,
+                    std::unique_ptr<MFFrameSink>* aOutSink)
 {
   HRESULT hr;
 
-  IMFMediaTypePtr videoType;
-  hr = MFCreateMediaType(&videoType);
-  ENSURE_SUCCESS(hr, hr);
-  hr = videoType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
-  ENSURE_SUCCESS(hr, hr);
-  hr = videoType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_H264);
-  ENSURE_SUCCESS(hr, hr);
-  // Note: We may not have successfully retrieved mAvgBitRate, that's OK, provided we set
-  // it to -1. mAvgBitRate is initialized to -1 by the constructor.
-  hr = videoType->SetUINT32(MF_MT_AVG_BITRATE, mAvgBitRate);
-  ENSURE_SUCCESS(hr, hr);
-  hr = videoType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
-  ENSURE_SUCCESS(hr, hr);
-  UINT32 width = mReaderOuptutPictureRegion.Area.cx; 
-  UINT32 height = mReaderOuptutPictureRegion.Area.cy;
-  hr = AdjustFrameSizeForRotation(mJob->GetRotation(), &width, &height);
-  ENSURE_SUCCESS(hr, hr);
-  
-  if (height > 1080) {
-    // TODO: Scale WRT aspect ratio, such that height <= 1080p.
-    //float ratio = float(width) / float(height);
-    //width = ratio * 1080;
-    height = 1080;
+  // The encoder takes the audio in the format the audio processor
+  // outputs. Compressed audio is written in the source's type.
+  IMFMediaTypePtr audioType;
+  if (aAudioProcessor) {
+    hr = aAudioProcessor->GetOutputType(&audioType);
+    ENSURE_SUCCESS(hr, hr);
+  } else if (aSource.HasAudio() && aSource.IsAudioCompressed()) {
+    audioType = aSource.GetAudioMediaType();
   }
-  hr = MFSetAttributeSize(videoType, MF_MT_FRAME_SIZE, width, height);
-  ENSURE_SUCCESS(hr, hr);
-  hr = MFSetAttributeRatio(videoType, MF_MT_FRAME_RATE, mFrameRateNumer, mFrameRateDenom);
-  ENSURE_SUCCESS(hr, hr);
 
-  // Swap the pixel aspect ratio if the frame is rotated 90 or 270 degrees.
-  if (mJob->GetRotation() == ROTATE_180) {
-    hr = MFSetAttributeRatio(videoType, MF_MT_PIXEL_ASPECT_RATIO, mPixelAspectRatioNumer, mPixelAspectRatioDenom);
-  } else {
-    hr = MFSetAttributeRatio(videoType, MF_MT_PIXEL_ASPECT_RATIO, mPixelAspectRatioDenom, mPixelAspectRatioNumer);
-  }
-  ENSURE_SUCCESS(hr, hr);
-  
-  if (mH264Profile > eAVEncH264VProfile_Main /* && !IsWindows8())*/ ) {
-    // Note: Windows 8 Supports High as well.
-    mH264Profile = eAVEncH264VProfile_Main;
-  }
-  if (mH264Profile != Unknown) {
-    hr = videoType->SetUINT32(MF_MT_MPEG2_PROFILE, mH264Profile);
+  std::unique_ptr<MFFrameSink> sink(new MFFrameSink());
+  hr = sink->Init(aFilename, aSource, aRotation, aWidth, aHeight,
+                  aEncoderSettings, audioType);
+  if (FAILED(hr) && aSource.GetVideoSubtype() != MFVideoFormat_RGB32) {
+    // The encoder won't take NV12 frames. Have the reader give us RGB32
+    // instead, which every H.264 encoder we register accepts.
+    DBGMSG(L"Writer rejected NV12 input hr=0x%x, falling back to RGB32\n", hr);
+    hr = aSource.ConfigureVideoOutput(MFVideoFormat_RGB32);
     ENSURE_SUCCESS(hr, hr);
+    sink.reset(new MFFrameSink());
+    hr = sink->Init(aFilename, aSource, aRotation, aWidth, aHeight,
+                    aEncoderSettings, audioType);
   }
-  *aOutVideoType = videoType.Detach();
+  ENSURE_SUCCESS(hr, hr);
 
+  *aOutSink = std::move(sink);
   return S_OK;
 }
 
-HRESULT
-RotationTranscoder::GetEncoderVideoInputType(IMFMediaType** aOutVideoType)
+// Returns the quality to resample audio with in jobs encoded with aPreset;
+// the faster the preset, the faster the resampler.
+static ResampleQuality
+GetResampleQualityForPreset(EncoderPreset aPreset)
 {
-  HRESULT hr;
-
-  IMFMediaTypePtr videoType;
-  hr = MFCreateMediaType(&videoType);
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = videoType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = videoType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_RGB32);
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = videoType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
-  ENSURE_SUCCESS(hr, hr);
-
-  UINT32 width = mReaderOuptutPictureRegion.Area.cx;
-  UINT32 height = mReaderOuptutPictureRegion.Area.cy;
-  hr = AdjustFrameSizeForRotation(mJob->GetRotation(), &width, &height);
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = MFSetAttributeSize(videoType, MF_MT_FRAME_SIZE, width, height);
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = MFSetAttributeRatio(videoType, MF_MT_FRAME_RATE, mFrameRateNumer, mFrameRateDenom);
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = MFSetAttributeRatio(videoType, MF_MT_PIXEL_ASPECT_RATIO, mPixelAspectRatioNumer, mPixelAspectRatioDenom);
-  ENSURE_SUCCESS(hr, hr);
-
-  // Note: We *must* set the stride on the input video type, as if it's
-  // negative and we don't report that the image will be encoded upside down!
-  hr = videoType->SetUINT32(MF_MT_DEFAULT_STRIDE, width * 4);
-  ENSURE_SUCCESS(hr, hr);
-
-  *aOutVideoType = videoType.Detach();
+  switch (aPreset) {
+    case EncoderPreset_Fast: return ResampleQuality_Fast;
+    case EncoderPreset_Balanced: return ResampleQuality_Balanced;
+    default: return ResampleQuality_Best;
+  }
+}
 
-  return S_OK;
+std::vector<TranscodeSegment>
+RotationTranscoder::ChooseSegments()
+{
+  UINT32 numSegments = mJob->GetNumSegments();
+  if (!numSegments) {
+    numSegments = min(MaxAutoSegments,
+                      max(1u, std::thread::hardware_concurrency() / HardwareThreadsPerSegment));
+  }
+  // Transcoding serially means one frame at a time, on one thread.
+  KeyframeIndex index;
+  if (numSegments < 2 ||
+      !mJob->IsPipelined() ||
+      !mSource.GetKeyframeIndex(&index)) {
+    return std::vector<TranscodeSegment>(1);
+  }
+  return SplitAtKeyframes(index, mSource.GetDuration(), numSegments, MinSegmentDuration);
 }
 
 HRESULT
-RotationTranscoder::GetEncoderAudioOutputType(IMFMediaType** aOutAudioType)
+RotationTranscoder::Initialize()
 {
-  // Construct the encoder's output audio type. This is AAC, but with
-  // the channel/sample rate of the audio processor's output type.
-  // The AAC encoder only supports up to 2 channels, 44.1KHz or 48KHz,
-  // so the audio processor resamples for us if need be. We can't use
-  // the audio processor's output type, since it includes extra attributes
-  // which confuses the encoder.
-
   HRESULT hr;
 
-  IMFMediaTypePtr outputAudioType;
-  hr = MFCreateMediaType(&outputAudioType);
-  ENSURE_SUCCESS(hr, hr);
+  mStartTimeUs = GetHighResTimeUs();
 
-  hr = outputAudioType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio);
+  // AAC the writer can take is copied rather than reencoded.
+  hr = mSource.Init(mJob->GetInputFilename(), true);
   ENSURE_SUCCESS(hr, hr);
 
-  hr = outputAudioType->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_AAC);
-  ENSURE_SUCCESS(hr, hr);
-
-  IMFMediaTypePtr processorOutputType;
-  hr = mAudioProcessor.GetOutputType(&processorOutputType);
-  ENSURE_SUCCESS(hr, hr);
-
-  GUID attr[] = {
-    MF_MT_AUDIO_BITS_PER_SAMPLE,
-    MF_MT_AUDIO_NUM_CHANNELS,
-    MF_MT_AUDIO_SAMPLES_PER_SECOND,
-    MF_MT_AUDIO_AVG_BYTES_PER_SECOND
-  };
-
-  for (UINT i=0; i<ARRAYSIZE(attr); i++) {
-    UINT32 value;
-    hr = processorOutputType->GetUINT32(attr[i], &value);
+  const bool processAudio = mSource.HasAudio() && !mSource.IsAudioCompressed();
+  if (processAudio) {
+    // Pass the type to the resampler, it'll figure out the encode media type.
+    hr = mAudioProcessor.SetInputType(mSource.GetAudioMediaType(),
+                                      GetResampleQualityForPreset(mJob->GetEncoderPreset()));
     ENSURE_SUCCESS(hr, hr);
+  }
 
-    hr = outputAudioType->SetUINT32(attr[i], value);
-    ENSURE_SUCCESS(hr, hr);
+  // Frames too big for the encoder are shrunk in the same pass as they're
+  // rotated. Scaling both dimensions by the same factor leaves the pixel
+  // aspect ratio unchanged.
+  UINT32 width = mSource.GetVideoFormat().width;
+  UINT32 height = mSource.GetVideoFormat().height;
+  AdjustFrameSizeForRotation(mJob->GetRotation(), &width, &height);
+  FitFrameSize(width, height, MaxOutputWidth, MaxOutputHeight, &mOutputWidth, &mOutputHeight);
+
+  RotateKernel kernel = GetBestRotateKernel();
+
+  TranscodeOptions options;
+  options.rotation = mJob->GetRotation();
+  options.outputWidth = mOutputWidth;
+  options.outputHeight = mOutputHeight;
+  options.scaleFilter = mJob->GetScaleFilter();
+  options.numRotationThreads = mJob->GetNumRotationThreads();
+  options.tile = GetTunedRotateTileShape(kernel);
+  options.pipelined = mJob->IsPipelined();
+  options.queueDepths = mJob->GetQueueDepths();
+  options.startTimeUs = mStartTimeUs;
+  options.threadHook = InitComOnThread;
+
+  std::vector<TranscodeSegment> segments = ChooseSegments();
+  if (segments.size() > 1) {
+    // Each segment opens its own source and sink, on its own thread.
+    mSegmented.reset(new SegmentedTranscode(this));
+    ENSURE_TRUE(mSegmented->Init(segments, mSource.GetDuration(), options), E_FAIL);
+    DBGMSG(L"Transcoding in %u segments\n", mSegmented->GetNumSegments());
+    return S_OK;
   }
 
-  // Just set the audio output average bit rate to the max 192 Kbps.
-  hr = outputAudioType->SetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND, 20000);
-  ENSURE_SUCCESS(hr, hr);
+  hr = CreateSinkForSource(mJob->GetOutputFilename(),
+                           mJob->GetRotation(),
+                           mSource,
+                           processAudio ? &mAudioProcessor : nullptr,
+                           mOutputWidth,
+                           mOutputHeight,
+                           GetEncoderPresetSettings(mJob->GetEncoderPreset()),
+                           &mSink);
+  ENSURE_SUCCESS(hr, hr);
+  DBGMSG(L"Encoding with the %S preset\n", GetEncoderPresetName(mJob->GetEncoderPreset()));
+  options.outputStride = mSink->GetVideoStride();
+
+  mPipeline.reset(new TranscodePipeline(&mSource,
+                                        processAudio ? &mAudioProcessor : nullptr,
+                                        mSink.get()));
+  ENSURE_TRUE(mPipeline->Init(options), E_FAIL);
+
+  const ImageRotator& rotator = mPipeline->GetRotator();
+  DBGMSG(L"Rotating with %S kernel, %ux%u tiles, on %u threads\n",
+         GetRotateKernelName(rotator.GetKernel()),
+         rotator.GetTileShape().width, rotator.GetTileShape().height,
+         rotator.GetNumThreads());
 
-  *aOutAudioType = outputAudioType.Detach();
   return S_OK;
 }
 
 HRESULT
-RotationTranscoder::GetEncoderAudioInputType(IMFMediaType** aOutEncoderAudioInputType)
+RotationTranscoder::GetPipelineError() const
 {
-  HRESULT hr;
-
-  // Construct the audio input media type. We copy the relevant fields from
-  // the output type of the audio processor.
-
-  IMFMediaTypePtr processorOutputType;
-  hr = mAudioProcessor.GetOutputType(&processorOutputType);
-  ENSURE_SUCCESS(hr, hr);
-
-  IMFMediaTypePtr encoderInputAudioType;
-  hr = MFCreateMediaType(&encoderInputAudioType);
-  ENSURE_SUCCESS(hr, hr);
-
-  GUID guidAttrs[] = {
-    MF_MT_MAJOR_TYPE,
-    MF_MT_SUBTYPE
-  };
-
-  for (UINT i=0; i<ARRAYSIZE(guidAttrs); i++) {
-    GUID value;
-    hr = processorOutputType->GetGUID(guidAttrs[i], &value);
-    ENSURE_SUCCESS(hr, hr);
-
-    hr = encoderInputAudioType->SetGUID(guidAttrs[i], value);
-    ENSURE_SUCCESS(hr, hr);
+  if (FAILED(mSource.GetError())) {
+    return mSource.GetError();
   }
-
-  GUID uintAttrs[] = {
-    MF_MT_AUDIO_BITS_PER_SAMPLE,
-    MF_MT_AUDIO_NUM_CHANNELS,
-    MF_MT_AUDIO_SAMPLES_PER_SECOND,
-    MF_MT_AUDIO_AVG_BYTES_PER_SECOND
-  };
-
-  for (UINT i=0; i<ARRAYSIZE(uintAttrs); i++) {
-    UINT32 value;
-    hr = processorOutputType->GetUINT32(uintAttrs[i], &value);
-    ENSURE_SUCCESS(hr, hr);
-
-    hr = encoderInputAudioType->SetUINT32(uintAttrs[i], value);
-    ENSURE_SUCCESS(hr, hr);
+  if (FAILED(mSink->GetError())) {
+    return mSink->GetError();
   }
-
-  *aOutEncoderAudioInputType = encoderInputAudioType.Detach();
-
-  return S_OK;
+  return E_FAIL;
 }
 
 HRESULT
-RotationTranscoder::Initialize()
+RotationTranscoder::Transcode()
 {
   HRESULT hr;
-
-  hr = mFrameRotator.Init();
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = CreateReader();
-  ENSURE_SUCCESS(hr, hr);
-
-  const wstring& outputFilename = mJob->GetOutputFilename();
-
-  IMFAttributesPtr attributes;
-  hr = MFCreateAttributes(&attributes, 1);
-  ENSURE_SUCCESS(hr, hr);
-  hr = attributes->SetGUID(MF_TRANSCODE_CONTAINERTYPE, MFTranscodeContainerType_MPEG4);
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = attributes->SetUINT32(MF_READWRITE_ENABLE_HARDWARE_TRANSFORMS, TRUE);
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = MFCreateSinkWriterFromURL(outputFilename.c_str(), NULL, attributes, &mWriter);
-  ENSURE_SUCCESS(hr, hr);
-
-  // Set the encoded output video type.
-  IMFMediaTypePtr encoderVideoOutputType;
-  hr = GetEncoderVideoOutputType(&encoderVideoOutputType);
-  ENSURE_SUCCESS(hr, hr);
-  hr = mWriter->AddStream(encoderVideoOutputType,
-                          &mEncoderVideoStreamIndex);
-  ENSURE_SUCCESS(hr, hr);
-  DBGMSG(L"Writer output video type:\n");
-  LogMediaType(encoderVideoOutputType);
-  DBGMSG(L"\n");
-
-  // Set the writer input video type.
-  IMFMediaTypePtr writerInputVideoType;
-  hr = GetEncoderVideoInputType(&writerInputVideoType);
-  ENSURE_SUCCESS(hr, hr);
-
-  hr = GetDefaultStride(writerInputVideoType, &mWriterInputVideoStride);
-  ENSURE_SUCCESS(hr, hr);
-
-  DBGMSG(L"Writer input video type:\n");
-  LogMediaType(writerInputVideoType);
-  DBGMSG(L"\n");
-
-  hr = mWriter->SetInputMediaType(mEncoderVideoStreamIndex,
-                                  writerInputVideoType,
-                                  NULL);
-  ENSURE_SUCCESS(hr, hr);
-
-  if (mDecoderAudioStreamIndex != -1) {
-    // We have audio. Set the encoded output audio type.
-    IMFMediaTypePtr encoderAudioOutputType;
-    hr = GetEncoderAudioOutputType(&encoderAudioOutputType);
-    ENSURE_SUCCESS(hr, hr);
-    hr = mWriter->AddStream(encoderAudioOutputType,
-                            &mEncoderAudioStreamIndex);
-    ENSURE_SUCCESS(hr, hr);
-
-    DBGMSG(L"Writer output audio type:\n");
-    LogMediaType(encoderAudioOutputType);
-    DBGMSG(L"\n");
-
-    // Set the writer's audio input type.
-    IMFMediaTypePtr writerInputAudioType;
-    hr = GetEncoderAudioInputType(&writerInputAudioType);
-    ENSURE_SUCCESS(hr, hr);
-    DBGMSG(L"Writer input audio type:\n");
-    LogMediaType(writerInputAudioType);
-    DBGMSG(L"\n");
-    hr = mWriter->SetInputMediaType(mEncoderAudioStreamIndex,
-                                    writerInputAudioType,
-                                    NULL);
-    if (FAILED(hr)) {
-      DBGMSG(L"Failed to set writer input audio type: hr=0x%x\n", hr);
-    }
-    ENSURE_SUCCESS(hr, hr);
+  if (mSegmented) {
+    hr = mSegmented->Transcode() ? S_OK : E_FAIL;
+  } else {
+    ENSURE_TRUE(mPipeline, E_UNEXPECTED);
+    hr = mPipeline->Transcode() ? S_OK : GetPipelineError();
   }
-
-  hr = mWriter->BeginWriting();
   ENSURE_SUCCESS(hr, hr);
 
-  mInitialized = true;
-
+  if (GetProgress() == 1000 && !mReportWritten) {
+    mReportWritten = true;
+    WriteReport();
+  }
   return S_OK;
 }
 
-// Transcodes. Call this in a loop until *aOutPercentComplete == 100.
-HRESULT
-RotationTranscoder::Transcode()
+static std::string
+WideToUtf8(const wstring& aString)
 {
-  IMFSamplePtr sample;
-  DWORD streamIndex, flags;
-  LONGLONG timestamp;
-  HRESULT hr;
-  uint64_t videoSampleNum = 0;
-
-  hr = mReader->ReadSample(MF_SOURCE_READER_ANY_STREAM,
-                           0,                // Flags.
-                           &streamIndex,     // Receives the actual stream index.
-                           &flags,           // Receives status flags.
-                           &timestamp,     // Receives the time stamp.
-                           &sample);         // Receives the sample or NULL.
-  if (FAILED(hr)) {
-    DBGMSG(L"ReadSample failed with 0x%x\n", hr);
-    return hr;
+  int length = WideCharToMultiByte(CP_UTF8, 0, aString.c_str(), -1,
+                                   nullptr, 0, nullptr, nullptr);
+  if (length <= 1) {
+    return std::string();
   }
+  std::vector<char> buffer(length);
+  WideCharToMultiByte(CP_UTF8, 0, aString.c_str(), -1,
+                      &buffer[0], length, nullptr, nullptr);
+  return std::string(&buffer[0]);
+}
 
-  bool isVideoSample = streamIndex == mDecoderVideoStreamIndex;
-  bool isAudioSample = streamIndex == mDecoderAudioStreamIndex;
-
-  if (flags & MF_SOURCE_READERF_ENDOFSTREAM) {
-    if (isVideoSample) {
-      mVideoEOS = true;
-    } else if (isAudioSample) {
-      mAudioEOS = true;
-    }
-  }
-  if (flags & MF_SOURCE_READERF_NEWSTREAM) {
-    DBGMSG(L"ReadSample flag: New stream\n");
+// Returns the size of aFilename in bytes, or 0 if we can't tell.
+static uint64_t
+GetFileSizeBytes(const wstring& aFilename)
+{
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!GetFileAttributesExW(aFilename.c_str(), GetFileExInfoStandard, &data)) {
+    return 0;
   }
-  if (flags & MF_SOURCE_READERF_CURRENTMEDIATYPECHANGED) {
-    DBGMSG(L"Current media type change to:\n");
-    IMFMediaTypePtr type;
-    hr = mReader->GetCurrentMediaType(streamIndex, &type);
-    ENSURE_SUCCESS(hr, hr)
-    LogMediaType(type);
-    DBGMSG(L"\n");
+  return (uint64_t(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+}
+
+void
+RotationTranscoder::WriteReport()
+{
+  TranscodeReportInfo info;
+  info.inputFilename = WideToUtf8(mJob->GetInputFilename());
+  info.outputFilename = WideToUtf8(mJob->GetOutputFilename());
+  info.pipelined = mJob->IsPipelined();
+  info.wallTimeUs = GetHighResTimeUs() - mStartTimeUs;
+  info.inputBytes = GetFileSizeBytes(mJob->GetInputFilename());
+  info.outputBytes = GetFileSizeBytes(mJob->GetOutputFilename());
+  const TranscodeStats* stats;
+  if (mSegmented) {
+    info.numSegments = mSegmented->GetNumSegments();
+    info.numVideoFrames = mSegmented->GetNumVideoFramesWritten();
+    stats = &mSegmented->GetStats();
+  } else {
+    info.startupLatencyUs = mPipeline->GetStartupLatencyUs();
+    info.numVideoFrames = mPipeline->GetNumVideoFramesWritten();
+    stats = &mPipeline->GetStats();
   }
-  if (flags & MF_SOURCE_READERF_STREAMTICK) {
-    DBGMSG(L"Stream tick\n");
+
+  const wstring filename = mJob->GetOutputFilename() + L".perf.json";
+  FILE* file = nullptr;
+  if (_wfopen_s(&file, filename.c_str(), L"wb") != 0 || !file) {
+    DBGMSG(L"Failed to open %s to write the performance report\n", filename.c_str());
+    return;
   }
-  if (flags & MF_SOURCE_READERF_NATIVEMEDIATYPECHANGED) {
-    // The format changed. Reconfigure the decoder.
-    DBGMSG(L"MF_SOURCE_READERF_NATIVEMEDIATYPECHANGED\n");
+  if (!WriteTranscodeReport(file, info, *stats)) {
+    DBGMSG(L"Failed to write the performance report to %s\n", filename.c_str());
+    return;
   }
+  DBGMSG(L"Wrote performance report to %s\n", filename.c_str());
+}
 
-  if (!sample) {
-    if (mAudioEOS && mVideoEOS) {
-      mProgress = 1000;
-      hr = mWriter->Finalize();
-      ENSURE_SUCCESS(hr, hr);
-    }
-    return S_OK;
-  }
+wstring
+RotationTranscoder::GetSegmentFilename(uint32_t aIndex) const
+{
+  return mJob->GetOutputFilename() + L".segment" + std::to_wstring(aIndex) + L".mp4";
+}
 
-  if (!isAudioSample && !isVideoSample) {
-    DBGMSG(L"This stream should be deselected!\n");
-    return S_OK;
+bool
+RotationTranscoder::OpenSegment(uint32_t aIndex,
+                                SegmentStreams* aOutStreams,
+                                TranscodeOptions* aOptions)
+{
+  std::unique_ptr<MFFrameSource> source(new MFFrameSource());
+  HRESULT hr = source->Init(mJob->GetInputFilename(), true);
+  std::unique_ptr<AudioProcessor> audioProcessor;
+  if (SUCCEEDED(hr) && source->HasAudio() && !source->IsAudioCompressed()) {
+    audioProcessor.reset(new AudioProcessor());
+    hr = audioProcessor->SetInputType(source->GetAudioMediaType(),
+                                      GetResampleQualityForPreset(mJob->GetEncoderPreset()));
+  }
+  std::unique_ptr<MFFrameSink> sink;
+  if (SUCCEEDED(hr)) {
+    hr = CreateSinkForSource(GetSegmentFilename(aIndex),
+                             mJob->GetRotation(),
+                             *source,
+                             audioProcessor.get(),
+                             mOutputWidth,
+                             mOutputHeight,
+                             GetEncoderPresetSettings(mJob->GetEncoderPreset()),
+                             &sink);
+  }
+  if (FAILED(hr)) {
+    DBGMSG(L"Failed to open segment %u hr=0x%x\n", aIndex, hr);
+    return false;
   }
 
-  if (isVideoSample) {
-    videoSampleNum++;
-    IMFSamplePtr rotated;
-    hr = mFrameRotator.RotateFrame(mJob->GetRotation(),
-                                   sample,
-                                   &mReaderOuptutPictureRegion,
-                                   mReaderOutputVideoStride,
-                                   mWriterInputVideoStride,
-                                   &rotated);
-    ENSURE_SUCCESS(hr, hr);
-    sample = rotated;
+  aOptions->outputStride = sink->GetVideoStride();
+  aOutStreams->source = std::move(source);
+  aOutStreams->audioFilter = std::move(audioProcessor);
+  aOutStreams->sink = std::move(sink);
+  return true;
+}
 
-    mLastVideoTimestamp = timestamp;
-  } else {
-    // Audio sample.
-    IMFSamplePtr processed;
-    hr = mAudioProcessor.Process(sample, &processed, mAudioEOS);
-    ENSURE_SUCCESS(hr, hr);
-    sample = processed;
+bool
+RotationTranscoder::OpenSegmentOutput(uint32_t aIndex,
+                                      std::unique_ptr<IFrameSource>* aOutSource)
+{
+  std::unique_ptr<MFFrameSource> source(new MFFrameSource());
+  HRESULT hr = source->InitCompressed(GetSegmentFilename(aIndex));
+  if (FAILED(hr)) {
+    DBGMSG(L"Failed to read back segment %u hr=0x%x\n", aIndex, hr);
+    return false;
   }
+  *aOutSource = std::move(source);
+  return true;
+}
 
-  DWORD encoderStreamIndex = isVideoSample ? mEncoderVideoStreamIndex
-                                           : mEncoderAudioStreamIndex;
-  hr = mWriter->WriteSample(encoderStreamIndex, sample);
+bool
+RotationTranscoder::CreateJoinedSink(IFrameSource* aFirstSegment,
+                                     std::unique_ptr<IFrameSink>* aOutSink)
+{
+  // The segments are read back by OpenSegmentOutput(), and encoded with the
+  // same settings, so the first segment's types suit them all.
+  MFFrameSource* segment = static_cast<MFFrameSource*>(aFirstSegment);
+  std::unique_ptr<MFFrameSink> sink(new MFFrameSink());
+  HRESULT hr = sink->InitPassthrough(mJob->GetOutputFilename(),
+                                     segment->GetVideoMediaType(),
+                                     segment->HasAudio() ? segment->GetAudioMediaType() : nullptr);
   if (FAILED(hr)) {
-    DBGMSG(L"Failed writing %s, sample 0x%x hr=0x%x\n", (isAudioSample ? L"audio" : L"video"), hr);
-    return hr;
+    DBGMSG(L"Failed to create the joined output hr=0x%x\n", hr);
+    return false;
   }
+  *aOutSink = std::move(sink);
+  return true;
+}
 
-  if (mAudioEOS && mVideoEOS) {
-    mProgress = 1000;
-    hr = mWriter->Finalize();
-    ENSURE_SUCCESS(hr, hr);
-  } else {
-    UINT32 progress = floor(1000.0 * (double)(mLastVideoTimestamp) / (double)(mDuration));
-    mProgress = max(1, min(999, progress));
+void
+RotationTranscoder::RemoveSegmentOutput(uint32_t aIndex)
+{
+  DeleteFileW(GetSegmentFilename(aIndex).c_str());
+}
+
+/* static */
+void
+RotationTranscoder::RunBenchmark(const wstring& aInputFilename,
+                                 const wstring& aOutputFilename,
+                                 EncoderPreset aPreset)
+{
+  for (int pipelined = 0; pipelined < 2; pipelined++) {
+    TranscodeJob job(aInputFilename, aOutputFilename, ROTATE_90);
+    job.SetMode(TranscodeMode_Reencode);
+    job.SetPipelined(pipelined != 0);
+    job.SetNumSegments(1);
+    job.SetEncoderPreset(aPreset);
+    RotationTranscoder transcoder(&job);
+
+    uint64_t start = GetHighResTimeUs();
+    HRESULT hr = transcoder.Initialize();
+    while (SUCCEEDED(hr) && transcoder.GetProgress() < 1000) {
+      hr = transcoder.Transcode();
+    }
+    uint64_t elapsedUs = GetHighResTimeUs() - start;
+    if (FAILED(hr)) {
+      DBGMSG(L"Benchmark transcode failed with 0x%x\n", hr);
+      return;
+    }
+
+    double seconds = elapsedUs / 1e6;
+    uint64_t frames = transcoder.mPipeline->GetNumVideoFramesWritten();
+    DBGMSG(L"Benchmark %s, %S preset: %u frames in %.0lf ms, %.1lf fps, startup latency %.1lf ms\n",
+           (pipelined ? L"pipelined" : L"serial"),
+           GetEncoderPresetName(aPreset),
+           (UINT32)frames,
+           seconds * 1000.0,
+           frames / max(seconds, 1e-6),
+           transcoder.mPipeline->GetStartupLatencyUs() / 1000.0);
   }
-  return S_OK;
+}
+
+LONGLONG
+RotationTranscoder::GetDuration()
+{
+  return mSource.GetDuration();
 }
 
 UINT32
 RotationTranscoder::GetProgress()
 {
-  return mProgress;
+  if (mSegmented) {
+    return mSegmented->GetProgress();
+  }
+  return mPipeline ? mPipeline->GetProgress() : 0;
 }
@@ -14,77 +14,92 @@
 
 #pragma once
 
-#include "FrameRotator.h"
 #include "AudioProcessor.h"
+#include "Interfaces.h"
+#include "MFFrameSink.h"
+#include "MFFrameSource.h"
+#include "SegmentedTranscode.h"
+#include "TranscodePipeline.h"
 
-class TranscodeJob;
+#include <memory>
 
-enum {
-  Unknown = -1
-};
+class TranscodeJob;
 
-class RotationTranscoder {
+// Rotates by decoding, rotating each frame, and reencoding. This connects
+// the Media Foundation backends of IFrameSource and IFrameSink with a
+// TranscodePipeline, which does the work. Long inputs are split into
+// segments at their keyframes, which are transcoded concurrently by a
+// SegmentedTranscode into temporary files next to the output, and joined.
+class RotationTranscoder : public Transcoder,
+                           private ISegmentBackend {
 public:
   RotationTranscoder(const TranscodeJob* aJob);
   ~RotationTranscoder();
 
-  HRESULT Initialize();
+  HRESULT Initialize() override;
 
-  // Transcodes. Call this in a loop until GetPercentComplete() returns 100.
-  HRESULT Transcode();
+  // Transcodes. Call this in a loop until GetProgress() returns 1000.
+  HRESULT Transcode() override;
 
   // Returns how many thousandths through the transcode we are.
-  UINT32 GetProgress();
+  UINT32 GetProgress() override;
 
-private:
+  LONGLONG GetDuration() override;
 
-  HRESULT CreateReader();
-  HRESULT ConfigureReaderVideoOutput();
-  HRESULT ConfigureReaderAudioOutput();
-  
-  HRESULT DetermineReaderOutputVideoType(IMFMediaType** aOutVideoType);
+  // Rotates aInputFilename by 90 degrees into aOutputFilename twice, once
+  // with the stages run one after another and once pipelined, encoding
+  // with aPreset, and logs how long each took. Run from the command line
+  // with --benchmark-transcode.
+  static void RunBenchmark(const std::wstring& aInputFilename,
+                           const std::wstring& aOutputFilename,
+                           EncoderPreset aPreset);
 
-  HRESULT GetEncoderVideoOutputType(IMFMediaType** aOutVideoType);
-  HRESULT GetEncoderAudioOutputType(IMFMediaType** aOutAudioType);
-  HRESULT GetEncoderVideoInputType(IMFMediaType** aOutVideoType);
-  HRESULT GetEncoderAudioInputType(IMFMediaType** aOutAudioType);
+private:
 
-  FrameRotator mFrameRotator;
-  AudioProcessor mAudioProcessor;
+  // Returns the segments to split the input into; just one if it shouldn't
+  // be split.
+  std::vector<TranscodeSegment> ChooseSegments();
 
-  const TranscodeJob* mJob;
+  // Returns the error which made the pipeline fail.
+  HRESULT GetPipelineError() const;
 
-  IMFMediaTypePtr mReaderOutputRGBVideoType;
+  // Returns the name of the temporary file segment aIndex is written to.
+  std::wstring GetSegmentFilename(uint32_t aIndex) const;
 
-  IMFSourceReaderPtr mReader;
-  IMFSinkWriterPtr mWriter;
+  // Writes how long each stage of the transcode took, and how fast it was
+  // overall, as JSON to <output>.perf.json. Called once the output is
+  // finished.
+  void WriteReport();
 
-  DWORD mDecoderVideoStreamIndex;
-  DWORD mDecoderAudioStreamIndex;
-  DWORD mEncoderVideoStreamIndex;
-  DWORD mEncoderAudioStreamIndex;
+  // ISegmentBackend methods. OpenSegment() is called on the segments'
+  // threads, so it only reads what Initialize() set up.
+  bool OpenSegment(uint32_t aIndex,
+                   SegmentStreams* aOutStreams,
+                   TranscodeOptions* aOptions) override;
+  bool OpenSegmentOutput(uint32_t aIndex,
+                         std::unique_ptr<IFrameSource>* aOutSource) override;
+  bool CreateJoinedSink(IFrameSource* aFirstSegment,
+                        std::unique_ptr<IFrameSink>* aOutSink) override;
+  void RemoveSegmentOutput(uint32_t aIndex) override;
 
-  LONG mReaderOutputVideoStride;
-  LONG mWriterInputVideoStride;
+  const TranscodeJob* mJob;
 
-  // H264 stream properties, extracked from the reader's output.
-  UINT32 mH264Profile;
-  UINT32 mAvgBitRate;
-  UINT32 mInterlaceMode;
-  UINT32 mFrameRateNumer;
-  UINT32 mFrameRateDenom;
-  UINT32 mPixelAspectRatioNumer;
-  UINT32 mPixelAspectRatioDenom;
+  // When Initialize() was called, which the startup latency is measured
+  // from.
+  uint64_t mStartTimeUs;
 
-  // The region inside the frame in which the picture actually resides.
-  MFVideoArea mReaderOuptutPictureRegion;
+  // The size of the encoded frames.
+  UINT32 mOutputWidth;
+  UINT32 mOutputHeight;
 
-  UINT32 mProgress;
+  bool mReportWritten;
 
-  LONGLONG mDuration;
-  LONGLONG mLastVideoTimestamp;
+  MFFrameSource mSource;
+  AudioProcessor mAudioProcessor;
+  std::unique_ptr<MFFrameSink> mSink;
 
-  bool mInitialized;
-  bool mAudioEOS;
-  bool mVideoEOS;
+  // Declared last, so that they're destroyed first, and their stages have
+  // stopped before the source and sink go away. Only one of them is used.
+  std::unique_ptr<TranscodePipeline> mPipeline;
+  std::unique_ptr<SegmentedTranscode> mSegmented;
 };
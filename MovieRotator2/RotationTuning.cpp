@@ -0,0 +1,118 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "stdafx.h"
+#include "RotationTuning.h"
+#include "CpuFeatures.h"
+#include "HighResClock.h"
+#include "ImageRotator.h"
+
+using std::wstring;
+using std::string;
+
+// Tile shapes are tuned once per process.
+static std::mutex sTileShapeMutex;
+static bool sHaveTileShape = false;
+static RotateKernel sTileShapeKernel = RotateKernel_Auto;
+static RotateTileShape sTileShape;
+
+// Returns the key which identifies tuning results for aKernel on this CPU in
+// the RotationTuningPath file. Results from one CPU model don't apply to
+// another, as the best tile shape depends on the cache sizes. The version
+// is bumped when the tuning changes, so that older results are retuned;
+// version 1 only timed 1080p RGB32 frames.
+static const char* const TuningVersion = "v2";
+
+static wstring
+GetTuningKey(RotateKernel aKernel)
+{
+  string key = string(TuningVersion) + " " + GetRotateKernelName(aKernel) + " " +
+               GetCpuModelName();
+  return wstring(key.begin(), key.end());
+}
+
+// Looks up the tuned tile shape for aKey in the RotationTuningPath file.
+// Each line in the file is "<tile width> <tile height> <key>".
+static bool
+LoadTileShape(const wstring& aKey, RotateTileShape* aOutTile)
+{
+  FILE* file = nullptr;
+  if (FAILED(OpenSpecialFile(RotationTuningPath, Read, &file))) {
+    return false;
+  }
+  bool found = false;
+  wchar_t line[512];
+  while (!found && fgetws(line, ARRAYSIZE(line), file)) {
+    unsigned width = 0, height = 0;
+    int keyOffset = 0;
+    if (swscanf_s(line, L"%u %u %n", &width, &height, &keyOffset) != 2) {
+      continue;
+    }
+    wstring key(line + keyOffset);
+    while (!key.empty() && iswspace(key[key.size() - 1])) {
+      key.resize(key.size() - 1);
+    }
+    if (key == aKey) {
+      *aOutTile = RotateTileShape(width, height);
+      found = true;
+    }
+  }
+  fclose(file);
+  return found;
+}
+
+static void
+StoreTileShape(const wstring& aKey, const RotateTileShape& aTile)
+{
+  FILE* file = nullptr;
+  if (FAILED(OpenSpecialFile(RotationTuningPath, Append, &file))) {
+    DBGMSG(L"Failed to open rotation tuning file for writing\n");
+    return;
+  }
+  fwprintf(file, L"%u %u %s\n", aTile.width, aTile.height, aKey.c_str());
+  fclose(file);
+}
+
+RotateTileShape
+GetTunedRotateTileShape(RotateKernel aKernel)
+{
+  std::lock_guard<std::mutex> lock(sTileShapeMutex);
+  if (!sHaveTileShape || sTileShapeKernel != aKernel) {
+    wstring key = GetTuningKey(aKernel);
+    if (!LoadTileShape(key, &sTileShape)) {
+      const uint64_t start = GetHighResTimeUs();
+      sTileShape = AutotuneRotateTileShape(aKernel);
+      DBGMSG(L"Rotation autotuning took %.1lf ms\n", (GetHighResTimeUs() - start) / 1e3);
+      StoreTileShape(key, sTileShape);
+    }
+    sHaveTileShape = true;
+    sTileShapeKernel = aKernel;
+    DBGMSG(L"Rotating with %ux%u transpose tiles for %s\n",
+           sTileShape.width, sTileShape.height, key.c_str());
+  }
+  return sTileShape;
+}
+
+void
+RunRotationBenchmark()
+{
+  MeasureRotationScaling(max(1u, std::thread::hardware_concurrency()),
+                         GetTunedRotateTileShape(GetBestRotateKernel()),
+                         [](const RotationScalingSample& aSample) {
+    DBGMSG(L"Rotation benchmark %ux%u %S, %u threads: %.2lf ms/frame, %.2lfx speedup\n",
+           aSample.width, aSample.height, GetPixelFormatName(aSample.format),
+           aSample.numThreads, aSample.msPerFrame, aSample.speedup);
+  });
+}
@@ -0,0 +1,31 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Tuning of the rotation kernels for the CPU we're running on.
+
+#pragma once
+
+#include "RotationKernels.h"
+
+// Returns the fastest transpose tile shape for aKernel on this CPU. The
+// shape is autotuned the first time we run on a given CPU model, and the
+// result is stored in the RotationTuningPath file so that later runs don't
+// pay for the tuning again. Threadsafe.
+RotateTileShape GetTunedRotateTileShape(RotateKernel aKernel);
+
+// Logs how long rotating 1080p and 4K RGB32 and NV12 frames takes with 1 up
+// to N threads, where N is the number of hardware threads; see
+// MeasureRotationScaling(). For debugging.
+void RunRotationBenchmark();
@@ -0,0 +1,252 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "SegmentedTranscode.h"
+#include "HighResClock.h"
+
+#include <algorithm>
+
+// How long Transcode() waits for the segments before returning, so that the
+// caller can report progress and notice cancellation.
+static const uint64_t ProgressIntervalUs = 100000;
+
+// How often Transcode() checks whether a segment has finished while it
+// waits.
+static const uint64_t PollIntervalUs = 5000;
+
+// The share of the progress given to transcoding the segments, in
+// thousandths; the rest is joining them.
+static const uint32_t SegmentsProgress = 950;
+
+SegmentedTranscode::SegmentedTranscode(ISegmentBackend* aBackend)
+  : mBackend(aBackend),
+    mDuration(0),
+    mNumRunning(0),
+    mCancelled(false),
+    mStarted(false),
+    mJoinIndex(0),
+    mJoinedAudioEnd(INT64_MIN),
+    mProgress(0)
+{
+}
+
+SegmentedTranscode::~SegmentedTranscode()
+{
+  mCancelled = true;
+  JoinSegments();
+  mJoinSource.reset();
+  mSink.reset();
+  for (uint32_t i = 0; i < mRemoved.size(); i++) {
+    if (!mRemoved[i]) {
+      mBackend->RemoveSegmentOutput(i);
+    }
+  }
+}
+
+bool
+SegmentedTranscode::Init(const std::vector<TranscodeSegment>& aSegments,
+                         int64_t aDuration,
+                         const TranscodeOptions& aOptions)
+{
+  if (aSegments.empty()) {
+    return false;
+  }
+  mDuration = aDuration;
+  mOptions = aOptions;
+  if (!mOptions.numRotationThreads) {
+    // Each segment rotates on its own threads, so divide the hardware
+    // threads between them, rather than oversubscribe them.
+    const uint32_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+    mOptions.numRotationThreads = std::max(1u, numThreads / uint32_t(aSegments.size()));
+  }
+  for (size_t i = 0; i < aSegments.size(); i++) {
+    mSegments.push_back(std::unique_ptr<Segment>(new Segment()));
+    mSegments.back()->span = aSegments[i];
+  }
+  mRemoved.resize(aSegments.size(), true);
+  return true;
+}
+
+uint64_t
+SegmentedTranscode::GetNumVideoFramesWritten() const
+{
+  uint64_t total = 0;
+  for (size_t i = 0; i < mSegments.size(); i++) {
+    total += mSegments[i]->numVideoFramesWritten;
+  }
+  return total;
+}
+
+void
+SegmentedTranscode::StartSegments()
+{
+  mStarted = true;
+  mNumRunning = uint32_t(mSegments.size());
+  for (uint32_t i = 0; i < mSegments.size(); i++) {
+    mRemoved[i] = false;
+    mSegments[i]->thread = std::thread([this, i]() { RunSegment(i); });
+  }
+}
+
+void
+SegmentedTranscode::JoinSegments()
+{
+  for (size_t i = 0; i < mSegments.size(); i++) {
+    if (mSegments[i]->thread.joinable()) {
+      mSegments[i]->thread.join();
+    }
+  }
+}
+
+void
+SegmentedTranscode::RunSegment(uint32_t aIndex)
+{
+  AutoThreadHook hook(mOptions.threadHook);
+  Segment& segment = *mSegments[aIndex];
+  bool succeeded = false;
+  TranscodeStats stats;
+  {
+    TranscodeOptions options = mOptions;
+    options.segment = segment.span;
+    SegmentStreams streams;
+    if (mBackend->OpenSegment(aIndex, &streams, &options) &&
+        (!segment.span.start || streams.source->Seek(segment.span.start))) {
+      // Declared after the streams, so that it's destroyed first, and its
+      // stages have stopped before the source and sink go away.
+      TranscodePipeline pipeline(streams.source.get(),
+                                 streams.audioFilter.get(),
+                                 streams.sink.get());
+      succeeded = pipeline.Init(options);
+      while (succeeded && pipeline.GetProgress() < 1000 && !mCancelled) {
+        succeeded = pipeline.Transcode();
+        segment.progress = pipeline.GetProgress();
+        segment.numVideoFramesWritten = pipeline.GetNumVideoFramesWritten();
+      }
+      // The pipeline's stages have stopped once it's finished or failed,
+      // but not if we were cancelled part way through.
+      if (!mCancelled) {
+        stats = pipeline.GetStats();
+      }
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mMutex);
+  mStats.Merge(stats);
+  segment.finished = true;
+  segment.failed = !succeeded || mCancelled;
+  mNumRunning--;
+}
+
+void
+SegmentedTranscode::UpdateProgress(uint32_t aProgress)
+{
+  mProgress = std::max(1u, std::min(999u, aProgress));
+}
+
+bool
+SegmentedTranscode::Transcode()
+{
+  if (mProgress == 1000) {
+    return true;
+  }
+  if (!mStarted) {
+    StartSegments();
+  }
+
+  {
+    // Wait until a segment finishes, or the interval is up. This sleeps in
+    // short steps, paced by GetHighResTimeUs(), rather than in a timed wait
+    // on a condition variable, which VS2012 bases on the system clock.
+    const uint64_t deadlineUs = GetHighResTimeUs() + ProgressIntervalUs;
+    std::unique_lock<std::mutex> lock(mMutex);
+    const uint32_t numRunning = mNumRunning;
+    while (mNumRunning && mNumRunning == numRunning && GetHighResTimeUs() < deadlineUs) {
+      lock.unlock();
+      SleepUs(PollIntervalUs);
+      lock.lock();
+    }
+    for (size_t i = 0; i < mSegments.size(); i++) {
+      if (mSegments[i]->failed) {
+        // Stop the other segments; their work is wasted now.
+        mCancelled = true;
+        return false;
+      }
+    }
+    if (mNumRunning) {
+      // Weight each segment's progress by its length.
+      double progress = 0.0;
+      for (size_t i = 0; i < mSegments.size(); i++) {
+        const TranscodeSegment& span = mSegments[i]->span;
+        const int64_t length = std::min(span.end, mDuration) - span.start;
+        progress += double(mSegments[i]->progress) * std::max<int64_t>(length, 0);
+      }
+      progress /= 1000.0 * std::max<int64_t>(mDuration, 1);
+      UpdateProgress(uint32_t(progress * SegmentsProgress));
+      return true;
+    }
+  }
+
+  JoinSegments();
+  return JoinNextFrame();
+}
+
+bool
+SegmentedTranscode::JoinNextFrame()
+{
+  if (!mJoinSource) {
+    if (!mBackend->OpenSegmentOutput(mJoinIndex, &mJoinSource)) {
+      return false;
+    }
+    if (!mSink && !mBackend->CreateJoinedSink(mJoinSource.get(), &mSink)) {
+      return false;
+    }
+  }
+
+  MediaFrame frame;
+  bool endOfStream = false;
+  if (!mJoinSource->ReadFrame(&frame, &endOfStream)) {
+    return false;
+  }
+  if (endOfStream) {
+    mJoinSource.reset();
+    mBackend->RemoveSegmentOutput(mJoinIndex);
+    mRemoved[mJoinIndex] = true;
+    if (++mJoinIndex < mSegments.size()) {
+      return true;
+    }
+    if (!mSink->Finish()) {
+      return false;
+    }
+    mProgress = 1000;
+    return true;
+  }
+
+  frame.timestamp += mSegments[mJoinIndex]->span.start;
+  if (frame.stream == Stream_Audio) {
+    if (frame.timestamp + frame.duration / 2 <= mJoinedAudioEnd) {
+      return true;
+    }
+    mJoinedAudioEnd = frame.timestamp + frame.duration;
+  }
+  if (!mSink->WriteFrame(frame)) {
+    return false;
+  }
+
+  if (frame.stream == Stream_Video && mDuration > 0) {
+    const int64_t progress = (1000 - SegmentsProgress) * frame.timestamp / mDuration;
+    UpdateProgress(SegmentsProgress + uint32_t(std::max<int64_t>(progress, 0)));
+  }
+  return true;
+}
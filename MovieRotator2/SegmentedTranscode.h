@@ -0,0 +1,158 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Transcodes a long input as several segments split at keyframes, each with
+// its own source, pipeline and sink on its own thread, so that one input
+// can keep more cores busy than one pipeline does. Once every segment is
+// written, their frames are read back without being decoded, and copied
+// into the output one after another, with the segments' start times added
+// back on to their timestamps.
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "FrameSource.h"
+#include "KeyframeIndex.h"
+#include "TranscodePipeline.h"
+
+// The source, audio filter and sink which one segment is transcoded with.
+struct SegmentStreams {
+  std::unique_ptr<IFrameSource> source;
+  // May be null, in which case audio is written as it's read.
+  std::unique_ptr<IAudioFilter> audioFilter;
+  std::unique_ptr<IFrameSink> sink;
+};
+
+// Opens the files of a segmented transcode. OpenSegment() is called on the
+// segments' threads, concurrently, and everything else on the thread
+// calling SegmentedTranscode::Transcode().
+class ISegmentBackend {
+public:
+  virtual ~ISegmentBackend() {}
+
+  // Opens the input to decode segment aIndex from, and creates the file
+  // its output is written to. *aOptions are the options the segment will
+  // be transcoded with, which the backend can adjust to suit the sink,
+  // e.g. its stride.
+  virtual bool OpenSegment(uint32_t aIndex,
+                           SegmentStreams* aOutStreams,
+                           TranscodeOptions* aOptions) = 0;
+
+  // Opens the output of segment aIndex to read its frames back without
+  // decoding them.
+  virtual bool OpenSegmentOutput(uint32_t aIndex,
+                                 std::unique_ptr<IFrameSource>* aOutSource) = 0;
+
+  // Creates the output the segments are joined into, for frames in the
+  // formats aFirstSegment reads them back in.
+  virtual bool CreateJoinedSink(IFrameSource* aFirstSegment,
+                                std::unique_ptr<IFrameSink>* aOutSink) = 0;
+
+  // Deletes the output of segment aIndex, once it's been joined, or the
+  // transcode has been abandoned.
+  virtual void RemoveSegmentOutput(uint32_t aIndex) = 0;
+};
+
+class SegmentedTranscode {
+public:
+  // aBackend must outlive us.
+  explicit SegmentedTranscode(ISegmentBackend* aBackend);
+
+  // Stops the segments' threads, in case we're destroyed part way through,
+  // and deletes the segments' outputs.
+  ~SegmentedTranscode();
+
+  // aSegments are from SplitAtKeyframes(), for a source of aDuration. Each
+  // segment is transcoded with aOptions, except that if they leave the
+  // number of rotation threads up to us, the hardware threads are shared
+  // between the segments.
+  bool Init(const std::vector<TranscodeSegment>& aSegments,
+            int64_t aDuration,
+            const TranscodeOptions& aOptions);
+
+  // Starts the segments, then waits a little for them to progress, and
+  // once they're all written, copies the next frame into the output. Call
+  // this in a loop until GetProgress() returns 1000. Returns false if any
+  // segment, or the join, has failed.
+  bool Transcode();
+
+  // Returns how many thousandths through the transcode we are. Joining the
+  // segments counts for the last twentieth.
+  uint32_t GetProgress() const { return mProgress; }
+
+  uint32_t GetNumSegments() const { return uint32_t(mSegments.size()); }
+
+  uint64_t GetNumVideoFramesWritten() const;
+
+  // The stats of every segment's pipeline, merged as each one finishes.
+  // Only read this once the transcode has finished.
+  const TranscodeStats& GetStats() const { return mStats; }
+
+private:
+  SegmentedTranscode(const SegmentedTranscode&);
+  SegmentedTranscode& operator=(const SegmentedTranscode&);
+
+  struct Segment {
+    Segment() : progress(0), numVideoFramesWritten(0), finished(false), failed(false) {}
+    TranscodeSegment span;
+    std::thread thread;
+    std::atomic<uint32_t> progress;
+    std::atomic<uint64_t> numVideoFramesWritten;
+    bool finished;
+    bool failed;
+  };
+
+  // Transcodes segment aIndex, on its thread.
+  void RunSegment(uint32_t aIndex);
+
+  void StartSegments();
+  void JoinSegments();
+
+  // Copies the next frame of the segments' outputs into mSink.
+  bool JoinNextFrame();
+
+  void UpdateProgress(uint32_t aProgress);
+
+  ISegmentBackend* mBackend;
+  TranscodeOptions mOptions;
+  int64_t mDuration;
+  std::vector<std::unique_ptr<Segment>> mSegments;
+
+  // Guards the segments' finished and failed flags, mNumRunning and mStats.
+  std::mutex mMutex;
+  uint32_t mNumRunning;
+  std::atomic<bool> mCancelled;
+  bool mStarted;
+  TranscodeStats mStats;
+
+  // The segment whose output is being copied into mSink, and where it's
+  // being read back from.
+  uint32_t mJoinIndex;
+  std::unique_ptr<IFrameSource> mJoinSource;
+  std::unique_ptr<IFrameSink> mSink;
+  // The end of the last audio written to mSink, so that audio which would
+  // overlap it, such as the encoder's priming at the start of each
+  // segment, can be dropped.
+  int64_t mJoinedAudioEnd;
+  // The segments whose outputs have been deleted.
+  std::vector<bool> mRemoved;
+
+  volatile uint32_t mProgress;
+};
@@ -0,0 +1,147 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// A command line tool which runs the checks and benchmarks SelfTest.h
+// declares, of the rotation and audio kernels, the transcode pipeline and
+// the preview's playback, by name, e.g. "SelfTest --check-planar-rotation".
+// It doesn't depend on Windows, so they can run on CI machines. It's not
+// part of the MovieRotator project; build it by compiling it with
+// AudioSelfTests.cpp, ClockSelfTests.cpp, PlaybackSelfTests.cpp,
+// RotationSelfTests.cpp and TranscodeSelfTests.cpp, and with the files
+// HeadlessTranscode.cpp is built with, except HeadlessTranscode.cpp itself.
+//
+// Usage: SelfTest <test>...
+
+#include <stdio.h>
+#include <string.h>
+
+#include "SelfTest.h"
+
+bool
+MakeImage(PixelFormat aFormat,
+          uint32_t aWidth,
+          uint32_t aHeight,
+          bool aBottomUp,
+          OwnedImage* aOutImage)
+{
+  const int32_t pitch = int32_t((aWidth * GetBytesPerPixel(aFormat, 0) + 63) & ~63);
+  const int32_t stride = aBottomUp ? -pitch : pitch;
+  std::vector<uint8_t>& buffer = aOutImage->buffer;
+  buffer.resize(GetImageBufferSize(aFormat, stride, aHeight));
+  uint32_t seed = aWidth * 7919 + aHeight;
+  for (size_t i = 0; i < buffer.size(); i++) {
+    seed = seed * 1664525 + 1013904223;
+    buffer[i] = uint8_t(seed >> 24);
+  }
+  return GetImageLayout(aFormat, &buffer[0], buffer.size(), stride, aHeight,
+                        aWidth, aHeight, &aOutImage->image);
+}
+
+std::vector<float>
+MakeNoise(size_t aNumSamples)
+{
+  std::vector<float> noise(aNumSamples);
+  uint32_t seed = 1;
+  for (size_t i = 0; i < noise.size(); i++) {
+    seed = seed * 1664525 + 1013904223;
+    noise[i] = float(int32_t(seed) / 2147483648.0 * 0.5);
+  }
+  return noise;
+}
+
+std::vector<uint8_t>
+EncodeSamples(const std::vector<float>& aSamples, uint32_t aBits)
+{
+  if (!aBits) {
+    std::vector<uint8_t> bytes(aSamples.size() * sizeof(float));
+    memcpy(&bytes[0], &aSamples[0], bytes.size());
+    return bytes;
+  }
+  const uint32_t bytesPerSample = aBits / 8;
+  std::vector<uint8_t> bytes(aSamples.size() * bytesPerSample);
+  for (size_t i = 0; i < aSamples.size(); i++) {
+    const int32_t value = int32_t(aSamples[i] * 2147483648.0);
+    for (uint32_t b = 0; b < bytesPerSample; b++) {
+      bytes[i * bytesPerSample + b] = uint8_t(uint32_t(value) >> (32 - aBits + 8 * b));
+    }
+  }
+  return bytes;
+}
+
+struct SelfTest {
+  const char* name;
+  bool (*run)();
+};
+
+static const SelfTest SelfTests[] = {
+  { "--benchmark-rotate", BenchmarkRotate },
+  { "--benchmark-rotate-tiles", BenchmarkRotateTiles },
+  { "--benchmark-rotate-threads", BenchmarkRotateThreads },
+  { "--check-planar-rotation", CheckPlanarRotation },
+  { "--check-rotate-scaler", CheckRotateScaler },
+  { "--check-frame-allocations", CheckFrameAllocations },
+  { "--check-mp4-metadata", CheckMp4Metadata },
+  { "--benchmark-resampler", BenchmarkResampler },
+  { "--benchmark-audio", BenchmarkAudio },
+  { "--check-audio-batching", CheckAudioBatching },
+  { "--benchmark-queues", BenchmarkQueues },
+  { "--stress-audio-callback", StressAudioCallback },
+  { "--simulate-decode-ahead", SimulateDecodeAhead },
+  { "--benchmark-decode-threads", BenchmarkDecodeThreads },
+  { "--check-playback-clock", CheckPlaybackClock },
+  { "--check-throughput", CheckThroughput },
+};
+
+static const size_t NumSelfTests = sizeof(SelfTests) / sizeof(SelfTests[0]);
+
+static const SelfTest*
+FindSelfTest(const char* aName)
+{
+  for (size_t i = 0; i < NumSelfTests; i++) {
+    if (!strcmp(SelfTests[i].name, aName)) {
+      return &SelfTests[i];
+    }
+  }
+  return nullptr;
+}
+
+// Runs each test named on the command line, in order, and fails if any
+// of them does.
+int
+main(int aArgc, char** aArgv)
+{
+  bool known = aArgc > 1;
+  for (int i = 1; i < aArgc; i++) {
+    known = known && FindSelfTest(aArgv[i]);
+  }
+  if (!known) {
+    fprintf(stderr, "Usage: %s <test>...\nTests:\n", aArgv[0]);
+    for (size_t i = 0; i < NumSelfTests; i++) {
+      fprintf(stderr, "  %s\n", SelfTests[i].name);
+    }
+    return 2;
+  }
+  bool ok = true;
+  for (int i = 1; i < aArgc; i++) {
+    if (aArgc > 2) {
+      printf("%s\n", aArgv[i]);
+    }
+    if (!FindSelfTest(aArgv[i])->run()) {
+      fprintf(stderr, "%s failed\n", aArgv[i]);
+      ok = false;
+    }
+  }
+  return ok ? 0 : 1;
+}
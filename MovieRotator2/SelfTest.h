@@ -0,0 +1,182 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// The checks and benchmarks the SelfTest tool runs, and the helpers they
+// share. Each returns false on error, or if a check fails. SelfTest.cpp
+// says how to build the tool.
+
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include "HighResClock.h"
+#include "RotationKernels.h"
+
+// RotationSelfTests.cpp
+
+// --benchmark-rotate measures how fast each of the RGB32 rotation kernels
+// rotates 720p, 1080p and 4K frames by each rotation, with positive and
+// negative strides, and checks that their output matches a reference
+// rotation's exactly.
+bool BenchmarkRotate();
+
+// --benchmark-rotate-tiles autotunes the transpose tile shape for each of
+// the RGB32 kernels, prints it, and compares how fast 1080p and 4K frames
+// are rotated by 90 and 270 degrees untiled and with the tuned tiles. On
+// Linux it also counts the cache and data TLB misses per pixel, where the
+// perf counters are available.
+bool BenchmarkRotateTiles();
+
+// --benchmark-rotate-threads measures how the rotation of 1080p and 4K
+// RGB32 and NV12 frames in parallel bands scales from 1 thread up to one
+// per hardware thread.
+bool BenchmarkRotateThreads();
+
+// --check-planar-rotation checks that rotating NV12 and I420 frames by each
+// rotation, with each chroma siting, matches a reference rotation done a
+// pixel at a time, plane by plane, chroma resiting included, with each
+// kernel and with ImageRotator's bands. Then it compares how fast 1080p
+// and 4K NV12 and I420 frames are rotated with RGB32.
+bool CheckPlanarRotation();
+
+// --check-rotate-scaler checks that RotateScaler's output, unscaled,
+// matches RotatePlane()'s exactly, that flat RGB32, NV12 and I420 frames
+// stay exactly flat when they're rotated and shrunk or enlarged with
+// either filter, and that frames cropped to a picture region are scaled
+// from the region alone.
+bool CheckRotateScaler();
+
+// TranscodeSelfTests.cpp
+
+// --check-frame-allocations transcodes a short and a long generated Y4M
+// and WAV file, serially and pipelined, counting the heap allocations made
+// with operator new and by the frame buffer pools, and checks that once
+// it's warmed up, transcoding doesn't allocate for each frame. Pipelined,
+// the pools may grow until the queues have been full, so a few more
+// allocations, up to the queues' capacity, are allowed.
+bool CheckFrameAllocations();
+
+// --check-mp4-metadata writes a small MP4 file, checks that its tracks,
+// duration and keyframes are read, and that its keyframes aren't read if
+// its stts counts more samples than its stsz. Then it rotates it by each
+// rotation by rewriting the display matrix, and checks that the matrix
+// reads back as written, and that nothing else in the file changed, and
+// that malformed boxes are rejected, without the file being written.
+bool CheckMp4Metadata();
+
+// AudioSelfTests.cpp
+
+// --benchmark-resampler measures how fast the resampler is with each of
+// its kernels, and how well it preserves sine waves, compared with ideal
+// ones, at each quality: the THD+N of a 1KHz tone, and the passband
+// ripple.
+bool BenchmarkResampler();
+
+// --benchmark-audio measures how fast the sample format conversion and
+// downmix kernels are, checks that the SIMD kernels match the scalar ones,
+// and measures the noise the dither adds. Then it measures how fast 5.1
+// 24 bit audio is converted for the encoder, with and without resampling.
+bool BenchmarkAudio();
+
+// --check-audio-batching feeds audio in frames of random sizes, with a
+// gap, through an AudioBatcher, and checks that every sample comes out
+// once, in whole AAC frames, and that the timestamps carry on without
+// drifting.
+bool CheckAudioBatching();
+
+// PlaybackSelfTests.cpp
+
+// --benchmark-queues compares how long popping from VideoDecoder's sample
+// queues takes while the decode thread, the audio callback and the paint
+// thread contend for them, with the SpscRings they are now and with the
+// mutex and condition variable they used to share.
+bool BenchmarkQueues();
+
+// --stress-audio-callback drives an AudioRingBuffer from a simulated audio
+// device thread, as the preview's cubeb callback does, while a stalling
+// decode thread fills it, and checks that underruns play silence, and are
+// counted, rather than losing or repeating audio.
+bool StressAudioCallback();
+
+// --simulate-decode-ahead simulates the preview decoding 4K video whose
+// decode time varies a lot, and compares how many frames are late with
+// the decode-ahead depth fixed at 2 frames and with it adapting, and
+// checks that the adaptive depth stays in its memory budget.
+bool SimulateDecodeAhead();
+
+// --benchmark-decode-threads plays from a stand-in for VideoDecoder whose
+// video decodes slower than real time, decoding audio and video on one
+// thread, as VideoDecoder used to, and on a thread each, as it does now,
+// and reports how often the audio underruns, and how far the video falls
+// behind.
+bool BenchmarkDecodeThreads();
+
+// ClockSelfTests.cpp
+
+// --check-playback-clock drives the preview's clocks with a fake clock,
+// and checks that the stopwatch only counts time it's running, that the
+// audio position interpolated between a drifting device's coarse updates
+// is smooth and tracks the device, and that the A/V drift estimate
+// recovers a known drift from noisy frame offsets.
+bool CheckPlaybackClock();
+
+// --check-throughput drives the job runner's throughput estimator and
+// progress throttle with a fake clock, and checks that the estimate and
+// the time left are right at a steady speed, ride out encoder stalls,
+// and follow a lasting change in speed as fast as the time constant says,
+// however often they're updated; and that progress is published about
+// once an interval, with the first and final progress always published.
+bool CheckThroughput();
+
+// Helpers, in SelfTest.cpp.
+
+// Returns the shortest time, in seconds, aRun takes in a few runs.
+template <typename Fn>
+double
+TimeFastest(Fn aRun)
+{
+  uint64_t fastestUs = UINT64_MAX;
+  for (int i = 0; i < 5; i++) {
+    const uint64_t start = GetHighResTimeUs();
+    aRun();
+    fastestUs = std::min(fastestUs, GetHighResTimeUs() - start);
+  }
+  return std::max<uint64_t>(fastestUs, 1) / 1e6;
+}
+
+// An image in a buffer of its own.
+struct OwnedImage {
+  std::vector<uint8_t> buffer;
+  Image image;
+};
+
+// Lays out aOutImage as an aWidth x aHeight image in aFormat, in a buffer
+// laid out as Media Foundation lays frames out, with rows padded to a
+// multiple of 64 bytes, and bottom-up if aBottomUp. The buffer is filled
+// with noise, so that every pixel differs from its neighbours.
+bool MakeImage(PixelFormat aFormat,
+               uint32_t aWidth,
+               uint32_t aHeight,
+               bool aBottomUp,
+               OwnedImage* aOutImage);
+
+// Returns aNumSamples samples of white noise, at half full scale.
+std::vector<float> MakeNoise(size_t aNumSamples);
+
+// Returns aSamples, which are in [-1, 1), as little endian integer PCM of
+// aBits bits, or as float PCM if aBits is 0.
+std::vector<uint8_t> EncodeSamples(const std::vector<float>& aSamples, uint32_t aBits);
@@ -0,0 +1,199 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// A queue with a fixed capacity for handing items from exactly one producer
+// thread to exactly one consumer thread, such as decoded samples from the
+// decode thread to the audio callback. Pushing and popping are wait-free;
+// neither side takes a lock or makes a system call, so the consumer can be
+// a real time thread. The ring never blocks; a side which needs to wait for
+// the other sleeps on a WakeupEvent, which the other side only signals when
+// somebody is waiting, so the common case doesn't pay for a wakeup.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+template<typename T>
+class SpscRing {
+public:
+  // aCapacity is the most items the ring holds; it's rounded up to a power
+  // of two.
+  explicit SpscRing(size_t aCapacity)
+    : mSlots(RoundUpToPowerOfTwo(aCapacity)),
+      mMask(mSlots.size() - 1),
+      mHead(0),
+      mCachedTail(0),
+      mTail(0),
+      mCachedHead(0)
+  {
+  }
+
+  // Producer only. Appends aItem, or returns false, and leaves aItem alone,
+  // if the ring is full.
+  bool TryPush(T& aItem) {
+    const size_t tail = mTail.load(std::memory_order_relaxed);
+    if (tail - mCachedHead > mMask) {
+      // Only reread the consumer's index when the ring looks full, so that
+      // the two sides don't keep stealing each other's cache lines.
+      mCachedHead = mHead.load(std::memory_order_acquire);
+      if (tail - mCachedHead > mMask) {
+        return false;
+      }
+    }
+    mSlots[tail & mMask] = std::move(aItem);
+    mTail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only. Returns the item at the front of the ring without
+  // removing it, or nullptr if the ring is empty. The item stays put until
+  // the consumer pops it.
+  T* Peek() {
+    const size_t head = mHead.load(std::memory_order_relaxed);
+    if (head == mCachedTail) {
+      mCachedTail = mTail.load(std::memory_order_acquire);
+      if (head == mCachedTail) {
+        return nullptr;
+      }
+    }
+    return &mSlots[head & mMask];
+  }
+
+  // Consumer only. Removes the item at the front into *aOutItem, or returns
+  // false if the ring is empty.
+  bool TryPop(T* aOutItem) {
+    T* front = Peek();
+    if (!front) {
+      return false;
+    }
+    *aOutItem = std::move(*front);
+    mHead.store(mHead.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+    return true;
+  }
+
+  // The number of items in the ring. Threadsafe, but only a snapshot if
+  // the other side is running.
+  size_t Size() const {
+    // The head is read first, so that the size can't be negative.
+    const size_t head = mHead.load(std::memory_order_acquire);
+    const size_t tail = mTail.load(std::memory_order_acquire);
+    const size_t size = tail - head;
+    return size < mSlots.size() ? size : mSlots.size();
+  }
+
+  bool IsEmpty() const { return Size() == 0; }
+
+  size_t GetCapacity() const { return mSlots.size(); }
+
+private:
+  SpscRing(const SpscRing&);
+  SpscRing& operator=(const SpscRing&);
+
+  static size_t RoundUpToPowerOfTwo(size_t aValue) {
+    size_t capacity = 1;
+    while (capacity < aValue) {
+      capacity <<= 1;
+    }
+    return capacity;
+  }
+
+  // The indexes count up forever, and are masked to find the slot, so that
+  // a full ring can be told apart from an empty one.
+  std::vector<T> mSlots;
+  const size_t mMask;
+  // Each side's index and its cached copy of the other's are written
+  // together, so they're padded onto their own cache lines, away from the
+  // other side's.
+  char mPad0[64];
+  // Written by the consumer.
+  std::atomic<size_t> mHead;
+  size_t mCachedTail;
+  char mPad1[64];
+  // Written by the producer.
+  std::atomic<size_t> mTail;
+  size_t mCachedHead;
+  char mPad2[64];
+};
+
+// Lets a thread sleep until another thread changes something it's waiting
+// on, such as the size of an SpscRing, while costing the other thread only
+// a fence and a load when nobody is waiting, which is most of the time.
+// The state waited on must be atomic, as it's read without the lock.
+class WakeupEvent {
+public:
+  WakeupEvent()
+    : mNumWaiters(0),
+      mNumWakeups(0)
+  {
+  }
+
+  // Blocks until aReady() returns true.
+  template<typename Predicate>
+  void Wait(Predicate aReady) {
+    if (aReady()) {
+      return;
+    }
+    std::unique_lock<std::mutex> lock(mMutex);
+    mNumWaiters.fetch_add(1, std::memory_order_relaxed);
+    // Pairs with the fence in NotifyIf(). Either we see the change which
+    // made us ready, or the notifier sees that we're waiting.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (!aReady()) {
+      mCondVar.wait(lock);
+    }
+    mNumWaiters.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  // Wakes the waiting threads if there are any, and aReady() returns true;
+  // i.e. if the change the caller has just made has crossed the threshold
+  // they're waiting for. Call this after every change which could do so.
+  template<typename Predicate>
+  void NotifyIf(Predicate aReady) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!mNumWaiters.load(std::memory_order_relaxed) || !aReady()) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    mNumWakeups++;
+    mCondVar.notify_all();
+  }
+
+  // Wakes the waiting threads, whatever they're waiting for.
+  void Notify() {
+    NotifyIf([]() { return true; });
+  }
+
+  // The number of times waiting threads have been woken.
+  uint64_t GetNumWakeups() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mNumWakeups;
+  }
+
+private:
+  WakeupEvent(const WakeupEvent&);
+  WakeupEvent& operator=(const WakeupEvent&);
+
+  std::mutex mMutex;
+  std::condition_variable mCondVar;
+  std::atomic<uint32_t> mNumWaiters;
+  uint64_t mNumWakeups;
+};
@@ -0,0 +1,122 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(uint32_t aNumThreads)
+  : mTaskFunction(nullptr),
+    mTask(nullptr),
+    mNumTasks(0),
+    mNextTask(0),
+    mBatch(0),
+    mNumBusyWorkers(0),
+    mShutdown(false)
+{
+  if (aNumThreads == 0) {
+    aNumThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (uint32_t i = 1; i < aNumThreads; i++) {
+    mWorkers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mShutdown = true;
+  }
+  mBatchAvailable.notify_all();
+  for (size_t i = 0; i < mWorkers.size(); i++) {
+    mWorkers[i].join();
+  }
+}
+
+uint32_t
+ThreadPool::GetNumThreads() const
+{
+  return uint32_t(mWorkers.size()) + 1;
+}
+
+void
+ThreadPool::RunTasks()
+{
+  uint32_t task;
+  while ((task = mNextTask++) < mNumTasks) {
+    mTaskFunction(mTask, task);
+  }
+}
+
+void
+ThreadPool::WorkerLoop()
+{
+  uint64_t lastBatch = 0;
+  std::unique_lock<std::mutex> lock(mMutex);
+  while (true) {
+    while (!mShutdown && mBatch == lastBatch) {
+      mBatchAvailable.wait(lock);
+    }
+    if (mShutdown) {
+      return;
+    }
+    lastBatch = mBatch;
+    mNumBusyWorkers++;
+    lock.unlock();
+
+    RunTasks();
+
+    lock.lock();
+    if (--mNumBusyWorkers == 0) {
+      mWorkersIdle.notify_all();
+    }
+  }
+}
+
+void
+ThreadPool::RunBatch(uint32_t aNumTasks, TaskFunction aFunction, const void* aTask)
+{
+  if (mWorkers.empty() || aNumTasks <= 1) {
+    for (uint32_t i = 0; i < aNumTasks; i++) {
+      aFunction(aTask, i);
+    }
+    return;
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mMutex);
+    // A worker which woke up late for the previous batch may still be
+    // looking for tasks in it. Wait for it before we replace the batch.
+    while (mNumBusyWorkers > 0) {
+      mWorkersIdle.wait(lock);
+    }
+    mTaskFunction = aFunction;
+    mTask = aTask;
+    mNumTasks = aNumTasks;
+    mNextTask = 0;
+    mBatch++;
+  }
+  mBatchAvailable.notify_all();
+
+  RunTasks();
+
+  // Once we've run out of tasks to claim, the only tasks still running are
+  // those claimed by busy workers.
+  std::unique_lock<std::mutex> lock(mMutex);
+  while (mNumBusyWorkers > 0) {
+    mWorkersIdle.wait(lock);
+  }
+}
@@ -0,0 +1,93 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// A fixed size pool of persistent worker threads, for splitting data
+// parallel work, such as rotating a frame, across cores without paying to
+// create threads for every frame.
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+  // Creates a pool which runs tasks on aNumThreads threads. The thread which
+  // calls ParallelFor() is one of them, so aNumThreads-1 workers are
+  // started. 0 means one thread per hardware thread.
+  explicit ThreadPool(uint32_t aNumThreads);
+
+  // Shuts down and joins the worker threads.
+  ~ThreadPool();
+
+  // Returns the number of threads tasks run on, including the caller's.
+  uint32_t GetNumThreads() const;
+
+  // Runs aTask(i) for every i in [0, aNumTasks), spread across the pool,
+  // and returns once they've all completed. Tasks may run in any order.
+  // Only one thread may call this at a time. aTask is called where it is,
+  // not copied into a std::function, so this doesn't allocate.
+  template<typename Task>
+  void ParallelFor(uint32_t aNumTasks, const Task& aTask)
+  {
+    RunBatch(aNumTasks, &CallTask<Task>, &aTask);
+  }
+
+private:
+  ThreadPool(const ThreadPool&);
+  ThreadPool& operator=(const ThreadPool&);
+
+  typedef void (*TaskFunction)(const void* aTask, uint32_t aIndex);
+
+  template<typename Task>
+  static void CallTask(const void* aTask, uint32_t aIndex)
+  {
+    (*static_cast<const Task*>(aTask))(aIndex);
+  }
+
+  // Runs aFunction(aTask, i) for every i in [0, aNumTasks), as
+  // ParallelFor() describes.
+  void RunBatch(uint32_t aNumTasks, TaskFunction aFunction, const void* aTask);
+
+  void WorkerLoop();
+
+  // Claims and runs tasks from the current batch until there are none left.
+  void RunTasks();
+
+  std::vector<std::thread> mWorkers;
+
+  // Protects the members below, and the state of the current batch.
+  std::mutex mMutex;
+  std::condition_variable mBatchAvailable;
+  std::condition_variable mWorkersIdle;
+
+  // The current batch. Set by RunBatch() while no workers are busy.
+  TaskFunction mTaskFunction;
+  const void* mTask;
+  uint32_t mNumTasks;
+  std::atomic<uint32_t> mNextTask;
+
+  // Incremented for every batch, so workers can tell when a new one starts.
+  uint64_t mBatch;
+
+  // Number of workers which are currently running tasks from a batch.
+  uint32_t mNumBusyWorkers;
+
+  bool mShutdown;
+};
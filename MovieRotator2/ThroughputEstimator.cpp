@@ -0,0 +1,110 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "ThroughputEstimator.h"
+#include "FrameSource.h"
+
+#include <math.h>
+#include <algorithm>
+
+// Positions are accumulated for at least this long before the throughput
+// over them is folded into the estimate.
+static const uint64_t SampleIntervalUs = 250000;
+
+ThroughputEstimator::ThroughputEstimator(uint64_t aTimeConstantUs)
+  : mTimeConstantUs(std::max<uint64_t>(aTimeConstantUs, 1)),
+    mDuration(0),
+    mPosition(0),
+    mSampleTimeUs(0),
+    mSamplePosition(0),
+    mRate(0.0),
+    mHasRate(false)
+{
+}
+
+void
+ThroughputEstimator::Start(uint64_t aNowUs, int64_t aDuration)
+{
+  mDuration = aDuration;
+  mPosition = 0;
+  mSampleTimeUs = aNowUs;
+  mSamplePosition = 0;
+  mRate = 0.0;
+  mHasRate = false;
+}
+
+void
+ThroughputEstimator::Update(uint64_t aNowUs, int64_t aPosition)
+{
+  mPosition = aPosition;
+  if (aNowUs < mSampleTimeUs + SampleIntervalUs) {
+    return;
+  }
+  const uint64_t elapsedUs = aNowUs - mSampleTimeUs;
+  const double mediaSeconds = double(aPosition - mSamplePosition) / TimeUnitsPerSecond;
+  const double rate = std::max(0.0, mediaSeconds * 1e6 / double(elapsedUs));
+  if (mHasRate) {
+    // Weight the interval by its length, so that the estimate's response
+    // doesn't depend on how often we're updated.
+    const double weight = 1.0 - exp(-double(elapsedUs) / double(mTimeConstantUs));
+    mRate += weight * (rate - mRate);
+  } else {
+    mRate = rate;
+    mHasRate = true;
+  }
+  mSampleTimeUs = aNowUs;
+  mSamplePosition = aPosition;
+}
+
+int64_t
+ThroughputEstimator::GetRemainingUs() const
+{
+  if (!mHasRate) {
+    return -1;
+  }
+  return EstimateTranscodeTimeUs(std::max<int64_t>(mDuration - mPosition, 0), mRate);
+}
+
+int64_t
+EstimateTranscodeTimeUs(int64_t aDuration, double aRate)
+{
+  if (aDuration < 0 || aRate <= 0.0) {
+    return -1;
+  }
+  return int64_t(double(aDuration) / TimeUnitsPerSecond / aRate * 1e6);
+}
+
+ProgressThrottle::ProgressThrottle(uint64_t aIntervalUs)
+  : mIntervalUs(aIntervalUs),
+    mLastPublishUs(0),
+    mLastProgress(0),
+    mPublished(false)
+{
+}
+
+bool
+ProgressThrottle::ShouldPublish(uint64_t aNowUs, uint32_t aProgress)
+{
+  if (mPublished && aProgress == mLastProgress) {
+    return false;
+  }
+  if (mPublished && aProgress < 1000 && aNowUs < mLastPublishUs + mIntervalUs) {
+    return false;
+  }
+  mPublished = true;
+  mLastPublishUs = aNowUs;
+  mLastProgress = aProgress;
+  return true;
+}
@@ -0,0 +1,90 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Estimates how long a transcode has left from how fast it's going, and
+// limits how often its progress is published.
+
+#pragma once
+
+#include <stdint.h>
+
+// Estimates throughput, in seconds of media transcoded per second of wall
+// clock time, as an exponentially weighted moving average, so that the
+// estimate rides out the encoder stalling at a keyframe, or the disk
+// stalling, but still follows lasting changes, such as a scene which is
+// harder to encode.
+class ThroughputEstimator {
+public:
+  // How quickly the estimate follows a change in throughput; it's moved
+  // about two thirds of the way to a new throughput after this long.
+  static const uint64_t DefaultTimeConstantUs = 5000000;
+
+  explicit ThroughputEstimator(uint64_t aTimeConstantUs = DefaultTimeConstantUs);
+
+  // Starts measuring a transcode of aDuration of media, in 100ns units,
+  // at time aNowUs.
+  void Start(uint64_t aNowUs, int64_t aDuration);
+
+  // Records that by aNowUs, the transcode has reached aPosition, in 100ns
+  // units. Positions closer together in time than a sampling interval are
+  // accumulated, so that calling this for every frame doesn't make the
+  // estimate noisy.
+  void Update(uint64_t aNowUs, int64_t aPosition);
+
+  bool HasEstimate() const { return mHasRate; }
+
+  // Media seconds transcoded per wall clock second, or 0 if there's no
+  // estimate yet.
+  double GetRate() const { return mHasRate ? mRate : 0.0; }
+
+  // The wall clock time the transcode has left, in microseconds, or -1 if
+  // there's no estimate yet.
+  int64_t GetRemainingUs() const;
+
+private:
+  uint64_t mTimeConstantUs;
+  int64_t mDuration;
+  int64_t mPosition;
+  // The time and position at the end of the last interval which was
+  // folded into the rate.
+  uint64_t mSampleTimeUs;
+  int64_t mSamplePosition;
+  double mRate;
+  bool mHasRate;
+};
+
+// Returns the wall clock time transcoding aDuration of media, in 100ns
+// units, takes at aRate media seconds per second, in microseconds, or -1
+// if either is unknown.
+int64_t EstimateTranscodeTimeUs(int64_t aDuration, double aRate);
+
+// Decides when to publish a job's progress, so that the UI is updated at a
+// steady rate, however long or short the job's media is, rather than every
+// thousandth of the way through it.
+class ProgressThrottle {
+public:
+  explicit ProgressThrottle(uint64_t aIntervalUs);
+
+  // Returns true if aProgress, in thousandths, should be published at
+  // aNowUs; that's if it's changed since it was last published, and either
+  // the interval has passed since then, or the job has just finished.
+  bool ShouldPublish(uint64_t aNowUs, uint32_t aProgress);
+
+private:
+  uint64_t mIntervalUs;
+  uint64_t mLastPublishUs;
+  uint32_t mLastProgress;
+  bool mPublished;
+};
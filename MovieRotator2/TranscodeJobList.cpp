@@ -16,6 +16,8 @@
 #include "TranscodeJobList.h"
 #include "TranscodeJobRunner.h"
 #include "D2DManager.h"
+#include "Mp4Metadata.h"
+#include "ThroughputEstimator.h"
 
 using std::wstring;
 
@@ -28,7 +30,16 @@ TranscodeJob::TranscodeJob(const wstring& aInputFilename,
     mInputFilename(aInputFilename),
     mOutputFilename(aOutputFilename),
     mRotation(aRotation),
+    mMode(TranscodeMode_Reencode),
+    mPipelined(true),
+    mNumRotationThreads(0),
+    mNumSegments(1),
+    mEncoderPreset(EncoderPreset_Archival),
+    mScaleFilter(ScaleFilter_Lanczos3),
     mProgress(0),
+    mDuration(0),
+    mMetadataOnly(false),
+    mRemainingUs(-1),
     mIsCanceled(false),
     mIsFailed(false)
 {
@@ -59,6 +70,90 @@ TranscodeJob::GetRotation() const
   return mRotation;
 }
 
+TranscodeMode
+TranscodeJob::GetMode() const
+{
+  return mMode;
+}
+
+void
+TranscodeJob::SetMode(TranscodeMode aMode)
+{
+  mMode = aMode;
+}
+
+bool
+TranscodeJob::IsPipelined() const
+{
+  return mPipelined;
+}
+
+void
+TranscodeJob::SetPipelined(bool aPipelined)
+{
+  mPipelined = aPipelined;
+}
+
+const TranscodeQueueDepths&
+TranscodeJob::GetQueueDepths() const
+{
+  return mQueueDepths;
+}
+
+void
+TranscodeJob::SetQueueDepths(const TranscodeQueueDepths& aDepths)
+{
+  mQueueDepths = aDepths;
+}
+
+UINT32
+TranscodeJob::GetNumRotationThreads() const
+{
+  return mNumRotationThreads;
+}
+
+void
+TranscodeJob::SetNumRotationThreads(UINT32 aNumThreads)
+{
+  mNumRotationThreads = aNumThreads;
+}
+
+UINT32
+TranscodeJob::GetNumSegments() const
+{
+  return mNumSegments;
+}
+
+void
+TranscodeJob::SetNumSegments(UINT32 aNumSegments)
+{
+  mNumSegments = aNumSegments;
+}
+
+EncoderPreset
+TranscodeJob::GetEncoderPreset() const
+{
+  return mEncoderPreset;
+}
+
+void
+TranscodeJob::SetEncoderPreset(EncoderPreset aPreset)
+{
+  mEncoderPreset = aPreset;
+}
+
+ScaleFilter
+TranscodeJob::GetScaleFilter() const
+{
+  return mScaleFilter;
+}
+
+void
+TranscodeJob::SetScaleFilter(ScaleFilter aFilter)
+{
+  mScaleFilter = aFilter;
+}
+
 UINT32
 TranscodeJob::GetProgress()
 {
@@ -72,6 +167,42 @@ TranscodeJob::SetProgress(UINT32 aProgress)
   mProgress = aProgress;
 }
 
+LONGLONG
+TranscodeJob::GetDuration() const
+{
+  return mDuration;
+}
+
+void
+TranscodeJob::SetDuration(LONGLONG aDuration)
+{
+  mDuration = aDuration;
+}
+
+bool
+TranscodeJob::IsMetadataOnly() const
+{
+  return mMetadataOnly;
+}
+
+void
+TranscodeJob::SetMetadataOnly(bool aMetadataOnly)
+{
+  mMetadataOnly = aMetadataOnly;
+}
+
+LONGLONG
+TranscodeJob::GetRemainingUs() const
+{
+  return mRemainingUs;
+}
+
+void
+TranscodeJob::SetRemainingUs(LONGLONG aRemainingUs)
+{
+  mRemainingUs = aRemainingUs;
+}
+
 TranscodeJobId
 TranscodeJob::GetId() const
 {
@@ -81,6 +212,8 @@ TranscodeJob::GetId() const
 
 TranscodeJobList::TranscodeJobList(HWND aHWnd)
   : mRunningJobId(TRANSCODE_JOB_INVALID_ID),
+    mReencodeRate(0.0),
+    mMetadataOnlyRate(0.0),
     mTranscoder(nullptr),
     mHWnd(aHWnd)
 {
@@ -90,9 +223,31 @@ TranscodeJobList::~TranscodeJobList()
 {
 }
 
+// Reads aJob's duration, and whether it can be rotated by rewriting the
+// display matrix, from its input's headers, if it's an MP4, so that we can
+// estimate how long it'll take before it starts. Other inputs are only
+// measured once they start.
+static void
+ProbeJob(TranscodeJob* aJob)
+{
+  FILE* file = nullptr;
+  if (_wfopen_s(&file, aJob->GetInputFilename().c_str(), L"rb") != 0 || !file) {
+    return;
+  }
+  Mp4File mp4(file);
+  int64_t duration = 0;
+  if (ReadMp4Duration(mp4, &duration)) {
+    aJob->SetDuration(duration);
+  }
+  aJob->SetMetadataOnly(aJob->GetMode() != TranscodeMode_Reencode &&
+                        CanRotateMp4Metadata(mp4));
+  fclose(file);
+}
+
 HRESULT
 TranscodeJobList::AddJob(TranscodeJob* aJob)
 {
+  ProbeJob(aJob);
   mJobs.push_back(aJob);
   EnsureJobRunning();
   PostMessage(mHWnd, MSG_JOBLIST_UPDATE, 0, 0);
@@ -241,6 +396,41 @@ TranscodeJobList::IsRunning()
   return false;
 }
 
+bool
+TranscodeJobList::GetProjectedRemainingUs(UINT32 aIndex, LONGLONG* aOutRemainingUs)
+{
+  if (aIndex >= mJobs.size()) {
+    return false;
+  }
+  // Jobs run in list order, so the job completes once every unfinished
+  // job up to and including it has.
+  LONGLONG total = 0;
+  for (UINT32 i = 0; i <= aIndex; i++) {
+    TranscodeJob* job = mJobs[i];
+    const UINT32 progress = job->GetProgress();
+    if (job->IsFailed() || job->IsCanceled() || progress == 1000) {
+      if (i == aIndex) {
+        return false;
+      }
+      continue;
+    }
+    LONGLONG remainingUs;
+    if (progress > 0) {
+      remainingUs = job->GetRemainingUs();
+    } else {
+      const double rate = job->IsMetadataOnly() ? mMetadataOnlyRate : mReencodeRate;
+      remainingUs = job->GetDuration() ? EstimateTranscodeTimeUs(job->GetDuration(), rate)
+                                       : -1;
+    }
+    if (remainingUs < 0) {
+      return false;
+    }
+    total += remainingUs;
+  }
+  *aOutRemainingUs = total;
+  return true;
+}
+
 bool
 TranscodeJobList::Handle(HWND hWnd,
                          UINT message,
@@ -272,6 +462,20 @@ TranscodeJobList::Handle(HWND hWnd,
       D2DManager::Invalidate();
       return true;
     }
+    case MSG_TRANSCODE_ESTIMATE: {
+      TranscodeJob* job = reinterpret_cast<TranscodeJob*>(lParam);
+      std::unique_ptr<TranscodeEstimate> estimate(reinterpret_cast<TranscodeEstimate*>(wParam));
+      if (estimate->duration) {
+        job->SetDuration(estimate->duration);
+      }
+      job->SetMetadataOnly(estimate->metadataOnly);
+      job->SetRemainingUs(estimate->remainingUs);
+      if (estimate->rate > 0.0) {
+        (estimate->metadataOnly ? mMetadataOnlyRate : mReencodeRate) = estimate->rate;
+      }
+      D2DManager::Invalidate();
+      return true;
+    }
     case MSG_TRANSCODE_FAILED: {
       TranscodeJob* job = reinterpret_cast<TranscodeJob*>(lParam);
       job->SetFailed();
@@ -17,7 +17,22 @@
 #pragma once
 
 #include "Utils.h"
+#include "EncoderSettings.h"
 #include "Interfaces.h"
+#include "TranscodePipeline.h"
+
+// How a job rotates its input.
+enum TranscodeMode {
+  // Rewrite the display matrix if the input is an MP4 which allows it,
+  // otherwise reencode. Only players which honor the display matrix show
+  // the result rotated, so this is only used if the user asks for it.
+  TranscodeMode_Auto,
+  // Decode, rotate the frames and reencode.
+  TranscodeMode_Reencode,
+  // Copy the input and rewrite its display matrix. Fails if the input
+  // doesn't allow it.
+  TranscodeMode_MetadataOnly
+};
 
 typedef UINT32 TranscodeJobId;
 #define TRANSCODE_JOB_INVALID_ID ((TranscodeJobId)(-1))
@@ -36,6 +51,43 @@ public:
 
   Rotation GetRotation() const;
 
+  // Defaults to TranscodeMode_Reencode.
+  TranscodeMode GetMode() const;
+  void SetMode(TranscodeMode aMode);
+
+  // Whether reencoding runs decode, rotation, audio processing and
+  // encoding as a pipeline, each stage on its own thread, connected by
+  // queues of the given depths. Otherwise the stages run one after another
+  // on one thread. Defaults to true.
+  bool IsPipelined() const;
+  void SetPipelined(bool aPipelined);
+  const TranscodeQueueDepths& GetQueueDepths() const;
+  void SetQueueDepths(const TranscodeQueueDepths& aDepths);
+
+  // Number of threads to rotate each frame on. 0, the default, means one
+  // per hardware thread, shared between the segments if the input is split.
+  UINT32 GetNumRotationThreads() const;
+  void SetNumRotationThreads(UINT32 aNumThreads);
+
+  // The most segments to split a long input into at its keyframes, to
+  // reencode concurrently and then join. 1, the default, disables
+  // splitting, until the join has been checked for A/V sync and gaps at
+  // the segment boundaries. 0 picks a number to suit the hardware. Only
+  // MP4 inputs, whose keyframes can be found without decoding, are split.
+  UINT32 GetNumSegments() const;
+  void SetNumSegments(UINT32 aNumSegments);
+
+  // How the encoder trades speed for quality and size when reencoding.
+  // Chosen by the file type picked in the save dialog. Defaults to
+  // archival, the encoder's best quality.
+  EncoderPreset GetEncoderPreset() const;
+  void SetEncoderPreset(EncoderPreset aPreset);
+
+  // Filter used to shrink frames which are too big for the encoder, which
+  // takes at most 1080 lines. Defaults to Lanczos.
+  ScaleFilter GetScaleFilter() const;
+  void SetScaleFilter(ScaleFilter aFilter);
+
   // Retrieves the measure of progress through the job, in thousandths.
   // Note that we round up to 1/1000 and down to 999/1000, so therefore:
   //    0         = job pending
@@ -49,6 +101,22 @@ public:
   // 1 and 999 this job will be considered running.
   void SetProgress(UINT32 aProgress);
 
+  // The duration of the input's media, in 100ns units, or 0 if unknown.
+  // Read from the input when the job is added to the list, if it's an MP4,
+  // and from the transcoder once the job starts.
+  LONGLONG GetDuration() const;
+  void SetDuration(LONGLONG aDuration);
+
+  // Whether the job is expected to rotate by rewriting the display matrix,
+  // which goes as fast as the file can be copied, rather than reencoding.
+  bool IsMetadataOnly() const;
+  void SetMetadataOnly(bool aMetadataOnly);
+
+  // The estimated wall clock time the running job has left, in
+  // microseconds, or -1 if there's no estimate yet.
+  LONGLONG GetRemainingUs() const;
+  void SetRemainingUs(LONGLONG aRemainingUs);
+
   // Jobs are identified by ID, not index, so that movements in the list
   // don't affect our ability to retrieve a job.
   TranscodeJobId GetId() const;
@@ -64,7 +132,17 @@ private:
   const std::wstring mInputFilename;
   const std::wstring mOutputFilename;
   const Rotation mRotation;
+  TranscodeMode mMode;
+  bool mPipelined;
+  TranscodeQueueDepths mQueueDepths;
+  UINT32 mNumRotationThreads;
+  UINT32 mNumSegments;
+  EncoderPreset mEncoderPreset;
+  ScaleFilter mScaleFilter;
   UINT32 mProgress;
+  LONGLONG mDuration;
+  bool mMetadataOnly;
+  LONGLONG mRemainingUs;
   bool mIsFailed;
   bool mIsCanceled;
 };
@@ -108,6 +186,13 @@ public:
   // Whether a job is currently running
   bool IsRunning();
 
+  // Estimates the wall clock time until the job at aIndex completes, in
+  // microseconds, from the running job's estimate, and the durations of
+  // the pending jobs ahead of it at the throughput of the last job of
+  // their kind. Returns false if there's no estimate yet, or the job has
+  // already completed or failed.
+  bool GetProjectedRemainingUs(UINT32 aIndex, LONGLONG* aOutRemainingUs);
+
 private:
 
   UINT32 GetIndexFor(TranscodeJobId aJobId);
@@ -118,6 +203,11 @@ private:
 
   TranscodeJobId mRunningJobId;
 
+  // The last throughput estimates of reencoding and metadata only jobs, in
+  // media seconds per second, or 0 if no such job has run yet.
+  double mReencodeRate;
+  double mMetadataOnlyRate;
+
   std::vector<TranscodeJob*> mJobs;
   HWND mHWnd;
   TranscodeJobRunner* mTranscoder;
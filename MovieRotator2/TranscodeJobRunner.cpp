@@ -16,9 +16,31 @@
 #include "TranscodeJobRunner.h"
 #include "TranscodeJobList.h"
 #include "RotationTranscoder.h"
+#include "MetadataRotator.h"
+#include "HighResClock.h"
+#include "ThroughputEstimator.h"
 
 using std::wstring;
 
+// Returns the transcoder for aJob's mode and input, or nullptr if the job
+// can't be done. Sets *aOutMetadataOnly if it's a MetadataRotator.
+static Transcoder*
+CreateTranscoder(const TranscodeJob* aJob, bool* aOutMetadataOnly)
+{
+  const TranscodeMode mode = aJob->GetMode();
+  *aOutMetadataOnly = false;
+  if (mode != TranscodeMode_Reencode &&
+      MetadataRotator::CanRotate(aJob->GetInputFilename())) {
+    DBGMSG(L"Rotating by rewriting the display matrix\n");
+    *aOutMetadataOnly = true;
+    return new MetadataRotator(aJob);
+  }
+  if (mode == TranscodeMode_MetadataOnly) {
+    DBGMSG(L"Input can't be rotated by rewriting the display matrix\n");
+    return nullptr;
+  }
+  return new RotationTranscoder(aJob);
+}
 
 void
 TranscodeJobRunner::DoTranscode()
@@ -27,11 +49,14 @@ TranscodeJobRunner::DoTranscode()
   DBGMSG(L"Input: %s\n", mJob->GetInputFilename().c_str());
   DBGMSG(L"Output: %s\n", mJob->GetOutputFilename().c_str());
   DBGMSG(L"Rotation: %d\n", mJob->GetRotation());
+  DBGMSG(L"Mode: %d, preset: %S\n", mJob->GetMode(),
+         GetEncoderPresetName(mJob->GetEncoderPreset()));
   AutoComInit x1;
 
-  RotationTranscoder transcoder(mJob);
+  bool metadataOnly = false;
+  std::unique_ptr<Transcoder> transcoder(CreateTranscoder(mJob, &metadataOnly));
 
-  HRESULT hr = transcoder.Initialize();
+  HRESULT hr = transcoder ? transcoder->Initialize() : MF_E_UNSUPPORTED_FORMAT;
   if (FAILED(hr)) {
     DBGMSG(L"Failed to initialize transcode\n");
     PostMessage(mEventTarget,
@@ -48,11 +73,19 @@ TranscodeJobRunner::DoTranscode()
               1,
               (LPARAM)(mJob));
 
+  // Progress is in thousandths of the media's duration; the estimator
+  // wants media time.
+  const LONGLONG duration = transcoder->GetDuration();
+  ThroughputEstimator estimator;
+  estimator.Start(GetHighResTimeUs(), duration);
+  ProgressThrottle throttle(uint64_t(ProgressIntervalMs) * 1000);
+  throttle.ShouldPublish(GetHighResTimeUs(), 1);
+
   UINT32 progressAtLastReport = 1;
   UINT32 progress = 0;
   uint64_t start = GetTickCount64_DLL();
   while (progress < 1000 && !IsCanceled()) {
-    hr = transcoder.Transcode();
+    hr = transcoder->Transcode();
     if (FAILED(hr)) {
       PostMessage(mEventTarget,
                   MSG_TRANSCODE_FAILED,
@@ -63,18 +96,34 @@ TranscodeJobRunner::DoTranscode()
     ENSURE_SUCCESS(hr,);
 
 
-    progress = transcoder.GetProgress();
-    if (progress > progressAtLastReport) {
+    progress = transcoder->GetProgress();
+    const uint64_t now = GetHighResTimeUs();
+    if (duration > 0) {
+      estimator.Update(now, duration * progress / 1000);
+    }
+    if (progress > progressAtLastReport && throttle.ShouldPublish(now, progress)) {
       progressAtLastReport = progress;
       PostMessage(mEventTarget,
                   MSG_TRANSCODE_PROGRESS,
                   progress,
                   (LPARAM)(mJob));
+      TranscodeEstimate* estimate = new TranscodeEstimate();
+      estimate->duration = duration;
+      estimate->rate = estimator.GetRate();
+      estimate->remainingUs = (progress < 1000) ? estimator.GetRemainingUs() : 0;
+      estimate->metadataOnly = metadataOnly;
+      if (!PostMessage(mEventTarget,
+                       MSG_TRANSCODE_ESTIMATE,
+                       (WPARAM)(estimate),
+                       (LPARAM)(mJob))) {
+        delete estimate;
+      }
     }
   }
   uint64_t elapsed = GetTickCount64_DLL() - start;
 
-  DBGMSG(L"Trancode finished took %lld ms\n", elapsed);
+  DBGMSG(L"Trancode finished took %lld ms, %.2lf media seconds per second\n",
+         elapsed, estimator.GetRate());
 
 
   PostMessage(mEventTarget,
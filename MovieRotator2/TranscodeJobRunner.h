@@ -30,10 +30,35 @@ class TranscodeJob;
 // completion, or is canceled.
 // wParam = 0, lParam = TranscodeJob* of job.
 //
-// MSG_TRANSCODE_PROGRESS posted every 0.1 percentage point of progress
-// through transcode job.
-// wParam = percent complete, lParam = TranscodeJob* of job.
+// MSG_TRANSCODE_PROGRESS posted when the progress through the transcode
+// job changes, at most every ProgressIntervalMs, so that long and short
+// jobs update the UI at the same rate.
+// wParam = thousandths complete, lParam = TranscodeJob* of job.
 //
+// MSG_TRANSCODE_ESTIMATE posted after each MSG_TRANSCODE_PROGRESS, with
+// how fast the job is going, and how long it has left.
+// wParam = TranscodeEstimate*, which the handler must delete,
+// lParam = TranscodeJob* of job.
+//
+struct TranscodeEstimate {
+  TranscodeEstimate()
+    : duration(0),
+      rate(0.0),
+      remainingUs(-1),
+      metadataOnly(false)
+  {
+  }
+  // The duration of the job's media, in 100ns units, or 0 if unknown.
+  LONGLONG duration;
+  // Smoothed throughput in media seconds per second, or 0 if unknown.
+  double rate;
+  // Wall clock time the job has left, or -1 if unknown.
+  LONGLONG remainingUs;
+  // Whether the job is rotating by rewriting the display matrix, which
+  // goes as fast as the file can be copied, rather than reencoding.
+  bool metadataOnly;
+};
+
 class TranscodeJobRunner : public EventSource {
 public:
   TranscodeJobRunner(TranscodeJob* aJob,
@@ -53,6 +78,9 @@ public:
   // the worker thread. Don't call this directly, call Begin() instead.
   void DoTranscode();
 
+  // The least time between progress messages.
+  static const UINT32 ProgressIntervalMs = 250;
+
   // The event target we dispatch messages to.
   const HWND mEventTarget;
 
@@ -0,0 +1,496 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "TranscodePipeline.h"
+#include "HighResClock.h"
+
+#include <math.h>
+#include <algorithm>
+
+TranscodePipeline::TranscodePipeline(IFrameSource* aSource,
+                                     IAudioFilter* aAudioFilter,
+                                     IFrameSink* aSink)
+  : mSource(aSource),
+    mAudioFilter(aAudioFilter),
+    mSink(aSink),
+    mBufferPool(std::make_shared<FrameBufferPool>()),
+    mOutputWidth(0),
+    mOutputHeight(0),
+    mOutputStride(0),
+    mBatchingAudio(false),
+    mVideoSegmentEnded(false),
+    mAudioSegmentEnded(false),
+    mProgress(0),
+    mLastVideoTimestamp(0),
+    mNumVideoFramesWritten(0),
+    mNumAudioFramesWritten(0),
+    mStartTimeUs(0),
+    mFirstWriteTimeUs(0),
+    mNumProcessingStages(0),
+    mFailed(false),
+    mStarted(false)
+{
+}
+
+TranscodePipeline::~TranscodePipeline()
+{
+  if (mReaderThread.joinable() || mVideoThread.joinable() || mAudioThread.joinable()) {
+    // We've been cancelled part way through. Unblock the stages so they can
+    // exit.
+    Fail();
+    JoinStages();
+  }
+}
+
+bool
+TranscodePipeline::Init(const TranscodeOptions& aOptions)
+{
+  if (!mSource->HasVideo()) {
+    return false;
+  }
+  if (aOptions.segment.start >= aOptions.segment.end) {
+    return false;
+  }
+  mOptions = aOptions;
+  mAudioSegmentEnded = !mSource->HasAudio();
+  // Compressed audio is copied frame for frame, so it can't be batched.
+  mBatchingAudio = mSource->HasAudio() && aOptions.audioBatchFrames &&
+                   mAudioBatcher.Init(mAudioFilter ? mAudioFilter->GetOutputFormat()
+                                                   : mSource->GetAudioFormat(),
+                                      aOptions.audioBatchFrames);
+  mStartTimeUs = aOptions.startTimeUs ? aOptions.startTimeUs : GetHighResTimeUs();
+
+  const VideoFormat& format = mSource->GetVideoFormat();
+  const bool swap = (aOptions.rotation == ROTATE_90 || aOptions.rotation == ROTATE_270);
+  mOutputWidth = aOptions.outputWidth ? aOptions.outputWidth
+                                      : (swap ? format.height : format.width);
+  mOutputHeight = aOptions.outputHeight ? aOptions.outputHeight
+                                        : (swap ? format.width : format.height);
+  if (!mOutputWidth || !mOutputHeight) {
+    return false;
+  }
+  // 4:2:0 frames must have whole chroma samples.
+  if (format.pixelFormat != PixelFormat_RGB32 && ((mOutputWidth | mOutputHeight) & 1)) {
+    return false;
+  }
+  mOutputStride = aOptions.outputStride
+                ? aOptions.outputStride
+                : int32_t(mOutputWidth * GetBytesPerPixel(format.pixelFormat, 0));
+
+  mRotator.Init(aOptions.numRotationThreads, aOptions.tile);
+  mRotator.SetChromaSiting(format.horizontalSiting, format.verticalSiting);
+  mRotator.SetScaleFilter(aOptions.scaleFilter);
+
+  return true;
+}
+
+TranscodeQueueDepths
+TranscodePipeline::GetPeakQueueDepths()
+{
+  TranscodeQueueDepths peaks;
+  peaks.decodedVideo = mStarted ? uint32_t(mDecodedVideo->GetPeakSize()) : 0;
+  peaks.decodedAudio = mStarted ? uint32_t(mDecodedAudio->GetPeakSize()) : 0;
+  peaks.encoder = mStarted ? uint32_t(mEncoderQueue->GetPeakSize()) : 0;
+  return peaks;
+}
+
+uint64_t
+TranscodePipeline::GetStartupLatencyUs() const
+{
+  return mFirstWriteTimeUs ? mFirstWriteTimeUs - mStartTimeUs : 0;
+}
+
+FrameBufferPoolStats
+TranscodePipeline::GetBufferPoolStats() const
+{
+  return mBufferPool->GetStats();
+}
+
+bool
+TranscodePipeline::ReadFrame(MediaFrame* aOutFrame, bool* aOutEndOfStream)
+{
+  const TranscodeSegment& segment = mOptions.segment;
+  for (;;) {
+    {
+      AutoStageTimer timer(mStats, TranscodeStage_Read);
+      if (!mSource->ReadFrame(aOutFrame, aOutEndOfStream)) {
+        return false;
+      }
+      timer.SetBytes(0, aOutFrame->length);
+    }
+    if (*aOutEndOfStream) {
+      return true;
+    }
+    const bool isVideo = aOutFrame->stream == Stream_Video;
+    if (aOutFrame->timestamp >= segment.end) {
+      (isVideo ? mVideoSegmentEnded : mAudioSegmentEnded) = true;
+      if (mVideoSegmentEnded && mAudioSegmentEnded) {
+        *aOutEndOfStream = true;
+        return true;
+      }
+      continue;
+    }
+    if (isVideo) {
+      // The source starts at the keyframe before the segment, so the
+      // frames before its start are decoded only to get to it.
+      if (aOutFrame->timestamp < segment.start) {
+        continue;
+      }
+    } else {
+      TrimAudioToSegment(aOutFrame);
+      if (!aOutFrame->data) {
+        continue;
+      }
+    }
+    aOutFrame->timestamp -= segment.start;
+    return true;
+  }
+}
+
+void
+TranscodePipeline::TrimAudioToSegment(MediaFrame* aFrame)
+{
+  const TranscodeSegment& segment = mOptions.segment;
+  if (segment.start == 0 && segment.end == INT64_MAX) {
+    return;
+  }
+  const AudioFormat& format = mSource->GetAudioFormat();
+  if (format.compressed) {
+    // Compressed frames can't be cut, so each goes in whichever segment
+    // its middle is in, which is also how the join decides between the
+    // frames the segments either side of a boundary both have.
+    const int64_t middle = aFrame->timestamp + aFrame->duration / 2;
+    if (middle < segment.start || middle >= segment.end) {
+      *aFrame = MediaFrame();
+    }
+    return;
+  }
+  const size_t frameSize = format.numChannels * format.bitsPerSample / 8;
+  if (!frameSize || !format.sampleRate) {
+    return;
+  }
+
+  // Work in samples, counted from the start of the stream, so that the
+  // segments either side of a boundary agree on which side of it each
+  // sample is, whatever the timestamps of the frames it's in.
+  const double rate = double(format.sampleRate) / TimeUnitsPerSecond;
+  const int64_t first = int64_t(floor(aFrame->timestamp * rate + 0.5));
+  const int64_t count = int64_t(aFrame->length / frameSize);
+  const int64_t start = int64_t(ceil(segment.start * rate));
+  const int64_t end = (segment.end == INT64_MAX) ? first + count
+                                                 : int64_t(ceil(segment.end * rate));
+  const int64_t skip = std::max<int64_t>(start - first, 0);
+  const int64_t keep = std::min(end - first, count) - skip;
+  if (keep <= 0) {
+    *aFrame = MediaFrame();
+    return;
+  }
+  if (!skip && keep == count) {
+    return;
+  }
+  aFrame->data += skip * frameSize;
+  aFrame->length = size_t(keep) * frameSize;
+  aFrame->timestamp = int64_t(double(first + skip) / rate + 0.5);
+  aFrame->duration = int64_t(double(keep) / rate + 0.5);
+}
+
+bool
+TranscodePipeline::RotateVideo(const MediaFrame& aFrame, MediaFrame* aOutRotated)
+{
+  const PixelFormat format = aFrame.image.format;
+  const size_t length = GetImageBufferSize(format, mOutputStride, mOutputHeight);
+  std::shared_ptr<uint8_t> buffer = FrameBufferPool::AcquireShared(mBufferPool, length);
+  if (!buffer) {
+    return false;
+  }
+
+  aOutRotated->stream = Stream_Video;
+  aOutRotated->timestamp = aFrame.timestamp;
+  aOutRotated->duration = aFrame.duration;
+  aOutRotated->data = buffer.get();
+  aOutRotated->length = length;
+  aOutRotated->storage = buffer;
+  if (!GetImageLayout(format, buffer.get(), length, mOutputStride,
+                      mOutputHeight, mOutputWidth, mOutputHeight,
+                      &aOutRotated->image)) {
+    return false;
+  }
+  AutoStageTimer timer(mStats, TranscodeStage_Rotate);
+  timer.SetBytes(aFrame.length, length);
+  return mRotator.Rotate(mOptions.rotation, aFrame.image, aOutRotated->image);
+}
+
+bool
+TranscodePipeline::FilterAudio(const MediaFrame* aNext, MediaFrame* aOutFiltered)
+{
+  *aOutFiltered = MediaFrame();
+  if (mHeldAudio.data) {
+    if (mAudioFilter) {
+      AutoStageTimer timer(mStats, TranscodeStage_Audio);
+      if (!mAudioFilter->Process(mHeldAudio, !aNext, aOutFiltered)) {
+        return false;
+      }
+      timer.SetBytes(mHeldAudio.length, aOutFiltered->length);
+      aOutFiltered->stream = Stream_Audio;
+    } else {
+      *aOutFiltered = mHeldAudio;
+    }
+  }
+  mHeldAudio = aNext ? *aNext : MediaFrame();
+  return true;
+}
+
+bool
+TranscodePipeline::BatchAudio(const MediaFrame& aFiltered, bool aLast)
+{
+  mAudioBatches.clear();
+  if (!mBatchingAudio) {
+    if (aFiltered.data) {
+      mAudioBatches.push_back(aFiltered);
+    }
+    return true;
+  }
+  if (!mAudioBatcher.Process(aFiltered, &mAudioBatches)) {
+    return false;
+  }
+  if (aLast) {
+    mAudioBatcher.Flush(&mAudioBatches);
+  }
+  return true;
+}
+
+bool
+TranscodePipeline::WriteFrame(const MediaFrame& aFrame)
+{
+  if (!aFrame.data) {
+    return true;
+  }
+  {
+    AutoStageTimer timer(mStats, TranscodeStage_Write);
+    timer.SetBytes(aFrame.length, 0);
+    if (!mSink->WriteFrame(aFrame)) {
+      return false;
+    }
+  }
+  if (!mFirstWriteTimeUs) {
+    mFirstWriteTimeUs = std::max(GetHighResTimeUs(), mStartTimeUs + 1);
+  }
+
+  if (aFrame.stream == Stream_Video) {
+    mLastVideoTimestamp = aFrame.timestamp;
+    mNumVideoFramesWritten++;
+  } else {
+    mNumAudioFramesWritten++;
+  }
+  const int64_t end = std::min(mOptions.segment.end, mSource->GetDuration());
+  const int64_t duration = end - mOptions.segment.start;
+  double progress = (duration > 0) ? floor(1000.0 * double(mLastVideoTimestamp) / double(duration))
+                                   : 0.0;
+  mProgress = uint32_t(std::max(1.0, std::min(999.0, progress)));
+
+  return true;
+}
+
+bool
+TranscodePipeline::Finish()
+{
+  if (!mSink->Finish()) {
+    return false;
+  }
+  mProgress = 1000;
+  return true;
+}
+
+bool
+TranscodePipeline::Transcode()
+{
+  if (mProgress == 1000) {
+    return true;
+  }
+  return mOptions.pipelined ? TranscodePipelined() : TranscodeSerially();
+}
+
+bool
+TranscodePipeline::TranscodeSerially()
+{
+  MediaFrame frame;
+  bool endOfStream = false;
+  if (!ReadFrame(&frame, &endOfStream)) {
+    return false;
+  }
+
+  MediaFrame output;
+  if (frame.stream == Stream_Video && !endOfStream) {
+    return RotateVideo(frame, &output) && WriteFrame(output);
+  }
+  if (!FilterAudio(endOfStream ? nullptr : &frame, &output) ||
+      !BatchAudio(output, endOfStream)) {
+    return false;
+  }
+  for (size_t i = 0; i < mAudioBatches.size(); i++) {
+    if (!WriteFrame(mAudioBatches[i])) {
+      return false;
+    }
+  }
+  mAudioBatches.clear();
+  return !endOfStream || Finish();
+}
+
+bool
+TranscodePipeline::TranscodePipelined()
+{
+  if (!mStarted) {
+    StartStages();
+  }
+
+  MediaFrame frame;
+  if (mEncoderQueue->Pop(&frame)) {
+    if (!WriteFrame(frame)) {
+      Fail();
+      JoinStages();
+      return false;
+    }
+    return true;
+  }
+
+  // The encoder queue only runs dry once the video and audio stages have
+  // both finished, or a stage has failed.
+  JoinStages();
+  if (mFailed) {
+    return false;
+  }
+  return Finish();
+}
+
+void
+TranscodePipeline::StartStages()
+{
+  const TranscodeQueueDepths& depths = mOptions.queueDepths;
+  mDecodedVideo.reset(new FrameQueue(depths.decodedVideo));
+  mDecodedAudio.reset(new FrameQueue(depths.decodedAudio));
+  mEncoderQueue.reset(new FrameQueue(depths.encoder));
+
+  mStarted = true;
+  mNumProcessingStages = 2;
+  mReaderThread = std::thread([this]() { RunReaderStage(); });
+  mVideoThread = std::thread([this]() { RunVideoStage(); });
+  mAudioThread = std::thread([this]() { RunAudioStage(); });
+}
+
+void
+TranscodePipeline::JoinStages()
+{
+  if (mReaderThread.joinable()) {
+    mReaderThread.join();
+  }
+  if (mVideoThread.joinable()) {
+    mVideoThread.join();
+  }
+  if (mAudioThread.joinable()) {
+    mAudioThread.join();
+  }
+}
+
+void
+TranscodePipeline::RunReaderStage()
+{
+  AutoThreadHook hook(mOptions.threadHook);
+  for (;;) {
+    MediaFrame frame;
+    bool endOfStream = false;
+    if (!ReadFrame(&frame, &endOfStream)) {
+      Fail();
+      return;
+    }
+    if (endOfStream) {
+      break;
+    }
+    FrameQueue* queue = (frame.stream == Stream_Video) ? mDecodedVideo.get()
+                                                       : mDecodedAudio.get();
+    if (!queue->Push(frame)) {
+      // Aborted.
+      return;
+    }
+  }
+  mDecodedVideo->Close();
+  mDecodedAudio->Close();
+}
+
+void
+TranscodePipeline::RunVideoStage()
+{
+  AutoThreadHook hook(mOptions.threadHook);
+  MediaFrame frame;
+  while (mDecodedVideo->Pop(&frame)) {
+    MediaFrame rotated;
+    if (!RotateVideo(frame, &rotated)) {
+      Fail();
+      return;
+    }
+    // Give the decoded frame's buffer back before we block on the encoder.
+    frame = MediaFrame();
+    if (!mEncoderQueue->Push(rotated)) {
+      return;
+    }
+  }
+  OnProcessingStageFinished();
+}
+
+void
+TranscodePipeline::RunAudioStage()
+{
+  AutoThreadHook hook(mOptions.threadHook);
+  MediaFrame frame;
+  MediaFrame filtered;
+  bool last = false;
+  while (!last) {
+    last = !mDecodedAudio->Pop(&frame);
+    if (last && mFailed) {
+      return;
+    }
+    // At the end, drain the filter and the batcher.
+    if (!FilterAudio(last ? nullptr : &frame, &filtered) ||
+        !BatchAudio(filtered, last)) {
+      Fail();
+      return;
+    }
+    for (size_t i = 0; i < mAudioBatches.size(); i++) {
+      if (!mEncoderQueue->Push(mAudioBatches[i])) {
+        return;
+      }
+    }
+    mAudioBatches.clear();
+  }
+  OnProcessingStageFinished();
+}
+
+void
+TranscodePipeline::OnProcessingStageFinished()
+{
+  if (--mNumProcessingStages == 0) {
+    mEncoderQueue->Close();
+  }
+}
+
+void
+TranscodePipeline::Fail()
+{
+  mFailed = true;
+  if (mStarted) {
+    mDecodedVideo->Abort();
+    mDecodedAudio->Abort();
+    mEncoderQueue->Abort();
+  }
+}
@@ -0,0 +1,264 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Rotates the video from an IFrameSource into an IFrameSink, passing the
+// audio through an optional IAudioFilter on the way. Reading, rotating
+// video, filtering audio and writing each run on their own thread,
+// connected by BoundedQueues, so the stages overlap instead of taking turns.
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "AudioBatcher.h"
+#include "BoundedQueue.h"
+#include "FrameBufferPool.h"
+#include "FrameSource.h"
+#include "ImageRotator.h"
+#include "KeyframeIndex.h"
+#include "TranscodeStats.h"
+
+// The capacities of the queues between the stages of the pipeline. Deeper
+// queues smooth out stalls, such as the decoder pausing at a keyframe, at
+// the cost of holding more frames in memory.
+struct TranscodeQueueDepths {
+  TranscodeQueueDepths()
+    : decodedVideo(3),
+      decodedAudio(32),
+      encoder(4)
+  {
+  }
+  // Decoded frames waiting to be rotated.
+  uint32_t decodedVideo;
+  // Decoded audio waiting to be filtered.
+  uint32_t decodedAudio;
+  // Rotated frames and filtered audio waiting to be encoded and written.
+  uint32_t encoder;
+};
+
+// Called with true on each thread the transcode starts, as it starts, and
+// with false as it exits, so that the backends can set up the threads
+// they're called on; e.g. to initialize COM.
+typedef void (*ThreadHook)(bool aStarting);
+
+// Calls a ThreadHook, if there is one, for the lifetime of a scope.
+class AutoThreadHook {
+public:
+  explicit AutoThreadHook(ThreadHook aHook) : mHook(aHook) {
+    if (mHook) {
+      mHook(true);
+    }
+  }
+  ~AutoThreadHook() {
+    if (mHook) {
+      mHook(false);
+    }
+  }
+private:
+  ThreadHook mHook;
+};
+
+struct TranscodeOptions {
+  TranscodeOptions()
+    : rotation(ROTATE_90),
+      outputWidth(0),
+      outputHeight(0),
+      outputStride(0),
+      scaleFilter(ScaleFilter_Lanczos3),
+      numRotationThreads(0),
+      pipelined(true),
+      audioBatchFrames(4),
+      startTimeUs(0),
+      threadHook(nullptr)
+  {
+  }
+  Rotation rotation;
+  // The size of the frames written to the sink. If this isn't the size of
+  // the rotated picture, frames are scaled as they're rotated. 0x0 means
+  // the size of the rotated picture.
+  uint32_t outputWidth;
+  uint32_t outputHeight;
+  // The stride of the frames written to the sink. 0 means rows are packed
+  // together. Negative means bottom-up, for RGB32.
+  int32_t outputStride;
+  ScaleFilter scaleFilter;
+  // See ImageRotator::Init().
+  uint32_t numRotationThreads;
+  RotateTileShape tile;
+  // If false, each Transcode() call reads, processes and writes one frame
+  // on the caller's thread, and no other threads are started.
+  bool pipelined;
+  TranscodeQueueDepths queueDepths;
+  // PCM audio is written in batches of this many AAC frames; see
+  // AudioBatcher. 0 writes it in the sizes it's filtered in.
+  uint32_t audioBatchFrames;
+  // When the job started, from GetHighResTimeUs(), which the startup
+  // latency is measured from. Opening the source and sink count as startup
+  // too, so callers should pass the time from before they did. 0 means
+  // when Init() is called.
+  uint64_t startTimeUs;
+  ThreadHook threadHook;
+  // The part of the source to transcode. The source must already have
+  // been seeked to its start. Frames are written with timestamps relative
+  // to its start, and audio is trimmed to it to the sample, or to the
+  // frame if it's compressed, so that segments transcoded separately join
+  // up without gaps or overlaps.
+  TranscodeSegment segment;
+};
+
+class TranscodePipeline {
+public:
+  // aSource, aAudioFilter and aSink must outlive the pipeline. aAudioFilter
+  // may be null, in which case audio is written as it's read.
+  TranscodePipeline(IFrameSource* aSource,
+                    IAudioFilter* aAudioFilter,
+                    IFrameSink* aSink);
+
+  // Stops the stages, in case we're destroyed part way through.
+  ~TranscodePipeline();
+
+  // Returns false if the source has no video, or the output size doesn't
+  // suit the source's pixel format.
+  bool Init(const TranscodeOptions& aOptions);
+
+  // Writes the next frame, starting the stages first if need be. Call this
+  // in a loop until GetProgress() returns 1000. Returns false if any stage
+  // has failed.
+  bool Transcode();
+
+  // Returns how many thousandths through the source we are.
+  uint32_t GetProgress() const { return mProgress; }
+
+  uint64_t GetNumVideoFramesWritten() const { return mNumVideoFramesWritten; }
+  uint64_t GetNumAudioFramesWritten() const { return mNumAudioFramesWritten; }
+
+  // The time from the start of the job to the first frame being written to
+  // the sink, in microseconds, or 0 if no frame has been written yet.
+  uint64_t GetStartupLatencyUs() const;
+
+  // The most items each queue held at once. If a queue's peak stays below
+  // its depth, the stage after it keeps up with the one before it.
+  TranscodeQueueDepths GetPeakQueueDepths();
+
+  // Statistics on the pool of buffers the rotated frames are written to.
+  // Once the sink's encoder is full, every frame should be a pool hit.
+  FrameBufferPoolStats GetBufferPoolStats() const;
+
+  // How long each stage took per frame. Only read this once the transcode
+  // has finished, or failed, as the stages record to it unlocked.
+  const TranscodeStats& GetStats() const { return mStats; }
+
+  const ImageRotator& GetRotator() const { return mRotator; }
+
+private:
+  TranscodePipeline(const TranscodePipeline&);
+  TranscodePipeline& operator=(const TranscodePipeline&);
+
+  typedef BoundedQueue<MediaFrame> FrameQueue;
+
+  // Reads the next frame of the segment from the source, with its
+  // timestamp made relative to the segment's start. Sets *aOutEndOfStream
+  // once every stream has ended or passed the end of the segment.
+  bool ReadFrame(MediaFrame* aOutFrame, bool* aOutEndOfStream);
+
+  // Drops the samples of the audio frame aFrame which are outside the
+  // segment, or all of them if it's compressed and its middle is outside.
+  // Leaves aFrame without data if none are inside.
+  void TrimAudioToSegment(MediaFrame* aFrame);
+
+  // Rotates aFrame into a frame of the output size from the pool.
+  bool RotateVideo(const MediaFrame& aFrame, MediaFrame* aOutRotated);
+
+  // Filters the audio frame held back by the last call, and holds aNext
+  // back in its place; the filter needs to know which frame is the last,
+  // which we only find out when the next read hits the end of the stream.
+  // aNext is null at the end of the stream. *aOutFiltered has no data if
+  // there's nothing to write.
+  bool FilterAudio(const MediaFrame* aNext, MediaFrame* aOutFiltered);
+
+  // Replaces mAudioBatches with the frames to write for the filtered audio
+  // frame aFiltered, which is the last if aLast is set; the batches it
+  // completes, or aFiltered itself if we're not batching.
+  bool BatchAudio(const MediaFrame& aFiltered, bool aLast);
+
+  // Writes aFrame to the sink, unless it has no data, and updates the
+  // progress.
+  bool WriteFrame(const MediaFrame& aFrame);
+
+  bool Finish();
+
+  bool TranscodeSerially();
+  bool TranscodePipelined();
+
+  void StartStages();
+  void JoinStages();
+  void RunReaderStage();
+  void RunVideoStage();
+  void RunAudioStage();
+  // Called by the video and audio stages when they've finished feeding
+  // mEncoderQueue.
+  void OnProcessingStageFinished();
+  // Marks the transcode as failed, and aborts all the queues, so that every
+  // stage stops.
+  void Fail();
+
+  IFrameSource* mSource;
+  IAudioFilter* mAudioFilter;
+  IFrameSink* mSink;
+  TranscodeOptions mOptions;
+
+  ImageRotator mRotator;
+  // Rotated frames' buffers come from this pool, and go back to it when the
+  // sink releases them. Shared with the buffers, as they can outlive us.
+  std::shared_ptr<FrameBufferPool> mBufferPool;
+  uint32_t mOutputWidth;
+  uint32_t mOutputHeight;
+  int32_t mOutputStride;
+
+  MediaFrame mHeldAudio;
+  AudioBatcher mAudioBatcher;
+  bool mBatchingAudio;
+  std::vector<MediaFrame> mAudioBatches;
+  // Whether each stream has passed the end of the segment.
+  bool mVideoSegmentEnded;
+  bool mAudioSegmentEnded;
+
+  volatile uint32_t mProgress;
+  int64_t mLastVideoTimestamp;
+  uint64_t mNumVideoFramesWritten;
+  uint64_t mNumAudioFramesWritten;
+  uint64_t mStartTimeUs;
+  // When the first frame was written, or 0 if it hasn't been.
+  uint64_t mFirstWriteTimeUs;
+  TranscodeStats mStats;
+
+  // The reader stage feeds mDecodedVideo and mDecodedAudio, and the video
+  // and audio stages feed mEncoderQueue, which the thread calling
+  // Transcode() drains into the sink.
+  std::unique_ptr<FrameQueue> mDecodedVideo;
+  std::unique_ptr<FrameQueue> mDecodedAudio;
+  std::unique_ptr<FrameQueue> mEncoderQueue;
+  std::thread mReaderThread;
+  std::thread mVideoThread;
+  std::thread mAudioThread;
+  // The number of video and audio stages still running.
+  std::atomic<int> mNumProcessingStages;
+  std::atomic<bool> mFailed;
+  bool mStarted;
+};
@@ -0,0 +1,605 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// The SelfTest tool's checks of the transcode pipeline's allocations, and
+// of the MP4 metadata reader and rewriter.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <string>
+#include <vector>
+#include "FileIO.h"
+#include "KeyframeIndex.h"
+#include "Mp4Metadata.h"
+#include "RawFrameSource.h"
+#include "SelfTest.h"
+#include "TranscodePipeline.h"
+#include "WavFile.h"
+#include "Y4MFile.h"
+
+// Whether operator new counts the heap allocations it makes. It's only set
+// while --check-frame-allocations transcodes, so counting doesn't touch
+// the other tests' allocations.
+static std::atomic<bool> sCountHeapAllocations(false);
+
+// The number of times operator new has been called while
+// sCountHeapAllocations was set.
+static std::atomic<uint64_t> sNumHeapAllocations(0);
+
+void*
+operator new(size_t aSize)
+{
+  if (sCountHeapAllocations) {
+    sNumHeapAllocations++;
+  }
+  void* ptr = malloc(aSize ? aSize : 1);
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+// GCC inlines this into the standard library's allocators, and then warns
+// that it frees memory from operator new with free(), which is what it's
+// meant to do.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void
+operator delete(void* aPtr) throw()
+{
+  free(aPtr);
+}
+
+// Writes aNumFrames frames of aWidth x aHeight I420 noise at 30 fps to
+// aY4MFilename, and as long of 48KHz stereo noise to aWavFilename.
+static bool
+WriteTestMedia(const std::string& aY4MFilename,
+               const std::string& aWavFilename,
+               uint32_t aWidth,
+               uint32_t aHeight,
+               uint32_t aNumFrames)
+{
+  VideoFormat videoFormat;
+  videoFormat.width = aWidth;
+  videoFormat.height = aHeight;
+  videoFormat.frameRateNumer = 30;
+  OwnedImage image;
+  Y4MWriter video;
+  if (!MakeImage(PixelFormat_I420, aWidth, aHeight, false, &image) ||
+      !video.Open(aY4MFilename, videoFormat)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < aNumFrames; i++) {
+    if (!video.WriteFrame(image.image)) {
+      return false;
+    }
+  }
+  AudioFormat audioFormat;
+  audioFormat.sampleRate = 48000;
+  audioFormat.numChannels = 2;
+  const std::vector<uint8_t> samples =
+    EncodeSamples(MakeNoise(size_t(audioFormat.sampleRate) * 2 * aNumFrames / 30), 16);
+  WavWriter audio;
+  return video.Close() &&
+         audio.Open(aWavFilename, audioFormat) &&
+         audio.Write(&samples[0], samples.size()) &&
+         audio.Close();
+}
+
+// Transcodes aY4MFilename and aWavFilename to files next to them, rotating
+// the video by 90 degrees and writing the audio as it is, in batches, and
+// sets *aOutPoolAllocations to the number of frame buffers the pools
+// allocated.
+static bool
+TranscodeTestMedia(const std::string& aY4MFilename,
+                   const std::string& aWavFilename,
+                   bool aPipelined,
+                   uint64_t* aOutPoolAllocations)
+{
+  RawFrameSource source;
+  if (!source.Open(aY4MFilename, aWavFilename)) {
+    return false;
+  }
+  VideoFormat outputFormat = source.GetVideoFormat();
+  std::swap(outputFormat.width, outputFormat.height);
+  RawFrameSink sink;
+  if (!sink.Open(aY4MFilename + ".out.y4m", outputFormat,
+                 aWavFilename + ".out.wav", source.GetAudioFormat())) {
+    return false;
+  }
+  TranscodeOptions options;
+  options.pipelined = aPipelined;
+  options.numRotationThreads = 2;
+  TranscodePipeline pipeline(&source, nullptr, &sink);
+  if (!pipeline.Init(options)) {
+    return false;
+  }
+  while (pipeline.GetProgress() < 1000) {
+    if (!pipeline.Transcode()) {
+      return false;
+    }
+  }
+  *aOutPoolAllocations = source.GetBufferPoolStats().misses +
+                         pipeline.GetBufferPoolStats().misses;
+  return true;
+}
+
+// Transcodes aY4MFilename and aWavFilename as TranscodeTestMedia() does,
+// and sets *aOutAllocations to the number of heap allocations made from
+// opening the files to finishing the output, including the frame buffers
+// the pools allocated.
+static bool
+CountTranscodeAllocations(const std::string& aY4MFilename,
+                          const std::string& aWavFilename,
+                          bool aPipelined,
+                          uint64_t* aOutAllocations)
+{
+  const uint64_t numAllocations = sNumHeapAllocations;
+  uint64_t numPoolAllocations = 0;
+  sCountHeapAllocations = true;
+  const bool ok = TranscodeTestMedia(aY4MFilename, aWavFilename, aPipelined,
+                                     &numPoolAllocations);
+  sCountHeapAllocations = false;
+  remove((aY4MFilename + ".out.y4m").c_str());
+  remove((aWavFilename + ".out.wav").c_str());
+  *aOutAllocations = sNumHeapAllocations - numAllocations + numPoolAllocations;
+  return ok;
+}
+
+bool
+CheckFrameAllocations()
+{
+  // Two inputs which differ only in length. Everything up to the steady
+  // state is the same for both, so any difference in the number of
+  // allocations transcoding them makes is made by the extra frames.
+  static const uint32_t ShortFrames = 60;
+  static const uint32_t LongFrames = 600;
+  // Pipelined, the frames in flight depend on how the threads are
+  // scheduled, so the pools can need another buffer whenever more are in
+  // flight than ever before. That's bounded by the queues' capacity, not
+  // by the number of frames.
+  const TranscodeQueueDepths depths;
+  const int64_t maxPipelinedWarmUp = depths.decodedVideo + depths.decodedAudio + depths.encoder;
+  const std::string shortVideo = "frame-allocations-short.y4m";
+  const std::string shortAudio = "frame-allocations-short.wav";
+  const std::string longVideo = "frame-allocations-long.y4m";
+  const std::string longAudio = "frame-allocations-long.wav";
+  bool ok = WriteTestMedia(shortVideo, shortAudio, 640, 360, ShortFrames) &&
+            WriteTestMedia(longVideo, longAudio, 640, 360, LongFrames);
+  bool allocationFree = true;
+  for (int pipelined = 0; ok && pipelined < 2; pipelined++) {
+    uint64_t shortAllocations = 0, longAllocations = 0;
+    ok = CountTranscodeAllocations(shortVideo, shortAudio, pipelined != 0, &shortAllocations) &&
+         CountTranscodeAllocations(longVideo, longAudio, pipelined != 0, &longAllocations);
+    if (ok) {
+      const int64_t extra = int64_t(longAllocations) - int64_t(shortAllocations);
+      printf("%s: %llu allocations for %u frames, %llu for %u frames, "
+             "%.2lf per frame in the steady state\n",
+             pipelined ? "pipelined" : "serial",
+             (unsigned long long)shortAllocations, ShortFrames,
+             (unsigned long long)longAllocations, LongFrames,
+             double(extra) / (LongFrames - ShortFrames));
+      allocationFree = allocationFree && extra <= (pipelined ? maxPipelinedWarmUp : 0);
+    }
+  }
+  remove(shortVideo.c_str());
+  remove(shortAudio.c_str());
+  remove(longVideo.c_str());
+  remove(longAudio.c_str());
+  if (!ok) {
+    fprintf(stderr, "Transcode failed\n");
+  } else if (!allocationFree) {
+    fprintf(stderr, "Transcoding allocates in the steady state\n");
+  }
+  return ok && allocationFree;
+}
+
+// Appends aValue to aOut, big endian, as MP4 fields are stored.
+static void
+AppendBigEndianU32(std::vector<uint8_t>& aOut, uint32_t aValue)
+{
+  aOut.push_back(uint8_t(aValue >> 24));
+  aOut.push_back(uint8_t(aValue >> 16));
+  aOut.push_back(uint8_t(aValue >> 8));
+  aOut.push_back(uint8_t(aValue));
+}
+
+static void
+AppendZeros(std::vector<uint8_t>& aOut, size_t aLength)
+{
+  aOut.insert(aOut.end(), aLength, 0);
+}
+
+// Starts a box of type aType at the end of aOut. Returns its offset, for
+// EndMp4Box() to fill its size in once its body has been appended.
+static size_t
+BeginMp4Box(std::vector<uint8_t>& aOut, uint32_t aType)
+{
+  const size_t offset = aOut.size();
+  AppendBigEndianU32(aOut, 0);
+  AppendBigEndianU32(aOut, aType);
+  return offset;
+}
+
+static void
+EndMp4Box(std::vector<uint8_t>& aOut, size_t aOffset)
+{
+  const uint32_t size = uint32_t(aOut.size() - aOffset);
+  for (int i = 0; i < 4; i++) {
+    aOut[aOffset + i] = uint8_t(size >> (24 - 8 * i));
+  }
+}
+
+static void
+WriteBigEndianU32(std::vector<uint8_t>& aOut, size_t aOffset, uint32_t aValue)
+{
+  for (int i = 0; i < 4; i++) {
+    aOut[aOffset + i] = uint8_t(aValue >> (24 - 8 * i));
+  }
+}
+
+// A small MP4 file for --check-mp4-metadata, and the offsets of the boxes
+// and fields it corrupts.
+struct TestMp4 {
+  std::vector<uint8_t> bytes;
+  size_t ftyp;
+  size_t moov;
+  size_t videoTrak;
+  size_t videoTkhd;
+  size_t videoMatrix;
+  // The sample count in the video's stsz.
+  size_t videoSampleCount;
+  size_t mdat;
+};
+
+// The test MP4's video is 1920x1080 at 30fps, in 10 frames, with
+// keyframes at frames 0, 4 and 8, presented 3000 ticks of the 90KHz
+// timescale after they're decoded.
+static const uint32_t TestMp4Timescale = 90000;
+static const uint32_t TestMp4FrameDuration = 3000;
+
+// Appends the trak box of a track with handler aHandler, whose sample
+// entry is of type aCodec, to aOut. A version 1 tkhd is written if
+// aLongTimes, so that both layouts are read. Returns the tkhd's offset, and
+// sets *aOutSampleCount to the offset of the sample count in its stsz.
+static size_t
+AppendTestTrack(std::vector<uint8_t>& aOut,
+                uint32_t aHandler,
+                uint32_t aCodec,
+                bool aLongTimes,
+                uint32_t aWidth,
+                uint32_t aHeight,
+                size_t* aOutSampleCount)
+{
+  const size_t trak = BeginMp4Box(aOut, MP4_FOURCC('t','r','a','k'));
+  const size_t tkhd = BeginMp4Box(aOut, MP4_FOURCC('t','k','h','d'));
+  // Version and flags, then the creation and modification times, track ID,
+  // a reserved field and the duration, then layer, volume etc.
+  AppendBigEndianU32(aOut, aLongTimes ? 0x01000007 : 0x00000007);
+  AppendZeros(aOut, (aLongTimes ? 32 : 20) + 16);
+  int32_t matrix[9];
+  GetMp4RotationMatrix(ROTATE_0, aWidth, aHeight, matrix);
+  for (int i = 0; i < 9; i++) {
+    AppendBigEndianU32(aOut, uint32_t(matrix[i]));
+  }
+  AppendBigEndianU32(aOut, aWidth);
+  AppendBigEndianU32(aOut, aHeight);
+  EndMp4Box(aOut, tkhd);
+
+  const size_t mdia = BeginMp4Box(aOut, MP4_FOURCC('m','d','i','a'));
+  const size_t mdhd = BeginMp4Box(aOut, MP4_FOURCC('m','d','h','d'));
+  AppendBigEndianU32(aOut, 0);
+  AppendZeros(aOut, 8);
+  AppendBigEndianU32(aOut, TestMp4Timescale);
+  AppendBigEndianU32(aOut, 10 * TestMp4FrameDuration);
+  AppendZeros(aOut, 4);
+  EndMp4Box(aOut, mdhd);
+  const size_t hdlr = BeginMp4Box(aOut, MP4_FOURCC('h','d','l','r'));
+  AppendZeros(aOut, 8);
+  AppendBigEndianU32(aOut, aHandler);
+  AppendZeros(aOut, 13);
+  EndMp4Box(aOut, hdlr);
+
+  const size_t minf = BeginMp4Box(aOut, MP4_FOURCC('m','i','n','f'));
+  const size_t stbl = BeginMp4Box(aOut, MP4_FOURCC('s','t','b','l'));
+  const size_t stsd = BeginMp4Box(aOut, MP4_FOURCC('s','t','s','d'));
+  AppendBigEndianU32(aOut, 0);
+  AppendBigEndianU32(aOut, 1);
+  const size_t entry = BeginMp4Box(aOut, aCodec);
+  AppendZeros(aOut, 28);
+  EndMp4Box(aOut, entry);
+  EndMp4Box(aOut, stsd);
+  // The frames all have the same size, and there are 10 of them.
+  const size_t stsz = BeginMp4Box(aOut, MP4_FOURCC('s','t','s','z'));
+  AppendBigEndianU32(aOut, 0);
+  AppendBigEndianU32(aOut, 6);
+  *aOutSampleCount = aOut.size();
+  AppendBigEndianU32(aOut, 10);
+  EndMp4Box(aOut, stsz);
+  // The frames' durations in two runs, their composition offsets, and the
+  // sync samples.
+  const size_t stts = BeginMp4Box(aOut, MP4_FOURCC('s','t','t','s'));
+  AppendBigEndianU32(aOut, 0);
+  AppendBigEndianU32(aOut, 2);
+  AppendBigEndianU32(aOut, 6);
+  AppendBigEndianU32(aOut, TestMp4FrameDuration);
+  AppendBigEndianU32(aOut, 4);
+  AppendBigEndianU32(aOut, TestMp4FrameDuration);
+  EndMp4Box(aOut, stts);
+  const size_t ctts = BeginMp4Box(aOut, MP4_FOURCC('c','t','t','s'));
+  AppendBigEndianU32(aOut, 0);
+  AppendBigEndianU32(aOut, 1);
+  AppendBigEndianU32(aOut, 10);
+  AppendBigEndianU32(aOut, TestMp4FrameDuration);
+  EndMp4Box(aOut, ctts);
+  const size_t stss = BeginMp4Box(aOut, MP4_FOURCC('s','t','s','s'));
+  AppendBigEndianU32(aOut, 0);
+  AppendBigEndianU32(aOut, 3);
+  AppendBigEndianU32(aOut, 1);
+  AppendBigEndianU32(aOut, 5);
+  AppendBigEndianU32(aOut, 9);
+  EndMp4Box(aOut, stss);
+  EndMp4Box(aOut, stbl);
+  EndMp4Box(aOut, minf);
+  EndMp4Box(aOut, mdia);
+  EndMp4Box(aOut, trak);
+  return tkhd;
+}
+
+// Lays out a small MP4 file with an H.264 video track and an AAC audio
+// track, with just the boxes Mp4Metadata reads, and no real samples.
+static TestMp4
+MakeTestMp4()
+{
+  TestMp4 mp4;
+  std::vector<uint8_t>& out = mp4.bytes;
+  mp4.ftyp = BeginMp4Box(out, MP4_FOURCC('f','t','y','p'));
+  AppendBigEndianU32(out, MP4_FOURCC('i','s','o','m'));
+  AppendBigEndianU32(out, 0x200);
+  AppendBigEndianU32(out, MP4_FOURCC('i','s','o','m'));
+  AppendBigEndianU32(out, MP4_FOURCC('a','v','c','1'));
+  EndMp4Box(out, mp4.ftyp);
+
+  mp4.moov = BeginMp4Box(out, MP4_FOURCC('m','o','o','v'));
+  // A version 0 mvhd; 1000 ticks a second, and 3 seconds long.
+  const size_t mvhd = BeginMp4Box(out, MP4_FOURCC('m','v','h','d'));
+  AppendBigEndianU32(out, 0);
+  AppendZeros(out, 8);
+  AppendBigEndianU32(out, 1000);
+  AppendBigEndianU32(out, 3000);
+  AppendZeros(out, 80);
+  EndMp4Box(out, mvhd);
+  mp4.videoTrak = out.size();
+  mp4.videoTkhd = AppendTestTrack(out, MP4_FOURCC('v','i','d','e'), MP4_FOURCC('a','v','c','1'),
+                                  true, 1920 << 16, 1080 << 16, &mp4.videoSampleCount);
+  mp4.videoMatrix = mp4.videoTkhd + 8 + 4 + 32 + 16;
+  size_t audioSampleCount;
+  AppendTestTrack(out, MP4_FOURCC('s','o','u','n'), MP4_FOURCC('m','p','4','a'),
+                  false, 0, 0, &audioSampleCount);
+  EndMp4Box(out, mp4.moov);
+
+  mp4.mdat = BeginMp4Box(out, MP4_FOURCC('m','d','a','t'));
+  AppendZeros(out, 64);
+  EndMp4Box(out, mp4.mdat);
+  return mp4;
+}
+
+static bool
+WriteFileBytes(const std::string& aFilename, const std::vector<uint8_t>& aBytes)
+{
+  FILE* file = OpenFile(aFilename, "wb");
+  if (!file) {
+    return false;
+  }
+  const bool written = fwrite(&aBytes[0], 1, aBytes.size(), file) == aBytes.size();
+  return (fclose(file) == 0) && written;
+}
+
+static bool
+ReadFileBytes(const std::string& aFilename, std::vector<uint8_t>* aOutBytes)
+{
+  FILE* file = OpenFile(aFilename, "rb");
+  if (!file) {
+    return false;
+  }
+  aOutBytes->clear();
+  uint8_t buffer[4096];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    aOutBytes->insert(aOutBytes->end(), buffer, buffer + length);
+  }
+  const bool read = !ferror(file);
+  fclose(file);
+  return read;
+}
+
+// Checks that the test MP4 in aFilename reads back as MakeTestMp4() laid
+// it out, with its video displayed rotated by aRotation. Prints what
+// differs, if anything.
+static bool
+CheckTestMp4Tracks(const std::string& aFilename, Rotation aRotation)
+{
+  FILE* file = OpenFile(aFilename, "rb");
+  if (!file) {
+    return false;
+  }
+  Mp4File mp4(file);
+  uint32_t brand = 0;
+  std::vector<Mp4Track> tracks;
+  int64_t duration = 0;
+  const bool read = ReadMp4Tracks(mp4, &brand, &tracks) && ReadMp4Duration(mp4, &duration);
+  const bool canRotate = CanRotateMp4Metadata(mp4);
+  fclose(file);
+  if (!read || brand != MP4_FOURCC('i','s','o','m') || tracks.size() != 2 ||
+      duration != 3 * 10000000 || !canRotate) {
+    fprintf(stderr, "Failed to read the test MP4's tracks\n");
+    return false;
+  }
+  const Mp4Track& video = tracks[0];
+  const Mp4Track& audio = tracks[1];
+  if (video.handlerType != MP4_FOURCC('v','i','d','e') ||
+      video.sampleEntryType != MP4_FOURCC('a','v','c','1') ||
+      video.width != (1920 << 16) || video.height != (1080 << 16) ||
+      audio.handlerType != MP4_FOURCC('s','o','u','n') ||
+      audio.sampleEntryType != MP4_FOURCC('m','p','4','a')) {
+    fprintf(stderr, "The test MP4's tracks were misread\n");
+    return false;
+  }
+  int32_t expected[9], identity[9];
+  GetMp4RotationMatrix(aRotation, video.width, video.height, expected);
+  GetMp4RotationMatrix(ROTATE_0, 0, 0, identity);
+  if (memcmp(video.matrix, expected, sizeof(expected)) ||
+      memcmp(audio.matrix, identity, sizeof(identity))) {
+    fprintf(stderr, "%u degrees: the display matrices aren't what was written\n",
+            unsigned(aRotation) * 90);
+    return false;
+  }
+  return true;
+}
+
+bool
+CheckMp4Metadata()
+{
+  const std::string filename = "check-mp4-metadata.mp4";
+  const TestMp4 original = MakeTestMp4();
+  if (!WriteFileBytes(filename, original.bytes) ||
+      !CheckTestMp4Tracks(filename, ROTATE_0)) {
+    remove(filename.c_str());
+    return false;
+  }
+
+  // The keyframes' presentation times, in 100ns units.
+  bool passed = true;
+  KeyframeIndex index;
+  FILE* file = OpenFile(filename, "rb");
+  if (file) {
+    Mp4File mp4(file);
+    passed = ReadMp4KeyframeIndex(mp4, &index) && index.GetLength() == 3;
+    fclose(file);
+  }
+  for (size_t i = 0; passed && i < 3; i++) {
+    const int64_t ticks = int64_t(i * 4 + 1) * TestMp4FrameDuration;
+    passed = index.GetTime(i) == ticks * 10000000 / TestMp4Timescale;
+  }
+  printf("Read the tracks, duration and keyframes: %s\n", passed ? "ok" : "FAILED");
+
+  // The keyframe index mustn't be read past the samples stsz counts.
+  TestMp4 shortened = original;
+  WriteBigEndianU32(shortened.bytes, shortened.videoSampleCount, 8);
+  bool rejected = false;
+  if (WriteFileBytes(filename, shortened.bytes) && (file = OpenFile(filename, "rb"))) {
+    Mp4File mp4(file);
+    rejected = !ReadMp4KeyframeIndex(mp4, &index);
+    fclose(file);
+  }
+  printf("stts describing more samples than stsz counts: %s\n",
+         rejected ? "rejected" : "FAILED");
+  passed = passed && rejected && WriteFileBytes(filename, original.bytes);
+
+  // Rotating rewrites the video's matrix in place, and nothing else.
+  static const Rotation Rotations[] = { ROTATE_90, ROTATE_180, ROTATE_270, ROTATE_0 };
+  for (size_t r = 0; r < sizeof(Rotations) / sizeof(Rotations[0]); r++) {
+    file = OpenFile(filename, "r+b");
+    bool rotated = false;
+    if (file) {
+      Mp4File mp4(file);
+      rotated = RotateMp4Metadata(mp4, Rotations[r]);
+      fclose(file);
+    }
+    std::vector<uint8_t> bytes;
+    bool unmoved = ReadFileBytes(filename, &bytes) && bytes.size() == original.bytes.size();
+    for (size_t i = 0; unmoved && i < bytes.size(); i++) {
+      const bool inMatrix = i >= original.videoMatrix && i < original.videoMatrix + 36;
+      unmoved = inMatrix || bytes[i] == original.bytes[i];
+    }
+    const bool ok = rotated && unmoved && CheckTestMp4Tracks(filename, Rotations[r]);
+    printf("Rotated by %u degrees: %s\n", unsigned(Rotations[r]) * 90, ok ? "ok" : "FAILED");
+    passed = passed && ok;
+  }
+
+  // Malformed files, which ReadBox() or the track parsing must reject,
+  // without RotateMp4Metadata() writing anything; and a final box sized 0,
+  // which runs to the end of the file, which is allowed.
+  static const char* const Cases[] = {
+    "box smaller than its header",
+    "box running past its parent",
+    "box running past the end of the file",
+    "truncated 64 bit size",
+    "64 bit size past the end of the file",
+    "uuid box smaller than its header",
+    "first box isn't ftyp",
+    "two moov boxes",
+    "tkhd version 2",
+    "file truncated in moov",
+    "last box sized 0"
+  };
+  static const size_t NumCases = sizeof(Cases) / sizeof(Cases[0]);
+  for (size_t c = 0; c < NumCases; c++) {
+    TestMp4 mp4 = original;
+    std::vector<uint8_t>& bytes = mp4.bytes;
+    switch (c) {
+      case 0: WriteBigEndianU32(bytes, mp4.moov, 4); break;
+      case 1: WriteBigEndianU32(bytes, mp4.videoTrak, uint32_t(mp4.mdat - mp4.videoTrak + 8)); break;
+      case 2: WriteBigEndianU32(bytes, mp4.mdat, uint32_t(bytes.size() - mp4.mdat + 1)); break;
+      case 3:
+        AppendBigEndianU32(bytes, 1);
+        AppendBigEndianU32(bytes, MP4_FOURCC('f','r','e','e'));
+        AppendBigEndianU32(bytes, 0);
+        break;
+      case 4:
+        AppendBigEndianU32(bytes, 1);
+        AppendBigEndianU32(bytes, MP4_FOURCC('f','r','e','e'));
+        AppendBigEndianU32(bytes, 1);
+        AppendBigEndianU32(bytes, 0);
+        break;
+      case 5:
+        AppendBigEndianU32(bytes, 16);
+        AppendBigEndianU32(bytes, MP4_FOURCC('u','u','i','d'));
+        AppendZeros(bytes, 8);
+        break;
+      case 6: WriteBigEndianU32(bytes, mp4.ftyp + 4, MP4_FOURCC('f','r','e','e')); break;
+      case 7:
+        bytes.insert(bytes.end(), original.bytes.begin() + mp4.moov,
+                     original.bytes.begin() + mp4.mdat);
+        break;
+      case 8: bytes[mp4.videoTkhd + 8] = 2; break;
+      case 9: bytes.resize(mp4.videoTkhd + 40); break;
+      case 10: WriteBigEndianU32(bytes, mp4.mdat, 0); break;
+    }
+    const bool valid = (c == NumCases - 1);
+    bool read = false, rotated = false;
+    std::vector<uint8_t> after;
+    if (WriteFileBytes(filename, bytes) && (file = OpenFile(filename, "r+b"))) {
+      Mp4File mp4File(file);
+      uint32_t brand;
+      std::vector<Mp4Track> tracks;
+      read = ReadMp4Tracks(mp4File, &brand, &tracks);
+      rotated = RotateMp4Metadata(mp4File, ROTATE_90);
+      fclose(file);
+    }
+    const bool untouched = ReadFileBytes(filename, &after) && after == bytes;
+    const bool ok = valid ? (read && rotated) : (!read && !rotated && untouched);
+    printf("%s: %s\n", Cases[c],
+           ok ? (valid ? "accepted" : "rejected") : "FAILED");
+    passed = passed && ok;
+  }
+  remove(filename.c_str());
+  return passed;
+}
@@ -0,0 +1,238 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "TranscodeStats.h"
+#include "FileIO.h"
+#include "HighResClock.h"
+
+#include <math.h>
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+// Each power of two is split into this many buckets, as a power of two.
+// Latencies below the number of sub-buckets each get their own bucket.
+static const uint32_t SubBucketBits = 3;
+static const uint32_t NumSubBuckets = 1 << SubBucketBits;
+static const uint32_t NumBuckets = NumSubBuckets * (64 - SubBucketBits + 1);
+
+// Returns the index of the highest set bit of aValue, which must be non-zero.
+static uint32_t
+HighestBit(uint64_t aValue)
+{
+  uint32_t bit = 0;
+  while (aValue >>= 1) {
+    bit++;
+  }
+  return bit;
+}
+
+LatencyHistogram::LatencyHistogram()
+  : mBuckets(NumBuckets, 0),
+    mCount(0),
+    mTotalUs(0),
+    mMaxUs(0)
+{
+}
+
+uint32_t
+LatencyHistogram::GetBucket(uint64_t aLatencyUs)
+{
+  if (aLatencyUs < NumSubBuckets) {
+    return uint32_t(aLatencyUs);
+  }
+  const uint32_t shift = HighestBit(aLatencyUs) - SubBucketBits;
+  const uint32_t subBucket = uint32_t(aLatencyUs >> shift) & (NumSubBuckets - 1);
+  return NumSubBuckets * (shift + 1) + subBucket;
+}
+
+uint64_t
+LatencyHistogram::GetBucketLatency(uint32_t aBucket)
+{
+  if (aBucket < NumSubBuckets) {
+    return aBucket;
+  }
+  const uint32_t shift = aBucket / NumSubBuckets - 1;
+  const uint64_t low = uint64_t(NumSubBuckets + aBucket % NumSubBuckets) << shift;
+  return low + ((uint64_t(1) << shift) >> 1);
+}
+
+void
+LatencyHistogram::Add(uint64_t aLatencyUs)
+{
+  mBuckets[GetBucket(aLatencyUs)]++;
+  mCount++;
+  mTotalUs += aLatencyUs;
+  mMaxUs = std::max(mMaxUs, aLatencyUs);
+}
+
+void
+LatencyHistogram::Merge(const LatencyHistogram& aOther)
+{
+  for (uint32_t i = 0; i < NumBuckets; i++) {
+    mBuckets[i] += aOther.mBuckets[i];
+  }
+  mCount += aOther.mCount;
+  mTotalUs += aOther.mTotalUs;
+  mMaxUs = std::max(mMaxUs, aOther.mMaxUs);
+}
+
+uint64_t
+LatencyHistogram::GetPercentileUs(double aPercentile) const
+{
+  if (!mCount) {
+    return 0;
+  }
+  const double rank = ceil(mCount * std::max(0.0, std::min(100.0, aPercentile)) / 100.0);
+  const uint64_t target = std::max<uint64_t>(1, uint64_t(rank));
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < NumBuckets; i++) {
+    seen += mBuckets[i];
+    if (seen >= target) {
+      return std::min(GetBucketLatency(i), mMaxUs);
+    }
+  }
+  return mMaxUs;
+}
+
+const char*
+GetTranscodeStageName(TranscodeStage aStage)
+{
+  switch (aStage) {
+    case TranscodeStage_Read: return "read";
+    case TranscodeStage_Rotate: return "rotate";
+    case TranscodeStage_Audio: return "audio";
+    case TranscodeStage_Write: return "write";
+    default: return "unknown";
+  }
+}
+
+void
+TranscodeStats::Record(TranscodeStage aStage,
+                       uint64_t aLatencyUs,
+                       size_t aBytesIn,
+                       size_t aBytesOut)
+{
+  StageStats& stage = mStages[aStage];
+  stage.latency.Add(aLatencyUs);
+  stage.bytesIn += aBytesIn;
+  stage.bytesOut += aBytesOut;
+}
+
+void
+TranscodeStats::Merge(const TranscodeStats& aOther)
+{
+  for (int i = 0; i < NumTranscodeStages; i++) {
+    mStages[i].latency.Merge(aOther.mStages[i].latency);
+    mStages[i].bytesIn += aOther.mStages[i].bytesIn;
+    mStages[i].bytesOut += aOther.mStages[i].bytesOut;
+  }
+}
+
+AutoStageTimer::AutoStageTimer(TranscodeStats& aStats, TranscodeStage aStage)
+  : mStats(aStats),
+    mStage(aStage),
+    mStartUs(GetHighResTimeUs()),
+    mBytesIn(0),
+    mBytesOut(0)
+{
+}
+
+AutoStageTimer::~AutoStageTimer()
+{
+  mStats.Record(mStage, GetHighResTimeUs() - mStartUs, mBytesIn, mBytesOut);
+}
+
+// Returns aString as a quoted JSON string.
+static std::string
+QuoteJson(const std::string& aString)
+{
+  static const char HexDigits[] = "0123456789abcdef";
+  std::string quoted = "\"";
+  for (size_t i = 0; i < aString.size(); i++) {
+    const unsigned char c = aString[i];
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+      quoted += c;
+    } else if (c < 0x20) {
+      quoted += "\\u00";
+      quoted += HexDigits[c >> 4];
+      quoted += HexDigits[c & 0xf];
+    } else {
+      quoted += c;
+    }
+  }
+  return quoted + "\"";
+}
+
+std::string
+FormatTranscodeReport(const TranscodeReportInfo& aInfo,
+                      const TranscodeStats& aStats)
+{
+  const double wallTimeS = aInfo.wallTimeUs / 1e6;
+  std::ostringstream json;
+  json << std::fixed << std::setprecision(3);
+  json << "{\n"
+       << "  \"input\": " << QuoteJson(aInfo.inputFilename) << ",\n"
+       << "  \"output\": " << QuoteJson(aInfo.outputFilename) << ",\n"
+       << "  \"pipelined\": " << (aInfo.pipelined ? "true" : "false") << ",\n"
+       << "  \"segments\": " << aInfo.numSegments << ",\n"
+       << "  \"wallTimeMs\": " << aInfo.wallTimeUs / 1e3 << ",\n"
+       << "  \"startupLatencyMs\": " << aInfo.startupLatencyUs / 1e3 << ",\n"
+       << "  \"videoFrames\": " << aInfo.numVideoFrames << ",\n"
+       << "  \"fps\": " << (wallTimeS > 0 ? aInfo.numVideoFrames / wallTimeS : 0.0) << ",\n"
+       << "  \"inputBytes\": " << aInfo.inputBytes << ",\n"
+       << "  \"outputBytes\": " << aInfo.outputBytes << ",\n"
+       << "  \"stages\": {\n";
+  for (int i = 0; i < NumTranscodeStages; i++) {
+    const StageStats& stage = aStats.Get(TranscodeStage(i));
+    const LatencyHistogram& latency = stage.latency;
+    json << "    " << QuoteJson(GetTranscodeStageName(TranscodeStage(i))) << ": {"
+         << "\"count\": " << latency.GetCount()
+         << ", \"totalMs\": " << latency.GetTotalUs() / 1e3
+         << ", \"p50Ms\": " << latency.GetPercentileUs(50) / 1e3
+         << ", \"p95Ms\": " << latency.GetPercentileUs(95) / 1e3
+         << ", \"p99Ms\": " << latency.GetPercentileUs(99) / 1e3
+         << ", \"maxMs\": " << latency.GetMaxUs() / 1e3
+         << ", \"bytesIn\": " << stage.bytesIn
+         << ", \"bytesOut\": " << stage.bytesOut
+         << "}" << (i + 1 < NumTranscodeStages ? "," : "") << "\n";
+  }
+  json << "  }\n"
+       << "}\n";
+  return json.str();
+}
+
+bool
+WriteTranscodeReport(const std::string& aFilename,
+                     const TranscodeReportInfo& aInfo,
+                     const TranscodeStats& aStats)
+{
+  FILE* file = OpenFile(aFilename, "wb");
+  if (!file) {
+    return false;
+  }
+  return WriteTranscodeReport(file, aInfo, aStats);
+}
+
+bool
+WriteTranscodeReport(FILE* aFile,
+                     const TranscodeReportInfo& aInfo,
+                     const TranscodeStats& aStats)
+{
+  const std::string report = FormatTranscodeReport(aInfo, aStats);
+  const bool written = fwrite(report.data(), 1, report.size(), aFile) == report.size();
+  return (fclose(aFile) == 0) && written;
+}
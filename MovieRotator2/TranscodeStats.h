@@ -0,0 +1,152 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Timing of each stage of a transcode, so that we can see which stage is the
+// bottleneck for each kind of input, and a JSON report of them written when
+// a job finishes.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// A histogram of latencies in microseconds, with buckets whose width grows
+// with the latency, so that percentiles are within about 6% at any scale.
+class LatencyHistogram {
+public:
+  LatencyHistogram();
+
+  void Add(uint64_t aLatencyUs);
+  void Merge(const LatencyHistogram& aOther);
+
+  uint64_t GetCount() const { return mCount; }
+  uint64_t GetTotalUs() const { return mTotalUs; }
+  uint64_t GetMaxUs() const { return mMaxUs; }
+
+  // Returns the latency which aPercentile percent of the samples are at or
+  // below, e.g. 95 for the p95. Returns 0 if there are no samples.
+  uint64_t GetPercentileUs(double aPercentile) const;
+
+private:
+  static uint32_t GetBucket(uint64_t aLatencyUs);
+  // Returns the middle of the range of latencies in aBucket.
+  static uint64_t GetBucketLatency(uint32_t aBucket);
+
+  std::vector<uint64_t> mBuckets;
+  uint64_t mCount;
+  uint64_t mTotalUs;
+  uint64_t mMaxUs;
+};
+
+enum TranscodeStage {
+  // Reading and decoding a frame from the source.
+  TranscodeStage_Read,
+  // Rotating, and scaling, a video frame.
+  TranscodeStage_Rotate,
+  // Filtering a chunk of audio.
+  TranscodeStage_Audio,
+  // Encoding and writing a frame to the sink.
+  TranscodeStage_Write,
+  NumTranscodeStages
+};
+
+// Returns the name a stage is reported as.
+const char* GetTranscodeStageName(TranscodeStage aStage);
+
+struct StageStats {
+  StageStats() : bytesIn(0), bytesOut(0) {}
+  LatencyHistogram latency;
+  // The sizes of the frames the stage took and produced.
+  uint64_t bytesIn;
+  uint64_t bytesOut;
+};
+
+// The timings of every stage of a transcode. Each stage only ever runs on
+// one thread, and only records its own stats, so recording doesn't need a
+// lock; read the stats once the transcode has finished.
+class TranscodeStats {
+public:
+  void Record(TranscodeStage aStage, uint64_t aLatencyUs, size_t aBytesIn, size_t aBytesOut);
+  void Merge(const TranscodeStats& aOther);
+
+  const StageStats& Get(TranscodeStage aStage) const { return mStages[aStage]; }
+
+private:
+  StageStats mStages[NumTranscodeStages];
+};
+
+// Records how long the scope takes as a sample of a stage.
+class AutoStageTimer {
+public:
+  AutoStageTimer(TranscodeStats& aStats, TranscodeStage aStage);
+  ~AutoStageTimer();
+
+  // The sizes of the frames the stage took and produced, recorded with the
+  // time when the scope ends.
+  void SetBytes(size_t aBytesIn, size_t aBytesOut) {
+    mBytesIn = aBytesIn;
+    mBytesOut = aBytesOut;
+  }
+
+private:
+  TranscodeStats& mStats;
+  TranscodeStage mStage;
+  uint64_t mStartUs;
+  size_t mBytesIn;
+  size_t mBytesOut;
+};
+
+// What a job's performance report describes, besides its stages' stats.
+struct TranscodeReportInfo {
+  TranscodeReportInfo()
+    : pipelined(true),
+      numSegments(1),
+      wallTimeUs(0),
+      startupLatencyUs(0),
+      numVideoFrames(0),
+      inputBytes(0),
+      outputBytes(0)
+  {
+  }
+  // UTF-8.
+  std::string inputFilename;
+  std::string outputFilename;
+  bool pipelined;
+  uint32_t numSegments;
+  uint64_t wallTimeUs;
+  uint64_t startupLatencyUs;
+  uint64_t numVideoFrames;
+  // The sizes of the input and output files.
+  uint64_t inputBytes;
+  uint64_t outputBytes;
+};
+
+// Formats a job's performance report as a JSON object.
+std::string FormatTranscodeReport(const TranscodeReportInfo& aInfo,
+                                  const TranscodeStats& aStats);
+
+// Writes the report to aFilename. Returns false on error.
+bool WriteTranscodeReport(const std::string& aFilename,
+                          const TranscodeReportInfo& aInfo,
+                          const TranscodeStats& aStats);
+
+// Writes the report to aFile, and closes it, for callers which open files
+// by wide filenames. Returns false on error.
+bool WriteTranscodeReport(FILE* aFile,
+                          const TranscodeReportInfo& aInfo,
+                          const TranscodeStats& aStats);
@@ -253,6 +253,9 @@ OpenSpecialFile(SpecialPath aPath, FileMode aMode, FILE** aOutFile)
     case LogFilePath:
       filename = L"\\log.txt";
       break;
+    case RotationTuningPath:
+      filename = L"\\rotation-tuning.txt";
+      break;
     default:
       return E_INVALIDARG;
   }
@@ -158,7 +158,8 @@ CloneSample(IMFSample* aSample, IMFSample** aClone);
 // Use fputws(L"...", file) to write, and close with fclose(file);
 enum SpecialPath {
   RegistrationKeyPath,
-  LogFilePath
+  LogFilePath,
+  RotationTuningPath
 };
 
 enum FileMode {
@@ -14,8 +14,10 @@
 
 #include "stdafx.h"
 #include "VideoDecoder.h"
+#include "DecodeLoop.h"
 #include "Utils.h"
 #include "Interfaces.h"
+#include "HighResClock.h"
 
 using std::wstring;
 using std::thread;
@@ -23,6 +25,18 @@ using std::mutex;
 using std::lock_guard;
 using std::unique_lock;
 
+static DecodeAheadLimits
+GetDecodeAheadLimits()
+{
+  DecodeAheadLimits limits;
+  limits.minVideoFrames = VIDEO_SAMPLE_QUEUE_MIN_FRAMES;
+  limits.maxVideoFrames = VIDEO_SAMPLE_QUEUE_MAX_FRAMES;
+  limits.minAudioMs = AUDIO_SAMPLE_QUEUE_MIN_MS;
+  limits.maxAudioMs = AUDIO_SAMPLE_QUEUE_MAX_MS;
+  limits.budgetBytes = DECODE_AHEAD_BUDGET_BYTES;
+  return limits;
+}
+
 VideoDecoder::VideoDecoder(HWND aEventTarget,
                            const std::wstring& aFilename,
                            IDirect3DDeviceManager9* aDeviceManager,
@@ -31,8 +45,17 @@ VideoDecoder::VideoDecoder(HWND aEventTarget,
     mFilename(aFilename),
     mAudioStreamIndex(-1),
     mVideoStreamIndex(-1),
+    mVideoQueue(VIDEO_SAMPLE_QUEUE_MAX_FRAMES),
+    mAudioQueue(AUDIO_SAMPLE_QUEUE_CAPACITY),
     mEnqueuedAudioDuration(0),
     mDuration(0),
+    mDecodeAhead(GetDecodeAheadLimits()),
+    mVideoTargetFrames(VIDEO_SAMPLE_QUEUE_MIN_FRAMES),
+    mAudioTargetMs(AUDIO_SAMPLE_QUEUE_MIN_MS),
+    mNumLateFrames(0),
+    mNumAudioUnderruns(0),
+    mReportedLateFrames(0),
+    mReportedAudioUnderruns(0),
     mDeviceManager(aDeviceManager),
     mD3D9(aD3D9),
     mShutdown(false),
@@ -44,6 +67,14 @@ VideoDecoder::VideoDecoder(HWND aEventTarget,
 
 VideoDecoder::~VideoDecoder()
 {
+  // The decode thread has been joined, so nothing else is using the queues.
+  MediaSample* m = nullptr;
+  while (mAudioQueue.TryPop(&m)) {
+    delete m;
+  }
+  while (mVideoQueue.TryPop(&m)) {
+    delete m;
+  }
 }
 
 static void
@@ -62,14 +93,17 @@ VideoDecoder::Begin()
 HRESULT
 VideoDecoder::Shutdown()
 {
-  {
-    lock_guard<mutex> guard(mMutex);
-    mShutdown = true;
-    mCondVar.notify_all();
-  }
+  mShutdown = true;
+  mVideoDecodeEvent.Notify();
+  mAudioDecodeEvent.Notify();
+  mAudioEvent.Notify();
+  // The decode thread starts the audio decode thread, so join it first.
   if (mThread.joinable()) {
     mThread.join();
   }
+  if (mAudioThread.joinable()) {
+    mAudioThread.join();
+  }
   return S_OK;
 }
 
@@ -132,6 +166,35 @@ VideoDecoder::CreateReader(bool aWithVideoProcessing)
                               &mVideoStreamIndex);
   ENSURE_SUCCESS(hr, hr);
 
+  // The audio is read from mAudioReader.
+  if (mAudioStreamIndex != -1) {
+    hr = mReader->SetStreamSelection(mAudioStreamIndex, FALSE);
+    ENSURE_SUCCESS(hr, hr);
+  }
+
+  return S_OK;
+}
+
+HRESULT
+VideoDecoder::CreateAudioReader()
+{
+  HRESULT hr = MFCreateSourceReaderFromURL(mFilename.c_str(), NULL, &mAudioReader);
+  ENSURE_SUCCESS(hr, hr);
+
+  DWORD audioStreamIndex = -1;
+  DWORD videoStreamIndex = -1;
+  hr = GetReaderStreamIndexes(mAudioReader,
+                              &audioStreamIndex,
+                              &videoStreamIndex);
+  ENSURE_SUCCESS(hr, hr);
+  ENSURE_TRUE(audioStreamIndex == mAudioStreamIndex, E_UNEXPECTED);
+
+  // The video is read from mReader.
+  if (videoStreamIndex != -1) {
+    hr = mAudioReader->SetStreamSelection(videoStreamIndex, FALSE);
+    ENSURE_SUCCESS(hr, hr);
+  }
+
   return S_OK;
 }
 
@@ -210,12 +273,14 @@ VideoDecoder::LoadMetadata()
       DBGMSG(L"Decoder can't process MFT_MESSAGE_SET_D3D_MANAGER, no GPU accelerated decoding!");
     }
 
-    lock_guard<mutex> lock(mMutex);
     mHasVideo = true;
   }
 
   // Set audio stream output type.
   if (mAudioStreamIndex != -1) {
+    hr = CreateAudioReader();
+    ENSURE_SUCCESS(hr, hr);
+
     IMFMediaTypePtr type;
     hr = MFCreateMediaType(&type);
     ENSURE_SUCCESS(hr, hr);
@@ -226,16 +291,19 @@ VideoDecoder::LoadMetadata()
     hr = type->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_PCM);
     ENSURE_SUCCESS(hr, hr);
 
-    hr = mReader->SetCurrentMediaType(mAudioStreamIndex, NULL, type);
+    hr = mAudioReader->SetCurrentMediaType(mAudioStreamIndex, NULL, type);
     ENSURE_SUCCESS(hr, hr);
 
-    hr = mReader->GetCurrentMediaType(mAudioStreamIndex, &mAudioType);
+    hr = mAudioReader->GetCurrentMediaType(mAudioStreamIndex, &mAudioType);
     ENSURE_SUCCESS(hr, hr);
 
     {
       lock_guard<mutex> lock(mMutex);
-      mHasAudio = true;
+      mDecodeAhead.SetAudioBytesPerSecond(
+        MFGetAttributeUINT32(mAudioType, MF_MT_AUDIO_AVG_BYTES_PER_SECOND, 0));
     }
+
+    mHasAudio = true;
     // Decode one sample. If the audio stream is HE-AAC the media type may not
     // take into account the effects of SBR/PS on the sample rate or number of
     // channels until after we've decoded the first sample.
@@ -258,15 +326,13 @@ VideoDecoder::GetDuration()
 bool
 VideoDecoder::HasAudio()
 {
-  lock_guard<mutex> lock(mMutex);
-  return mHasAudio || !mAudioQueue.empty();
+  return mHasAudio || !mAudioQueue.IsEmpty();
 }
 
 bool
 VideoDecoder::HasVideo()
 {
-  lock_guard<mutex> lock(mMutex);
-  return mHasVideo || !mVideoQueue.empty();
+  return mHasVideo || !mVideoQueue.IsEmpty();
 }
 
 bool
@@ -278,13 +344,27 @@ VideoDecoder::IsShutdown()
 bool
 VideoDecoder::IsAudioQueueFull()
 {
-  return mEnqueuedAudioDuration > MStoHNS(AUDIO_SAMPLE_QUEUE_TARGET_MS);
+  return mEnqueuedAudioDuration > MStoHNS(mAudioTargetMs) ||
+         mAudioQueue.Size() >= mAudioQueue.GetCapacity();
 }
 
 bool
 VideoDecoder::IsVideoQueueFull()
 {
-  return mVideoQueue.size() >= VIDEO_SAMPLE_QUEUE_TARGET_FRAMES;
+  return mVideoQueue.Size() >= mVideoTargetFrames;
+}
+
+bool
+VideoDecoder::IsAudioQueueLow()
+{
+  return mEnqueuedAudioDuration <= MStoHNS(mAudioTargetMs / 2) &&
+         mAudioQueue.Size() < mAudioQueue.GetCapacity() / 2;
+}
+
+bool
+VideoDecoder::CanDecodeVideo()
+{
+  return IsShutdown() || (mHasVideo && !IsVideoQueueFull());
 }
 
 HRESULT
@@ -297,22 +377,20 @@ VideoDecoder::DecodeAudio()
   DWORD flags;
   LONGLONG timestamp;
   IMFSamplePtr sample;
-  hr = mReader->ReadSample(mAudioStreamIndex, 0, &actualStreamIndex, &flags, &timestamp, &sample);
+  hr = mAudioReader->ReadSample(mAudioStreamIndex, 0, &actualStreamIndex, &flags, &timestamp, &sample);
   ENSURE_SUCCESS(hr, hr);
   ENSURE_TRUE(!(flags & MF_SOURCE_READERF_ERROR), E_FAIL);
 
-  if (flags & MF_SOURCE_READERF_ENDOFSTREAM) {
-    lock_guard<mutex> lock(mMutex);
-    mHasAudio = false;
-  }
-
   // Null sample can sometimes just mean the decoder needed more data...
   if (!sample) {
+    if (flags & MF_SOURCE_READERF_ENDOFSTREAM) {
+      EndAudio();
+    }
     return S_FALSE;
   }
 
   if (flags & MF_SOURCE_READERF_CURRENTMEDIATYPECHANGED) {
-    hr = mReader->GetCurrentMediaType(mAudioStreamIndex, &mAudioType);
+    hr = mAudioReader->GetCurrentMediaType(mAudioStreamIndex, &mAudioType);
     ENSURE_SUCCESS(hr, hr);
   }
 
@@ -321,11 +399,17 @@ VideoDecoder::DecodeAudio()
   ENSURE_SUCCESS(hr, hr);
 
   MediaSample* m = new MediaSample(sample, timestamp, flags, mAudioType);
-  {
-    lock_guard<mutex> lock(mMutex);
-    mEnqueuedAudioDuration += duration;
-    mAudioQueue.push(m);
-    mCondVar.notify_one();
+  mEnqueuedAudioDuration += duration;
+  if (!mAudioQueue.TryPush(m)) {
+    // We only decode when IsAudioQueueFull() is false, so there's room.
+    mEnqueuedAudioDuration -= duration;
+    delete m;
+    return E_UNEXPECTED;
+  }
+  mAudioEvent.NotifyIf([this]() { return !mAudioQueue.IsEmpty(); });
+
+  if (flags & MF_SOURCE_READERF_ENDOFSTREAM) {
+    EndAudio();
   }
 
   return S_OK;
@@ -341,17 +425,17 @@ VideoDecoder::DecodeVideo()
   DWORD flags;
   LONGLONG timestamp;
   IMFSamplePtr sample;
+  const uint64_t startUs = GetHighResTimeUs();
   hr = mReader->ReadSample(mVideoStreamIndex, 0, &actualStreamIndex, &flags, &timestamp, &sample);
+  const uint64_t decodeUs = GetHighResTimeUs() - startUs;
   ENSURE_SUCCESS(hr, hr);
   ENSURE_TRUE(!(flags & MF_SOURCE_READERF_ERROR), E_FAIL);
 
-  if (flags & MF_SOURCE_READERF_ENDOFSTREAM) {
-    lock_guard<mutex> lock(mMutex);
-    mHasVideo = false;
-  }
-
   // Null sample can sometimes just mean the decoder needed more data...
   if (!sample) {
+    if (flags & MF_SOURCE_READERF_ENDOFSTREAM) {
+      mHasVideo = false;
+    }
     return S_FALSE;
   }
 
@@ -360,69 +444,67 @@ VideoDecoder::DecodeVideo()
     ENSURE_SUCCESS(hr, hr);
   }
 
-  MediaSample* m = new MediaSample(sample, timestamp, flags, mVideoType);
+  DWORD length = 0;
+  sample->GetTotalLength(&length);
   {
     lock_guard<mutex> lock(mMutex);
-    mVideoQueue.push(m);
+    mDecodeAhead.AddVideoFrame(timestamp, decodeUs, length);
+  }
+
+  MediaSample* m = new MediaSample(sample, timestamp, flags, mVideoType);
+  if (!mVideoQueue.TryPush(m)) {
+    // We only decode when IsVideoQueueFull() is false, so there's room.
+    delete m;
+    return E_UNEXPECTED;
+  }
+
+  if (flags & MF_SOURCE_READERF_ENDOFSTREAM) {
+    mHasVideo = false;
   }
 
   return S_OK;
 }
 
 HRESULT
-VideoDecoder::Decode()
+VideoDecoder::DecodeVideoStream()
 {
-  HRESULT hr;
-  while (true) {
-    {
-      // Check if we've shutdown.
-      lock_guard<mutex> guard(mMutex);
-      if (IsShutdown()) {
-        return S_OK;
-      }
-    }
-
-    // Audio Decode.
-    if (mHasAudio) {
-      bool audioQueueFull;
-      {
-        lock_guard<mutex> guard(mMutex);
-        audioQueueFull = IsAudioQueueFull();
-      }
-      if (!audioQueueFull) {
-        hr = DecodeAudio();
-        ENSURE_SUCCESS(hr, hr);
-      }
-    }
-
-    // Video Decode.
-    if (mHasVideo) {
-      bool videoQueueFull;
-      {
-        lock_guard<mutex> guard(mMutex);
-        videoQueueFull = IsVideoQueueFull();
-      }
-      if (!videoQueueFull) {
-        hr = DecodeVideo();
-        ENSURE_SUCCESS(hr, hr);
-      }
-    }
+  // While the video queue is full, we wait until a frame popped off it
+  // makes room, or we're shutdown.
+  HRESULT hr = S_OK;
+  DecodeStreamUntilEnd(mHasVideo, mShutdown, mVideoDecodeEvent,
+                       [this]() { UpdateDecodeAhead(); },
+                       [this]() { return IsVideoQueueFull(); },
+                       [this, &hr]() {
+                         hr = DecodeVideo();
+                         return SUCCEEDED(hr);
+                       });
+  ENSURE_SUCCESS(hr, hr);
+  return S_OK;
+}
 
-    {
-      // Wait while both sample queues are full and we're not shutdown.
-      // We'll break out of this loop when we're shutdown, or when a sample
-      // is popped off one of the sample queues.
-      unique_lock<mutex> lock(mMutex);
-      while (!IsShutdown() &&
-             (!mHasAudio || IsAudioQueueFull()) &&
-             (!mHasVideo || IsVideoQueueFull())) {
-        mCondVar.wait(lock);
-      }
-    }
-  }
+HRESULT
+VideoDecoder::DecodeAudioStream()
+{
+  // While the audio queue is full, we wait until it's drained to half its
+  // depth, or we're shutdown.
+  HRESULT hr = S_OK;
+  DecodeStreamUntilEnd(mHasAudio, mShutdown, mAudioDecodeEvent,
+                       [this]() { UpdateDecodeAhead(); },
+                       [this]() { return IsAudioQueueFull(); },
+                       [this, &hr]() {
+                         hr = DecodeAudio();
+                         return SUCCEEDED(hr);
+                       });
+  ENSURE_SUCCESS(hr, hr);
   return S_OK;
 }
 
+static void
+CallVideoDecoderRunAudio(VideoDecoder* aDecoder)
+{
+  aDecoder->RunAudio();
+}
+
 // Called on the decode thread. Don't call this.
 void
 VideoDecoder::Run()
@@ -437,59 +519,128 @@ VideoDecoder::Run()
     NotifyListeners(VideoDecoder_Loaded);
   } else {
     mReader = nullptr;
+    mAudioReader = nullptr;
     NotifyListeners(VideoDecoder_Error);
     return;
   }
 
-  hr = Decode();
+  if (mHasAudio) {
+    mAudioThread = thread(CallVideoDecoderRunAudio, this);
+  }
+
+  hr = DecodeVideoStream();
+  if (FAILED(hr)) {
+    NotifyListeners(VideoDecoder_Error);
+  }
+}
+
+// Called on the audio decode thread. Don't call this.
+void
+VideoDecoder::RunAudio()
+{
+  DBGMSG(L"VideoDecoder audio decode thread started\n");
+  AutoComInit initCOM;
+  AutoWMFInit initWMF;
+
+  HRESULT hr = DecodeAudioStream();
   if (FAILED(hr)) {
     NotifyListeners(VideoDecoder_Error);
   }
 }
 
+void
+VideoDecoder::UpdateDecodeAhead()
+{
+  // Both decode threads call this, so read the counts under the lock, so
+  // that we never see them older than they were last passed on.
+  lock_guard<mutex> lock(mMutex);
+  const uint64_t numLateFrames = mNumLateFrames;
+  const uint64_t numAudioUnderruns = mNumAudioUnderruns;
+  mDecodeAhead.AddLateFrames(numLateFrames - mReportedLateFrames);
+  mDecodeAhead.AddAudioUnderruns(numAudioUnderruns - mReportedAudioUnderruns);
+  mReportedLateFrames = numLateFrames;
+  mReportedAudioUnderruns = numAudioUnderruns;
+  if (!mDecodeAhead.Update(GetHighResTimeUs())) {
+    return;
+  }
+  mVideoTargetFrames = mDecodeAhead.GetVideoFrames();
+  mAudioTargetMs = mDecodeAhead.GetAudioMs();
+  DecodeAheadStats stats;
+  mDecodeAhead.GetStats(&stats);
+  DBGMSG(L"VideoDecoder decoding %u frames and %u ms of audio ahead (%S); decode %.1lf +/- %.1lf ms per %.1lf ms frame\n",
+         stats.videoFrames, stats.audioMs,
+         GetDecodeAheadReasonName(stats.changes.back().reason),
+         stats.meanDecodeUs / 1e3, stats.stdDevDecodeUs / 1e3,
+         stats.frameIntervalUs / 1e3);
+}
+
+void
+VideoDecoder::GetDecodeAheadStats(DecodeAheadStats* aOutStats)
+{
+  lock_guard<mutex> lock(mMutex);
+  mDecodeAhead.GetStats(aOutStats);
+}
+
+void
+VideoDecoder::OnVideoFrameLate()
+{
+  mNumLateFrames++;
+}
+
+void
+VideoDecoder::SetNumAudioUnderruns(uint64_t aNumUnderruns)
+{
+  mNumAudioUnderruns = aNumUnderruns;
+}
+
+void
+VideoDecoder::EndAudio()
+{
+  mHasAudio = false;
+  mAudioEvent.Notify();
+}
+
 MediaSample*
 VideoDecoder::PopAudio(bool aBlocking)
 {
-  unique_lock<mutex> lock(mMutex);
-  if (!mHasAudio) {
-    return nullptr;
-  }
-  while (mAudioQueue.empty() &&
-         !IsShutdown()) {
-    if (!aBlocking) {
+  MediaSample* m = nullptr;
+  while (true) {
+    // Read whether the audio has ended before trying to pop, as the decode
+    // thread ends it after pushing the last sample. If we find the queue
+    // empty after reading that it's ended, there are no more samples.
+    const bool ended = !mHasAudio;
+    if (mAudioQueue.TryPop(&m)) {
+      break;
+    }
+    if (ended || !aBlocking || IsShutdown()) {
       return nullptr;
     }
-    mCondVar.wait(lock);
+    mAudioEvent.Wait([this]() {
+      return !mAudioQueue.IsEmpty() || !mHasAudio || IsShutdown();
+    });
   }
-  MediaSample* m = mAudioQueue.front();
-  mAudioQueue.pop();
   LONGLONG duration = 0;
   m->sample->GetSampleDuration(&duration);
   mEnqueuedAudioDuration -= duration;
-  mCondVar.notify_one();
+  mAudioDecodeEvent.NotifyIf([this]() { return IsAudioQueueLow(); });
   return m;
 }
 
 MediaSample*
 VideoDecoder::PeekVideo()
 {
-  lock_guard<mutex> guard(mMutex);
-  if (mVideoQueue.empty()) {
-    return nullptr;
-  }
-  return mVideoQueue.front();
+  MediaSample** front = mVideoQueue.Peek();
+  return front ? *front : nullptr;
 }
 
 MediaSample*
 VideoDecoder::PopVideo()
 {
-  lock_guard<mutex> guard(mMutex);
-  if (mVideoQueue.empty()) {
+  MediaSample* m = nullptr;
+  if (!mVideoQueue.TryPop(&m)) {
     return nullptr;
   }
-  MediaSample* m = mVideoQueue.front();
-  mVideoQueue.pop();
-  mCondVar.notify_one();
+  mVideoDecodeEvent.NotifyIf([this]() { return CanDecodeVideo(); });
   return m;
 }
 
@@ -14,7 +14,9 @@
 
 #pragma once
 
+#include "DecodeAhead.h"
 #include "EventListeners.h"
+#include "SpscRing.h"
 
 struct MediaSample {
   MediaSample(IMFSample* aSample,
@@ -43,13 +45,29 @@ struct MediaSample {
   IMFMediaTypePtr type;
 };
 
-typedef std::queue< MediaSample* > MediaSampleQueue;
+// Each queue has one producer, the decode thread, and one consumer; the
+// audio callback for audio, and the paint thread for video.
+typedef SpscRing< MediaSample* > MediaSampleQueue;
 
-// The amount of decoded audio we try to keep in our audio queue.
-#define AUDIO_SAMPLE_QUEUE_TARGET_MS 1000
+// The range of the amount of decoded audio we try to keep in our audio
+// queue. We start at the least, and the DecodeAheadController raises it if
+// the audio output underruns. Once the queue is full, the decode thread
+// isn't woken to refill it until it's down to half, so that the audio
+// callback isn't waking it for every sample it pops.
+#define AUDIO_SAMPLE_QUEUE_MIN_MS 1000
+#define AUDIO_SAMPLE_QUEUE_MAX_MS 4000
 
-// The number of decoded video frames we try to keep in our queue.
-#define VIDEO_SAMPLE_QUEUE_TARGET_FRAMES 2
+// The most audio samples the audio queue holds, however short they are.
+#define AUDIO_SAMPLE_QUEUE_CAPACITY 512
+
+// The range of the number of decoded video frames we try to keep in our
+// queue. We start at the least, and the DecodeAheadController raises it if
+// the decode time varies, or frames are late.
+#define VIDEO_SAMPLE_QUEUE_MIN_FRAMES 2
+#define VIDEO_SAMPLE_QUEUE_MAX_FRAMES 16
+
+// The most bytes of decoded video frames and audio we keep queued.
+#define DECODE_AHEAD_BUDGET_BYTES (256 * 1024 * 1024)
 
 class VideoDecoder : public EventSource {
 public:
@@ -60,7 +78,9 @@ public:
   ~VideoDecoder();
 
   // Begins the decode. The decode automatically throttles itself once its
-  // buffers are full.
+  // buffers are full. Audio and video are decoded on threads of their own,
+  // from readers of their own, so that a slow video frame doesn't hold up
+  // the audio, and the audio doesn't underrun.
   HRESULT Begin();
 
   // Shutsdown the decode. Synchronous!
@@ -78,69 +98,120 @@ public:
   HRESULT GetVideoMediaType(IMFMediaType** aOutType);
 
   // Pops and returns the audio MediaSample at the front of the queue, or nullptr
-  // if the queue is empty. Caller must delete the sample. Threadsafe.
-  // If aBlocking==true, this call blocks until a sample is available.
+  // if the queue is empty. Caller must delete the sample. Only call this from
+  // one thread at a time. Unless it blocks, it's wait-free, so it can be
+  // called from the audio callback.
+  // If aBlocking==true, this call blocks until a sample is available, or
+  // the audio has ended.
   MediaSample* PopAudio(bool aBlocking);
 
   // Pops and returns the video MediaSample at the front of the queue, or nullptr
-  // if the queue is empty. Caller must delete the sample. Threadsafe.
+  // if the queue is empty. Caller must delete the sample. Only call this and
+  // PeekVideo() from one thread at a time. Wait-free.
   MediaSample* PopVideo();
 
   // Returns the video MediaSample at the front of the queue without popping,
-  // or nullptr if the queue is empty. Caller must *not* delete the sample. Threadsafe.
+  // or nullptr if the queue is empty. Caller must *not* delete the sample. Wait-free.
   MediaSample* PeekVideo();
 
   // Returns duration in hundred nanosecond units.
   uint64_t GetDuration();
 
+  // Records that a video frame was shown late, or skipped, so that we keep
+  // more frames decoded ahead. Threadsafe and wait-free.
+  void OnVideoFrameLate();
+
+  // Records how many times the audio output has underrun, and played
+  // silence, as the playback clock counts them, so that we keep more audio
+  // decoded ahead. Threadsafe and wait-free.
+  void SetNumAudioUnderruns(uint64_t aNumUnderruns);
+
+  // Returns how far ahead we're decoding, and why that last changed.
+  // Threadsafe.
+  void GetDecodeAheadStats(DecodeAheadStats* aOutStats);
+
   // Note: Pop audio must maintian audio decoded counter!
 
   // Called on the decode thread. Don't call this.
   void Run();
 
+  // Called on the audio decode thread. Don't call this.
+  void RunAudio();
+
 private:
 
   // Initializes the SourceReader.
   HRESULT LoadMetadata();
 
+  // Creates mReader, which we read the metadata and video from.
   HRESULT CreateReader(bool aWithVideoProcessing);
 
-  // High-level driver of the decode process.
-  HRESULT Decode();
+  // Creates mAudioReader, which we read the audio from.
+  HRESULT CreateAudioReader();
+
+  // Decode each stream until it ends, or we're shutdown, waiting while its
+  // queue is full. Both run DecodeStreamUntilEnd().
+  HRESULT DecodeVideoStream();
+  HRESULT DecodeAudioStream();
 
   // Returns true if we are/should shutdown.
-  // Caller must acquire the mMutex first.
   bool IsShutdown();
 
   // Returns true if the audio queue is full, i.e. if we don't need to
-  // decode audio. Caller must acquire the mMutex first.
+  // decode audio.
   bool IsAudioQueueFull();
 
   // Returns true if the video queue is full, i.e. if we don't need to
-  // decode video. Caller must acquire the mMutex first.
+  // decode video.
   bool IsVideoQueueFull();
 
+  // Returns true if the audio queue has drained enough that the decode
+  // thread should be woken to refill it.
+  bool IsAudioQueueLow();
+
+  // Returns true if the video decode thread has something to do; that's
+  // if we're shutdown, or the video queue has room.
+  bool CanDecodeVideo();
+
   // Decodes one audio sample, pushing it onto the queue.
   HRESULT DecodeAudio();
 
   // Decodes one video sample, pushing it onto the queue.
   HRESULT DecodeVideo();
 
+  // Marks the audio as finished decoding, and wakes PopAudio() if it's
+  // waiting for more.
+  void EndAudio();
+
+  // Passes the late frames and audio underruns since we last did to
+  // mDecodeAhead, and adopts the depths it decides on.
+  void UpdateDecodeAhead();
+
   // Filename of resource we're decoding.
   const std::wstring mFilename;
 
   // HWND of the main window.
   HWND mEventTarget;
 
-  // The decode thread.
+  // The decode thread, which loads the metadata, and then decodes video,
+  // and the audio decode thread.
   std::thread mThread;
+  std::thread mAudioThread;
 
-  // Mutex to protect data shared between decode and main thread.
+  // Mutex to protect the media types, duration and mDecodeAhead, which are
+  // shared between decode and main thread. The sample queues don't need it.
   std::mutex mMutex;
 
-  // Condition variable which the decode thread waits on while the sample
-  // queues are full, or until we're shutdown.
-  std::condition_variable mCondVar;
+  // Each decode thread waits on its event while its queue is full, or until
+  // we're shutdown. The consumers only signal them when they're waiting,
+  // and a pop has made room in the video queue, or drained the audio queue
+  // to half its depth.
+  WakeupEvent mVideoDecodeEvent;
+  WakeupEvent mAudioDecodeEvent;
+
+  // PopAudio(true) waits on this while the audio queue is empty. The decode
+  // thread signals it when it pushes onto the empty queue, or the audio ends.
+  WakeupEvent mAudioEvent;
 
   // The output media types.
   // Synchronized by mMutex.
@@ -148,12 +219,15 @@ private:
   IMFMediaTypePtr mVideoType;
 
   // Queues of decoded media samples.
-  // Synchronized by mMutex.
   MediaSampleQueue mVideoQueue;
   MediaSampleQueue mAudioQueue;
 
-  // The following are accessed on the decode thread only:
+  // The following are accessed on the decode threads only. Each reader
+  // only has its own stream selected, so that neither buffers up samples
+  // of the other's while it waits. mAudioReader is only used by the audio
+  // decode thread once it's started.
   IMFSourceReaderPtr mReader;
+  IMFSourceReaderPtr mAudioReader;
   DWORD mAudioStreamIndex;
   DWORD mVideoStreamIndex;
 
@@ -168,20 +242,37 @@ private:
   // Duration of audio in mAudioQueue. This is maintained as we push/pop
   // audio samples. We keep this tally so that we can easily tell whether
   // we need to decode more data or not.
-  // Synchronized by mMutex.
-  LONGLONG mEnqueuedAudioDuration;
+  std::atomic<LONGLONG> mEnqueuedAudioDuration;
 
   // Synchronized by mMutex.
   uint64_t mDuration;
 
-  // True if we either don't have an audio stream, or if we do and it's
-  // finished decoding. Shared across threads. Only written with lock
-  // held on the decode thread, so can be read on decode thread without
-  // lock, but can only be read off-decode-thread if the lock is acquired.
-  bool mHasAudio;
-  bool mHasVideo;
+  // Decides the depths of the sample queues. Only updated on the decode
+  // threads. Synchronized by mMutex.
+  DecodeAheadController mDecodeAhead;
+
+  // The depths mDecodeAhead decided on; the number of video frames, and
+  // the milliseconds of audio. Written on the decode threads, and read by
+  // the consumers to decide whether to wake them.
+  std::atomic<uint32_t> mVideoTargetFrames;
+  std::atomic<uint32_t> mAudioTargetMs;
+
+  // The number of frames the paint thread has reported late, and the number
+  // of times the audio output has underrun, and how many of each the decode
+  // threads have passed to mDecodeAhead. The latter are synchronized by
+  // mMutex.
+  std::atomic<uint64_t> mNumLateFrames;
+  std::atomic<uint64_t> mNumAudioUnderruns;
+  uint64_t mReportedLateFrames;
+  uint64_t mReportedAudioUnderruns;
+
+  // False if we either don't have an audio stream, or if we do and it's
+  // finished decoding. Shared across threads. Only written on the stream's
+  // decode thread, after its last sample has been pushed, so a consumer
+  // which reads false and then finds the queue empty has had every sample.
+  std::atomic<bool> mHasAudio;
+  std::atomic<bool> mHasVideo;
 
   // Flag to denote that we should shutdown.
-  // Synchronized by mMutex.
-  bool mShutdown;
+  std::atomic<bool> mShutdown;
 };
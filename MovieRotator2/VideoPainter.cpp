@@ -17,12 +17,18 @@
 #include "PlaybackClocks.h"
 #include "VideoDecoder.h"
 #include "D2DManager.h"
+#include "HighResClock.h"
 
 #include <initguid.h>
 #include <evr.h>
 #include <math.h>
 
 static const UINT32 VIDEO_FPS = 60;
+
+// Frames shown more than this long after they were due, in 100ns units,
+// were late; we paint every 1000 / VIDEO_FPS ms, so a frame can be shown
+// that late when the decoder's kept up.
+static const LONGLONG LATE_FRAME_THRESHOLD = 2 * 10000000 / VIDEO_FPS;
 #define VIDEO_PAINT_TIMER 1
 
 RECT
@@ -582,8 +588,13 @@ VideoPainter::PaintFrame()
   hr = mClock->GetPosition(&pos);
   ENSURE_SUCCESS(hr,);
 
+  mDecoder->SetNumAudioUnderruns(mClock->GetNumUnderruns());
+
   bool mustUpdateTexture = false;
   while (nextSample && nextSample->timestamp <= pos) {
+    if (pos - nextSample->timestamp > LATE_FRAME_THRESHOLD) {
+      mDecoder->OnVideoFrameLate();
+    }
     if (mCurrentFrame) {
       delete mCurrentFrame;
       mCurrentFrame = nullptr;
@@ -608,6 +619,8 @@ VideoPainter::PaintFrame()
   }
 
   if (mustUpdateTexture) {
+    // The offset of the frame from the clock is in 100ns units.
+    mDrift.Add(GetHighResTimeUs(), (mCurrentFrame->timestamp - pos) / 10);
     UpdateTexture();
   }
 
@@ -657,6 +670,14 @@ VideoPainter::SetInputs(VideoDecoder* aDecoder,
                         Rotation aRotation)
 {
   DBGMSG(L"VideoPainter::Reset(%p, %p)\n", aDecoder, aClock);
+  if (mDrift.HasEstimate()) {
+    const LatencyHistogram& offsets = mDrift.GetOffsets();
+    DBGMSG(L"A/V offset %lld us, drift %.1lf ppm, |offset| p50 %llu us, p99 %llu us, max %llu us over %llu frames\n",
+           mDrift.GetOffsetUs(), mDrift.GetDriftPpm(),
+           offsets.GetPercentileUs(50), offsets.GetPercentileUs(99),
+           offsets.GetMaxUs(), offsets.GetCount());
+  }
+  mDrift.Reset();
   if (mCurrentFrame) {
     delete mCurrentFrame;
     mCurrentFrame = nullptr;
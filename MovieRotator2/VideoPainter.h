@@ -15,6 +15,7 @@
 #pragma once
 
 #include "Interfaces.h"
+#include "PlaybackTiming.h"
 
 class PlaybackClock;
 class VideoDecoder;
@@ -109,6 +110,9 @@ private:
 
   MediaSample* mCurrentFrame;
 
+  // How far the frames we show are from the clock, and how that changes.
+  AVDriftEstimator mDrift;
+
   //Transformed vertex with 1 set of texture coordinates
   static const DWORD tri_fvf=D3DFVF_XYZRHW|D3DFVF_TEX1;
 
@@ -0,0 +1,249 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "WavFile.h"
+#include "FileIO.h"
+
+#include <string.h>
+
+static const uint16_t WAVE_FORMAT_PCM = 0x0001;
+static const uint16_t WAVE_FORMAT_IEEE_FLOAT = 0x0003;
+static const uint16_t WAVE_FORMAT_EXTENSIBLE = 0xFFFE;
+
+// The offsets of the sizes in the header WavWriter writes.
+static const uint32_t RiffSizeOffset = 4;
+static const uint32_t DataSizeOffset = 40;
+static const uint32_t HeaderSize = 44;
+
+static uint16_t
+ReadLE16(const uint8_t* aData)
+{
+  return uint16_t(aData[0] | (aData[1] << 8));
+}
+
+static uint32_t
+ReadLE32(const uint8_t* aData)
+{
+  return uint32_t(aData[0]) | (uint32_t(aData[1]) << 8) |
+         (uint32_t(aData[2]) << 16) | (uint32_t(aData[3]) << 24);
+}
+
+static void
+WriteLE16(uint8_t* aData, uint16_t aValue)
+{
+  aData[0] = uint8_t(aValue);
+  aData[1] = uint8_t(aValue >> 8);
+}
+
+static void
+WriteLE32(uint8_t* aData, uint32_t aValue)
+{
+  for (uint32_t i = 0; i < 4; i++) {
+    aData[i] = uint8_t(aValue >> (8 * i));
+  }
+}
+
+WavReader::WavReader()
+  : mFile(nullptr),
+    mDataOffset(0),
+    mNumFrames(0),
+    mFramesRead(0)
+{
+}
+
+WavReader::~WavReader()
+{
+  if (mFile) {
+    fclose(mFile);
+  }
+}
+
+bool
+WavReader::Open(const std::string& aFilename)
+{
+  mFile = OpenFile(aFilename, "rb");
+  if (!mFile) {
+    return false;
+  }
+
+  uint8_t riff[12];
+  if (fread(riff, 1, sizeof(riff), mFile) != sizeof(riff) ||
+      memcmp(riff, "RIFF", 4) != 0 ||
+      memcmp(riff + 8, "WAVE", 4) != 0) {
+    return false;
+  }
+
+  bool haveFormat = false;
+  uint32_t blockAlign = 0;
+  for (;;) {
+    uint8_t chunk[8];
+    if (fread(chunk, 1, sizeof(chunk), mFile) != sizeof(chunk)) {
+      return false;
+    }
+    const uint32_t chunkSize = ReadLE32(chunk + 4);
+
+    if (memcmp(chunk, "fmt ", 4) == 0) {
+      uint8_t fmt[40];
+      if (chunkSize < 16 || chunkSize > sizeof(fmt) ||
+          fread(fmt, 1, chunkSize, mFile) != chunkSize) {
+        return false;
+      }
+      uint16_t tag = ReadLE16(fmt);
+      if (tag == WAVE_FORMAT_EXTENSIBLE && chunkSize >= 26) {
+        // The first two bytes of the subformat GUID are the format tag.
+        tag = ReadLE16(fmt + 24);
+      }
+      mFormat.numChannels = ReadLE16(fmt + 2);
+      mFormat.sampleRate = ReadLE32(fmt + 4);
+      blockAlign = ReadLE16(fmt + 12);
+      mFormat.bitsPerSample = ReadLE16(fmt + 14);
+      mFormat.floatingPoint = (tag == WAVE_FORMAT_IEEE_FLOAT);
+      if ((tag != WAVE_FORMAT_PCM && tag != WAVE_FORMAT_IEEE_FLOAT) ||
+          !mFormat.numChannels ||
+          !mFormat.sampleRate ||
+          (mFormat.bitsPerSample != 16 &&
+           mFormat.bitsPerSample != 24 &&
+           mFormat.bitsPerSample != 32) ||
+          (mFormat.floatingPoint && mFormat.bitsPerSample != 32) ||
+          blockAlign != mFormat.numChannels * mFormat.bitsPerSample / 8) {
+        return false;
+      }
+      haveFormat = true;
+      // Chunks are padded to an even length.
+      if ((chunkSize & 1) && !SeekFile(mFile, 1, SEEK_CUR)) {
+        return false;
+      }
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      if (!haveFormat) {
+        return false;
+      }
+      // Streamed files may not have had the size filled in, in which case
+      // the data runs to the end of the file.
+      uint64_t dataSize = chunkSize;
+      const int64_t remaining = GetFileSize(mFile) - TellFile(mFile);
+      if (!dataSize || dataSize == 0xFFFFFFFF || int64_t(dataSize) > remaining) {
+        dataSize = uint64_t(remaining > 0 ? remaining : 0);
+      }
+      mNumFrames = dataSize / blockAlign;
+      mDataOffset = TellFile(mFile);
+      return true;
+    } else if (!SeekFile(mFile, int64_t(chunkSize) + (chunkSize & 1), SEEK_CUR)) {
+      return false;
+    }
+  }
+}
+
+bool
+WavReader::Read(uint8_t* aBuffer, uint32_t aMaxFrames, uint32_t* aOutNumFrames)
+{
+  const uint32_t frameSize = mFormat.numChannels * mFormat.bitsPerSample / 8;
+  const uint64_t remaining = mNumFrames - mFramesRead;
+  const uint32_t numFrames = uint32_t((remaining < aMaxFrames) ? remaining : aMaxFrames);
+  *aOutNumFrames = 0;
+  if (!numFrames) {
+    return true;
+  }
+  if (fread(aBuffer, frameSize, numFrames, mFile) != numFrames) {
+    return false;
+  }
+  mFramesRead += numFrames;
+  *aOutNumFrames = numFrames;
+  return true;
+}
+
+bool
+WavReader::Seek(uint64_t aFrame)
+{
+  const uint32_t frameSize = mFormat.numChannels * mFormat.bitsPerSample / 8;
+  mFramesRead = (aFrame < mNumFrames) ? aFrame : mNumFrames;
+  return SeekFile(mFile, mDataOffset + int64_t(mFramesRead * frameSize), SEEK_SET);
+}
+
+WavWriter::WavWriter()
+  : mFile(nullptr),
+    mDataLength(0)
+{
+}
+
+WavWriter::~WavWriter()
+{
+  Close();
+}
+
+bool
+WavWriter::Open(const std::string& aFilename, const AudioFormat& aFormat)
+{
+  if (!aFormat.numChannels || !aFormat.sampleRate || (aFormat.bitsPerSample & 7)) {
+    return false;
+  }
+  mFile = OpenFile(aFilename, "wb");
+  if (!mFile) {
+    return false;
+  }
+  mDataLength = 0;
+
+  const uint32_t blockAlign = aFormat.numChannels * aFormat.bitsPerSample / 8;
+  uint8_t header[HeaderSize];
+  memcpy(header, "RIFF", 4);
+  WriteLE32(header + RiffSizeOffset, HeaderSize - 8);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  WriteLE32(header + 16, 16);
+  WriteLE16(header + 20, aFormat.floatingPoint ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM);
+  WriteLE16(header + 22, uint16_t(aFormat.numChannels));
+  WriteLE32(header + 24, aFormat.sampleRate);
+  WriteLE32(header + 28, aFormat.sampleRate * blockAlign);
+  WriteLE16(header + 32, uint16_t(blockAlign));
+  WriteLE16(header + 34, uint16_t(aFormat.bitsPerSample));
+  memcpy(header + 36, "data", 4);
+  WriteLE32(header + DataSizeOffset, 0);
+  return fwrite(header, 1, sizeof(header), mFile) == sizeof(header);
+}
+
+bool
+WavWriter::Write(const uint8_t* aData, size_t aLength)
+{
+  if (!mFile || fwrite(aData, 1, aLength, mFile) != aLength) {
+    return false;
+  }
+  mDataLength += aLength;
+  return true;
+}
+
+bool
+WavWriter::Close()
+{
+  if (!mFile) {
+    return true;
+  }
+  bool succeeded = true;
+  if (mDataLength & 1) {
+    succeeded = fputc(0, mFile) != EOF;
+  }
+  // Sizes which don't fit in 32 bits are left as the maximum, which
+  // readers take to mean the data runs to the end of the file.
+  const uint64_t riffSize = HeaderSize - 8 + mDataLength + (mDataLength & 1);
+  uint8_t size[4];
+  WriteLE32(size, uint32_t(riffSize > 0xFFFFFFFF ? 0xFFFFFFFF : riffSize));
+  succeeded = succeeded &&
+              SeekFile(mFile, RiffSizeOffset, SEEK_SET) &&
+              fwrite(size, 1, 4, mFile) == 4;
+  WriteLE32(size, uint32_t(mDataLength > 0xFFFFFFFF ? 0xFFFFFFFF : mDataLength));
+  succeeded = succeeded &&
+              SeekFile(mFile, DataSizeOffset, SEEK_SET) &&
+              fwrite(size, 1, 4, mFile) == 4;
+  succeeded = (fclose(mFile) == 0) && succeeded;
+  mFile = nullptr;
+  return succeeded;
+}
@@ -0,0 +1,80 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Reading and writing WAV files of integer or float PCM.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include "FrameSource.h"
+
+class WavReader {
+public:
+  WavReader();
+  ~WavReader();
+
+  // Opens aFilename and finds its format and data chunks. Only 16, 24 and
+  // 32 bit integer PCM, and 32 bit float PCM, are supported.
+  bool Open(const std::string& aFilename);
+
+  const AudioFormat& GetFormat() const { return mFormat; }
+
+  // The number of audio frames, i.e. samples per channel.
+  uint64_t GetNumFrames() const { return mNumFrames; }
+
+  // Reads up to aMaxFrames frames into aBuffer. *aOutNumFrames is 0 at the
+  // end of the data.
+  bool Read(uint8_t* aBuffer, uint32_t aMaxFrames, uint32_t* aOutNumFrames);
+
+  // Seeks so that the next frame read is frame aFrame, counting from 0.
+  // Seeking past the end leaves nothing more to read.
+  bool Seek(uint64_t aFrame);
+
+private:
+  WavReader(const WavReader&);
+  WavReader& operator=(const WavReader&);
+
+  FILE* mFile;
+  AudioFormat mFormat;
+  // File offset of the first frame of the data chunk.
+  int64_t mDataOffset;
+  uint64_t mNumFrames;
+  uint64_t mFramesRead;
+};
+
+class WavWriter {
+public:
+  WavWriter();
+  ~WavWriter();
+
+  // Creates aFilename, and writes a header for audio in aFormat. The sizes
+  // in the header are filled in by Close().
+  bool Open(const std::string& aFilename, const AudioFormat& aFormat);
+
+  // Appends aLength bytes of audio in the format passed to Open().
+  bool Write(const uint8_t* aData, size_t aLength);
+
+  bool Close();
+
+private:
+  WavWriter(const WavWriter&);
+  WavWriter& operator=(const WavWriter&);
+
+  FILE* mFile;
+  uint64_t mDataLength;
+};
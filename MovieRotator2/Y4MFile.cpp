@@ -0,0 +1,268 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "Y4MFile.h"
+#include "FileIO.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char Y4MSignature[] = "YUV4MPEG2 ";
+static const char Y4MFrameTag[] = "FRAME";
+
+// Reads up to and including the next '\n' into aOutLine, without the '\n'.
+// Returns false at the end of the file, or if the line is unreasonably long.
+static bool
+ReadLine(FILE* aFile, std::string* aOutLine)
+{
+  aOutLine->clear();
+  for (;;) {
+    int c = fgetc(aFile);
+    if (c == EOF) {
+      return false;
+    }
+    if (c == '\n') {
+      return true;
+    }
+    if (aOutLine->size() >= 4096) {
+      return false;
+    }
+    aOutLine->push_back(char(c));
+  }
+}
+
+// Parses "<a>:<b>" into *aOutA and *aOutB.
+static bool
+ParseRatio(const char* aText, uint32_t* aOutA, uint32_t* aOutB)
+{
+  char* end = nullptr;
+  unsigned long a = strtoul(aText, &end, 10);
+  if (end == aText || *end != ':') {
+    return false;
+  }
+  const char* b = end + 1;
+  *aOutB = uint32_t(strtoul(b, &end, 10));
+  *aOutA = uint32_t(a);
+  return end != b;
+}
+
+// Where the chroma is sited, for each of the 4:2:0 colorspaces. Plain
+// "420" is the same as "420jpeg".
+static bool
+ParseColorspace(const std::string& aColorspace, VideoFormat* aFormat)
+{
+  if (aColorspace == "420" || aColorspace == "420jpeg") {
+    aFormat->horizontalSiting = ChromaSiting_Centered;
+    aFormat->verticalSiting = ChromaSiting_Centered;
+  } else if (aColorspace == "420mpeg2") {
+    aFormat->horizontalSiting = ChromaSiting_Cosited;
+    aFormat->verticalSiting = ChromaSiting_Centered;
+  } else if (aColorspace == "420paldv") {
+    aFormat->horizontalSiting = ChromaSiting_Cosited;
+    aFormat->verticalSiting = ChromaSiting_Cosited;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static const char*
+GetColorspace(const VideoFormat& aFormat)
+{
+  if (aFormat.horizontalSiting == ChromaSiting_Centered) {
+    return "420jpeg";
+  }
+  return (aFormat.verticalSiting == ChromaSiting_Centered) ? "420mpeg2" : "420paldv";
+}
+
+Y4MReader::Y4MReader()
+  : mFile(nullptr),
+    mDataOffset(0),
+    mFrameSize(0),
+    mNumFrames(0)
+{
+}
+
+Y4MReader::~Y4MReader()
+{
+  if (mFile) {
+    fclose(mFile);
+  }
+}
+
+bool
+Y4MReader::Open(const std::string& aFilename)
+{
+  mFile = OpenFile(aFilename, "rb");
+  if (!mFile) {
+    return false;
+  }
+
+  std::string header;
+  if (!ReadLine(mFile, &header) ||
+      header.compare(0, strlen(Y4MSignature), Y4MSignature) != 0) {
+    return false;
+  }
+
+  mFormat = VideoFormat();
+  mFormat.pixelFormat = PixelFormat_I420;
+  mFormat.frameRateNumer = 25;
+  mFormat.frameRateDenom = 1;
+  ParseColorspace("420jpeg", &mFormat);
+
+  // Each parameter is a letter followed by its value, separated by spaces.
+  size_t start = strlen(Y4MSignature);
+  while (start < header.size()) {
+    size_t end = header.find(' ', start);
+    if (end == std::string::npos) {
+      end = header.size();
+    }
+    const std::string param = header.substr(start, end - start);
+    start = end + 1;
+    if (param.empty()) {
+      continue;
+    }
+    const char* value = param.c_str() + 1;
+    switch (param[0]) {
+      case 'W': mFormat.width = uint32_t(atoi(value)); break;
+      case 'H': mFormat.height = uint32_t(atoi(value)); break;
+      case 'F':
+        if (!ParseRatio(value, &mFormat.frameRateNumer, &mFormat.frameRateDenom)) {
+          return false;
+        }
+        break;
+      case 'A':
+        if (!ParseRatio(value, &mFormat.pixelAspectNumer, &mFormat.pixelAspectDenom)) {
+          return false;
+        }
+        // 0:0 means unknown.
+        if (!mFormat.pixelAspectNumer || !mFormat.pixelAspectDenom) {
+          mFormat.pixelAspectNumer = mFormat.pixelAspectDenom = 1;
+        }
+        break;
+      case 'C':
+        if (!ParseColorspace(value, &mFormat)) {
+          return false;
+        }
+        break;
+      default:
+        // Interlacing, and comments, which don't affect the layout.
+        break;
+    }
+  }
+
+  if (!mFormat.width || !mFormat.height ||
+      !mFormat.frameRateNumer || !mFormat.frameRateDenom) {
+    return false;
+  }
+
+  const size_t chromaSize = size_t((mFormat.width + 1) / 2) * ((mFormat.height + 1) / 2);
+  mFrameSize = size_t(mFormat.width) * mFormat.height + 2 * chromaSize;
+
+  // Assume the frame headers have no parameters, which they don't in
+  // practice.
+  mDataOffset = int64_t(header.size() + 1);
+  const int64_t dataSize = GetFileSize(mFile) - mDataOffset;
+  mNumFrames = (dataSize > 0) ? uint64_t(dataSize) / (mFrameSize + strlen(Y4MFrameTag) + 1) : 0;
+
+  return true;
+}
+
+bool
+Y4MReader::ReadFrame(uint8_t* aBuffer, bool* aOutEndOfFile)
+{
+  *aOutEndOfFile = false;
+  std::string line;
+  if (!ReadLine(mFile, &line)) {
+    *aOutEndOfFile = feof(mFile) && line.empty();
+    return *aOutEndOfFile;
+  }
+  if (line.compare(0, strlen(Y4MFrameTag), Y4MFrameTag) != 0) {
+    return false;
+  }
+  return fread(aBuffer, 1, mFrameSize, mFile) == mFrameSize;
+}
+
+bool
+Y4MReader::Seek(uint64_t aFrame)
+{
+  // Frames are all the same size, as we assume when counting them.
+  const int64_t frameSize = int64_t(mFrameSize + strlen(Y4MFrameTag) + 1);
+  return SeekFile(mFile, mDataOffset + int64_t(aFrame) * frameSize, SEEK_SET);
+}
+
+Y4MWriter::Y4MWriter()
+  : mFile(nullptr)
+{
+}
+
+Y4MWriter::~Y4MWriter()
+{
+  Close();
+}
+
+bool
+Y4MWriter::Open(const std::string& aFilename, const VideoFormat& aFormat)
+{
+  if (aFormat.pixelFormat != PixelFormat_I420 ||
+      (aFormat.width & 1) || (aFormat.height & 1)) {
+    return false;
+  }
+  mFile = OpenFile(aFilename, "wb");
+  if (!mFile) {
+    return false;
+  }
+  mFormat = aFormat;
+  return fprintf(mFile, "%sW%u H%u F%u:%u Ip A%u:%u C%s\n",
+                 Y4MSignature, aFormat.width, aFormat.height,
+                 aFormat.frameRateNumer, aFormat.frameRateDenom,
+                 aFormat.pixelAspectNumer, aFormat.pixelAspectDenom,
+                 GetColorspace(aFormat)) > 0;
+}
+
+bool
+Y4MWriter::WriteFrame(const Image& aImage)
+{
+  if (!mFile ||
+      aImage.format != PixelFormat_I420 ||
+      aImage.planes[0].width != mFormat.width ||
+      aImage.planes[0].height != mFormat.height) {
+    return false;
+  }
+  if (fprintf(mFile, "%s\n", Y4MFrameTag) < 0) {
+    return false;
+  }
+  for (uint32_t i = 0; i < 3; i++) {
+    const ImagePlane& plane = aImage.planes[i];
+    for (uint32_t y = 0; y < plane.height; y++) {
+      const uint8_t* row = plane.data + int64_t(y) * plane.stride;
+      if (fwrite(row, 1, plane.width, mFile) != plane.width) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool
+Y4MWriter::Close()
+{
+  if (!mFile) {
+    return true;
+  }
+  bool succeeded = fclose(mFile) == 0;
+  mFile = nullptr;
+  return succeeded;
+}
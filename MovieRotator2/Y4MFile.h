@@ -0,0 +1,84 @@
+// Copyright 2013  Chris Pearce
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Reading and writing YUV4MPEG2 (.y4m) files; raw 8 bit 4:2:0 video, as
+// written by ffmpeg and x264 among others. They let the transcode pipeline
+// run without a decoder or encoder.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include "FrameSource.h"
+
+class Y4MReader {
+public:
+  Y4MReader();
+  ~Y4MReader();
+
+  // Opens aFilename and parses its header. Only 8 bit 4:2:0 video is
+  // supported; the frames are read as I420.
+  bool Open(const std::string& aFilename);
+
+  const VideoFormat& GetFormat() const { return mFormat; }
+
+  // The size of the buffer ReadFrame() reads into; the three planes
+  // packed together.
+  size_t GetFrameSize() const { return mFrameSize; }
+
+  // The number of frames, estimated from the file's size.
+  uint64_t GetNumFrames() const { return mNumFrames; }
+
+  // Reads the next frame into aBuffer, which must be GetFrameSize() bytes.
+  // Sets *aOutEndOfFile instead once there are no more frames.
+  bool ReadFrame(uint8_t* aBuffer, bool* aOutEndOfFile);
+
+  // Seeks so that the next frame read is frame aFrame, counting from 0.
+  bool Seek(uint64_t aFrame);
+
+private:
+  Y4MReader(const Y4MReader&);
+  Y4MReader& operator=(const Y4MReader&);
+
+  FILE* mFile;
+  VideoFormat mFormat;
+  // File offset of the first frame's header.
+  int64_t mDataOffset;
+  size_t mFrameSize;
+  uint64_t mNumFrames;
+};
+
+class Y4MWriter {
+public:
+  Y4MWriter();
+  ~Y4MWriter();
+
+  // Creates aFilename, and writes the header for frames in aFormat, which
+  // must be I420.
+  bool Open(const std::string& aFilename, const VideoFormat& aFormat);
+
+  // Appends aImage, which must be the size passed to Open().
+  bool WriteFrame(const Image& aImage);
+
+  bool Close();
+
+private:
+  Y4MWriter(const Y4MWriter&);
+  Y4MWriter& operator=(const Y4MWriter&);
+
+  FILE* mFile;
+  VideoFormat mFormat;
+};
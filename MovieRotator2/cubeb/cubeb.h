@@ -7,7 +7,18 @@
 #if !defined(CUBEB_c2f983e9_c96f_e71c_72c3_bbf62992a382)
 #define CUBEB_c2f983e9_c96f_e71c_72c3_bbf62992a382
 
+#if defined(_WIN32)
 #define USE_WINMM
+#else
+/* The null backend, CubebNullBackend.cpp, is only the fallback where no
+   real backend is built, such as HeadlessTranscode's builds on CI
+   machines without audio hardware. On Windows, cubeb_init() must fail on
+   a machine with no audio device, as it did before the null backend
+   existed, rather than silently play the preview's audio into it.
+   HeadlessTranscode creates null streams with InitNullCubeb(), so it
+   works either way. */
+#define USE_NULL
+#endif
 
 #include "stdint.h"
 
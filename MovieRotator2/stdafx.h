@@ -132,17 +132,11 @@ COM_SMARTPTR(IWICBitmap);
 COM_SMARTPTR(IWICBitmapLock);
 COM_SMARTPTR(IWICImagingFactory);
 COM_SMARTPTR(IDWriteTextFormat);
-COM_SMARTPTR(IWMResamplerProps);
 COM_SMARTPTR(IMF2DBuffer);
 COM_SMARTPTR(IDWriteInlineObject);
 COM_SMARTPTR(ICodecAPI);
 
-enum Rotation {
-  ROTATE_0 = 0,
-  ROTATE_90 = 1,
-  ROTATE_180  = 2,
-  ROTATE_270 = 3
-};
+#include "Rotation.h"
 
 // TranscodeJobRunner Events:
 //
@@ -151,14 +145,19 @@ enum Rotation {
 // wParam = 0, lParam = TranscodeJob* of job.
 #define MSG_TRANSCODE_COMPLETE (WM_USER + 1)
 
-// Sent every percentage point to notify parent of job progress.
-// wParam = percent complete, lParam = TranscodeJob* of job.
+// Sent at most a few times a second to notify parent of job progress.
+// wParam = thousandths complete, lParam = TranscodeJob* of job.
 #define MSG_TRANSCODE_PROGRESS (WM_USER + 2)
 
 // Sent when a transcode fails.
 // wParam = 0, lParam = TranscodeJob* of job.
 #define MSG_TRANSCODE_FAILED (WM_USER + 3)
 
+// Sent with each progress update, with how fast the job is going.
+// wParam = TranscodeEstimate*, event handler *must* delete the estimate.
+// lParam = TranscodeJob* of job.
+#define MSG_TRANSCODE_ESTIMATE (WM_USER + 4)
+
 // TranscodeJobList events:
 //
 // Sent when the TranscodeJobList has been changed, i.e. a job added or removed.